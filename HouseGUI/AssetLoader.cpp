@@ -0,0 +1,151 @@
+// AssetLoader.cpp
+#include "AssetLoader.h"
+#include "AssetPack.h"
+#include "ImageCache.h"
+#include "TextureResidency.h"
+#include "JobSystem.h"
+#include "GLState.h"
+#include "CpuProfiler.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+AssetLoader* AssetLoader::current = nullptr;
+
+static const unsigned char placeholderTexel[4] = { 128, 128, 128, 255 };
+
+AssetLoader::AssetLoader() : pending(0), loaded(0), uploadedBytes(0) {
+    current = this;
+}
+
+AssetLoader::~AssetLoader() {
+    Finish();
+    if (current == this) current = nullptr;
+}
+
+void AssetLoader::LoadTexture(GLuint texture, const char* path, bool mipmaps) {
+    LoadTexture(texture, path, ImageCache::FlipOnLoad(), mipmaps, true);
+}
+
+void AssetLoader::LoadTexture(GLuint texture, const char* path, bool flip, bool mipmaps, bool placeholder) {
+    // baked textures are already decoded and mipmapped, nothing to do off-thread
+    AssetPack* pack = AssetPack::Current();
+    const AssetPack::Entry* baked = pack ? pack->Find((flip ? "1:" : "0:") + std::string(path)) : nullptr;
+    if (baked && baked->type == AssetPack::Texture && AssetPack::Fresh(*baked, path)) {
+        GLState::BindTexture(GL_TEXTURE_2D, texture);
+        AssetPack::UploadTexture(*baked, pack->Data(*baked), mipmaps);
+        unsigned char average[4];
+        AssetPack::AverageColor(*baked, pack->Data(*baked), average);
+        TextureResidency::Loaded(texture, path, flip, mipmaps, baked->width, baked->height, average);
+        return;
+    }
+    if (current) {
+        current->RequestTexture(texture, path, flip, mipmaps, placeholder);
+        return;
+    }
+    int w, h;
+    const unsigned char* data = ImageCache::Load(path, flip, &w, &h);
+    if (!data) {
+        std::cout << "Failed to load " << path << "\n";
+        return;
+    }
+    GLState::BindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+    unsigned char average[4];
+    TextureResidency::Average(data, w, h, average);
+    TextureResidency::Loaded(texture, path, flip, mipmaps, w, h, average);
+}
+
+void AssetLoader::RequestTexture(GLuint texture, const char* path, bool flip, bool mipmaps, bool placeholder) {
+    if (placeholder) {
+        GLState::BindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholderTexel);
+    }
+    pending++;
+    loadTexture(texture, path, flip, mipmaps);
+}
+
+bool AssetLoader::toWorker(std::coroutine_handle<> h) {
+    JobSystem* jobs = JobSystem::Current();
+    // without worker threads the step just continues inline
+    if (!jobs || jobs->ThreadCount() < 2) return false;
+    jobs->Run([h] { h.resume(); });
+    return true;
+}
+
+void AssetLoader::toGL(std::coroutine_handle<> h) {
+    std::lock_guard<std::mutex> lk(glLock);
+    glQueue.push_back(h);
+}
+
+AssetLoader::Task AssetLoader::loadTexture(GLuint texture, std::string path, bool flip, bool mipmaps) {
+    co_await WorkerStep{ this };
+    int w = 0, h = 0;
+    const unsigned char* pixels = ImageCache::Load(path.c_str(), flip, &w, &h);
+    // kept for eviction, which would otherwise have to read the texture back
+    unsigned char average[4];
+    if (pixels) TextureResidency::Average(pixels, w, h, average);
+
+    co_await GLStep{ this };
+    if (!pixels) {
+        std::cout << "Failed to load " << path << "\n";
+        pending--;
+        co_return;
+    }
+    size_t bytes = (size_t)w * h * 4;
+    GLuint pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (dst) {
+        co_await WorkerStep{ this };
+        {
+            PROFILE_SCOPE("copy to pixel buffer");
+            memcpy(dst, pixels, bytes);
+        }
+        co_await GLStep{ this };
+    }
+    PROFILE_SCOPE("upload texture");
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    if (dst) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    else glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes, pixels);
+    GLState::BindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+    glDeleteBuffers(1, &pbo);
+    TextureResidency::Loaded(texture, path.c_str(), flip, mipmaps, w, h, average);
+    uploadedBytes += bytes;
+    loaded++;
+    pending--;
+}
+
+void AssetLoader::Pump(double budgetMs) {
+    PROFILE_SCOPE("AssetLoader::Pump");
+    auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> lk(glLock);
+            if (glQueue.empty()) return;
+            h = glQueue.front();
+            glQueue.pop_front();
+        }
+        h.resume();
+        if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs) return;
+    }
+}
+
+void AssetLoader::Finish() {
+    JobSystem* jobs = JobSystem::Current();
+    while (pending > 0) {
+        Pump(1e9);
+        // lend a hand with the decodes instead of spinning
+        if (pending > 0 && !(jobs && jobs->Help())) std::this_thread::yield();
+    }
+}
@@ -0,0 +1,64 @@
+// AssetLoader.h
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <glad/glad.h>
+
+// Asynchronous texture loading built on C++20 coroutines. A request gives the
+// texture a placeholder texel right away; the coroutine then hops between the
+// job system (decode, copy into a mapped pixel buffer) and the GL thread
+// (map, unmap, glTexImage2D from the PBO). GL steps only run inside Pump(),
+// which the main loop calls once per frame with a time budget.
+class AssetLoader {
+public:
+    AssetLoader();
+    ~AssetLoader();
+    // the texture must exist; its sampler parameters are left untouched.
+    // Without a placeholder the old contents stay until the new texels land.
+    void RequestTexture(GLuint texture, const char* path, bool flip, bool mipmaps, bool placeholder = true);
+    void Pump(double budgetMs);
+    // runs everything to completion, for code that needs real texels now
+    void Finish();
+    int Pending() const { return pending; }
+    int Loaded() const { return loaded; }
+    size_t UploadedBytes() const { return uploadedBytes; }
+    static AssetLoader* Current() { return current; }
+    // loads through the current loader, or synchronously when there is none
+    static void LoadTexture(GLuint texture, const char* path, bool mipmaps);
+    static void LoadTexture(GLuint texture, const char* path, bool flip, bool mipmaps, bool placeholder);
+private:
+    struct Task {
+        struct promise_type {
+            Task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+    struct WorkerStep {
+        AssetLoader* loader;
+        bool await_ready() const { return false; }
+        bool await_suspend(std::coroutine_handle<> h) { return loader->toWorker(h); }
+        void await_resume() const {}
+    };
+    struct GLStep {
+        AssetLoader* loader;
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> h) { loader->toGL(h); }
+        void await_resume() const {}
+    };
+    std::mutex glLock;
+    std::deque<std::coroutine_handle<>> glQueue;
+    std::atomic<int> pending, loaded;
+    size_t uploadedBytes;
+    static AssetLoader* current;
+    Task loadTexture(GLuint texture, std::string path, bool flip, bool mipmaps);
+    bool toWorker(std::coroutine_handle<> h);
+    void toGL(std::coroutine_handle<> h);
+};
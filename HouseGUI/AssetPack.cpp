@@ -0,0 +1,233 @@
+// AssetPack.cpp
+#include "AssetPack.h"
+#include "TextureResidency.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <glad/glad.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AssetPack* AssetPack::current = nullptr;
+
+static const char packMagic[4] = { 'H', 'G', 'P', 'K' };
+
+static size_t align16(size_t n) {
+    return (n + 15) & ~(size_t)15;
+}
+
+// bytes the entry's payload must hold, or 0 when its header makes no sense
+static uint64_t expectedSize(const AssetPack::Entry& e) {
+    if (e.type == AssetPack::Texture) {
+        if (e.width == 0 || e.height == 0 || e.width > 65536 || e.height > 65536 || e.levels == 0 || e.levels > 32) return 0;
+        uint64_t bytes = 0;
+        uint64_t w = e.width, h = e.height;
+        for (uint32_t level = 0; level < e.levels; level++) {
+            bytes += align16(w * h * 4);
+            w = std::max<uint64_t>(1, w / 2);
+            h = std::max<uint64_t>(1, h / 2);
+        }
+        return bytes;
+    }
+    if (e.type == AssetPack::Mesh)
+        return (uint64_t)e.width * e.levels + (uint64_t)e.height * sizeof(uint32_t);
+    return 0;
+}
+
+AssetPack::AssetPack() : base(nullptr), length(0), file(nullptr), mapping(nullptr) {}
+
+AssetPack::~AssetPack() {
+    Close();
+}
+
+bool AssetPack::Open(const char* path) {
+    Close();
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    GetFileSizeEx(f, &size);
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (m) CloseHandle(m);
+        CloseHandle(f);
+        return false;
+    }
+    file = f;
+    mapping = m;
+    length = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    fstat(fd, &st);
+    void* view = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (view == MAP_FAILED) return false;
+    length = (size_t)st.st_size;
+#endif
+    base = (const unsigned char*)view;
+
+    const Header* h = (const Header*)base;
+    if (length < sizeof(Header) || memcmp(h->magic, packMagic, 4) || h->version != Version ||
+        h->tocOffset + (uint64_t)h->entryCount * sizeof(Entry) > length) {
+        std::cout << path << " is not a version " << Version << " asset pack, ignoring it\n";
+        Close();
+        return false;
+    }
+    const Entry* toc = (const Entry*)(base + h->tocOffset);
+    for (uint32_t i = 0; i < h->entryCount; i++) {
+        const Entry& e = toc[i];
+        if (e.offset > length || e.size > length - e.offset || e.size != expectedSize(e)) {
+            std::cout << path << ": skipping damaged entry " << std::string(e.name, strnlen(e.name, sizeof(e.name))) << "\n";
+            continue;
+        }
+        entries.push_back(&toc[i]);
+        byName[std::string(toc[i].name, strnlen(toc[i].name, sizeof(toc[i].name)))] = &toc[i];
+    }
+    return true;
+}
+
+void AssetPack::Close() {
+    if (!base) return;
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle((HANDLE)mapping);
+    CloseHandle((HANDLE)file);
+#else
+    munmap((void*)base, length);
+#endif
+    base = nullptr;
+    length = 0;
+    file = mapping = nullptr;
+    entries.clear();
+    byName.clear();
+    if (current == this) current = nullptr;
+}
+
+const AssetPack::Entry* AssetPack::Find(const std::string& name) const {
+    auto it = byName.find(name);
+    return it == byName.end() ? nullptr : it->second;
+}
+
+bool AssetPack::Fresh(const Entry& e, const char* path) {
+    uint64_t size;
+    int64_t time;
+    return SourceStamp(path, size, time) && size == e.sourceSize && time == e.sourceTime;
+}
+
+bool AssetPack::SourceStamp(const char* path, uint64_t& size, int64_t& time) {
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    if (ec) return false;
+    time = (int64_t)std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    return !ec;
+}
+
+void AssetPack::UploadTexture(const Entry& e, const unsigned char* data, bool mipmaps) {
+    int w = e.width, h = e.height;
+    int levels = mipmaps ? (int)e.levels : 1;
+    for (int level = 0; level < levels; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        data += align16((size_t)w * h * 4);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+}
+
+void AssetPack::AverageColor(const Entry& e, const unsigned char* data, unsigned char* average) {
+    const unsigned char* last = data;
+    int w = e.width, h = e.height;
+    for (uint32_t level = 1; level < e.levels; level++) {
+        last += align16((size_t)w * h * 4);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    if (w == 1 && h == 1) memcpy(average, last, 4);
+    else TextureResidency::Average(data, e.width, e.height, average);
+}
+
+void AssetPackWriter::append(AssetPack::Entry& e, const void* data, size_t bytes) {
+    e.offset = align16(sizeof(AssetPack::Header)) + payload.size();
+    e.size = bytes;
+    payload.insert(payload.end(), (const unsigned char*)data, (const unsigned char*)data + bytes);
+    payload.resize(align16(payload.size()), 0);
+    entries.push_back(e);
+}
+
+void AssetPackWriter::AddTexture(const std::string& name, const char* source, int width, int height, const unsigned char* pixels) {
+    AssetPack::Entry e = {};
+    memcpy(e.name, name.c_str(), std::min(name.size(), sizeof(e.name) - 1));
+    e.type = AssetPack::Texture;
+    AssetPack::SourceStamp(source, e.sourceSize, e.sourceTime);
+    e.width = width;
+    e.height = height;
+    // same chain glGenerateMipmap would build: 2x2 box filter, odd edges clamped
+    std::vector<unsigned char> chain, level(pixels, pixels + (size_t)width * height * 4);
+    int w = width, h = height;
+    for (;;) {
+        chain.insert(chain.end(), level.begin(), level.end());
+        chain.resize(align16(chain.size()), 0);
+        e.levels++;
+        if (w == 1 && h == 1) break;
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        std::vector<unsigned char> next((size_t)nw * nh * 4);
+        for (int y = 0; y < nh; y++)
+            for (int x = 0; x < nw; x++)
+                for (int c = 0; c < 4; c++) {
+                    int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+                    int y0 = std::min(y * 2, h - 1), y1 = std::min(y * 2 + 1, h - 1);
+                    int sum = level[(y0 * w + x0) * 4 + c] + level[(y0 * w + x1) * 4 + c] +
+                        level[(y1 * w + x0) * 4 + c] + level[(y1 * w + x1) * 4 + c];
+                    next[(y * nw + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+        level.swap(next);
+        w = nw;
+        h = nh;
+    }
+    append(e, chain.data(), chain.size());
+}
+
+void AssetPackWriter::AddMesh(const std::string& name, const void* vertices, size_t vertexBytes, int vertexCount,
+    const unsigned* indices, int indexCount) {
+    AssetPack::Entry e = {};
+    memcpy(e.name, name.c_str(), std::min(name.size(), sizeof(e.name) - 1));
+    e.type = AssetPack::Mesh;
+    e.width = vertexCount;
+    e.height = indexCount;
+    e.levels = vertexCount ? (uint32_t)(vertexBytes / vertexCount) : 0;
+    std::vector<unsigned char> blob((const unsigned char*)vertices, (const unsigned char*)vertices + vertexBytes);
+    blob.insert(blob.end(), (const unsigned char*)indices, (const unsigned char*)(indices + indexCount));
+    append(e, blob.data(), blob.size());
+}
+
+bool AssetPackWriter::Write(const char* path) const {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        std::cout << "Failed to write " << path << "\n";
+        return false;
+    }
+    AssetPack::Header h = {};
+    memcpy(h.magic, packMagic, 4);
+    h.version = AssetPack::Version;
+    h.entryCount = (uint32_t)entries.size();
+    h.tocOffset = align16(sizeof(h)) + payload.size();
+    std::vector<unsigned char> head(align16(sizeof(h)), 0);
+    memcpy(head.data(), &h, sizeof(h));
+    bool ok = fwrite(head.data(), 1, head.size(), f) == head.size() &&
+        fwrite(payload.data(), 1, payload.size(), f) == payload.size() &&
+        fwrite(entries.data(), sizeof(AssetPack::Entry), entries.size(), f) == entries.size();
+    fclose(f);
+    return ok;
+}
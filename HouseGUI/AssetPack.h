@@ -0,0 +1,83 @@
+// AssetPack.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// One versioned file holding everything startup would otherwise rebuild:
+// decoded RGBA8 textures with their full mip chain and pre-built mesh
+// buffers. The file is memory-mapped and entries are handed to GL straight
+// from the mapped pages, so loading a texture is one glTexImage2D per level.
+//
+// Layout: Header, then 16-byte aligned payloads, then the Entry table at
+// Header::tocOffset. Texture names are ImageCache keys ("0:" or "1:" for the
+// flip flag, then the path), so both orientations can live in one pack.
+// Each texture remembers the size and write time of the PNG it came from;
+// callers check Fresh() and decode the PNG instead when it has changed.
+class AssetPack {
+public:
+    enum Type : uint32_t { Texture = 1, Mesh = 2 };
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t reserved;
+        uint64_t tocOffset;
+    };
+    struct Entry {
+        char name[64];
+        uint32_t type;
+        // textures: size of level 0 and number of levels; meshes: vertex
+        // and index count, levels holds the vertex stride and the 32-bit
+        // indices follow the vertex bytes
+        uint32_t width, height, levels;
+        uint64_t offset, size;
+        // textures: the source PNG when it was baked
+        uint64_t sourceSize;
+        int64_t sourceTime;
+    };
+    static constexpr uint32_t Version = 2;
+
+    AssetPack();
+    ~AssetPack();
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return base != nullptr; }
+    const Entry* Find(const std::string& name) const;
+    // false when the file at path no longer matches the one e was baked from
+    static bool Fresh(const Entry& e, const char* path);
+    static bool SourceStamp(const char* path, uint64_t& size, int64_t& time);
+    const unsigned char* Data(const Entry& e) const { return base + e.offset; }
+    const std::vector<const Entry*>& Entries() const { return entries; }
+    // uploads all levels (or only level 0) into the bound GL_TEXTURE_2D
+    static void UploadTexture(const Entry& e, const unsigned char* data, bool mipmaps);
+    // the texture's average colour: its last level when the chain goes down to 1x1
+    static void AverageColor(const Entry& e, const unsigned char* data, unsigned char* average);
+    static AssetPack* Current() { return current; }
+    static void SetCurrent(AssetPack* pack) { current = pack; }
+private:
+    const unsigned char* base;
+    size_t length;
+    void* file;
+    void* mapping;
+    std::vector<const Entry*> entries;
+    std::map<std::string, const Entry*> byName;
+    static AssetPack* current;
+};
+
+// Offline side of AssetPack; used by --bake-pack.
+class AssetPackWriter {
+public:
+    // pixels are RGBA8; the mip chain is box-filtered down to 1x1 here
+    void AddTexture(const std::string& name, const char* source, int width, int height, const unsigned char* pixels);
+    void AddMesh(const std::string& name, const void* vertices, size_t vertexBytes, int vertexCount,
+        const unsigned* indices, int indexCount);
+    bool Write(const char* path) const;
+    size_t Count() const { return entries.size(); }
+private:
+    std::vector<AssetPack::Entry> entries;
+    std::vector<unsigned char> payload;
+    void append(AssetPack::Entry& e, const void* data, size_t bytes);
+};
@@ -0,0 +1,211 @@
+// Benchmark.cpp
+#include "Benchmark.h"
+#include "GLState.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static const GpuProfiler::ZoneResult* findZone(const Benchmark::Frame& f, const char* name) {
+    for (const GpuProfiler::ZoneResult& z : f.zones)
+        if (!strcmp(z.name, name)) return &z;
+    return nullptr;
+}
+
+Benchmark::Benchmark() : slot(0), drawsAtStart(0) {
+    glGenQueries(Latency, startQueries);
+    glGenQueries(Latency, endQueries);
+    glGenQueries(Latency, triangleQueries);
+    for (int& p : pending) p = -1;
+}
+
+Benchmark::~Benchmark() {
+    glDeleteQueries(Latency, startQueries);
+    glDeleteQueries(Latency, endQueries);
+    glDeleteQueries(Latency, triangleQueries);
+}
+
+void Benchmark::SetInfo(const std::string& key, const std::string& value) {
+    info.push_back({ key, value });
+}
+
+void Benchmark::BeginFrame() {
+    if (pending[slot] >= 0) collect(slot);
+    takeZones();
+    GpuProfiler* profiler = GpuProfiler::Current();
+    pending[slot] = (int)frames.size();
+    frames.push_back({ glm::vec3(0.0f), 0.0, 0.0, 0, 0, profiler ? profiler->Frame() : 0, {} });
+    drawsAtStart = GLState::RunningStats().draws;
+    cpuStart = std::chrono::steady_clock::now();
+    glQueryCounter(startQueries[slot], GL_TIMESTAMP);
+    glBeginQuery(GL_PRIMITIVES_GENERATED, triangleQueries[slot]);
+}
+
+void Benchmark::EndFrame(const glm::vec3& cameraPos) {
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    glQueryCounter(endQueries[slot], GL_TIMESTAMP);
+    Frame& f = frames.back();
+    f.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+    f.draws = GLState::RunningStats().draws - drawsAtStart;
+    f.camera = cameraPos;
+    slot = (slot + 1) % Latency;
+}
+
+void Benchmark::collect(int s) {
+    GLuint64 start = 0, end = 0, triangles = 0;
+    glGetQueryObjectui64v(startQueries[s], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(endQueries[s], GL_QUERY_RESULT, &end);
+    glGetQueryObjectui64v(triangleQueries[s], GL_QUERY_RESULT, &triangles);
+    Frame& f = frames[pending[s]];
+    f.gpuMs = (end - start) / 1e6;
+    f.triangles = triangles;
+    pending[s] = -1;
+}
+
+// profiler frames count from the profiler's start, so they are matched by number
+void Benchmark::takeZones() {
+    GpuProfiler* profiler = GpuProfiler::Current();
+    if (!profiler || frames.empty()) return;
+    uint64_t first = frames.front().gpuFrame;
+    for (GpuProfiler::FrameResult& r : profiler->TakeCollected()) {
+        if (r.frame < first || r.frame - first >= frames.size()) continue;
+        Frame& f = frames[(size_t)(r.frame - first)];
+        if (f.gpuFrame == r.frame) f.zones = std::move(r.zones);
+    }
+}
+
+void Benchmark::Finish() {
+    for (int s = 0; s < Latency; s++)
+        if (pending[s] >= 0) collect(s);
+    if (GpuProfiler* profiler = GpuProfiler::Current()) profiler->Flush();
+    takeZones();
+}
+
+// nearest-rank percentiles over (value, frame) pairs
+Benchmark::Summary Benchmark::summarize(const std::vector<std::pair<double, int>>& values) {
+    Summary s = { 0.0, 0.0, 0.0, 0.0, 0.0, -1 };
+    if (values.empty()) return s;
+    std::vector<double> sorted;
+    sorted.reserve(values.size());
+    for (const auto& v : values) {
+        sorted.push_back(v.first);
+        s.mean += v.first / values.size();
+        if (s.worstFrame < 0 || v.first > s.worst) {
+            s.worst = v.first;
+            s.worstFrame = v.second;
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    auto rank = [&](double p) { return sorted[std::max((size_t)ceil(p * sorted.size()), (size_t)1) - 1]; };
+    s.p50 = rank(0.50);
+    s.p95 = rank(0.95);
+    s.p99 = rank(0.99);
+    return s;
+}
+
+template<typename F>
+Benchmark::Summary Benchmark::summarize(F value) const {
+    std::vector<std::pair<double, int>> values;
+    for (size_t i = 0; i < frames.size(); i++) values.push_back({ value(frames[i]), (int)i });
+    return summarize(values);
+}
+
+// only the frames whose zones came back
+Benchmark::Summary Benchmark::summarizeZone(const char* name) const {
+    std::vector<std::pair<double, int>> values;
+    for (size_t i = 0; i < frames.size(); i++)
+        if (const GpuProfiler::ZoneResult* z = findZone(frames[i], name)) values.push_back({ z->gpuMs, (int)i });
+    return summarize(values);
+}
+
+double Benchmark::zoneMean(const char* name, uint64_t GpuProfiler::ZoneResult::* counter) const {
+    double sum = 0.0;
+    size_t count = 0;
+    for (const Frame& f : frames)
+        if (const GpuProfiler::ZoneResult* z = findZone(f, name)) {
+            sum += (double)(z->*counter);
+            count++;
+        }
+    return count ? sum / count : 0.0;
+}
+
+// in the order they first appear
+std::vector<const char*> Benchmark::zoneNames() const {
+    std::vector<const char*> names;
+    for (const Frame& f : frames)
+        for (const GpuProfiler::ZoneResult& z : f.zones)
+            if (std::none_of(names.begin(), names.end(), [&](const char* n) { return !strcmp(n, z.name); }))
+                names.push_back(z.name);
+    return names;
+}
+
+void Benchmark::Print() const {
+    auto line = [](const std::string& name, const Summary& s) {
+        std::cout << "  " << name << ": mean " << s.mean << ", p50 " << s.p50 << ", p95 " << s.p95
+            << ", p99 " << s.p99 << ", worst " << s.worst << " (frame " << s.worstFrame << ")" << std::endl;
+    };
+    std::cout << "benchmark: " << frames.size() << " frames" << std::endl;
+    line("cpu ms", summarize([](const Frame& f) { return f.cpuMs; }));
+    line("gpu ms", summarize([](const Frame& f) { return f.gpuMs; }));
+    line("draw calls", summarize([](const Frame& f) { return (double)f.draws; }));
+    line("triangles", summarize([](const Frame& f) { return (double)f.triangles; }));
+    for (const char* name : zoneNames()) line(std::string(name) + " gpu ms", summarizeZone(name));
+}
+
+bool Benchmark::WriteJson(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+    auto summary = [&](const Summary& s) {
+        out << "{ \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+            << ", \"p99\": " << s.p99 << ", \"worst\": " << s.worst << ", \"worst_frame\": " << s.worstFrame << " }";
+    };
+    out << "{\n";
+    for (const auto& i : info) out << "  " << jsonString(i.first) << ": " << jsonString(i.second) << ",\n";
+    out << "  \"frames\": " << frames.size() << ",\n";
+    out << "  \"cpu_ms\": "; summary(summarize([](const Frame& f) { return f.cpuMs; })); out << ",\n";
+    out << "  \"gpu_ms\": "; summary(summarize([](const Frame& f) { return f.gpuMs; })); out << ",\n";
+    out << "  \"draw_calls\": "; summary(summarize([](const Frame& f) { return (double)f.draws; })); out << ",\n";
+    out << "  \"triangles\": "; summary(summarize([](const Frame& f) { return (double)f.triangles; })); out << ",\n";
+    out << "  \"zones\": {";
+    std::vector<const char*> names = zoneNames();
+    for (size_t i = 0; i < names.size(); i++) {
+        out << (i ? ",\n" : "\n") << "    " << jsonString(names[i]) << ": { \"gpu_ms\": ";
+        summary(summarizeZone(names[i]));
+        out << ", \"vertices\": " << zoneMean(names[i], &GpuProfiler::ZoneResult::vertices)
+            << ", \"primitives\": " << zoneMean(names[i], &GpuProfiler::ZoneResult::primitives)
+            << ", \"fragments\": " << zoneMean(names[i], &GpuProfiler::ZoneResult::fragments) << " }";
+    }
+    out << (names.empty() ? "}\n" : "\n  }\n") << "}\n";
+    return (bool)out;
+}
+
+bool Benchmark::WriteCsv(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+    std::vector<const char*> names = zoneNames();
+    out << "frame,camera_x,camera_y,camera_z,cpu_ms,gpu_ms,draw_calls,triangles";
+    for (const char* name : names) out << "," << name << "_ms";
+    out << "\n";
+    for (size_t i = 0; i < frames.size(); i++) {
+        const Frame& f = frames[i];
+        out << i << "," << f.camera.x << "," << f.camera.y << "," << f.camera.z << ","
+            << f.cpuMs << "," << f.gpuMs << "," << f.draws << "," << f.triangles;
+        // frames whose zones were dropped leave the cells empty
+        for (const char* name : names) {
+            out << ",";
+            if (const GpuProfiler::ZoneResult* z = findZone(f, name)) out << z->gpuMs;
+        }
+        out << "\n";
+    }
+    return (bool)out;
+}
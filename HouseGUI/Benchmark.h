@@ -0,0 +1,63 @@
+// Benchmark.h
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GpuProfiler.h"
+
+// Per-frame measurements of a scripted run. Between BeginFrame() and
+// EndFrame() it records the CPU time, the GPU time (a GL_TIMESTAMP pair, so
+// GpuProfiler zones can use GL_TIME_ELAPSED inside it), the triangles
+// (GL_PRIMITIVES_GENERATED) and the draw calls counted by GLState, and it
+// attaches the zones of the current GpuProfiler as they come back. Query
+// results are picked up Latency frames later, when the GPU has long finished
+// them; Finish() waits for the rest. Reports give the mean, p50, p95, p99 and
+// worst frame of each series, and the CSV has every frame, so two builds
+// replaying the same path can be compared frame for frame.
+class Benchmark {
+public:
+    struct Frame {
+        glm::vec3 camera;
+        double cpuMs, gpuMs;
+        uint64_t draws, triangles;
+        // GpuProfiler frame the zones belong to
+        uint64_t gpuFrame;
+        std::vector<GpuProfiler::ZoneResult> zones;
+    };
+    struct Summary {
+        double mean, p50, p95, p99, worst;
+        int worstFrame;
+    };
+    Benchmark();
+    ~Benchmark();
+    // written into the JSON report, e.g. the path and resolution of the run
+    void SetInfo(const std::string& key, const std::string& value);
+    void BeginFrame();
+    void EndFrame(const glm::vec3& cameraPos);
+    void Finish();
+    const std::vector<Frame>& Frames() const { return frames; }
+    void Print() const;
+    bool WriteJson(const std::string& path) const;
+    bool WriteCsv(const std::string& path) const;
+private:
+    static constexpr int Latency = 4;
+    GLuint startQueries[Latency], endQueries[Latency], triangleQueries[Latency];
+    // frame whose results each query set holds, -1 when it is free
+    int pending[Latency];
+    int slot;
+    std::chrono::steady_clock::time_point cpuStart;
+    uint64_t drawsAtStart;
+    std::vector<Frame> frames;
+    std::vector<std::pair<std::string, std::string>> info;
+    void collect(int s);
+    void takeZones();
+    std::vector<const char*> zoneNames() const;
+    static Summary summarize(const std::vector<std::pair<double, int>>& values);
+    template<typename F> Summary summarize(F value) const;
+    Summary summarizeZone(const char* name) const;
+    double zoneMean(const char* name, uint64_t GpuProfiler::ZoneResult::* counter) const;
+};
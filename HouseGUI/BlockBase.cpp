@@ -1,7 +1,12 @@
 #include "BlockBase.h"
+#include "AssetLoader.h"
+#include "TextureResidency.h"
+#include "GLState.h"
 #include <iostream>
 
-BlockBase::BlockBase(float s, float o) : VAO(0), VBO(0), EBO(0), topID(0), sideID(0), bottomID(0), shaderProgram(0), size(s), hasAlpha(false), outlineSize(0.03f) {}
+bool BlockBase::bakeMode = false;
+
+BlockBase::BlockBase(float s, float o) : VAO(0), VBO(0), EBO(0), topID(0), sideID(0), bottomID(0), shaderProgram(0), size(s), hasAlpha(false), outlineSize(0.03f), batchSlot(-1) {}
 
 BlockBase::~BlockBase() {
     Cleanup();
@@ -23,11 +28,10 @@ void BlockBase::Init(const std::string& tex) {
     SetupBuffers();
 }
 
-void BlockBase::Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model,
+void BlockBase::bindMaterial(const glm::mat4& view, const glm::mat4& proj,
     const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
     const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap) {
-    glUseProgram(shaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    GLState::UseProgram(shaderProgram);
     glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
     glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
@@ -35,30 +39,56 @@ void BlockBase::Draw(const glm::mat4& view, const glm::mat4& proj, const glm::ma
     glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, glm::value_ptr(lightColor));
     glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(viewPos));
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, topID);
+    TextureResidency::Use(topID);
+    TextureResidency::Use(sideID);
+    TextureResidency::Use(bottomID);
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D, topID);
     glUniform1i(glGetUniformLocation(shaderProgram, "topTexture"), 0);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, sideID);
+    GLState::ActiveTexture(GL_TEXTURE1);
+    GLState::BindTexture(GL_TEXTURE_2D, sideID);
     glUniform1i(glGetUniformLocation(shaderProgram, "sideTexture"), 1);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, bottomID);
+    GLState::ActiveTexture(GL_TEXTURE2);
+    GLState::BindTexture(GL_TEXTURE_2D, bottomID);
     glUniform1i(glGetUniformLocation(shaderProgram, "bottomTexture"), 2);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
+    GLState::ActiveTexture(GL_TEXTURE3);
+    GLState::BindTexture(GL_TEXTURE_2D, shadowMap);
     glUniform1i(glGetUniformLocation(shaderProgram, "shadowMap"), 3);
 
     glUniform1f(glGetUniformLocation(shaderProgram, "outlineSize"), outlineSize);
+    glUniform1i(glGetUniformLocation(shaderProgram, "bakeMode"), bakeMode);
 
-    if (hasAlpha) {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    }
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    GLState::Set(GL_BLEND, hasAlpha);
     if (hasAlpha)
-        glDisable(GL_BLEND);
+        GLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void BlockBase::Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model,
+    const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap) {
+    bindMaterial(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    GLState::BindVertexArray(VAO);
+    // with the instance arrays disabled the shader reads the current attribute value
+    for (int c = 0; c < 4; c++) glVertexAttrib4fv(ModelAttrib + c, glm::value_ptr(model[c]));
+    glDrawElements(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, 0);
+    GLState::CountDraw();
+}
+
+void BlockBase::DrawInstanced(const glm::mat4& view, const glm::mat4& proj,
+    const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap,
+    GLuint instanceBuffer, GLintptr offset, GLsizei count) {
+    bindMaterial(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (int c = 0; c < 4; c++) {
+        glVertexAttribPointer(ModelAttrib + c, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(offset + c * sizeof(glm::vec4)));
+        glVertexAttribDivisor(ModelAttrib + c, 1);
+        glEnableVertexAttribArray(ModelAttrib + c);
+    }
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, 0, count);
+    GLState::CountDraw();
+    for (int c = 0; c < 4; c++) glDisableVertexAttribArray(ModelAttrib + c);
 }
 
 const char* BlockBase::VertexShaderSrc() {
@@ -66,7 +96,7 @@ const char* BlockBase::VertexShaderSrc() {
         "layout(location=0) in vec3 aPos;\n"
         "layout(location=1) in vec2 aTex;\n"
         "layout(location=2) in vec3 aNormal;\n"
-        "uniform mat4 model;\n"
+        "layout(location=3) in mat4 model;\n"
         "uniform mat4 view;\n"
         "uniform mat4 projection;\n"
         "uniform mat4 lightSpaceMatrix;\n"
@@ -89,7 +119,8 @@ const char* BlockBase::FragmentShaderSrc() {
         "in vec3 FragPos;\n"
         "in vec3 Normal;\n"
         "in vec4 FragPosLightSpace;\n"
-        "out vec4 FragColor;\n"
+        "layout(location=0) out vec4 FragColor;\n"
+        "layout(location=1) out vec4 BakeNormal;\n"
         "uniform sampler2D topTexture;\n"
         "uniform sampler2D sideTexture;\n"
         "uniform sampler2D bottomTexture;\n"
@@ -98,6 +129,7 @@ const char* BlockBase::FragmentShaderSrc() {
         "uniform vec3 lightDir;\n"
         "uniform vec3 lightColor;\n"
         "uniform vec3 viewPos;\n"
+        "uniform int bakeMode;\n"
         "float ShadowCalculation(vec4 fragPosLightSpace){\n"
         "    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;\n"
         "    projCoords = projCoords * 0.5 + 0.5;\n"
@@ -124,6 +156,11 @@ const char* BlockBase::FragmentShaderSrc() {
         "        texColor = vec4(0,0,0,1);\n"
         "    if(texColor.a < 0.1) discard;\n"
         "    vec3 norm = normalize(Normal);\n"
+        "    if(bakeMode == 1) {\n"
+        "        FragColor = texColor;\n"
+        "        BakeNormal = vec4(norm * 0.5 + 0.5, gl_FragCoord.z);\n"
+        "        return;\n"
+        "    }\n"
         "    vec3 lightDirection = normalize(-lightDir);\n"
         "    float diff = max(dot(norm, lightDirection), 0.0);\n"
         "    vec3 diffuse = diff * lightColor;\n"
@@ -195,7 +232,7 @@ void BlockBase::SetupBuffers() {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
-    glBindVertexArray(VAO);
+    GLState::BindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
@@ -206,33 +243,28 @@ void BlockBase::SetupBuffers() {
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
     glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
+    GLState::BindVertexArray(0);
 }
 
 void BlockBase::LoadTexture(const char* path, unsigned int& texID) {
     glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
+    GLState::BindTexture(GL_TEXTURE_2D, texID);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    int w, h, n;
-    unsigned char* data = stbi_load(path, &w, &h, &n, 4);
-    if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    }
-    else {
-        std::cout << "Failed to load " << path << "\n";
-    }
-    stbi_image_free(data);
+    AssetLoader::LoadTexture(texID, path, false);
 }
 
 void BlockBase::Cleanup() {
-    if (VAO) glDeleteVertexArrays(1, &VAO);
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
     if (VBO) glDeleteBuffers(1, &VBO);
     if (EBO) glDeleteBuffers(1, &EBO);
-    if (topID) glDeleteTextures(1, &topID);
-    if (sideID && sideID != topID) glDeleteTextures(1, &sideID);
-    if (bottomID && bottomID != topID && bottomID != sideID) glDeleteTextures(1, &bottomID);
-    if (shaderProgram) glDeleteProgram(shaderProgram);
+    TextureResidency::Forget(topID);
+    TextureResidency::Forget(sideID);
+    TextureResidency::Forget(bottomID);
+    if (topID) GLState::DeleteTextures(1, &topID);
+    if (sideID && sideID != topID) GLState::DeleteTextures(1, &sideID);
+    if (bottomID && bottomID != topID && bottomID != sideID) GLState::DeleteTextures(1, &bottomID);
+    if (shaderProgram) GLState::DeleteProgram(shaderProgram);
 }
@@ -14,6 +14,9 @@ public:
     float size;
     bool hasAlpha;
     float outlineSize;
+    static bool bakeMode;
+    // index of this type in the BlockBatch, -1 when it is drawn on its own
+    int batchSlot;
     BlockBase(float s, float o = 0.03f);
     virtual ~BlockBase();
     virtual void Init(const char* t, const char* si, const char* b);
@@ -21,6 +24,16 @@ public:
     virtual void Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model,
         const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
         const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap);
+    // count model matrices (column-major mat4s) at offset in instanceBuffer
+    void DrawInstanced(const glm::mat4& view, const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+        const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap,
+        GLuint instanceBuffer, GLintptr offset, GLsizei count);
+    // the model matrix is a per-instance attribute in these four locations
+    static constexpr GLuint ModelAttrib = 3;
+    // whether BlockBatch may draw this type with its shared shader; types with
+    // their own shaders or blending keep their own draw
+    virtual bool Batchable() const { return !hasAlpha; }
 protected:
     virtual const char* VertexShaderSrc();
     virtual const char* FragmentShaderSrc();
@@ -28,4 +41,8 @@ protected:
     virtual void SetupBuffers();
     void LoadTexture(const char* path, unsigned int& texID);
     void Cleanup();
+    void bindMaterial(const glm::mat4& view, const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+        const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap);
+    virtual GLsizei indexCount() const { return 36; }
 };
@@ -0,0 +1,584 @@
+// BlockBatch.cpp
+#include "BlockBatch.h"
+#include "BlockBase.h"
+#include "AssetLoader.h"
+#include "FrameRingBuffer.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "TextureResidency.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+// gl_DrawID and gl_BaseInstance are core in 4.6 and come from
+// ARB_shader_draw_parameters before that
+static const char* drawParams46 =
+"#version 460 core\n"
+"#define DRAW_ID gl_DrawID\n"
+"#define BASE_INSTANCE gl_BaseInstance\n";
+static const char* drawParamsARB =
+"#version 450 core\n"
+"#extension GL_ARB_shader_draw_parameters : require\n"
+"#define DRAW_ID gl_DrawIDARB\n"
+"#define BASE_INSTANCE gl_BaseInstanceARB\n";
+
+static const char* batchVertSrc = R"(
+layout(location=0) in vec3 aPos;
+layout(location=1) in vec2 aTex;
+layout(location=2) in vec3 aNormal;
+struct Material { ivec4 layers; vec4 params; };
+layout(std430, binding=0) readonly buffer Materials { Material materials[]; };
+layout(std430, binding=1) readonly buffer Transforms { mat4 models[]; };
+// after GPU culling draw d is the d-th non-empty type, not type d
+layout(std430, binding=2) readonly buffer DrawTypes { uint drawTypes[]; };
+uniform bool compacted;
+uniform mat4 view, projection, lightSpaceMatrix;
+out vec2 TexCoord;
+out vec3 FragPos;
+out vec3 Normal;
+out vec4 FragPosLightSpace;
+flat out ivec3 Layers;
+flat out float OutlineSize;
+void main(){
+    mat4 model = models[BASE_INSTANCE + gl_InstanceID];
+    Material m = materials[compacted ? int(drawTypes[DRAW_ID]) : DRAW_ID];
+    Layers = m.layers.xyz;
+    OutlineSize = m.params.x;
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+    TexCoord = aTex;
+    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+static const char* batchFragSrc = R"(
+in vec2 TexCoord;
+in vec3 FragPos;
+in vec3 Normal;
+in vec4 FragPosLightSpace;
+flat in ivec3 Layers;
+flat in float OutlineSize;
+layout(location=0) out vec4 FragColor;
+layout(location=1) out vec4 BakeNormal;
+uniform sampler2DArray blockTextures;
+uniform sampler2D shadowMap;
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+uniform vec3 viewPos;
+uniform int bakeMode;
+float ShadowCalculation(vec4 fragPosLightSpace){
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    float currentDepth = projCoords.z;
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    for(int x = -1; x <= 1; ++x){
+        for(int y = -1; y <= 1; ++y){
+            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += currentDepth - 0.005 > pcfDepth ? 1.0 : 0.0;
+        }
+    }
+    shadow /= 9.0;
+    if(projCoords.z > 1.0) shadow = 0.0;
+    return shadow;
+}
+void main(){
+    // same face selection as the per-type block shader
+    int layer;
+    if(abs(Normal.y) > 0.9) layer = Layers.x;
+    else if(Normal.y < -0.9) layer = Layers.z;
+    else layer = Layers.y;
+    vec4 texColor = texture(blockTextures, vec3(TexCoord, float(layer)));
+    if(TexCoord.x < OutlineSize || TexCoord.x > 1.0 - OutlineSize || TexCoord.y < OutlineSize || TexCoord.y > 1.0 - OutlineSize)
+        texColor = vec4(0,0,0,1);
+    if(texColor.a < 0.1) discard;
+    vec3 norm = normalize(Normal);
+    if(bakeMode == 1) {
+        FragColor = texColor;
+        BakeNormal = vec4(norm * 0.5 + 0.5, gl_FragCoord.z);
+        return;
+    }
+    vec3 lightDirection = normalize(-lightDir);
+    float diff = max(dot(norm, lightDirection), 0.0);
+    vec3 diffuse = diff * lightColor;
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 reflectDir = reflect(-lightDirection, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
+    vec3 specular = spec * lightColor;
+    vec3 ambient = 0.2 * lightColor;
+    float shadow = ShadowCalculation(FragPosLightSpace);
+    vec3 lighting = ambient + (1.0 - shadow) * (diffuse + specular);
+    FragColor = vec4(texColor.rgb * lighting, texColor.a);
+}
+)";
+
+// one invocation per instance: frustum test, then append to the type's range
+static const char* cullSrc = R"(#version 430 core
+layout(local_size_x=64) in;
+struct Material { ivec4 layers; vec4 params; };
+struct Command { uint count, instanceCount, firstIndex; int baseVertex; uint baseInstance; };
+layout(std430, binding=0) readonly buffer Materials { Material materials[]; };
+layout(std430, binding=1) readonly buffer Instances { mat4 instances[]; };
+layout(std430, binding=2) readonly buffer Slots { uint slots[]; };
+layout(std430, binding=3) buffer Commands { Command commands[]; };
+layout(std430, binding=4) writeonly buffer Visible { mat4 visible[]; };
+layout(std430, binding=5) buffer Counters { uint drawCount; uint visibleCount; };
+uniform vec4 planes[6];
+uniform uint instanceCount;
+void main(){
+    uint i = gl_GlobalInvocationID.x;
+    if(i >= instanceCount) return;
+    uint slot = slots[i];
+    mat4 m = instances[i];
+    float r = materials[slot].params.y;
+    for(int p = 0; p < 6; p++)
+        if(dot(planes[p].xyz, m[3].xyz) + planes[p].w < -r) return;
+    uint k = atomicAdd(commands[slot].instanceCount, 1u);
+    visible[commands[slot].baseInstance + k] = m;
+    atomicAdd(visibleCount, 1u);
+}
+)";
+
+// one invocation per type: copy the non-empty commands to the front
+static const char* compactSrc = R"(#version 430 core
+layout(local_size_x=64) in;
+struct Command { uint count, instanceCount, firstIndex; int baseVertex; uint baseInstance; };
+layout(std430, binding=3) readonly buffer Commands { Command commands[]; };
+layout(std430, binding=5) buffer Counters { uint drawCount; uint visibleCount; };
+layout(std430, binding=6) writeonly buffer Draws { Command draws[]; };
+layout(std430, binding=7) writeonly buffer DrawTypes { uint drawTypes[]; };
+uniform uint typeCount;
+void main(){
+    uint t = gl_GlobalInvocationID.x;
+    if(t >= typeCount || commands[t].instanceCount == 0u) return;
+    uint d = atomicAdd(drawCount, 1u);
+    draws[d] = commands[t];
+    drawTypes[d] = t;
+}
+)";
+
+static GLintptr alignUp(GLintptr v, GLintptr a) {
+    return (v + a - 1) / a * a;
+}
+
+BlockBatch::BlockBatch()
+    : VAO(0), VBO(0), EBO(0), materialSSBO(0), textureArray(0), shader(0), texturesCopied(false), textureSize(0), ssboAlignment(16),
+    cullProgram(0), compactProgram(0), visibleBuffer(0), cullBuffer(0), drawTypesBuffer(0), visibleCapacity(0), drawsOffset(0),
+    statsFrame(0), cullStats{ 0, 0, 0 }
+{
+    for (int i = 0; i < StatsFrames; i++) {
+        statsBuffers[i] = 0;
+        statsFences[i] = nullptr;
+        statsInstances[i] = 0;
+    }
+}
+
+BlockBatch::~BlockBatch() {
+    for (Type& t : types) t.block->batchSlot = -1;
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
+    if (VBO) glDeleteBuffers(1, &VBO);
+    if (EBO) glDeleteBuffers(1, &EBO);
+    if (materialSSBO) glDeleteBuffers(1, &materialSSBO);
+    if (textureArray) {
+        TextureResidency::Forget(textureArray);
+        GLState::DeleteTextures(1, &textureArray);
+    }
+    if (shader) GLState::DeleteProgram(shader);
+    if (cullProgram) GLState::DeleteProgram(cullProgram);
+    if (compactProgram) GLState::DeleteProgram(compactProgram);
+    if (visibleBuffer) glDeleteBuffers(1, &visibleBuffer);
+    if (cullBuffer) glDeleteBuffers(1, &cullBuffer);
+    if (drawTypesBuffer) glDeleteBuffers(1, &drawTypesBuffer);
+    if (statsBuffers[0]) glDeleteBuffers(StatsFrames, statsBuffers);
+    for (GLsync f : statsFences)
+        if (f) glDeleteSync(f);
+}
+
+bool BlockBatch::Init(const std::vector<BlockBase*>& blocks) {
+    if (!GLAD_GL_VERSION_4_3 || !FrameRingBuffer::Current()) return false;
+    const char* header = GLAD_GL_VERSION_4_6 ? drawParams46 : GLState::HasExtension("GL_ARB_shader_draw_parameters") ? drawParamsARB : nullptr;
+    if (!header) return false;
+    shader = createProgram((std::string(header) + batchVertSrc).c_str(), (std::string(header) + batchFragSrc).c_str());
+    if (!shader) return false;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssboAlignment);
+
+    // pull every type's mesh back out of its own buffers into the shared ones
+    std::vector<float> vertices;
+    std::vector<GLuint> indices;
+    for (BlockBase* b : blocks) {
+        if (!b || !b->Batchable() || b->batchSlot >= 0) continue;
+        GLint vbytes = 0, ibytes = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, b->VBO);
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &vbytes);
+        size_t v0 = vertices.size();
+        vertices.resize(v0 + vbytes / sizeof(float));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vbytes, vertices.data() + v0);
+        glBindBuffer(GL_COPY_READ_BUFFER, b->EBO);
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &ibytes);
+        size_t i0 = indices.size();
+        indices.resize(i0 + ibytes / sizeof(GLuint));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, ibytes, indices.data() + i0);
+        Type t;
+        t.block = b;
+        t.indexCount = (GLuint)(indices.size() - i0);
+        t.firstIndex = (GLuint)i0;
+        t.baseVertex = (GLint)(v0 / 8);
+        b->batchSlot = (int)types.size();
+        types.push_back(t);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    if (types.empty()) return false;
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    GLState::BindVertexArray(0);
+    instanceCounts.resize(types.size());
+    return true;
+}
+
+// Blits every distinct block texture into one layer of the array. Blitting
+// rather than copying lets textures of different sizes share it.
+void BlockBatch::copyTextures() {
+    std::map<GLuint, int> layerOf;
+    std::vector<GLint> material(types.size() * 8, 0);
+    for (size_t i = 0; i < types.size(); i++) {
+        BlockBase* b = types[i].block;
+        GLuint ids[3] = { b->topID, b->sideID, b->bottomID };
+        for (int f = 0; f < 3; f++) {
+            auto it = layerOf.find(ids[f]);
+            if (it == layerOf.end()) {
+                it = layerOf.emplace(ids[f], (int)layers.size()).first;
+                layers.push_back({ ids[f], 0, false });
+            }
+            material[i * 8 + f] = it->second;
+            // an evicted texture is a single texel for now; the array is sized for its file
+            GLint w = 0, h = 0;
+            if (!TextureResidency::FullSize(ids[f], w, h)) {
+                GLState::BindTexture(GL_TEXTURE_2D, ids[f]);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+            }
+            textureSize = std::max(textureSize, (int)w);
+        }
+        // params: outline size, then the culling radius the CPU path uses too
+        float params[2] = { b->outlineSize, b->size * 1.8f };
+        memcpy(&material[i * 8 + 4], params, sizeof(params));
+    }
+    textureSize = std::max(textureSize, 1);
+    glGenTextures(1, &textureArray);
+    GLState::BindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, textureSize, textureSize, (GLsizei)layers.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    TextureResidency::Track(textureArray, (size_t)textureSize * textureSize * layers.size() * 4);
+    copyLayers(true);
+
+    glGenBuffers(1, &materialSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, material.size() * sizeof(GLint), material.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    texturesCopied = true;
+}
+
+// every layer, or the ones whose texture has landed again since it was copied
+void BlockBatch::copyLayers(bool all) {
+    GLint readFbo, drawFbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFbo);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+    GLuint fbos[2];
+    glGenFramebuffers(2, fbos);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+    for (size_t i = 0; i < layers.size(); i++) {
+        Layer& l = layers[i];
+        uint64_t version = TextureResidency::Version(l.source);
+        if (!all && version == l.version) continue;
+        GLint w = 0, h = 0;
+        GLState::BindTexture(GL_TEXTURE_2D, l.source);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, l.source, 0);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureArray, 0, (GLint)i);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, textureSize, textureSize, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        l.version = version;
+        l.resident = TextureResidency::Resident(l.source);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo);
+    glDeleteFramebuffers(2, fbos);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool BlockBatch::Ready() {
+    if (texturesCopied) {
+        // layers copied from a cut-down texture want it back, and are copied again when it lands
+        bool stale = false;
+        for (const Layer& l : layers) {
+            if (l.resident) continue;
+            TextureResidency::Use(l.source);
+            stale |= TextureResidency::Version(l.source) != l.version;
+        }
+        if (stale) copyLayers(false);
+        return true;
+    }
+    if (types.empty()) return false;
+    AssetLoader* assets = AssetLoader::Current();
+    if (assets && assets->Pending() > 0) return false;
+    copyTextures();
+    return true;
+}
+
+bool BlockBatch::Draw(const glm::mat4& view, const glm::mat4& proj,
+    const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap,
+    const std::vector<int>& slots, const std::vector<const glm::mat4*>& models) {
+    FrameRingBuffer* ring = FrameRingBuffer::Current();
+    if (!ring || !Ready()) return false;
+    if (models.empty()) return true;
+    FrameRingBuffer::Allocation transforms = ring->Alloc(models.size() * sizeof(glm::mat4), ssboAlignment);
+    FrameRingBuffer::Allocation commands = ring->Alloc(types.size() * sizeof(Command), 4);
+    if (!transforms.ptr || !commands.ptr) return false;
+
+    // counting sort by type, so each command's instances are contiguous
+    std::fill(instanceCounts.begin(), instanceCounts.end(), 0);
+    for (int s : slots) instanceCounts[s]++;
+    Command* cmd = (Command*)commands.ptr;
+    GLuint first = 0;
+    for (size_t t = 0; t < types.size(); t++) {
+        cmd[t].count = types[t].indexCount;
+        cmd[t].instanceCount = instanceCounts[t];
+        cmd[t].firstIndex = types[t].firstIndex;
+        cmd[t].baseVertex = types[t].baseVertex;
+        cmd[t].baseInstance = first;
+        instanceCounts[t] = first;
+        first += cmd[t].instanceCount;
+    }
+    glm::mat4* dst = (glm::mat4*)transforms.ptr;
+    for (size_t i = 0; i < models.size(); i++) dst[instanceCounts[slots[i]]++] = *models[i];
+
+    bindProgram(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap, false);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, ring->Buffer(), transforms.offset, models.size() * sizeof(glm::mat4));
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring->Buffer());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commands.offset, (GLsizei)types.size(), 0);
+    GLState::CountDraw();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return true;
+}
+
+bool BlockBatch::InitCulling() {
+    if (types.empty() || !glMultiDrawElementsIndirectCount) return false;
+    cullProgram = createComputeProgram(cullSrc);
+    compactProgram = createComputeProgram(compactSrc);
+    if (!cullProgram || !compactProgram) {
+        if (cullProgram) GLState::DeleteProgram(cullProgram);
+        if (compactProgram) GLState::DeleteProgram(compactProgram);
+        cullProgram = compactProgram = 0;
+        return false;
+    }
+    drawsOffset = alignUp(2 * sizeof(GLuint), ssboAlignment);
+    glGenBuffers(1, &visibleBuffer);
+    glGenBuffers(1, &cullBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, drawsOffset + types.size() * sizeof(Command), nullptr, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &drawTypesBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawTypesBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, types.size() * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glGenBuffers(StatsFrames, statsBuffers);
+    for (GLuint b : statsBuffers) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, b);
+        glBufferData(GL_COPY_WRITE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+}
+
+bool BlockBatch::DrawCulled(const glm::mat4& view, const glm::mat4& proj,
+    const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap,
+    const std::vector<int>& slots, const std::vector<const glm::mat4*>& models, bool stats) {
+    FrameRingBuffer* ring = FrameRingBuffer::Current();
+    if (!cullProgram || !ring || !Ready()) return false;
+    if (models.empty()) return true;
+    size_t n = models.size();
+    FrameRingBuffer::Allocation instances = ring->Alloc(n * sizeof(glm::mat4), ssboAlignment);
+    FrameRingBuffer::Allocation slotIds = ring->Alloc(n * sizeof(GLuint), ssboAlignment);
+    FrameRingBuffer::Allocation commands = ring->Alloc(types.size() * sizeof(Command), ssboAlignment);
+    if (!instances.ptr || !slotIds.ptr || !commands.ptr) return false;
+
+    // every type gets room for all its instances; the cull pass fills in how many survive
+    std::fill(instanceCounts.begin(), instanceCounts.end(), 0);
+    for (int s : slots) instanceCounts[s]++;
+    Command* cmd = (Command*)commands.ptr;
+    GLuint first = 0;
+    for (size_t t = 0; t < types.size(); t++) {
+        cmd[t].count = types[t].indexCount;
+        cmd[t].instanceCount = 0;
+        cmd[t].firstIndex = types[t].firstIndex;
+        cmd[t].baseVertex = types[t].baseVertex;
+        cmd[t].baseInstance = first;
+        first += instanceCounts[t];
+    }
+    glm::mat4* dst = (glm::mat4*)instances.ptr;
+    GLuint* ids = (GLuint*)slotIds.ptr;
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = *models[i];
+        ids[i] = (GLuint)slots[i];
+    }
+    if (n > visibleCapacity) {
+        visibleCapacity = std::max(n, visibleCapacity * 2);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, visibleCapacity * sizeof(glm::mat4), nullptr, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, 2 * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLsizeiptr commandBytes = types.size() * sizeof(Command);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, materialSSBO);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, ring->Buffer(), instances.offset, n * sizeof(glm::mat4));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, ring->Buffer(), slotIds.offset, n * sizeof(GLuint));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, ring->Buffer(), commands.offset, commandBytes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibleBuffer);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 5, cullBuffer, 0, 2 * sizeof(GLuint));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 6, cullBuffer, drawsOffset, commandBytes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, drawTypesBuffer);
+    Frustum frustum(proj * view);
+    GLState::UseProgram(cullProgram);
+    glUniform4fv(glGetUniformLocation(cullProgram, "planes"), 6, glm::value_ptr(frustum.planes[0]));
+    glUniform1ui(glGetUniformLocation(cullProgram, "instanceCount"), (GLuint)n);
+    glDispatchCompute((GLuint)(n + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    GLState::UseProgram(compactProgram);
+    glUniform1ui(glGetUniformLocation(compactProgram, "typeCount"), (GLuint)types.size());
+    glDispatchCompute((GLuint)(types.size() + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    if (stats) readCullStats((unsigned)n);
+
+    bindProgram(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap, true);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, drawTypesBuffer);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cullBuffer);
+    glBindBuffer(GL_PARAMETER_BUFFER, cullBuffer);
+    glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)drawsOffset, 0, (GLsizei)types.size(), 0);
+    GLState::CountDraw();
+    glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return true;
+}
+
+// Copies this frame's counters aside and picks up the oldest copy once its
+// fence has passed, so the CPU never waits for the cull pass.
+void BlockBatch::readCullStats(unsigned instances) {
+    glBindBuffer(GL_COPY_READ_BUFFER, cullBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, statsBuffers[statsFrame]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 2 * sizeof(GLuint));
+    if (statsFences[statsFrame]) glDeleteSync(statsFences[statsFrame]);
+    statsFences[statsFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    statsInstances[statsFrame] = instances;
+    statsFrame = (statsFrame + 1) % StatsFrames;
+    GLsync f = statsFences[statsFrame];
+    if (f && glClientWaitSync(f, 0, 0) != GL_TIMEOUT_EXPIRED) {
+        GLuint counts[2];
+        glBindBuffer(GL_COPY_WRITE_BUFFER, statsBuffers[statsFrame]);
+        glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(counts), counts);
+        cullStats = { statsInstances[statsFrame], counts[1], counts[0] };
+        glDeleteSync(f);
+        statsFences[statsFrame] = nullptr;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void BlockBatch::bindProgram(const glm::mat4& view, const glm::mat4& proj,
+    const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap, bool compacted) {
+    GLState::UseProgram(shader);
+    GLState::Disable(GL_BLEND);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    glUniform3fv(glGetUniformLocation(shader, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(shader, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, glm::value_ptr(viewPos));
+    glUniform1i(glGetUniformLocation(shader, "bakeMode"), BlockBase::bakeMode);
+    glUniform1i(glGetUniformLocation(shader, "compacted"), compacted);
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+    glUniform1i(glGetUniformLocation(shader, "blockTextures"), 0);
+    GLState::ActiveTexture(GL_TEXTURE1);
+    GLState::BindTexture(GL_TEXTURE_2D, shadowMap);
+    glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, materialSSBO);
+}
+
+GLuint BlockBatch::compileShader(const char* src, GLenum type) {
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        glDeleteShader(s);
+        return 0;
+    }
+    return s;
+}
+
+GLuint BlockBatch::createProgram(const char* vs, const char* fs) {
+    GLuint v = compileShader(vs, GL_VERTEX_SHADER);
+    GLuint f = compileShader(fs, GL_FRAGMENT_SHADER);
+    if (!v || !f) {
+        if (v) glDeleteShader(v);
+        if (f) glDeleteShader(f);
+        return 0;
+    }
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v);
+    glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v);
+    glDeleteShader(f);
+    GLint ok;
+    glGetProgramiv(p, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        GLState::DeleteProgram(p);
+        return 0;
+    }
+    return p;
+}
+
+GLuint BlockBatch::createComputeProgram(const char* cs) {
+    GLuint c = compileShader(cs, GL_COMPUTE_SHADER);
+    if (!c) return 0;
+    GLuint p = glCreateProgram();
+    glAttachShader(p, c);
+    glLinkProgram(p);
+    glDeleteShader(c);
+    GLint ok;
+    glGetProgramiv(p, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        GLState::DeleteProgram(p);
+        return 0;
+    }
+    return p;
+}
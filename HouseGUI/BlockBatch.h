@@ -0,0 +1,100 @@
+// BlockBatch.h
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+class BlockBase;
+
+// Draws every opaque block type with one glMultiDrawElementsIndirect. The
+// types' meshes share one vertex/index buffer and their textures are copied
+// into one texture array; per draw (gl_DrawID) the shader looks up the
+// type's texture layers, per instance (gl_BaseInstance + gl_InstanceID) its
+// model matrix. There is one command per registered type, so the CPU cost of
+// a frame does not depend on how many blocks are visible. Transforms and
+// commands are written into the frame ring buffer.
+//
+// The texture array counts against TextureResidency's budget. A layer copied
+// from a texture that was cut down at the time keeps asking for the texture
+// and is copied again once its full resolution is back.
+//
+// With InitCulling() the visibility test moves to the GPU as well: a compute
+// pass tests every instance's bounding sphere against the frustum and appends
+// the survivors to their type's range with atomics, a second pass compacts
+// the non-empty commands, and glMultiDrawElementsIndirectCount draws them.
+class BlockBatch {
+public:
+    BlockBatch();
+    ~BlockBatch();
+    // needs GL 4.3 plus shader draw parameters; sets BlockBase::batchSlot on
+    // the types it takes (opaque ones sharing the default block shader)
+    bool Init(const std::vector<BlockBase*>& types);
+    // false until the block textures have finished loading
+    bool Ready();
+    // models[i] is drawn with the type in slot slots[i]
+    bool Draw(const glm::mat4& view, const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+        const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap,
+        const std::vector<int>& slots, const std::vector<const glm::mat4*>& models);
+    // needs compute shaders and glMultiDrawElementsIndirectCount (GL 4.6 or
+    // ARB_indirect_parameters)
+    bool InitCulling();
+    bool Culling() const { return cullProgram != 0; }
+    // like Draw, but models is every queued instance, visible or not; stats
+    // keeps this draw's counts for GetCullStats, which one draw a frame should
+    bool DrawCulled(const glm::mat4& view, const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+        const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap,
+        const std::vector<int>& slots, const std::vector<const glm::mat4*>& models, bool stats);
+    // counts from StatsFrames - 1 frames back, read without stalling
+    struct CullStats {
+        unsigned instances, visible, draws;
+    };
+    CullStats GetCullStats() const { return cullStats; }
+    int Types() const { return (int)types.size(); }
+private:
+    struct Type {
+        BlockBase* block;
+        GLuint indexCount, firstIndex;
+        GLint baseVertex;
+    };
+    // the block texture in one layer of the array, and its version when copied
+    struct Layer {
+        GLuint source;
+        uint64_t version;
+        bool resident;
+    };
+    struct Command {
+        GLuint count, instanceCount, firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+    std::vector<Type> types;
+    std::vector<GLuint> instanceCounts;
+    std::vector<Layer> layers;
+    GLuint VAO, VBO, EBO, materialSSBO, textureArray, shader;
+    bool texturesCopied;
+    int textureSize;
+    GLint ssboAlignment;
+    // GPU culling: visibleBuffer holds the surviving transforms, cullBuffer the
+    // draw count, visible count and compacted commands
+    static constexpr int StatsFrames = 3;
+    GLuint cullProgram, compactProgram, visibleBuffer, cullBuffer, drawTypesBuffer;
+    size_t visibleCapacity;
+    GLintptr drawsOffset;
+    GLuint statsBuffers[StatsFrames];
+    GLsync statsFences[StatsFrames];
+    unsigned statsInstances[StatsFrames];
+    int statsFrame;
+    CullStats cullStats;
+    void copyTextures();
+    void copyLayers(bool all);
+    void bindProgram(const glm::mat4& view, const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
+        const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap, bool compacted);
+    void readCullStats(unsigned instances);
+    GLuint compileShader(const char* src, GLenum type);
+    GLuint createProgram(const char* vs, const char* fs);
+    GLuint createComputeProgram(const char* cs);
+};
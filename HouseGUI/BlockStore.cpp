@@ -0,0 +1,70 @@
+// BlockStore.cpp
+#include "BlockStore.h"
+#include <algorithm>
+#include <cmath>
+
+int BlockStore::Top(int x, int z) const {
+    if (x < lo.x || z < lo.z || x >= hi.x || z >= hi.z) return -1;
+    // down the column a cell at a time, so the air above the ground is a step or two
+    glm::ivec3 mn, mx;
+    for (int y = hi.y - 1; y >= lo.y; y = mn.y - 1)
+        if (cell(glm::ivec3(x, y, z), mn, mx) != PaletteChunk::Air) return y;
+    return -1;
+}
+
+bool BlockStore::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit& hit) const {
+    // clip the ray to the box
+    float tEnter = 0.0f, tLeave = maxDistance;
+    int enterAxis = -1;
+    for (int a = 0; a < 3; a++) {
+        if (direction[a] == 0.0f) {
+            if (origin[a] < lo[a] || origin[a] >= hi[a]) return false;
+            continue;
+        }
+        float tNear = (lo[a] - origin[a]) / direction[a], tFar = (hi[a] - origin[a]) / direction[a];
+        if (tNear > tFar) std::swap(tNear, tFar);
+        if (tNear > tEnter) {
+            tEnter = tNear;
+            enterAxis = a;
+        }
+        tLeave = std::min(tLeave, tFar);
+    }
+    if (tEnter > tLeave) return false;
+
+    glm::vec3 p = origin + direction * tEnter;
+    glm::ivec3 block = glm::clamp(glm::ivec3(glm::floor(p)), lo, hi - 1);
+    glm::ivec3 normal(0);
+    if (enterAxis >= 0) {
+        block[enterAxis] = direction[enterAxis] > 0.0f ? lo[enterAxis] : hi[enterAxis] - 1;
+        normal[enterAxis] = direction[enterAxis] > 0.0f ? -1 : 1;
+    }
+    float t = tEnter;
+    for (;;) {
+        glm::ivec3 mn, mx;
+        Value value = cell(block, mn, mx);
+        if (value != PaletteChunk::Air) {
+            hit = { block, normal, value, t };
+            return true;
+        }
+        // out through the nearest face of the cell
+        float tExit = INFINITY;
+        int axis = 0;
+        for (int a = 0; a < 3; a++) {
+            if (direction[a] == 0.0f) continue;
+            float ta = ((direction[a] > 0.0f ? mx[a] : mn[a]) - origin[a]) / direction[a];
+            if (ta < tExit) {
+                tExit = ta;
+                axis = a;
+            }
+        }
+        if (tExit > tLeave) return false;
+        t = std::max(t, tExit);
+        p = origin + direction * t;
+        // exact on the axis it steps along, kept inside the cell's face on the others
+        block = glm::clamp(glm::ivec3(glm::floor(p)), mn, mx - 1);
+        block[axis] = direction[axis] > 0.0f ? mx[axis] : mn[axis] - 1;
+        if (glm::any(glm::lessThan(block, lo)) || glm::any(glm::greaterThanEqual(block, hi))) return false;
+        normal = glm::ivec3(0);
+        normal[axis] = direction[axis] > 0.0f ? -1 : 1;
+    }
+}
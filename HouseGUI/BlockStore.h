@@ -0,0 +1,46 @@
+// BlockStore.h
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <glm/glm.hpp>
+#include "PaletteChunk.h"
+
+// Read access to the cube blocks of a whole world, in block coordinates:
+// block (x, y, z) is column x, z at level y, the unit cell [x, x + 1) and so
+// on, centred on (x, y, z) * spacing in the world. Blocks outside the box
+// [Min(), Max()) are air.
+//
+// Raycast is shared: it walks the ray cell by cell, where a cell is the
+// largest box around a block that the store knows to be of one value, so a
+// store that can report big empty cells skips over them.
+class BlockStore {
+public:
+    typedef PaletteChunk::Value Value;
+    struct Hit {
+        glm::ivec3 block;
+        // of the face the ray entered through; zero when it started inside the block
+        glm::ivec3 normal;
+        Value value;
+        // along the ray, in blocks
+        float distance;
+    };
+    typedef std::function<void(int x, int y, int z, Value value)> Visitor;
+
+    virtual ~BlockStore() {}
+    virtual const char* Name() const = 0;
+    virtual Value Get(int x, int y, int z) const = 0;
+    // every block that is not air in [mn, mx)
+    virtual void ForEachSolid(const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& visit) const = 0;
+    virtual size_t MemoryBytes() const = 0;
+    // the highest block of column x, z that is not air, or -1
+    int Top(int x, int z) const;
+    const glm::ivec3& Min() const { return lo; }
+    const glm::ivec3& Max() const { return hi; }
+    // the first block that is not air along origin + t * direction, t up to
+    // maxDistance; direction should be normalised for distances in blocks
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit& hit) const;
+protected:
+    glm::ivec3 lo, hi;
+    // the value at block p and a box [mn, mx) around it holding only that value
+    virtual Value cell(const glm::ivec3& p, glm::ivec3& mn, glm::ivec3& mx) const = 0;
+};
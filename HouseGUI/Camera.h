@@ -42,6 +42,12 @@ public:
         UpdateCameraVectors();
     }
 
+    void SetOrientation(float yaw, float pitch) {
+        Yaw = yaw;
+        Pitch = pitch;
+        UpdateCameraVectors();
+    }
+
     void ProcessMouseScroll(float yoffset) {
         Zoom -= yoffset;
         if (Zoom < 1)Zoom = 1;
@@ -0,0 +1,134 @@
+// CameraPath.cpp
+#include "CameraPath.h"
+#include "Robot.h"
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const struct { const char* name; unsigned key; } keyNames[] = {
+    { "left", RobotLeft }, { "right", RobotRight }, { "forward", RobotForward }, { "back", RobotBack }
+};
+
+bool CameraPath::Load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "camera path: cannot open " << path << std::endl;
+        return false;
+    }
+    points.clear();
+    inputs.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream words(line);
+        std::string kind;
+        if (!(words >> kind)) continue;
+        if (kind == "key") {
+            Key k;
+            if (words >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.yaw >> k.pitch) {
+                points.push_back(k);
+                continue;
+            }
+        }
+        else if (kind == "input") {
+            Input i = { 0.0f, 0 };
+            std::string name;
+            bool ok = (bool)(words >> i.time);
+            while (ok && words >> name) {
+                auto it = std::find_if(std::begin(keyNames), std::end(keyNames), [&](const auto& k) { return name == k.name; });
+                if (it == std::end(keyNames)) ok = false;
+                else i.keys |= it->key;
+            }
+            if (ok) {
+                inputs.push_back(i);
+                continue;
+            }
+        }
+        std::cout << "camera path: " << path << ":" << lineNumber << " is not a key or input line" << std::endl;
+        return false;
+    }
+    auto byTime = [](const auto& a, const auto& b) { return a.time < b.time; };
+    std::stable_sort(points.begin(), points.end(), byTime);
+    std::stable_sort(inputs.begin(), inputs.end(), byTime);
+    if (points.empty()) std::cout << "camera path: " << path << " has no keys" << std::endl;
+    return !points.empty();
+}
+
+bool CameraPath::Save(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "# key <seconds> <x> <y> <z> <yaw> <pitch>\n";
+    for (const Key& k : points)
+        out << "key " << k.time << " " << k.position.x << " " << k.position.y << " " << k.position.z
+            << " " << k.yaw << " " << k.pitch << "\n";
+    out << "# input <seconds> [left] [right] [forward] [back]\n";
+    for (const Input& i : inputs) {
+        out << "input " << i.time;
+        for (const auto& k : keyNames)
+            if (i.keys & k.key) out << " " << k.name;
+        out << "\n";
+    }
+    return (bool)out;
+}
+
+void CameraPath::AddKey(float time, const glm::vec3& position, float yaw, float pitch) {
+    points.push_back({ time, position, yaw, pitch });
+}
+
+void CameraPath::AddInput(float time, unsigned keys) {
+    unsigned previous = inputs.empty() ? 0 : inputs.back().keys;
+    if (keys != previous) inputs.push_back({ time, keys });
+}
+
+void CameraPath::Sample(float time, glm::vec3& position, float& yaw, float& pitch) const {
+    if (points.empty()) return;
+    if (time <= points.front().time || points.size() == 1) {
+        const Key& k = points.front();
+        position = k.position; yaw = k.yaw; pitch = k.pitch;
+        return;
+    }
+    if (time >= points.back().time) {
+        const Key& k = points.back();
+        position = k.position; yaw = k.yaw; pitch = k.pitch;
+        return;
+    }
+    size_t i = std::upper_bound(points.begin(), points.end(), time, [](float t, const Key& k) { return t < k.time; }) - points.begin() - 1;
+    const Key& a = points[i];
+    const Key& b = points[i + 1];
+    const glm::vec3& p0 = i > 0 ? points[i - 1].position : a.position;
+    const glm::vec3& p3 = i + 2 < points.size() ? points[i + 2].position : b.position;
+    float u = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0.0f;
+    float u2 = u * u, u3 = u2 * u;
+    position = 0.5f * (2.0f * a.position + (b.position - p0) * u
+        + (2.0f * p0 - 5.0f * a.position + 4.0f * b.position - p3) * u2
+        + (3.0f * a.position - p0 - 3.0f * b.position + p3) * u3);
+    yaw = a.yaw + (b.yaw - a.yaw) * u;
+    pitch = a.pitch + (b.pitch - a.pitch) * u;
+}
+
+unsigned CameraPath::KeysAt(float time) const {
+    unsigned keys = 0;
+    for (const Input& i : inputs) {
+        if (i.time > time) break;
+        keys = i.keys;
+    }
+    return keys;
+}
+
+CameraPath CameraPath::Orbit(const glm::vec3& center, float radius, float height, float seconds, int steps) {
+    CameraPath path;
+    float pitch = glm::degrees(atan2f(-height, radius));
+    for (int s = 0; s <= steps; s++) {
+        float a = glm::two_pi<float>() * s / steps;
+        glm::vec3 p = center + glm::vec3(cosf(a) * radius, height, sinf(a) * radius);
+        // facing the centre is the opposite of the direction to this point
+        path.AddKey(seconds * s / steps, p, glm::degrees(a) + 180.0f, pitch);
+    }
+    return path;
+}
@@ -0,0 +1,39 @@
+// CameraPath.h
+#pragma once
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// A camera fly-through plus the robot keys held along it, for replaying a run
+// with a fixed timestep. The position follows a Catmull-Rom spline through the
+// keys; yaw and pitch are interpolated linearly and are not wrapped, so a
+// recorded path that turned past 180 degrees keeps turning the same way.
+// The text format has one entry per line, # starts a comment:
+//   key <seconds> <x> <y> <z> <yaw> <pitch>
+//   input <seconds> [left] [right] [forward] [back]
+class CameraPath {
+public:
+    struct Key {
+        float time;
+        glm::vec3 position;
+        float yaw, pitch;
+    };
+    struct Input {
+        float time;
+        unsigned keys;
+    };
+    bool Load(const std::string& path);
+    bool Save(const std::string& path) const;
+    void AddKey(float time, const glm::vec3& position, float yaw, float pitch);
+    // only kept when the keys differ from the previous input
+    void AddInput(float time, unsigned keys);
+    bool Empty() const { return points.empty(); }
+    float Duration() const { return points.empty() ? 0.0f : points.back().time; }
+    void Sample(float time, glm::vec3& position, float& yaw, float& pitch) const;
+    unsigned KeysAt(float time) const;
+    // one turn around center at the given distance and height, looking at it
+    static CameraPath Orbit(const glm::vec3& center, float radius, float height, float seconds, int steps = 16);
+private:
+    std::vector<Key> points;
+    std::vector<Input> inputs;
+};
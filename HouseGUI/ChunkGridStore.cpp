@@ -0,0 +1,74 @@
+// ChunkGridStore.cpp
+#include "ChunkGridStore.h"
+#include <algorithm>
+
+static_assert(PaletteChunk::Size == 16, "chunkAt finds chunks with a shift by 4");
+
+ChunkGridStore::ChunkGridStore(std::vector<WorldGen::Chunk>& chunks)
+    : chunkX(0), chunkZ(0), chunksX(0), chunksZ(0)
+{
+    lo = hi = glm::ivec3(0);
+    if (chunks.empty()) return;
+    int maxX = chunks[0].x, maxZ = chunks[0].z, height = 0;
+    chunkX = chunks[0].x;
+    chunkZ = chunks[0].z;
+    for (const WorldGen::Chunk& c : chunks) {
+        chunkX = std::min(chunkX, c.x);
+        chunkZ = std::min(chunkZ, c.z);
+        maxX = std::max(maxX, c.x);
+        maxZ = std::max(maxZ, c.z);
+        height = std::max(height, c.voxels.Height());
+    }
+    chunksX = maxX - chunkX + 1;
+    chunksZ = maxZ - chunkZ + 1;
+    grid.assign((size_t)chunksX * chunksZ, PaletteChunk());
+    for (WorldGen::Chunk& c : chunks) std::swap(grid[(size_t)(c.z - chunkZ) * chunksX + (c.x - chunkX)], c.voxels);
+    lo = glm::ivec3(chunkX * Size, 0, chunkZ * Size);
+    hi = glm::ivec3((maxX + 1) * Size, height, (maxZ + 1) * Size);
+}
+
+BlockStore::Value ChunkGridStore::Get(int x, int y, int z) const {
+    if (x < lo.x || z < lo.z || y < 0 || x >= hi.x || z >= hi.z) return PaletteChunk::Air;
+    const PaletteChunk& c = chunkAt(x, z);
+    return y < c.Height() ? c.Get(x & (Size - 1), y, z & (Size - 1)) : PaletteChunk::Air;
+}
+
+void ChunkGridStore::ForEachSolid(const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& visit) const {
+    glm::ivec3 a = glm::max(mn, lo), b = glm::min(mx, hi);
+    if (glm::any(glm::greaterThanEqual(a, b))) return;
+    for (int cz = a.z >> 4; cz <= (b.z - 1) >> 4; cz++)
+        for (int cx = a.x >> 4; cx <= (b.x - 1) >> 4; cx++) {
+            const PaletteChunk& c = grid[(size_t)(cz - chunkZ) * chunksX + (cx - chunkX)];
+            const int x0 = cx * Size, z0 = cz * Size;
+            c.ForEachSolid([&](int x, int y, int z, Value v) {
+                x += x0;
+                z += z0;
+                if (x >= a.x && x < b.x && y >= a.y && y < b.y && z >= a.z && z < b.z) visit(x, y, z, v);
+            });
+        }
+}
+
+size_t ChunkGridStore::MemoryBytes() const {
+    size_t bytes = sizeof(*this) + (grid.capacity() - grid.size()) * sizeof(PaletteChunk);
+    for (const PaletteChunk& c : grid) bytes += c.MemoryBytes();
+    return bytes;
+}
+
+BlockStore::Value ChunkGridStore::cell(const glm::ivec3& p, glm::ivec3& mn, glm::ivec3& mx) const {
+    const PaletteChunk& c = chunkAt(p.x, p.z);
+    glm::ivec3 corner((p.x >> 4) * Size, 0, (p.z >> 4) * Size);
+    // the air above the chunk, and a chunk of one value, are a single cell
+    if (p.y >= c.Height()) {
+        mn = glm::ivec3(corner.x, c.Height(), corner.z);
+        mx = glm::ivec3(corner.x + Size, hi.y, corner.z + Size);
+        return PaletteChunk::Air;
+    }
+    if (c.Uniform()) {
+        mn = corner;
+        mx = glm::ivec3(corner.x + Size, c.Height(), corner.z + Size);
+        return c.Get(0, 0, 0);
+    }
+    mn = p;
+    mx = p + 1;
+    return c.Get(p.x & (Size - 1), p.y, p.z & (Size - 1));
+}
@@ -0,0 +1,32 @@
+// ChunkGridStore.h
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "BlockStore.h"
+#include "WorldGen.h"
+
+// The world as a grid of palette chunks, one per WorldGen chunk, each as
+// tall as its tallest column. Lookups find the chunk with a shift; rays step
+// block by block, except over the air above a chunk and through uniform
+// chunks, which are one cell each.
+class ChunkGridStore : public BlockStore {
+public:
+    // takes over the palette storage of chunks, a rectangle of chunks like
+    // WorldGen::GenerateChunks makes, and leaves their voxels empty; missing
+    // chunks are air
+    explicit ChunkGridStore(std::vector<WorldGen::Chunk>& chunks);
+    const char* Name() const override { return "chunks"; }
+    Value Get(int x, int y, int z) const override;
+    void ForEachSolid(const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& visit) const override;
+    size_t MemoryBytes() const override;
+protected:
+    Value cell(const glm::ivec3& p, glm::ivec3& mn, glm::ivec3& mx) const override;
+private:
+    static constexpr int Size = PaletteChunk::Size;
+    int chunkX, chunkZ, chunksX, chunksZ;
+    std::vector<PaletteChunk> grid;
+    // the chunk holding column x, z, which has to be inside the box
+    const PaletteChunk& chunkAt(int x, int z) const {
+        return grid[(size_t)((z >> 4) - chunkZ) * chunksX + ((x >> 4) - chunkX)];
+    }
+};
@@ -0,0 +1,302 @@
+// ChunkStreamer.cpp
+#include "ChunkStreamer.h"
+#include "BlockBase.h"
+#include "CpuProfiler.h"
+#include "Frustum.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+ChunkStreamer::Settings ChunkStreamer::DefaultSettings() {
+    Settings s;
+    s.loadRadius = 8.0f;
+    s.unloadRadius = 10.0f;
+    s.uploadBytesPerFrame = 512 * 1024;
+    s.maxInFlight = 0;
+    s.inlineMs = 2.0;
+    return s;
+}
+
+ChunkStreamer::ChunkStreamer(const WorldGen& gen, const Scene& scene, BlockBase* const* blockTypes, const Settings& settings, RegionStore* store)
+    : gen(gen), scene(scene), blockTypes(blockTypes), store(store), settings(settings), chunkWorld(WorldGen::ChunkSize * gen.Spacing()),
+    uploaded(0), uploadedBytes(0), unloaded(0), wasted(0), latencyCount(0)
+{
+    this->settings.unloadRadius = std::max(settings.unloadRadius, settings.loadRadius);
+    for (size_t p = 0; p < scene.PrefabCount(); p++) prefabColumns.push_back(scene.Columns((uint32_t)p, gen.Spacing()));
+}
+
+ChunkStreamer::~ChunkStreamer() {
+    if (JobSystem* jobs = JobSystem::Current()) jobs->Wait(inFlight);
+    for (auto& c : pool)
+        if (c->buffer) glDeleteBuffers(1, &c->buffer);
+}
+
+ChunkStreamer::Chunk* ChunkStreamer::acquire(int x, int z) {
+    Chunk* c;
+    if (freeChunks.empty()) {
+        pool.emplace_back(new Chunk());
+        c = pool.back().get();
+        c->data = std::make_shared<WorldGen::Chunk>();
+        c->buffer = 0;
+        c->capacity = 0;
+    }
+    else {
+        c = freeChunks.back();
+        freeChunks.pop_back();
+    }
+    c->data->x = x;
+    c->data->z = z;
+    c->state = Wanted;
+    c->wanted = std::chrono::steady_clock::now();
+    return c;
+}
+
+// the vectors keep their capacity and the buffer object its storage for the next chunk,
+// unless a save snapshot still reads the data
+void ChunkStreamer::release(Chunk* c) {
+    if (c->data.use_count() > 1) c->data = std::make_shared<WorldGen::Chunk>();
+    c->data->billboards.clear();
+    c->data->instances.clear();
+    c->models.clear();
+    c->billboards.clear();
+    freeChunks.push_back(c);
+}
+
+void ChunkStreamer::mesh(Chunk& c) const {
+    PROFILE_SCOPE("ChunkStreamer::mesh");
+    glm::vec3 origin = gen.ChunkOrigin(*c.data);
+    static thread_local std::vector<Scene::Block> blocks;
+    blocks.clear();
+    gen.VisibleBlocks(*c.data, blocks);
+    uint32_t counts[Scene::BlockTypes] = {};
+    for (const Scene::Block& b : blocks)
+        if (b.type < Scene::BlockTypes) counts[b.type]++;
+    uint32_t first = 0;
+    for (int t = 0; t < Scene::BlockTypes; t++) {
+        c.ranges[t] = { first, 0 };
+        first += counts[t];
+    }
+    c.models.resize(first);
+    float half = gen.Spacing() * 0.5f;
+    c.boundsMin = origin;
+    c.boundsMax = origin;
+    for (const Scene::Block& b : blocks) {
+        glm::vec3 p = origin + b.position;
+        c.boundsMin = glm::min(c.boundsMin, p - half);
+        c.boundsMax = glm::max(c.boundsMax, p + half);
+        if (b.type >= Scene::BlockTypes) continue;
+        Chunk::Range& r = c.ranges[b.type];
+        glm::mat4& m = c.models[r.first + r.count++];
+        m = glm::translate(glm::mat4(1.0f), p);
+        if (b.rotation) m = glm::rotate(m, glm::radians(b.rotation * 90.0f), glm::vec3(0, 1, 0));
+    }
+    for (const Scene::Block& b : c.data->billboards) {
+        Scene::Block w = b;
+        w.position = origin + b.position;
+        c.boundsMin = glm::min(c.boundsMin, w.position - half);
+        c.boundsMax = glm::max(c.boundsMax, w.position + half);
+        c.billboards.push_back(w);
+    }
+
+    const float s = gen.Spacing();
+    for (int j = 0; j < WorldGen::ChunkSize; j++)
+        for (int i = 0; i < WorldGen::ChunkSize; i++) {
+            int top = c.data->voxels.Top(i, j);
+            c.tops[j * WorldGen::ChunkSize + i] = top < 0 ? -INFINITY : top * s + half;
+        }
+    // the prefabs' standing columns raise the ground; roofs and crowns are left out, the ground cannot pass under them
+    for (const Scene::Instance& inst : c.data->instances) {
+        if (inst.prefab >= prefabColumns.size()) continue;
+        for (const Scene::Column& col : prefabColumns[inst.prefab]) {
+            glm::vec3 p = inst.position + glm::vec3(col.x, col.top, col.z) - origin;
+            int i = (int)floorf(p.x / s + 0.5f), j = (int)floorf(p.z / s + 0.5f);
+            if (i < 0 || j < 0 || i >= WorldGen::ChunkSize || j >= WorldGen::ChunkSize) continue;
+            float& top = c.tops[j * WorldGen::ChunkSize + i];
+            top = std::max(top, p.y + half);
+        }
+    }
+}
+
+void ChunkStreamer::build(Chunk& c) const {
+    if (!store || !store->Load(*c.data)) gen.GenerateChunk(*c.data);
+    mesh(c);
+}
+
+void ChunkStreamer::upload(Chunk& c) {
+    size_t bytes = c.models.size() * sizeof(glm::mat4);
+    if (!c.buffer) glGenBuffers(1, &c.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, c.buffer);
+    // storage only grows, in 16 KB steps, so a recycled buffer usually fits the next chunk
+    if (bytes > c.capacity) {
+        c.capacity = (bytes + 16383) & ~(size_t)16383;
+        glBufferData(GL_ARRAY_BUFFER, c.capacity, nullptr, GL_STATIC_DRAW);
+    }
+    if (bytes) glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, c.models.data());
+    uploaded++;
+    uploadedBytes += bytes;
+}
+
+void ChunkStreamer::Update(const glm::vec3& cameraPos, const glm::vec3& cameraFront) {
+    PROFILE_SCOPE("ChunkStreamer::Update");
+    auto now = std::chrono::steady_clock::now();
+    glm::vec2 cam = glm::vec2(cameraPos.x, cameraPos.z) / chunkWorld;
+    glm::vec2 front(cameraFront.x, cameraFront.z);
+    float frontLength = glm::length(front);
+    front = frontLength > 1e-4f ? front / frontLength : glm::vec2(0.0f);
+    auto distance = [&](const Chunk* c) { return glm::length(glm::vec2(c->data->x + 0.5f, c->data->z + 0.5f) - cam); };
+
+    // out of range; a chunk a worker is on goes once it is done
+    for (auto it = chunks.begin(); it != chunks.end();) {
+        Chunk* c = it->second;
+        int state = c->state;
+        if (state != Working && distance(c) > settings.unloadRadius) {
+            if (state == Drawable) unloaded++;
+            else if (state == Meshed) wasted++;
+            release(c);
+            it = chunks.erase(it);
+        }
+        else ++it;
+    }
+
+    int r = (int)ceilf(settings.loadRadius);
+    int cx = (int)floorf(cam.x), cz = (int)floorf(cam.y);
+    for (int z = cz - r; z <= cz + r; z++)
+        for (int x = cx - r; x <= cx + r; x++) {
+            if (glm::length(glm::vec2(x + 0.5f, z + 0.5f) - cam) > settings.loadRadius) continue;
+            Chunk*& c = chunks[key(x, z)];
+            if (!c) c = acquire(x, z);
+        }
+
+    // a chunk straight ahead counts as half as far away, one behind as one and a half
+    resident.clear();
+    scratch.clear();
+    for (auto& kv : chunks) {
+        Chunk* c = kv.second;
+        float d = distance(c);
+        glm::vec2 dir = glm::vec2(c->data->x + 0.5f, c->data->z + 0.5f) - cam;
+        float facing = d > 0.5f ? glm::dot(dir / d, front) : 1.0f;
+        c->priority = d * (1.0f - 0.5f * facing);
+        int state = c->state;
+        if (state == Drawable) resident.push_back(c);
+        else if (state == Wanted || state == Meshed) scratch.push_back(c);
+    }
+    std::sort(scratch.begin(), scratch.end(), [](const Chunk* a, const Chunk* b) {
+        if (a->priority != b->priority) return a->priority < b->priority;
+        return a->data->z != b->data->z ? a->data->z < b->data->z : a->data->x < b->data->x;
+    });
+
+    // at least one upload a frame, so a chunk larger than the budget still gets in
+    size_t budget = settings.uploadBytesPerFrame;
+    bool first = true;
+    for (Chunk* c : scratch) {
+        if (c->state != Meshed) continue;
+        size_t bytes = c->models.size() * sizeof(glm::mat4);
+        if (!first && bytes > budget) break;
+        upload(*c);
+        budget -= std::min(budget, bytes);
+        first = false;
+        c->state = Drawable;
+        resident.push_back(c);
+        latencies[latencyCount++ % LatencySamples] = std::chrono::duration<float, std::milli>(now - c->wanted).count();
+    }
+
+    JobSystem* jobs = JobSystem::Current();
+    if (!jobs) {
+        for (Chunk* c : scratch) {
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - now).count() > settings.inlineMs) break;
+            if (c->state != Wanted) continue;
+            build(*c);
+            c->state = Meshed;
+        }
+        return;
+    }
+    int limit = settings.maxInFlight > 0 ? settings.maxInFlight : 2 * std::max(jobs->ThreadCount() - 1, 1);
+    for (Chunk* c : scratch) {
+        if (inFlight.value >= limit) break;
+        if (c->state != Wanted) continue;
+        c->state = Working;
+        jobs->Run([this, c]() {
+            build(*c);
+            c->state = Meshed;
+        }, &inFlight);
+    }
+    // with no worker threads the queued chunks only move when this thread helps
+    if (jobs->ThreadCount() == 1) {
+        while (inFlight.value > 0 && std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - now).count() < settings.inlineMs)
+            if (!jobs->Help()) break;
+    }
+}
+
+void ChunkStreamer::Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
+    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap) {
+    PROFILE_SCOPE("ChunkStreamer::Draw");
+    Frustum frustum(proj * view);
+    scratch.clear();
+    for (Chunk* c : resident)
+        if (!c->models.empty() && frustum.BoxVisible(c->boundsMin, c->boundsMax)) scratch.push_back(c);
+    // type by type, so consecutive draws share the material
+    for (int t = 0; t < Scene::BlockTypes; t++) {
+        BlockBase* block = blockTypes[t];
+        if (!block) continue;
+        for (Chunk* c : scratch) {
+            const Chunk::Range& range = c->ranges[t];
+            if (range.count == 0) continue;
+            block->DrawInstanced(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap,
+                c->buffer, (GLintptr)range.first * sizeof(glm::mat4), (GLsizei)range.count);
+        }
+    }
+}
+
+bool ChunkStreamer::HeightAt(float x, float z, float& height) const {
+    // columns are centred on multiples of the spacing
+    const float s = gen.Spacing();
+    int i = (int)floorf(x / s + 0.5f), j = (int)floorf(z / s + 0.5f);
+    auto it = chunks.find(key(i >> 4, j >> 4));
+    if (it == chunks.end() || it->second->state != Drawable) return false;
+    static_assert(WorldGen::ChunkSize == 16, "columns are split into chunks with a shift by 4");
+    height = it->second->tops[(j & 15) * WorldGen::ChunkSize + (i & 15)];
+    return height != -INFINITY;
+}
+
+RegionStore::Snapshot ChunkStreamer::Snapshot() const {
+    RegionStore::Snapshot snapshot;
+    snapshot.reserve(resident.size());
+    for (Chunk* c : resident) snapshot.push_back(c->data);
+    return snapshot;
+}
+
+ChunkStreamer::Stats ChunkStreamer::GetStats() const {
+    Stats s = {};
+    s.resident = resident.size();
+    for (const Chunk* c : resident) {
+        s.voxelBytes += c->data->voxels.MemoryBytes();
+        s.listBytes += (c->models.size() + c->billboards.size()) * sizeof(Scene::Block);
+    }
+    for (auto& kv : chunks) {
+        int state = kv.second->state;
+        if (state == Wanted) s.wanted++;
+        else if (state == Working) s.inFlight++;
+        else if (state == Meshed) s.meshed++;
+    }
+    s.pooled = freeChunks.size();
+    s.uploaded = uploaded;
+    s.uploadedBytes = uploadedBytes;
+    s.unloaded = unloaded;
+    s.wasted = wasted;
+    size_t n = std::min(latencyCount, (size_t)LatencySamples);
+    if (n) {
+        std::vector<float> sorted(latencies, latencies + n);
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (float l : sorted) sum += l;
+        s.meanLatencyMs = sum / n;
+        s.p95LatencyMs = sorted[std::min(n - 1, n * 95 / 100)];
+        s.maxLatencyMs = sorted.back();
+    }
+    return s;
+}
+
+void ChunkStreamer::ResetStats() {
+    uploaded = uploadedBytes = unloaded = wasted = 0;
+    latencyCount = 0;
+}
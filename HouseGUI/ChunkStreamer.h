@@ -0,0 +1,127 @@
+// ChunkStreamer.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "JobSystem.h"
+#include "RegionStore.h"
+#include "Scene.h"
+#include "WorldGen.h"
+
+class BlockBase;
+
+// Streams WorldGen chunks in a ring around the camera instead of generating
+// a fixed grid. Chunks inside loadRadius are wanted; the wanted ones are
+// scheduled nearest first, with chunks in front of the camera counted as
+// nearer than those behind it, and only a few are in flight at a time, so
+// a fast flight re-prioritises instead of queueing up chunks it has already
+// left. A worker generates the chunk and meshes it: its opaque blocks become
+// one buffer of model matrices grouped by block type, drawn with one
+// instanced draw per type. Finished meshes are uploaded by the render thread
+// within a per-frame byte budget. Chunks beyond unloadRadius are dropped; a
+// gap between the two radii keeps chunks at the edge from flickering in and
+// out. Dropped chunks go back to a pool with their vectors and buffer
+// object, so steady streaming allocates nothing.
+//
+// With a RegionStore, a chunk saved before is loaded instead of generated.
+// Chunk data is shared with the snapshots a save works from: once a chunk
+// is done it is never written again, and a released chunk that a snapshot
+// still holds gets fresh data instead of being reused.
+//
+// The ground under the camera and the robot comes from the drawable chunks'
+// column tops, which take in the standing columns (Scene::Columns) of their
+// houses and trees.
+//
+// Latency is measured from the frame a chunk is first wanted to the frame it
+// is drawable.
+class ChunkStreamer {
+public:
+    struct Settings {
+        // in chunks
+        float loadRadius, unloadRadius;
+        size_t uploadBytesPerFrame;
+        // jobs in flight; 0 picks two per worker thread
+        int maxInFlight;
+        // without worker threads the render thread generates for this long per frame
+        double inlineMs;
+    };
+    struct Chunk {
+        // data->x and data->z are the chunk's coordinates
+        std::shared_ptr<WorldGen::Chunk> data;
+        // the mesh: opaque blocks by type, first and count into models
+        std::vector<glm::mat4> models;
+        struct Range { uint32_t first, count; } ranges[Scene::BlockTypes];
+        // flowers face the camera, so they are drawn like scene blocks; in world space
+        std::vector<Scene::Block> billboards;
+        glm::vec3 boundsMin, boundsMax;
+        // the top of each column, row by row, houses and trunks included; -INFINITY
+        // where the column is left to the scene
+        float tops[WorldGen::ChunkSize * WorldGen::ChunkSize];
+        GLuint buffer;
+        size_t capacity;
+        // Wanted -> Working -> Meshed -> Drawable
+        std::atomic<int> state;
+        std::chrono::steady_clock::time_point wanted;
+        float priority;
+    };
+    struct Stats {
+        size_t resident, wanted, inFlight, meshed, pooled;
+        // unloaded were drawable, wasted were meshed but never drawn
+        uint64_t uploaded, uploadedBytes, unloaded, wasted;
+        // the resident chunks' block storage, and what their drawn blocks took as lists of Scene::Block
+        size_t voxelBytes, listBytes;
+        double meanLatencyMs, p95LatencyMs, maxLatencyMs;
+    };
+    static Settings DefaultSettings();
+    // blockTypes is indexed by Scene::BlockType; the instances' prefabs are looked up in scene
+    ChunkStreamer(const WorldGen& gen, const Scene& scene, BlockBase* const* blockTypes, const Settings& settings, RegionStore* store = nullptr);
+    ~ChunkStreamer();
+    ChunkStreamer(const ChunkStreamer&) = delete;
+    ChunkStreamer& operator=(const ChunkStreamer&) = delete;
+    // once per frame on the render thread
+    void Update(const glm::vec3& cameraPos, const glm::vec3& cameraFront);
+    // the meshes of the resident chunks the frustum of proj * view sees
+    void Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
+        const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap);
+    // for the billboards and prefab instances of the resident chunks
+    const std::vector<Chunk*>& Resident() const { return resident; }
+    // false unless a drawable chunk has a column at x, z
+    bool HeightAt(float x, float z, float& height) const;
+    // the data of the resident chunks, for RegionStore::SaveAsync
+    RegionStore::Snapshot Snapshot() const;
+    // latencies are over the chunks that became resident since the last reset
+    Stats GetStats() const;
+    void ResetStats();
+private:
+    enum State { Wanted, Working, Meshed, Drawable };
+    static constexpr int LatencySamples = 1024;
+    const WorldGen& gen;
+    const Scene& scene;
+    // per prefab, taken when the streamer is made
+    std::vector<std::vector<Scene::Column>> prefabColumns;
+    BlockBase* const* blockTypes;
+    RegionStore* store;
+    Settings settings;
+    float chunkWorld;
+    std::unordered_map<uint64_t, Chunk*> chunks;
+    std::vector<std::unique_ptr<Chunk>> pool;
+    std::vector<Chunk*> freeChunks;
+    std::vector<Chunk*> resident;
+    std::vector<Chunk*> scratch;
+    JobSystem::Counter inFlight;
+    uint64_t uploaded, uploadedBytes, unloaded, wasted;
+    float latencies[LatencySamples];
+    size_t latencyCount;
+    Chunk* acquire(int x, int z);
+    void release(Chunk* c);
+    void mesh(Chunk& c) const;
+    void build(Chunk& c) const;
+    void upload(Chunk& c);
+    static uint64_t key(int x, int z) { return (uint64_t)(uint32_t)x << 32 | (uint32_t)z; }
+};
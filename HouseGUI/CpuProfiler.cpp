@@ -0,0 +1,147 @@
+// CpuProfiler.cpp
+#include "CpuProfiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> CpuProfiler::enabled(false);
+
+// about ten seconds of a busy thread at 60 fps
+static constexpr uint64_t RingSize = 1 << 16;
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start, end;
+};
+
+// a TraceEvent that WriteTrace may read while the owner overwrites it
+struct TraceSlot {
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> start, end;
+};
+
+// Each ring is a seqlock over its slots: the owner claims an event number
+// before it writes the slot, and publishes it after. A reader copies slots
+// below the published head, then drops those whose slot a later claim may
+// have reached while it copied.
+struct ThreadRing {
+    int id;
+    std::string name;
+    // events written so far; the newest RingSize of them are still in the ring
+    std::atomic<uint64_t> head;
+    // one past the event being written
+    std::atomic<uint64_t> claimed;
+    // allocated by the first event, so threads that never record cost a name
+    std::atomic<TraceSlot*> slots;
+    std::unique_ptr<TraceSlot[]> storage;
+};
+
+// rings outlive their threads so a trace can still show them
+static std::mutex ringsLock;
+static std::vector<std::unique_ptr<ThreadRing>> rings;
+static thread_local ThreadRing* localRing = nullptr;
+static uint64_t traceOrigin = 0;
+
+static ThreadRing* threadRing() {
+    if (localRing) return localRing;
+    std::unique_ptr<ThreadRing> ring(new ThreadRing());
+    ring->head = 0;
+    ring->claimed = 0;
+    ring->slots = nullptr;
+    std::lock_guard<std::mutex> lk(ringsLock);
+    ring->id = (int)rings.size() + 1;
+    ring->name = "thread " + std::to_string(ring->id);
+    localRing = ring.get();
+    rings.push_back(std::move(ring));
+    return localRing;
+}
+
+void CpuProfiler::Start() {
+    if (!traceOrigin) traceOrigin = Now();
+    enabled = true;
+}
+
+void CpuProfiler::Stop() {
+    enabled = false;
+}
+
+void CpuProfiler::SetThreadName(const std::string& name) {
+    ThreadRing* ring = threadRing();
+    std::lock_guard<std::mutex> lk(ringsLock);
+    ring->name = name;
+}
+
+void CpuProfiler::Record(const char* name, uint64_t start, uint64_t end) {
+    ThreadRing* ring = threadRing();
+    TraceSlot* slots = ring->slots.load(std::memory_order_relaxed);
+    if (!slots) {
+        ring->storage.reset(new TraceSlot[RingSize]());
+        slots = ring->storage.get();
+        ring->slots.store(slots, std::memory_order_release);
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceSlot& slot = slots[head % RingSize];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+static std::string jsonString(const char* s) {
+    std::string out = "\"";
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') out += '\\';
+        out += *s;
+    }
+    return out + "\"";
+}
+
+bool CpuProfiler::WriteTrace(const std::string& path, double seconds) {
+    uint64_t cutoff = 0;
+    uint64_t now = Now();
+    if (seconds > 0.0 && now > (uint64_t)(seconds * 1e9)) cutoff = now - (uint64_t)(seconds * 1e9);
+    std::ofstream out(path);
+    if (!out) return false;
+    // microseconds with nanosecond digits, never in exponent notation
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() -> std::ostream& {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        return out;
+    };
+    std::lock_guard<std::mutex> lk(ringsLock);
+    std::vector<TraceEvent> events;
+    for (const auto& ring : rings) {
+        separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->id
+            << ",\"args\":{\"name\":" << jsonString(ring->name.c_str()) << "}}";
+        const TraceSlot* slots = ring->slots.load(std::memory_order_acquire);
+        if (!slots) continue;
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > RingSize ? head - RingSize : 0;
+        events.clear();
+        for (uint64_t i = begin; i < head; i++) {
+            const TraceSlot& slot = slots[i % RingSize];
+            events.push_back({ slot.name.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed) });
+        }
+        // the owner kept recording while we copied; event i is intact unless event i + RingSize was claimed
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = ring->claimed.load(std::memory_order_relaxed);
+        uint64_t valid = claimed > RingSize ? claimed - RingSize : 0;
+        size_t skip = valid > begin ? (size_t)std::min(valid - begin, (uint64_t)events.size()) : 0;
+        for (size_t i = skip; i < events.size(); i++) {
+            const TraceEvent& e = events[i];
+            if (e.end < cutoff || e.start < traceOrigin) continue;
+            separator() << "{\"name\":" << jsonString(e.name) << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->id
+                << ",\"ts\":" << (e.start - traceOrigin) / 1000.0 << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
@@ -0,0 +1,55 @@
+// CpuProfiler.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Build with HOUSEGUI_PROFILING=0 and every PROFILE_SCOPE compiles to nothing.
+#ifndef HOUSEGUI_PROFILING
+#define HOUSEGUI_PROFILING 1
+#endif
+
+// Scoped CPU zones for timeline traces. Every thread records into its own
+// ring of recent events, allocated with its first event; the thread is the
+// ring's only writer, so recording takes no lock. WriteTrace() copies the
+// rings, dropping any event the owner overwrote meanwhile (each ring is a
+// seqlock), keeps the events that ended in the last N seconds and writes
+// them as Chrome trace event JSON, which chrome://tracing and Perfetto load.
+// Zone names are stored as pointers, so they must be string literals. Nothing
+// is recorded before Start(); until then a zone costs one relaxed atomic load.
+class CpuProfiler {
+public:
+    static void Start();
+    static void Stop();
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+    // shown as the thread's row name in the trace
+    static void SetThreadName(const std::string& name);
+    // seconds <= 0 writes everything the rings still hold
+    static bool WriteTrace(const std::string& path, double seconds = 0.0);
+    static uint64_t Now() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static void Record(const char* name, uint64_t start, uint64_t end);
+
+    class Scope {
+    public:
+        Scope(const char* name) : name(name), start(Enabled() ? Now() : 0) {}
+        ~Scope() { if (start) Record(name, start, Now()); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* name;
+        uint64_t start;
+    };
+private:
+    static std::atomic<bool> enabled;
+};
+
+#if HOUSEGUI_PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) CpuProfiler::Scope PROFILE_CONCAT(profileScope, __COUNTER__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
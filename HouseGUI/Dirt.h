@@ -0,0 +1,8 @@
+#pragma once
+#include "BlockBase.h"
+
+class Dirt : public BlockBase {
+public:
+    Dirt(float s, float o = 0.03f) : BlockBase(s, o) { hasAlpha = false; }
+    void Init() { BlockBase::Init(std::string("textures/dirt.png")); }
+};
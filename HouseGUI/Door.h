@@ -4,7 +4,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include "stb/stb_image.h"
+#include "AssetLoader.h"
+#include "TextureResidency.h"
+#include "GLState.h"
 
 class Door {
 public:
@@ -18,23 +20,25 @@ public:
     void Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model,
         const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
         const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap) {
-        glUseProgram(shaderProgram);
+        GLState::UseProgram(shaderProgram);
+        GLState::Disable(GL_BLEND);
         GLint mLoc = glGetUniformLocation(shaderProgram, "model");
         GLint vLoc = glGetUniformLocation(shaderProgram, "view");
         GLint pLoc = glGetUniformLocation(shaderProgram, "projection");
         glUniformMatrix4fv(mLoc, 1, GL_FALSE, glm::value_ptr(model));
         glUniformMatrix4fv(vLoc, 1, GL_FALSE, glm::value_ptr(view));
         glUniformMatrix4fv(pLoc, 1, GL_FALSE, glm::value_ptr(proj));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, bottomTex);
-        glBindVertexArray(VAO1);
+        TextureResidency::Use(bottomTex);
+        TextureResidency::Use(topTex);
+        GLState::ActiveTexture(GL_TEXTURE0);
+        GLState::BindTexture(GL_TEXTURE_2D, bottomTex);
+        GLState::BindVertexArray(VAO1);
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, topTex);
-        glBindVertexArray(VAO2);
+        GLState::CountDraw();
+        GLState::BindTexture(GL_TEXTURE_2D, topTex);
+        GLState::BindVertexArray(VAO2);
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        GLState::CountDraw();
     }
 private:
     float size;
@@ -44,18 +48,12 @@ private:
     unsigned int VAO2, VBO2, EBO2;
     void LoadTexture(const char* path, unsigned int& texID) {
         glGenTextures(1, &texID);
-        glBindTexture(GL_TEXTURE_2D, texID);
+        GLState::BindTexture(GL_TEXTURE_2D, texID);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        int w, h, n;
-        unsigned char* data = stbi_load(path, &w, &h, &n, 4);
-        if (data) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-        }
-        stbi_image_free(data);
+        AssetLoader::LoadTexture(texID, path, true);
     }
     void SetupShaders() {
         const char* vsSrc =
@@ -136,7 +134,7 @@ private:
         glGenVertexArrays(1, &VAO1);
         glGenBuffers(1, &VBO1);
         glGenBuffers(1, &EBO1);
-        glBindVertexArray(VAO1);
+        GLState::BindVertexArray(VAO1);
         glBindBuffer(GL_ARRAY_BUFFER, VBO1);
         glBufferData(GL_ARRAY_BUFFER, sizeof(v1), v1, GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO1);
@@ -145,7 +143,7 @@ private:
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
         glEnableVertexAttribArray(1);
-        glBindVertexArray(0);
+        GLState::BindVertexArray(0);
         float v2[] = {
             -halfW,     midY, -thick, 0,0,
              halfW,     midY, -thick, 1,0,
@@ -175,7 +173,7 @@ private:
         glGenVertexArrays(1, &VAO2);
         glGenBuffers(1, &VBO2);
         glGenBuffers(1, &EBO2);
-        glBindVertexArray(VAO2);
+        GLState::BindVertexArray(VAO2);
         glBindBuffer(GL_ARRAY_BUFFER, VBO2);
         glBufferData(GL_ARRAY_BUFFER, sizeof(v2), v2, GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO2);
@@ -184,6 +182,6 @@ private:
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
         glEnableVertexAttribArray(1);
-        glBindVertexArray(0);
+        GLState::BindVertexArray(0);
     }
 };
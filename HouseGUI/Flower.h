@@ -1,5 +1,6 @@
 #pragma once
 #include "BlockBase.h"
+#include "GLState.h"
 
 class Flower : public BlockBase {
 public:
@@ -14,7 +15,7 @@ protected:
             "layout(location=0) in vec3 p;"
             "layout(location=1) in vec2 uv;"
             "layout(location=2) in vec3 n;"
-            "uniform mat4 model;"
+            "layout(location=3) in mat4 model;"
             "uniform mat4 view;"
             "uniform mat4 projection;"
             "out vec2 TexCoord;"
@@ -56,7 +57,7 @@ protected:
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
-        glBindVertexArray(VAO);
+        GLState::BindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
@@ -67,8 +68,9 @@ protected:
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
         glEnableVertexAttribArray(2);
-        glBindVertexArray(0);
+        GLState::BindVertexArray(0);
     }
+    GLsizei indexCount() const override { return 12; }
 private:
     std::string texName;
 };
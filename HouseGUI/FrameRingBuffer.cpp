@@ -0,0 +1,85 @@
+// FrameRingBuffer.cpp
+#include "FrameRingBuffer.h"
+#include <algorithm>
+#include <chrono>
+
+FrameRingBuffer* FrameRingBuffer::current = nullptr;
+
+FrameRingBuffer::FrameRingBuffer(size_t regionBytes, int regions)
+    : regionBytes(regionBytes), regions(std::min(std::max(regions, 1), MaxRegions)), region(0), head(0),
+    buffer(0), mapped(nullptr), fenceWaits(0), overflows(0), fenceWaitMs(0.0), peakBytes(0)
+{
+    for (GLsync& f : fences) f = nullptr;
+}
+
+FrameRingBuffer::~FrameRingBuffer() {
+    for (GLsync f : fences)
+        if (f) glDeleteSync(f);
+    if (buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+    }
+    if (current == this) current = nullptr;
+}
+
+bool FrameRingBuffer::Init() {
+    if (!GLAD_GL_VERSION_4_4) return false;
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr total = (GLsizeiptr)(regionBytes * regions);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, total, nullptr, flags);
+    mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, total, flags);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (!mapped) {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        return false;
+    }
+    current = this;
+    return true;
+}
+
+FrameRingBuffer::Allocation FrameRingBuffer::Alloc(size_t bytes, size_t alignment) {
+    size_t start = (head + alignment - 1) / alignment * alignment;
+    if (!mapped || start + bytes > regionBytes) {
+        overflows++;
+        return { nullptr, 0 };
+    }
+    head = start + bytes;
+    peakBytes = std::max(peakBytes, head);
+    size_t offset = region * regionBytes + start;
+    return { mapped + offset, (GLintptr)offset };
+}
+
+void FrameRingBuffer::EndFrame() {
+    if (!mapped) return;
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % regions;
+    head = 0;
+    GLsync f = fences[region];
+    if (!f) return;
+    // a region is only rewritten once the GPU has passed the frame that used it
+    GLenum r = glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (r == GL_TIMEOUT_EXPIRED) {
+        fenceWaits++;
+        auto start = std::chrono::steady_clock::now();
+        do r = glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        while (r == GL_TIMEOUT_EXPIRED);
+        fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(f);
+    fences[region] = nullptr;
+}
+
+FrameRingBuffer::Stats FrameRingBuffer::GetStats() const {
+    return { fenceWaits, fenceWaitMs, peakBytes, regionBytes, overflows };
+}
+
+void FrameRingBuffer::ResetStats() {
+    fenceWaits = overflows = 0;
+    fenceWaitMs = 0.0;
+    peakBytes = 0;
+}
@@ -0,0 +1,49 @@
+// FrameRingBuffer.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+
+// One buffer object, allocated once with glBufferStorage and mapped
+// persistently and coherently, split into a region per frame in flight.
+// Per-frame data (instance transforms, part colours, ...) is bump-allocated
+// from the current region and written straight into the mapping; EndFrame()
+// fences the region and moves on to the next one, waiting only if the GPU
+// still reads it. Needs GL 4.4; Init() returns false otherwise and callers
+// keep their non-buffered path.
+class FrameRingBuffer {
+public:
+    struct Allocation {
+        void* ptr;
+        GLintptr offset;
+    };
+    struct Stats {
+        uint64_t fenceWaits;
+        double fenceWaitMs;
+        size_t peakBytes, regionBytes;
+        uint64_t overflows;
+    };
+    FrameRingBuffer(size_t regionBytes, int regions = 3);
+    ~FrameRingBuffer();
+    bool Init();
+    // ptr is nullptr when the region is full; the caller falls back for this draw
+    Allocation Alloc(size_t bytes, size_t alignment = 16);
+    void EndFrame();
+    GLuint Buffer() const { return buffer; }
+    Stats GetStats() const;
+    void ResetStats();
+    static FrameRingBuffer* Current() { return current; }
+private:
+    static constexpr int MaxRegions = 4;
+    size_t regionBytes;
+    int regions;
+    int region;
+    size_t head;
+    GLuint buffer;
+    unsigned char* mapped;
+    GLsync fences[MaxRegions];
+    uint64_t fenceWaits, overflows;
+    double fenceWaitMs;
+    size_t peakBytes;
+    static FrameRingBuffer* current;
+};
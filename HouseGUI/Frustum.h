@@ -0,0 +1,33 @@
+#pragma once
+#include <glm/glm.hpp>
+
+class Frustum {
+public:
+    glm::vec4 planes[6];
+
+    Frustum() {}
+    Frustum(const glm::mat4& viewProj) {
+        glm::mat4 m = glm::transpose(viewProj);
+        planes[0] = m[3] + m[0];
+        planes[1] = m[3] - m[0];
+        planes[2] = m[3] + m[1];
+        planes[3] = m[3] - m[1];
+        planes[4] = m[3] + m[2];
+        planes[5] = m[3] - m[2];
+        for (auto& p : planes) p /= glm::length(glm::vec3(p));
+    }
+
+    bool SphereVisible(const glm::vec3& c, float r) const {
+        for (const auto& p : planes)
+            if (glm::dot(glm::vec3(p), c) + p.w < -r) return false;
+        return true;
+    }
+
+    bool BoxVisible(const glm::vec3& mn, const glm::vec3& mx) const {
+        for (const auto& p : planes) {
+            glm::vec3 v(p.x > 0 ? mx.x : mn.x, p.y > 0 ? mx.y : mn.y, p.z > 0 ? mx.z : mn.z);
+            if (glm::dot(glm::vec3(p), v) + p.w < 0) return false;
+        }
+        return true;
+    }
+};
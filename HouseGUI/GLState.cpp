@@ -0,0 +1,124 @@
+// GLState.cpp
+#include "GLState.h"
+#include <cstring>
+
+// the defaults of a freshly created context
+GLuint GLState::program = 0;
+GLuint GLState::vao = 0;
+GLuint GLState::unit = GL_TEXTURE0;
+GLuint GLState::textures[GLState::MaxUnits][2] = {};
+signed char GLState::caps[GLState::Caps] = { 0, 0, 0 };
+GLenum GLState::blendSrc = GL_ONE;
+GLenum GLState::blendDst = GL_ZERO;
+GLState::Stats GLState::frame = { 0, 0, 0 };
+GLState::Stats GLState::last = { 0, 0, 0 };
+
+static int capIndex(GLenum cap) {
+    switch (cap) {
+    case GL_BLEND: return 0;
+    case GL_DEPTH_TEST: return 1;
+    case GL_CULL_FACE: return 2;
+    default: return -1;
+    }
+}
+
+static int targetIndex(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_2D: return 0;
+    case GL_TEXTURE_2D_ARRAY: return 1;
+    default: return -1;
+    }
+}
+
+void GLState::UseProgram(GLuint p) {
+    if (program == p) { frame.elided++; return; }
+    program = p;
+    frame.issued++;
+    glUseProgram(p);
+}
+
+void GLState::BindVertexArray(GLuint v) {
+    if (vao == v) { frame.elided++; return; }
+    vao = v;
+    frame.issued++;
+    glBindVertexArray(v);
+}
+
+void GLState::ActiveTexture(GLenum u) {
+    if (unit == u) { frame.elided++; return; }
+    unit = u;
+    frame.issued++;
+    glActiveTexture(u);
+}
+
+void GLState::BindTexture(GLenum target, GLuint texture) {
+    int t = targetIndex(target);
+    int u = unit == Unknown ? -1 : (int)(unit - GL_TEXTURE0);
+    if (t < 0 || u < 0 || u >= MaxUnits) {
+        frame.issued++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (textures[u][t] == texture) { frame.elided++; return; }
+    textures[u][t] = texture;
+    frame.issued++;
+    glBindTexture(target, texture);
+}
+
+void GLState::Set(GLenum cap, bool on) {
+    int c = capIndex(cap);
+    if (c >= 0 && caps[c] == (on ? 1 : 0)) { frame.elided++; return; }
+    if (c >= 0) caps[c] = on ? 1 : 0;
+    frame.issued++;
+    if (on) glEnable(cap);
+    else glDisable(cap);
+}
+
+void GLState::BlendFunc(GLenum src, GLenum dst) {
+    if (blendSrc == src && blendDst == dst) { frame.elided++; return; }
+    blendSrc = src;
+    blendDst = dst;
+    frame.issued++;
+    glBlendFunc(src, dst);
+}
+
+void GLState::DeleteProgram(GLuint p) {
+    // a deleted program stays current until another one is used; the name can be reused after that
+    if (program == p) program = Unknown;
+    glDeleteProgram(p);
+}
+
+void GLState::DeleteVertexArrays(GLsizei n, const GLuint* vaos) {
+    for (GLsizei i = 0; i < n; i++)
+        if (vao == vaos[i]) vao = 0;
+    glDeleteVertexArrays(n, vaos);
+}
+
+void GLState::DeleteTextures(GLsizei n, const GLuint* ids) {
+    for (GLsizei i = 0; i < n; i++)
+        for (auto& u : textures)
+            for (GLuint& t : u)
+                if (t == ids[i]) t = 0;
+    glDeleteTextures(n, ids);
+}
+
+void GLState::Invalidate() {
+    program = vao = unit = Unknown;
+    for (auto& u : textures)
+        for (GLuint& t : u) t = Unknown;
+    for (signed char& c : caps) c = -1;
+    blendSrc = blendDst = Unknown;
+}
+
+void GLState::EndFrame() {
+    last = frame;
+    frame = { 0, 0, 0 };
+}
+
+bool GLState::HasExtension(const char* name) {
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (GLint i = 0; i < n; i++)
+        if (!strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name)) return true;
+    return false;
+}
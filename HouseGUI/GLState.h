@@ -0,0 +1,51 @@
+// GLState.h
+#pragma once
+#include <cstdint>
+#include <glad/glad.h>
+
+// Shadow copy of the GL state the renderers touch on every draw: current
+// program, vertex array, active texture unit, 2D and 2D-array texture per
+// unit, blending, depth test, face culling and the blend function. Each call
+// only reaches GL when the value differs from the cached one. Everything
+// that changes this state has to go through here (deletes included, since GL
+// unbinds deleted objects); after code that does not, call Invalidate().
+// The cache starts out with the defaults of a new context.
+class GLState {
+public:
+    struct Stats {
+        uint64_t issued, elided;
+        uint64_t draws;
+    };
+    static void UseProgram(GLuint program);
+    static void BindVertexArray(GLuint vao);
+    static void ActiveTexture(GLenum unit);
+    static void BindTexture(GLenum target, GLuint texture);
+    static void Enable(GLenum cap) { Set(cap, true); }
+    static void Disable(GLenum cap) { Set(cap, false); }
+    static void Set(GLenum cap, bool on);
+    static void BlendFunc(GLenum src, GLenum dst);
+    static void DeleteProgram(GLuint program);
+    static void DeleteVertexArrays(GLsizei n, const GLuint* vaos);
+    static void DeleteTextures(GLsizei n, const GLuint* textures);
+    static void Invalidate();
+    // whether the context lists extension name in GL_EXTENSIONS
+    static bool HasExtension(const char* name);
+    // every draw call (a multi-draw counts once) reports itself here
+    static void CountDraw() { frame.draws++; }
+    // counts of the last finished frame; EndFrame() starts a new one
+    static Stats FrameStats() { return last; }
+    // counts of the frame still being recorded
+    static Stats RunningStats() { return frame; }
+    static void EndFrame();
+private:
+    static constexpr GLuint Unknown = 0xFFFFFFFFu;
+    static constexpr int MaxUnits = 32;
+    static constexpr int Caps = 3;
+    static GLuint program, vao, unit;
+    // [unit][0] is GL_TEXTURE_2D, [unit][1] GL_TEXTURE_2D_ARRAY
+    static GLuint textures[MaxUnits][2];
+    // -1 unknown, else 0/1, in the order blend, depth test, cull face
+    static signed char caps[Caps];
+    static GLenum blendSrc, blendDst;
+    static Stats frame, last;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "BlockBase.h"
+#include "GLState.h"
 
 class Panel : public BlockBase {
 public:
@@ -13,24 +14,29 @@ protected:
             "layout(location=0) in vec3 p;"
             "layout(location=1) in vec2 uv;"
             "layout(location=2) in vec3 n;"
-            "uniform mat4 model;"
+            "layout(location=3) in mat4 model;"
             "uniform mat4 view;"
             "uniform mat4 projection;"
             "out vec2 TexCoord;"
+            "out vec3 Normal;"
             "void main(){"
             "gl_Position=projection*view*model*vec4(p,1.0);"
             "TexCoord=uv;"
+            "Normal=mat3(model)*n;"
             "}";
     }
     const char* FragmentShaderSrc() override {
         return "#version 330 core\n"
             "in vec2 TexCoord;"
-            "out vec4 FragColor;"
+            "in vec3 Normal;"
+            "layout(location=0) out vec4 FragColor;"
+            "layout(location=1) out vec4 BakeNormal;"
             "uniform sampler2D ourTexture;"
             "void main(){"
             "vec4 c=texture(ourTexture,TexCoord);"
             "if(c.a<0.1) discard;"
             "FragColor=c;"
+            "BakeNormal=vec4(normalize(Normal)*0.5+0.5,gl_FragCoord.z);"
             "}";
     }
     void SetupBuffers() override {
@@ -75,7 +81,7 @@ protected:
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
-        glBindVertexArray(VAO);
+        GLState::BindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
@@ -86,6 +92,6 @@ protected:
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
         glEnableVertexAttribArray(2);
-        glBindVertexArray(0);
+        GLState::BindVertexArray(0);
     }
 };
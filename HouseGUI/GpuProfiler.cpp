@@ -0,0 +1,117 @@
+// GpuProfiler.cpp
+#include "GpuProfiler.h"
+#include "GLState.h"
+#include <algorithm>
+
+GpuProfiler* GpuProfiler::current = nullptr;
+
+static const GLenum statisticTargets[] = { GL_VERTICES_SUBMITTED, GL_PRIMITIVES_SUBMITTED, GL_FRAGMENT_SHADER_INVOCATIONS };
+
+GpuProfiler::GpuProfiler(int latency)
+    : latency(std::min(std::max(latency, 2), MaxLatency)), frame(0), depth(0), statistics(false), debugGroups(false),
+    latest{ 0, {} }, dropped(0)
+{
+    for (Slot& s : slots) {
+        s.frame = 0;
+        s.pending = false;
+        s.used = 0;
+    }
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (Slot& s : slots)
+        for (Zone& z : s.zones) glDeleteQueries(QueriesPerZone, z.queries);
+    if (current == this) current = nullptr;
+}
+
+void GpuProfiler::Init() {
+    statistics = GLAD_GL_VERSION_4_6 || GLState::HasExtension("GL_ARB_pipeline_statistics_query");
+    debugGroups = glPushDebugGroup && glPopDebugGroup;
+    current = this;
+}
+
+bool GpuProfiler::ready(const Slot& s) const {
+    // queries finish in order, so the last one of the frame decides
+    if (s.used == 0) return true;
+    GLuint available = 0;
+    glGetQueryObjectuiv(s.zones[s.used - 1].queries[0], GL_QUERY_RESULT_AVAILABLE, &available);
+    return available != 0;
+}
+
+void GpuProfiler::collect(Slot& s) {
+    FrameResult result = { s.frame, {} };
+    for (size_t i = 0; i < s.used; i++) {
+        const Zone& z = s.zones[i];
+        GLuint64 values[QueriesPerZone] = {};
+        int count = statistics ? QueriesPerZone : 1;
+        for (int q = 0; q < count; q++) glGetQueryObjectui64v(z.queries[q], GL_QUERY_RESULT, &values[q]);
+        result.zones.push_back({ z.name, values[0] / 1e6, values[1], values[2], values[3] });
+    }
+    s.pending = false;
+    latest = result;
+    collected.push_back(std::move(result));
+    if (collected.size() > MaxBacklog) collected.pop_front();
+}
+
+void GpuProfiler::BeginFrame() {
+    // pick up finished frames, oldest first, and stop at the first one still in flight
+    for (uint64_t f = frame > (uint64_t)latency ? frame - latency : 0; f < frame; f++) {
+        Slot& s = slots[f % latency];
+        if (!s.pending || s.frame != f) continue;
+        if (!ready(s)) break;
+        collect(s);
+    }
+    Slot& s = slots[frame % latency];
+    if (s.pending) {
+        s.pending = false;
+        dropped++;
+    }
+    s.frame = frame;
+    s.used = 0;
+    depth = 0;
+}
+
+void GpuProfiler::EndFrame() {
+    while (depth > 0) End();
+    slots[frame % latency].pending = true;
+    frame++;
+}
+
+void GpuProfiler::Begin(const char* name) {
+    if (debugGroups) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+    if (depth++ > 0) return;
+    Slot& s = slots[frame % latency];
+    if (s.used == s.zones.size()) {
+        Zone z;
+        glGenQueries(QueriesPerZone, z.queries);
+        s.zones.push_back(z);
+    }
+    Zone& z = s.zones[s.used++];
+    z.name = name;
+    glBeginQuery(GL_TIME_ELAPSED, z.queries[0]);
+    if (statistics)
+        for (int q = 0; q < 3; q++) glBeginQuery(statisticTargets[q], z.queries[q + 1]);
+}
+
+void GpuProfiler::End() {
+    if (depth == 0) return;
+    if (--depth == 0) {
+        if (statistics)
+            for (GLenum target : statisticTargets) glEndQuery(target);
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    if (debugGroups) glPopDebugGroup();
+}
+
+std::vector<GpuProfiler::FrameResult> GpuProfiler::TakeCollected() {
+    std::vector<FrameResult> out(std::make_move_iterator(collected.begin()), std::make_move_iterator(collected.end()));
+    collected.clear();
+    return out;
+}
+
+void GpuProfiler::Flush() {
+    for (uint64_t f = frame > (uint64_t)latency ? frame - latency : 0; f < frame; f++) {
+        Slot& s = slots[f % latency];
+        if (s.pending && s.frame == f) collect(s);
+    }
+}
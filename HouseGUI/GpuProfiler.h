@@ -0,0 +1,84 @@
+// GpuProfiler.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <glad/glad.h>
+
+// GPU cost of named zones (passes and draw groups) in the frame. Each zone
+// is wrapped in a GL_TIME_ELAPSED query and, when the driver has
+// ARB_pipeline_statistics_query (core in 4.6), in vertex, primitive and
+// fragment-invocation counters, plus a KHR_debug group so captures show
+// the same names. A frame's queries are read Latency frames later and only
+// once they are available: a frame whose results are still pending when
+// its slot comes round again is dropped rather than waited for, so the CPU
+// never stalls. Zones do not nest; a zone begun inside another one is
+// folded into it (its debug group is still pushed).
+class GpuProfiler {
+public:
+    struct ZoneResult {
+        const char* name;
+        double gpuMs;
+        uint64_t vertices, primitives, fragments;
+    };
+    struct FrameResult {
+        uint64_t frame;
+        std::vector<ZoneResult> zones;
+    };
+    GpuProfiler(int latency = 4);
+    ~GpuProfiler();
+    void Init();
+    bool PipelineStatistics() const { return statistics; }
+    void BeginFrame();
+    void EndFrame();
+    void Begin(const char* name);
+    void End();
+    // index of the frame being recorded
+    uint64_t Frame() const { return frame; }
+    // the newest frame whose results came back
+    const FrameResult& Latest() const { return latest; }
+    // every frame that came back since the last call, oldest first
+    std::vector<FrameResult> TakeCollected();
+    // waits for the frames still in flight; for the end of a run, not per frame
+    void Flush();
+    uint64_t DroppedFrames() const { return dropped; }
+    static GpuProfiler* Current() { return current; }
+private:
+    static constexpr int MaxLatency = 8;
+    static constexpr size_t MaxBacklog = 64;
+    // time, vertices, primitives, fragments
+    static constexpr int QueriesPerZone = 4;
+    struct Zone {
+        const char* name;
+        GLuint queries[QueriesPerZone];
+    };
+    struct Slot {
+        uint64_t frame;
+        bool pending;
+        std::vector<Zone> zones;
+        size_t used;
+    };
+    int latency;
+    Slot slots[MaxLatency];
+    uint64_t frame;
+    int depth;
+    bool statistics, debugGroups;
+    FrameResult latest;
+    std::deque<FrameResult> collected;
+    uint64_t dropped;
+    bool ready(const Slot& s) const;
+    void collect(Slot& s);
+    static GpuProfiler* current;
+};
+
+// Times the enclosing scope as a zone of the current profiler, if there is one.
+class GpuZone {
+public:
+    GpuZone(const char* name) : profiler(GpuProfiler::Current()) { if (profiler) profiler->Begin(name); }
+    ~GpuZone() { if (profiler) profiler->End(); }
+    GpuZone(const GpuZone&) = delete;
+    GpuZone& operator=(const GpuZone&) = delete;
+private:
+    GpuProfiler* profiler;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "BlockBase.h"
+#include "ImageCache.h"
 #include <iostream>
 
 class GrassBlock : public BlockBase {
@@ -7,7 +8,7 @@ public:
     GrassBlock(float s, float o = 0.03f) : BlockBase(s, o) { hasAlpha = false; }
     void Init() {
         LoadTexture("textures/grass_carried.png", topID);
-        stbi_set_flip_vertically_on_load(true);
+        ImageCache::SetFlipOnLoad(true);
         LoadTexture("textures/grass_side_carried.png", sideID);
         LoadTexture("textures/dirt.png", bottomID);
         SetupShaders();
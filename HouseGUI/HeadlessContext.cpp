@@ -0,0 +1,88 @@
+// HeadlessContext.cpp
+#include "HeadlessContext.h"
+#include <cstring>
+#include <iostream>
+
+#if __has_include(<EGL/egl.h>)
+#define HOUSEGUI_HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessContext::HeadlessContext() : display(nullptr), context(nullptr) {}
+
+#ifdef HOUSEGUI_HEADLESS_EGL
+
+HeadlessContext::~HeadlessContext() {
+    if (!display) return;
+    eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context) eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+    eglTerminate((EGLDisplay)display);
+}
+
+bool HeadlessContext::Init() {
+    EGLDisplay d = EGL_NO_DISPLAY;
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if (d == EGL_NO_DISPLAY) d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (d == EGL_NO_DISPLAY || !eglInitialize(d, &major, &minor)) {
+        std::cout << "headless: no EGL display" << std::endl;
+        return false;
+    }
+    display = d;
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cout << "headless: EGL " << major << "." << minor << " has no desktop GL" << std::endl;
+        return false;
+    }
+    // without a surface the context needs no config when the driver allows it
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    const char* extensions = eglQueryString(d, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_no_config_context")) {
+        const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLint count = 0;
+        if (!eglChooseConfig(d, configAttribs, &config, 1, &count) || count == 0) {
+            std::cout << "headless: no EGL config for desktop GL" << std::endl;
+            return false;
+        }
+    }
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext c = eglCreateContext(d, config, EGL_NO_CONTEXT, contextAttribs);
+    if (c == EGL_NO_CONTEXT) {
+        std::cout << "headless: could not create a GL 4.5 core context" << std::endl;
+        return false;
+    }
+    context = c;
+    if (!eglMakeCurrent(d, EGL_NO_SURFACE, EGL_NO_SURFACE, c)) {
+        std::cout << "headless: the driver cannot make a context current without a surface" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void* HeadlessContext::GetProcAddress(const char* name) {
+    return (void*)eglGetProcAddress(name);
+}
+
+#else
+
+HeadlessContext::~HeadlessContext() {}
+
+bool HeadlessContext::Init() {
+    std::cout << "headless: this build has no EGL" << std::endl;
+    return false;
+}
+
+void* HeadlessContext::GetProcAddress(const char*) {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,20 @@
+// HeadlessContext.h
+#pragma once
+
+// GL 4.5 core context without a window or display server, for render and
+// perf machines that only have Mesa (llvmpipe included). It uses a
+// surfaceless EGL display when the driver offers EGL_MESA_platform_surfaceless
+// and the default display otherwise. There is no default framebuffer, so
+// everything is drawn into FBOs. Builds without the EGL headers (Windows)
+// compile the class, but Init() returns false.
+class HeadlessContext {
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+    bool Init();
+    // loader for gladLoadGLLoader and for entry points glad does not know
+    static void* GetProcAddress(const char* name);
+private:
+    void* display;
+    void* context;
+};
@@ -3,25 +3,31 @@
     #include <glm/gtc/type_ptr.hpp>
     #include <vector>
     #include <cmath>
-    #include "stb/stb_image.h"
+    #include <cstdio>
+    #include <cstring>
+    #include <string>
+    #include "AssetLoader.h"
+    #include "AssetPack.h"
+    #include "TextureResidency.h"
+    #include "JobSystem.h"
+    #include "GLState.h"
 
     Hill::Hill(float bs, float h, int seg, float exp, float sq)
-        : baseSize(bs), height(h), segments(seg), exponent(exp), squareSize(sq / 0.64f),
-        VAO(0), VBO(0), EBO(0), shader(0), textureID(0), indexCount(0)
+        : TessEdgePixels(8.0f), baseSize(bs), height(h), segments(seg), exponent(exp), squareSize(sq / 0.64f),
+        VAO(0), VBO(0), EBO(0), shader(0), textureID(0), indexCount(0), tessellated(false), patchVertexCount(0)
     {
     }
 
     Hill::~Hill() {
-        if (VAO) glDeleteVertexArrays(1, &VAO);
+        if (VAO) GLState::DeleteVertexArrays(1, &VAO);
         if (VBO) glDeleteBuffers(1, &VBO);
         if (EBO) glDeleteBuffers(1, &EBO);
-        if (shader) glDeleteProgram(shader);
-        if (textureID) glDeleteTextures(1, &textureID);
+        if (shader) GLState::DeleteProgram(shader);
+        TextureResidency::Forget(textureID);
+        if (textureID) GLState::DeleteTextures(1, &textureID);
     }
 
-    void Hill::Init() {
-        generateMesh();
-
+    void Hill::Init(bool tessellate) {
         const char* vs = R"(
     #version 330 core
     layout(location=0) in vec3 aPos;
@@ -87,78 +93,210 @@
     }
     )";
 
-        shader = createProgram(vs, fs);
+        // tessellated variant: a coarse patch mesh stores (x, height fraction, z)
+        // and the power curve is evaluated per generated vertex
+        const char* tvs = R"(
+    #version 410 core
+    layout(location=0) in vec3 aPos;
+    layout(location=1) in vec3 aNormal;
+    layout(location=2) in vec2 aTex;
+    out vec3 vPos, vNormal;
+    out vec2 vTex;
+    void main(){
+        vPos = aPos;
+        vNormal = aNormal;
+        vTex = aTex;
+    }
+    )";
+
+        const char* tcs = R"(
+    #version 410 core
+    layout(vertices=4) out;
+    in vec3 vPos[], vNormal[];
+    in vec2 vTex[];
+    out vec3 cPos[], cNormal[];
+    out vec2 cTex[];
+    uniform mat4 model, view;
+    uniform float height, exponent, baseSize, pixelScale;
+    vec3 surface(vec3 p){
+        float t = clamp(p.x / baseSize + 0.5, 0.0, 1.0);
+        vec4 v = view * model * vec4(p.x, p.y * height * (1.0 - pow(t, exponent)), p.z, 1.0);
+        return v.xyz;
+    }
+    float edgeFactor(vec3 a, vec3 b){
+        vec3 pa = surface(a), pb = surface(b), pm = surface((a + b) * 0.5);
+        float len = length(pm - pa) + length(pb - pm);
+        float dist = max(length(pm), 0.05);
+        return clamp(len * pixelScale / dist, 1.0, 64.0);
+    }
+    void main(){
+        cPos[gl_InvocationID] = vPos[gl_InvocationID];
+        cNormal[gl_InvocationID] = vNormal[gl_InvocationID];
+        cTex[gl_InvocationID] = vTex[gl_InvocationID];
+        if(gl_InvocationID == 0){
+            float e0 = edgeFactor(vPos[0], vPos[3]);
+            float e1 = edgeFactor(vPos[0], vPos[1]);
+            float e2 = edgeFactor(vPos[1], vPos[2]);
+            float e3 = edgeFactor(vPos[3], vPos[2]);
+            gl_TessLevelOuter[0] = e0;
+            gl_TessLevelOuter[1] = e1;
+            gl_TessLevelOuter[2] = e2;
+            gl_TessLevelOuter[3] = e3;
+            gl_TessLevelInner[0] = max(e1, e3);
+            gl_TessLevelInner[1] = max(e0, e2);
+        }
+    }
+    )";
+
+        const char* tes = R"(
+    #version 410 core
+    layout(quads, fractional_odd_spacing, ccw) in;
+    in vec3 cPos[], cNormal[];
+    in vec2 cTex[];
+    uniform mat4 model, view, projection, lightSpaceMatrix;
+    uniform float height, exponent, baseSize;
+    out vec3 FragPos, Normal;
+    out vec4 FragPosLightSpace;
+    out vec2 TexCoord;
+    void main(){
+        float u = gl_TessCoord.x, v = gl_TessCoord.y;
+        vec3 p = mix(mix(cPos[0], cPos[1], u), mix(cPos[3], cPos[2], u), v);
+        vec3 n = cNormal[0];
+        float t = clamp(p.x / baseSize + 0.5, 0.0, 1.0);
+        float y = p.y * height * (1.0 - pow(t, exponent));
+        if(n.y > 0.5){
+            float dy = -height * exponent / baseSize * pow(t, exponent - 1.0);
+            n = normalize(vec3(-dy, 1.0, 0.0));
+        }
+        FragPos = vec3(model * vec4(p.x, y, p.z, 1.0));
+        Normal = mat3(transpose(inverse(model))) * n;
+        FragPosLightSpace = lightSpaceMatrix * vec4(FragPos,1.0);
+        TexCoord = mix(mix(cTex[0], cTex[1], u), mix(cTex[3], cTex[2], u), v);
+        gl_Position = projection * view * vec4(FragPos,1.0);
+    }
+    )";
+
+        tessellated = tessellate && GLAD_GL_VERSION_4_0;
+        if (tessellated) {
+            generatePatches(4);
+            shader = createTessProgram(tvs, tcs, tes, fs);
+        }
+        else {
+            generateMesh();
+            shader = createProgram(vs, fs);
+        }
 
         glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        GLState::BindTexture(GL_TEXTURE_2D, textureID);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        int w, h, n;
-        unsigned char* data = stbi_load("textures/grass_carried.png", &w, &h, &n, 4);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        stbi_image_free(data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        AssetLoader::LoadTexture(textureID, "textures/grass_carried.png", true);
 
-        glUseProgram(shader);
+        GLState::UseProgram(shader);
         glUniform1f(glGetUniformLocation(shader, "outlineSize"), 0.03f);
     }
 
+    std::string Hill::meshKey() const {
+        char key[64];
+        snprintf(key, sizeof(key), "hill:%g:%g:%d:%g:%g", baseSize, height, segments, exponent, squareSize);
+        return key;
+    }
+
+    void Hill::Bake(AssetPackWriter& pack) const {
+        std::vector<unsigned char> vertexData;
+        std::vector<unsigned int> idx;
+        int vertexCount = buildMesh(vertexData, idx);
+        pack.AddMesh(meshKey(), vertexData.data(), vertexData.size(), vertexCount, idx.data(), (int)idx.size());
+    }
+
     void Hill::generateMesh() {
+        std::vector<unsigned char> vertexData;
+        std::vector<unsigned int> idx;
+        const unsigned char* vertexPtr;
+        const unsigned int* indexPtr;
+        size_t vertexBytes;
+        int vertexCount;
+        AssetPack* pack = AssetPack::Current();
+        const AssetPack::Entry* baked = pack ? pack->Find(meshKey()) : nullptr;
+        const uint32_t stride = 2 * sizeof(glm::vec3) + sizeof(glm::vec2);
+        if (baked && baked->type == AssetPack::Mesh && baked->levels == stride) {
+            // straight from the mapped pack, no copy
+            vertexCount = baked->width;
+            indexCount = baked->height;
+            vertexPtr = pack->Data(*baked);
+            vertexBytes = (size_t)vertexCount * stride;
+            indexPtr = (const unsigned int*)(vertexPtr + vertexBytes);
+        }
+        else {
+            vertexCount = buildMesh(vertexData, idx);
+            indexCount = static_cast<GLuint>(idx.size());
+            vertexPtr = vertexData.data();
+            vertexBytes = vertexData.size();
+            indexPtr = idx.data();
+        }
+        size_t vb = vertexCount * sizeof(glm::vec3);
+        size_t nb = vb;
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        GLState::BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertexPtr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned), indexPtr, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(vb));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)(vb + nb));
+        GLState::BindVertexArray(0);
+    }
+
+    // positions, then normals, then uvs; returns the vertex count
+    int Hill::buildMesh(std::vector<unsigned char>& vertexData, std::vector<unsigned int>& idx) const {
         std::vector<glm::vec3> verts;
         std::vector<glm::vec3> norms;
         std::vector<glm::vec2> uvs;
-        std::vector<unsigned int> idx;
         float half = baseSize * 0.5f;
-        for (int i = 0; i <= segments; i++) {
-            float x = -half + baseSize * float(i) / segments;
-            float t = (x + half) / baseSize;
-            float y = height * (1.0f - pow(t, exponent));
-            float dy = (i == 0) ? 1e5f : -height * exponent / baseSize * pow(t, exponent - 1);
-            glm::vec3 n = (i == 0) ? glm::vec3(-1, 0, 0) : glm::normalize(glm::vec3(-dy, 1, 0));
-            for (int j = 0; j <= segments; j++) {
-                float z = -half + baseSize * float(j) / segments;
-                verts.emplace_back(x, y, z);
-                norms.push_back(n);
-                uvs.emplace_back(float(i) * squareSize, float(j) * squareSize);
-            }
-        }
         int topCount = (segments + 1) * (segments + 1);
-        for (int i = 0; i < segments; i++) {
-            for (int j = 0; j < segments; j++) {
-                int a = i * (segments + 1) + j;
-                int b = (i + 1) * (segments + 1) + j;
-                idx.push_back(a);
-                idx.push_back(b);
-                idx.push_back(a + 1);
-                idx.push_back(a + 1);
-                idx.push_back(b);
-                idx.push_back(b + 1);
-            }
-        }
-        for (int i = 0; i <= segments; i++) {
-            float x = -half + baseSize * float(i) / segments;
-            for (int j = 0; j <= segments; j++) {
-                float z = -half + baseSize * float(j) / segments;
-                verts.emplace_back(x, 0.0f, z);
-                norms.emplace_back(0.0f, -1.0f, 0.0f);
-                uvs.emplace_back(float(i) * squareSize, float(j) * squareSize);
+        int quadCount = segments * segments;
+        verts.resize(topCount * 2);
+        norms.resize(topCount * 2);
+        uvs.resize(topCount * 2);
+        idx.resize(quadCount * 12);
+        // top and base grids are independent per column, so build them in parallel
+        parallel_for(segments + 1, 4, [&](size_t b, size_t e) {
+            for (int i = (int)b; i < (int)e; i++) {
+                float x = -half + baseSize * float(i) / segments;
+                float t = (x + half) / baseSize;
+                float y = height * (1.0f - pow(t, exponent));
+                float dy = (i == 0) ? 1e5f : -height * exponent / baseSize * pow(t, exponent - 1);
+                glm::vec3 n = (i == 0) ? glm::vec3(-1, 0, 0) : glm::normalize(glm::vec3(-dy, 1, 0));
+                for (int j = 0; j <= segments; j++) {
+                    float z = -half + baseSize * float(j) / segments;
+                    int v = i * (segments + 1) + j;
+                    verts[v] = glm::vec3(x, y, z);
+                    norms[v] = n;
+                    uvs[v] = glm::vec2(float(i) * squareSize, float(j) * squareSize);
+                    verts[topCount + v] = glm::vec3(x, 0.0f, z);
+                    norms[topCount + v] = glm::vec3(0.0f, -1.0f, 0.0f);
+                    uvs[topCount + v] = uvs[v];
+                }
+                if (i == segments) continue;
+                for (int j = 0; j < segments; j++) {
+                    int a = i * (segments + 1) + j;
+                    int c = (i + 1) * (segments + 1) + j;
+                    unsigned int* top = &idx[(i * segments + j) * 6];
+                    unsigned int* bottom = &idx[(quadCount + i * segments + j) * 6];
+                    top[0] = a; top[1] = c; top[2] = a + 1;
+                    top[3] = a + 1; top[4] = c; top[5] = c + 1;
+                    for (int k = 0; k < 6; k++) bottom[k] = top[k] + topCount;
+                }
             }
-        }
-        int baseOffset = topCount;
-        for (int i = 0; i < segments; i++) {
-            for (int j = 0; j < segments; j++) {
-                int a = baseOffset + i * (segments + 1) + j;
-                int b = baseOffset + (i + 1) * (segments + 1) + j;
-                idx.push_back(a);
-                idx.push_back(b);
-                idx.push_back(a + 1);
-                idx.push_back(a + 1);
-                idx.push_back(b);
-                idx.push_back(b + 1);
-            }
-        }
+        });
         int wallOffset = topCount + topCount;
         for (int i = 0; i < segments; i++) {
             float x1 = -half + baseSize * float(i) / segments;
@@ -239,28 +377,74 @@
             idx.push_back(off + 2);
             idx.push_back(off + 3);
         }
-        indexCount = static_cast<GLuint>(idx.size());
+        size_t vb = verts.size() * sizeof(glm::vec3);
+        size_t nb = norms.size() * sizeof(glm::vec3);
+        size_t ub = uvs.size() * sizeof(glm::vec2);
+        vertexData.resize(vb + nb + ub);
+        memcpy(vertexData.data(), verts.data(), vb);
+        memcpy(vertexData.data() + vb, norms.data(), nb);
+        memcpy(vertexData.data() + vb + nb, uvs.data(), ub);
+        return (int)verts.size();
+    }
+
+    void Hill::generatePatches(int patches) {
+        std::vector<glm::vec3> verts;
+        std::vector<glm::vec3> norms;
+        std::vector<glm::vec2> uvs;
+        float half = baseSize * 0.5f;
+        float step = baseSize / patches;
+        float uvScale = segments * squareSize / baseSize;
+        auto quad = [&](glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d, glm::vec3 n,
+            glm::vec2 ta, glm::vec2 tb, glm::vec2 tc, glm::vec2 td) {
+            verts.push_back(a); verts.push_back(b); verts.push_back(c); verts.push_back(d);
+            for (int k = 0; k < 4; k++) norms.push_back(n);
+            uvs.push_back(ta); uvs.push_back(tb); uvs.push_back(tc); uvs.push_back(td);
+        };
+        for (int i = 0; i < patches; i++) {
+            float x1 = -half + i * step, x2 = x1 + step;
+            float u1 = (x1 + half) * uvScale, u2 = (x2 + half) * uvScale;
+            for (int j = 0; j < patches; j++) {
+                float z1 = -half + j * step, z2 = z1 + step;
+                float v1 = (z1 + half) * uvScale, v2 = (z2 + half) * uvScale;
+                quad(glm::vec3(x1, 1, z1), glm::vec3(x2, 1, z1), glm::vec3(x2, 1, z2), glm::vec3(x1, 1, z2), glm::vec3(0, 1, 0),
+                    glm::vec2(u1, v1), glm::vec2(u2, v1), glm::vec2(u2, v2), glm::vec2(u1, v2));
+                quad(glm::vec3(x1, 0, z1), glm::vec3(x2, 0, z1), glm::vec3(x2, 0, z2), glm::vec3(x1, 0, z2), glm::vec3(0, -1, 0),
+                    glm::vec2(u1, v1), glm::vec2(u2, v1), glm::vec2(u2, v2), glm::vec2(u1, v2));
+            }
+            quad(glm::vec3(x1, 1, -half), glm::vec3(x2, 1, -half), glm::vec3(x2, 0, -half), glm::vec3(x1, 0, -half), glm::vec3(0, 0, -1),
+                glm::vec2(u1, 0), glm::vec2(u2, 0), glm::vec2(u2, squareSize), glm::vec2(u1, squareSize));
+            quad(glm::vec3(x1, 1, half), glm::vec3(x2, 1, half), glm::vec3(x2, 0, half), glm::vec3(x1, 0, half), glm::vec3(0, 0, 1),
+                glm::vec2(u1, 0), glm::vec2(u2, 0), glm::vec2(u2, squareSize), glm::vec2(u1, squareSize));
+            float z1 = -half + i * step, z2 = z1 + step;
+            quad(glm::vec3(-half, 1, z1), glm::vec3(-half, 1, z2), glm::vec3(-half, 0, z2), glm::vec3(-half, 0, z1), glm::vec3(-1, 0, 0),
+                glm::vec2(0, u1), glm::vec2(0, u2), glm::vec2(squareSize, u2), glm::vec2(squareSize, u1));
+        }
+        patchVertexCount = static_cast<GLuint>(verts.size());
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
         size_t vb = verts.size() * sizeof(glm::vec3);
         size_t nb = norms.size() * sizeof(glm::vec3);
         size_t ub = uvs.size() * sizeof(glm::vec2);
-        glBindVertexArray(VAO);
+        GLState::BindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, vb + nb + ub, nullptr, GL_STATIC_DRAW);
         glBufferSubData(GL_ARRAY_BUFFER, 0, vb, verts.data());
         glBufferSubData(GL_ARRAY_BUFFER, vb, nb, norms.data());
         glBufferSubData(GL_ARRAY_BUFFER, vb + nb, ub, uvs.data());
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(unsigned), idx.data(), GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(vb));
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)(vb + nb));
-        glBindVertexArray(0);
+        GLState::BindVertexArray(0);
+    }
+
+    float Hill::SurfaceHeight(float x, float z) const {
+        float half = baseSize * 0.5f;
+        if (x < -half || x > half || z < -half || z > half) return 0.0f;
+        float t = (x + half) / baseSize;
+        return height * (1.0f - pow(t, exponent));
     }
 
     GLuint Hill::compileShader(const char* src, GLenum type) {
@@ -282,6 +466,24 @@
         return p;
     }
 
+    GLuint Hill::createTessProgram(const char* vs, const char* tcs, const char* tes, const char* fs) {
+        GLuint v = compileShader(vs, GL_VERTEX_SHADER);
+        GLuint c = compileShader(tcs, GL_TESS_CONTROL_SHADER);
+        GLuint e = compileShader(tes, GL_TESS_EVALUATION_SHADER);
+        GLuint f = compileShader(fs, GL_FRAGMENT_SHADER);
+        GLuint p = glCreateProgram();
+        glAttachShader(p, v);
+        glAttachShader(p, c);
+        glAttachShader(p, e);
+        glAttachShader(p, f);
+        glLinkProgram(p);
+        glDeleteShader(v);
+        glDeleteShader(c);
+        glDeleteShader(e);
+        glDeleteShader(f);
+        return p;
+    }
+
     void Hill::Draw(const glm::mat4& view,
         const glm::mat4& proj,
         const glm::mat4& model,
@@ -291,7 +493,8 @@
         const glm::vec3& viewPos,
         GLuint shadowMap)
     {
-        glUseProgram(shader);
+        GLState::UseProgram(shader);
+        GLState::Disable(GL_BLEND);
         glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, glm::value_ptr(model));
         glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
         glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
@@ -300,13 +503,27 @@
         glUniform3fv(glGetUniformLocation(shader, "lightColor"), 1, glm::value_ptr(lightColor));
         glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, glm::value_ptr(viewPos));
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        TextureResidency::Use(textureID);
+        GLState::ActiveTexture(GL_TEXTURE0);
+        GLState::BindTexture(GL_TEXTURE_2D, textureID);
         glUniform1i(glGetUniformLocation(shader, "hillTexture"), 0);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, shadowMap);
+        GLState::ActiveTexture(GL_TEXTURE1);
+        GLState::BindTexture(GL_TEXTURE_2D, shadowMap);
         glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        GLState::BindVertexArray(VAO);
+        if (tessellated) {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glUniform1f(glGetUniformLocation(shader, "height"), height);
+            glUniform1f(glGetUniformLocation(shader, "exponent"), exponent);
+            glUniform1f(glGetUniformLocation(shader, "baseSize"), baseSize);
+            glUniform1f(glGetUniformLocation(shader, "pixelScale"), proj[1][1] * viewport[3] * 0.5f / TessEdgePixels);
+            glPatchParameteri(GL_PATCH_VERTICES, 4);
+            glDrawArrays(GL_PATCHES, 0, patchVertexCount);
+            GLState::CountDraw();
+        }
+        else {
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+            GLState::CountDraw();
+        }
     }
\ No newline at end of file
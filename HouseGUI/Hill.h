@@ -2,12 +2,16 @@
 #pragma once
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+class AssetPackWriter;
 
 class Hill {
 public:
     Hill(float baseSize, float height, int segments, float exponent = 3.0f, float squareSize = 1.0f);
     ~Hill();
-    void Init();
+    void Init(bool tessellate = true);
     void Draw(const glm::mat4& view,
         const glm::mat4& proj,
         const glm::mat4& model,
@@ -16,6 +20,13 @@ public:
         const glm::vec3& lightColor,
         const glm::vec3& viewPos,
         GLuint shadowMap);
+    float SurfaceHeight(float x, float z) const;
+    float BaseSize() const { return baseSize; }
+    bool Tessellated() const { return tessellated; }
+    // adds the dense (non-tessellated) mesh to a pack; Init() picks it up from AssetPack::Current()
+    void Bake(AssetPackWriter& pack) const;
+    // target screen-space edge length in pixels for the tessellated path
+    float TessEdgePixels;
 private:
     float baseSize;
     float height;
@@ -28,7 +39,13 @@ private:
     GLuint shader;
     GLuint textureID;
     GLuint indexCount;
+    bool tessellated;
+    GLuint patchVertexCount;
     void generateMesh();
+    int buildMesh(std::vector<unsigned char>& vertexData, std::vector<unsigned int>& idx) const;
+    std::string meshKey() const;
+    void generatePatches(int patches);
     GLuint compileShader(const char* src, GLenum type);
     GLuint createProgram(const char* vs, const char* fs);
+    GLuint createTessProgram(const char* vs, const char* tcs, const char* tes, const char* fs);
 };
@@ -0,0 +1,74 @@
+// ImageCache.cpp
+#include "ImageCache.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+#include "stb/stb_image.h"
+
+std::map<std::string, ImageCache::Image> ImageCache::images;
+std::mutex ImageCache::lock;
+bool ImageCache::flipOnLoad = false;
+
+static std::string cacheKey(const std::string& path, bool flip) {
+    return (flip ? "1:" : "0:") + path;
+}
+
+void ImageCache::SetFlipOnLoad(bool flip) {
+    flipOnLoad = flip;
+}
+
+bool ImageCache::decode(const std::string& path, bool flip, Image& out) {
+    stbi_set_flip_vertically_on_load_thread(flip);
+    int n;
+    unsigned char* data = stbi_load(path.c_str(), &out.width, &out.height, &n, 4);
+    if (!data) return false;
+    out.pixels.assign(data, data + (size_t)out.width * out.height * 4);
+    stbi_image_free(data);
+    return true;
+}
+
+void ImageCache::Prefetch(const std::vector<std::string>& paths, bool flip) {
+    std::vector<Image> decoded(paths.size());
+    std::vector<char> ok(paths.size(), 0);
+    parallel_for(paths.size(), 1, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; i++) {
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                if (images.count(cacheKey(paths[i], flip))) continue;
+            }
+            ok[i] = decode(paths[i], flip, decoded[i]);
+        }
+    });
+    std::lock_guard<std::mutex> lk(lock);
+    for (size_t i = 0; i < paths.size(); i++)
+        if (ok[i]) images[cacheKey(paths[i], flip)] = std::move(decoded[i]);
+}
+
+const unsigned char* ImageCache::Load(const char* path, int* width, int* height) {
+    return Load(path, flipOnLoad, width, height);
+}
+
+const unsigned char* ImageCache::Load(const char* path, bool flip, int* width, int* height) {
+    PROFILE_SCOPE("ImageCache::Load");
+    std::string key = cacheKey(path, flip);
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = images.find(key);
+        if (it != images.end()) {
+            *width = it->second.width;
+            *height = it->second.height;
+            return it->second.pixels.data();
+        }
+    }
+    Image img;
+    if (!decode(path, flip, img)) return nullptr;
+    std::lock_guard<std::mutex> lk(lock);
+    Image& stored = images.emplace(key, std::move(img)).first->second;
+    *width = stored.width;
+    *height = stored.height;
+    return stored.pixels.data();
+}
+
+void ImageCache::Clear() {
+    std::lock_guard<std::mutex> lk(lock);
+    images.clear();
+}
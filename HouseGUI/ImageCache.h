@@ -0,0 +1,29 @@
+// ImageCache.h
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Decoded RGBA8 images shared by all texture loaders. Prefetch() decodes a
+// batch of files in parallel on the job system so the Init() calls that
+// follow only upload. The flip flag replaces stb's process-wide setting.
+class ImageCache {
+public:
+    static void SetFlipOnLoad(bool flip);
+    static bool FlipOnLoad() { return flipOnLoad; }
+    static void Prefetch(const std::vector<std::string>& paths, bool flip);
+    // pixels stay valid until Clear(); nullptr if the file could not be decoded
+    static const unsigned char* Load(const char* path, int* width, int* height);
+    static const unsigned char* Load(const char* path, bool flip, int* width, int* height);
+    static void Clear();
+private:
+    struct Image {
+        int width, height;
+        std::vector<unsigned char> pixels;
+    };
+    static std::map<std::string, Image> images;
+    static std::mutex lock;
+    static bool flipOnLoad;
+    static bool decode(const std::string& path, bool flip, Image& out);
+};
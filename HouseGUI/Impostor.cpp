@@ -0,0 +1,314 @@
+// Impostor.cpp
+#include "Impostor.h"
+#include "BlockBase.h"
+#include "GLState.h"
+#include "RenderGraph.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <iostream>
+
+static const char* impostorVertSrc = R"(
+#version 330 core
+layout(location=0) in vec2 aCorner;
+uniform mat4 view, projection;
+uniform vec3 center, viewPos;
+uniform float radius, frames;
+out vec2 FrameUV[4];
+flat out vec2 FrameCell[4];
+out vec4 Weights;
+out vec3 WorldPos;
+out vec3 ToCamera;
+vec2 octEncode(vec3 n){
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xz;
+    if(n.y < 0.0) e = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return e;
+}
+vec3 octDecode(vec2 e){
+    vec3 v = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if(v.y < 0.0) v.xz = (1.0 - abs(v.zx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.z >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+void main(){
+    ToCamera = normalize(viewPos - center);
+    vec3 camRight = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 camUp = vec3(view[0][1], view[1][1], view[2][1]);
+    WorldPos = center + (camRight * aCorner.x + camUp * aCorner.y) * radius;
+    vec2 g = (octEncode(ToCamera) * 0.5 + 0.5) * (frames - 1.0);
+    vec2 base = min(floor(g), vec2(frames - 2.0));
+    vec2 f = g - base;
+    Weights = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+    vec2 offs[4] = vec2[4](vec2(0, 0), vec2(1, 0), vec2(0, 1), vec2(1, 1));
+    for(int k = 0; k < 4; k++){
+        vec2 cell = base + offs[k];
+        vec3 d = octDecode(cell / (frames - 1.0) * 2.0 - 1.0);
+        vec3 up = abs(d.y) > 0.999 ? vec3(0, 0, 1) : vec3(0, 1, 0);
+        vec3 s = normalize(cross(-d, up));
+        vec3 u = cross(s, -d);
+        vec3 p = WorldPos - center;
+        FrameUV[k] = vec2(dot(p, s), dot(p, u)) / radius * 0.5 + 0.5;
+        FrameCell[k] = cell;
+    }
+    gl_Position = projection * view * vec4(WorldPos, 1.0);
+}
+)";
+
+static const char* impostorFragSrc = R"(
+#version 330 core
+in vec2 FrameUV[4];
+flat in vec2 FrameCell[4];
+in vec4 Weights;
+in vec3 WorldPos;
+in vec3 ToCamera;
+uniform sampler2D albedoAtlas, normalAtlas;
+uniform mat4 view, projection;
+uniform vec3 lightDir, lightColor;
+uniform float radius, frames;
+out vec4 FragColor;
+void main(){
+    vec4 albedo = vec4(0.0);
+    vec4 nd = vec4(0.0);
+    for(int k = 0; k < 4; k++){
+        vec2 uv = FrameUV[k];
+        if(uv.x < 0.0 || uv.x > 1.0 || uv.y < 0.0 || uv.y > 1.0) continue;
+        vec2 a = (FrameCell[k] + uv) / frames;
+        albedo += texture(albedoAtlas, a) * Weights[k];
+        nd += texture(normalAtlas, a) * Weights[k];
+    }
+    if(albedo.a < 0.5) discard;
+    albedo.rgb /= albedo.a;
+    nd /= albedo.a;
+    vec3 n = normalize(nd.rgb * 2.0 - 1.0);
+    float diff = max(dot(n, normalize(-lightDir)), 0.0);
+    vec3 lighting = 0.2 * lightColor + diff * lightColor;
+    vec3 surface = WorldPos + ToCamera * (radius - 2.0 * radius * nd.a);
+    vec4 clip = projection * view * vec4(surface, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+    FragColor = vec4(albedo.rgb * lighting, 1.0);
+}
+)";
+
+namespace {
+    const uint32_t cacheMagic = 0x4F504D49; // "IMPO"
+    const uint32_t cacheVersion = 2;
+
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        // the hash the atlases were baked from
+        uint64_t source;
+        int32_t frames;
+        int32_t frameSize;
+        float radius;
+        uint32_t reserved;
+    };
+
+    glm::vec3 octDecode(glm::vec2 e) {
+        glm::vec3 v(e.x, 1.0f - fabsf(e.x) - fabsf(e.y), e.y);
+        if (v.y < 0.0f) {
+            float x = (1.0f - fabsf(v.z)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+            float z = (1.0f - fabsf(v.x)) * (v.z >= 0.0f ? 1.0f : -1.0f);
+            v.x = x;
+            v.z = z;
+        }
+        return glm::normalize(v);
+    }
+}
+
+Impostor::Impostor(const std::string& n, const glm::vec3& c, float r, uint64_t s, int f, int fs)
+    : name(n), center(c), radius(r), source(s), frames(f), frameSize(fs),
+    albedoTex(0), normalTex(0), VAO(0), VBO(0), EBO(0), shader(0) {
+}
+
+Impostor::~Impostor() {
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
+    if (VBO) glDeleteBuffers(1, &VBO);
+    if (EBO) glDeleteBuffers(1, &EBO);
+    if (shader) GLState::DeleteProgram(shader);
+    if (albedoTex) GLState::DeleteTextures(1, &albedoTex);
+    if (normalTex) GLState::DeleteTextures(1, &normalTex);
+}
+
+bool Impostor::Init(bool forceBake) {
+    shader = createProgram(impostorVertSrc, impostorFragSrc);
+    setupBuffers();
+    albedoTex = createAtlas();
+    normalTex = createAtlas();
+    if (forceBake || !loadCache()) return true;
+    generateMipmaps();
+    return false;
+}
+
+void Impostor::AddBakePass(RenderGraph& graph, const DrawFn& drawObject) {
+    int size = frames * frameSize;
+    RenderGraph::Resource albedo = graph.ImportTexture(name + " albedo", albedoTex, { size, size, GL_RGBA8 });
+    RenderGraph::Resource normal = graph.ImportTexture(name + " normal", normalTex, { size, size, GL_RGBA8 });
+    RenderGraph::Resource depth = graph.CreateTexture(name + " depth", { size, size, GL_DEPTH_COMPONENT24 });
+    graph.MarkOutput(albedo);
+    graph.MarkOutput(normal);
+    graph.AddPass("bake " + name, [=](RenderGraph::Builder& b) {
+        b.Write(albedo);
+        b.Write(normal);
+        b.Write(depth);
+        }, [this, drawObject](const RenderGraph&) {
+        bake(drawObject);
+        saveCache();
+        generateMipmaps();
+        });
+}
+
+void Impostor::generateMipmaps() {
+    GLState::BindTexture(GL_TEXTURE_2D, albedoTex);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    GLState::BindTexture(GL_TEXTURE_2D, normalTex);
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+std::string Impostor::cachePath() const {
+    return "impostor_" + name + ".bin";
+}
+
+GLuint Impostor::createAtlas() {
+    int size = frames * frameSize;
+    GLuint tex;
+    glGenTextures(1, &tex);
+    GLState::BindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return tex;
+}
+
+// draws into the framebuffer the graph bound for the pass
+void Impostor::bake(const DrawFn& drawObject) {
+    GLint viewport[4];
+    GLfloat clearColor[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glm::mat4 proj = glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius);
+    BlockBase::bakeMode = true;
+    for (int j = 0; j < frames; j++) {
+        for (int i = 0; i < frames; i++) {
+            glm::vec3 d = octDecode(glm::vec2(i, j) / float(frames - 1) * 2.0f - 1.0f);
+            glm::vec3 up = fabsf(d.y) > 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+            glm::mat4 view = glm::lookAt(center + d * 2.0f * radius, center, up);
+            glViewport(i * frameSize, j * frameSize, frameSize, frameSize);
+            drawObject(view, proj);
+        }
+    }
+    BlockBase::bakeMode = false;
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
+
+bool Impostor::loadCache() {
+    FILE* f = fopen(cachePath().c_str(), "rb");
+    if (!f) return false;
+    CacheHeader h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == cacheMagic && h.version == cacheVersion &&
+        h.frames == frames && h.frameSize == frameSize && h.radius == radius;
+    if (ok && h.source != source) {
+        std::cout << cachePath() << " was baked from an older " << name << ", baking again\n";
+        ok = false;
+    }
+    if (ok) {
+        int size = frames * frameSize;
+        std::vector<unsigned char> pixels((size_t)size * size * 4);
+        GLuint textures[2] = { albedoTex, normalTex };
+        for (GLuint tex : textures) {
+            if (fread(pixels.data(), 1, pixels.size(), f) != pixels.size()) { ok = false; break; }
+            GLState::BindTexture(GL_TEXTURE_2D, tex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+void Impostor::saveCache() {
+    FILE* f = fopen(cachePath().c_str(), "wb");
+    if (!f) {
+        std::cout << "Failed to write " << cachePath() << "\n";
+        return;
+    }
+    CacheHeader h = { cacheMagic, cacheVersion, source, frames, frameSize, radius, 0 };
+    fwrite(&h, sizeof(h), 1, f);
+    int size = frames * frameSize;
+    std::vector<unsigned char> pixels((size_t)size * size * 4);
+    GLuint textures[2] = { albedoTex, normalTex };
+    for (GLuint tex : textures) {
+        GLState::BindTexture(GL_TEXTURE_2D, tex);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        fwrite(pixels.data(), 1, pixels.size(), f);
+    }
+    fclose(f);
+}
+
+void Impostor::setupBuffers() {
+    float v[] = { -1, -1,  1, -1,  1, 1,  -1, 1 };
+    unsigned int i[] = { 0, 1, 2, 2, 3, 0 };
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(i), i, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    GLState::BindVertexArray(0);
+}
+
+GLuint Impostor::compileShader(const char* src, GLenum type) {
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    return s;
+}
+
+GLuint Impostor::createProgram(const char* vs, const char* fs) {
+    GLuint v = compileShader(vs, GL_VERTEX_SHADER);
+    GLuint f = compileShader(fs, GL_FRAGMENT_SHADER);
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v);
+    glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v);
+    glDeleteShader(f);
+    return p;
+}
+
+void Impostor::Draw(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& worldPos,
+    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos) {
+    GLState::UseProgram(shader);
+    GLState::Disable(GL_BLEND);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
+    glUniform3fv(glGetUniformLocation(shader, "center"), 1, glm::value_ptr(worldPos + center));
+    glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, glm::value_ptr(viewPos));
+    glUniform3fv(glGetUniformLocation(shader, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(shader, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform1f(glGetUniformLocation(shader, "radius"), radius);
+    glUniform1f(glGetUniformLocation(shader, "frames"), (float)frames);
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D, albedoTex);
+    glUniform1i(glGetUniformLocation(shader, "albedoAtlas"), 0);
+    GLState::ActiveTexture(GL_TEXTURE1);
+    GLState::BindTexture(GL_TEXTURE_2D, normalTex);
+    glUniform1i(glGetUniformLocation(shader, "normalAtlas"), 1);
+    GLState::BindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    GLState::CountDraw();
+}
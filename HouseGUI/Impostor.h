@@ -0,0 +1,47 @@
+// Impostor.h
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+class RenderGraph;
+
+// Octahedral impostor: an object baked from frames x frames directions into
+// albedo and normal+depth atlases, drawn as one camera-facing quad. The
+// atlases are cached on disk under the object's name, along with a hash of
+// what they were baked from (the caller's), so an edited object is baked again.
+class Impostor {
+public:
+    typedef std::function<void(const glm::mat4& view, const glm::mat4& proj)> DrawFn;
+
+    Impostor(const std::string& name, const glm::vec3& center, float radius, uint64_t source, int frames = 8, int frameSize = 128);
+    ~Impostor();
+    // false when the atlases came from the cache; otherwise add the bake pass
+    bool Init(bool forceBake = false);
+    // renders the atlases into the graph with a transient depth buffer, then caches them
+    void AddBakePass(RenderGraph& graph, const DrawFn& drawObject);
+    void Draw(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& worldPos,
+        const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos);
+    glm::vec3 Center() const { return center; }
+    float Radius() const { return radius; }
+private:
+    std::string name;
+    glm::vec3 center;
+    float radius;
+    uint64_t source;
+    int frames;
+    int frameSize;
+    GLuint albedoTex, normalTex;
+    GLuint VAO, VBO, EBO, shader;
+    std::string cachePath() const;
+    GLuint createAtlas();
+    void bake(const DrawFn& drawObject);
+    void generateMipmaps();
+    bool loadCache();
+    void saveCache();
+    void setupBuffers();
+    GLuint compileShader(const char* src, GLenum type);
+    GLuint createProgram(const char* vs, const char* fs);
+};
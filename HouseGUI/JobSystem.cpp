@@ -0,0 +1,184 @@
+// JobSystem.cpp
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+#include <algorithm>
+
+JobSystem* JobSystem::current = nullptr;
+
+static thread_local int tlsIndex = -1;
+static thread_local const JobSystem* tlsOwner = nullptr;
+
+JobSystem::JobSystem(int threadCount)
+    : running(true), pending(0), nextQueue(0), statsStart(std::chrono::steady_clock::now())
+{
+    if (threadCount <= 0) threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < threadCount; i++) queues.emplace_back(new Queue());
+    tlsIndex = 0;
+    tlsOwner = this;
+    for (int i = 1; i < threadCount; i++) threads.emplace_back(&JobSystem::workerLoop, this, i);
+    current = this;
+}
+
+JobSystem::~JobSystem() {
+    running = false;
+    wake.notify_all();
+    for (auto& t : threads) t.join();
+    if (current == this) current = nullptr;
+    if (tlsOwner == this) tlsOwner = nullptr;
+}
+
+int JobSystem::threadIndex() const {
+    return tlsOwner == this ? tlsIndex : -1;
+}
+
+void JobSystem::Run(Job job, Counter* counter, Counter* dependency) {
+    if (counter) counter->value++;
+    if (dependency && dependency->value > 0) {
+        // finish() decrements under this lock, so the release cannot be missed
+        std::lock_guard<std::mutex> lk(dependency->lock);
+        if (dependency->value > 0) {
+            dependency->parked.emplace_back(std::move(job), counter);
+            return;
+        }
+    }
+    push(std::move(job), counter);
+}
+
+void JobSystem::push(Job job, Counter* counter) {
+    int self = threadIndex();
+    int q = self >= 0 ? self : (int)(nextQueue++ % queues.size());
+    {
+        std::lock_guard<std::mutex> lk(queues[q]->lock);
+        queues[q]->items.push_back({ std::move(job), counter });
+    }
+    pending++;
+    wake.notify_one();
+}
+
+void JobSystem::finish(Counter& counter) {
+    std::vector<std::pair<Job, Counter*>> ready;
+    {
+        std::lock_guard<std::mutex> lk(counter.lock);
+        if (--counter.value > 0) return;
+        ready.swap(counter.parked);
+    }
+    for (auto& p : ready) push(std::move(p.first), p.second);
+}
+
+bool JobSystem::runOne(int self) {
+    Item item;
+    bool found = false, stolen = false;
+    int n = (int)queues.size();
+    if (self >= 0) {
+        std::lock_guard<std::mutex> lk(queues[self]->lock);
+        if (!queues[self]->items.empty()) {
+            item = std::move(queues[self]->items.back());
+            queues[self]->items.pop_back();
+            found = true;
+        }
+    }
+    if (!found) {
+        int start = self >= 0 ? self + 1 : (int)(nextQueue++ % n);
+        for (int k = 0; k < n && !found; k++) {
+            int q = (start + k) % n;
+            if (q == self) continue;
+            std::lock_guard<std::mutex> lk(queues[q]->lock);
+            if (!queues[q]->items.empty()) {
+                item = std::move(queues[q]->items.front());
+                queues[q]->items.pop_front();
+                found = true;
+                stolen = self >= 0;
+            }
+        }
+    }
+    if (!found) return false;
+    pending--;
+
+    Queue& mine = *queues[self >= 0 ? self : 0];
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        PROFILE_SCOPE("job");
+        item.job();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    mine.busyNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    mine.jobs++;
+    if (stolen) mine.steals++;
+    if (item.counter) finish(*item.counter);
+    return true;
+}
+
+void JobSystem::workerLoop(int index) {
+    tlsIndex = index;
+    tlsOwner = this;
+    CpuProfiler::SetThreadName("worker " + std::to_string(index));
+    int idle = 0;
+    while (running) {
+        if (runOne(index)) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < 64) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(sleepLock);
+        wake.wait_for(lk, std::chrono::milliseconds(1), [this] { return pending > 0 || !running; });
+    }
+}
+
+void JobSystem::Wait(Counter& counter) {
+    int self = threadIndex();
+    while (counter.value > 0) {
+        if (!runOne(self)) std::this_thread::yield();
+    }
+    // the last finish() may still hold the lock; the counter can go away after this
+    std::lock_guard<std::mutex> lk(counter.lock);
+}
+
+void JobSystem::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (count == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = std::min((count + grain - 1) / grain, queues.size() * 4);
+    if (chunks <= 1) {
+        fn(0, count);
+        return;
+    }
+    size_t per = (count + chunks - 1) / chunks;
+    Counter done;
+    for (size_t b = per; b < count; b += per) {
+        size_t e = std::min(count, b + per);
+        Run([&fn, b, e] { fn(b, e); }, &done);
+    }
+    fn(0, per);
+    Wait(done);
+}
+
+std::vector<JobSystem::WorkerStats> JobSystem::Stats() const {
+    std::vector<WorkerStats> out;
+    for (auto& q : queues)
+        out.push_back({ q->jobs.load(), q->steals.load(), q->busyNs.load() * 1e-9 });
+    return out;
+}
+
+double JobSystem::Utilisation() const {
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - statsStart).count();
+    if (wall <= 0.0) return 0.0;
+    double busy = 0.0;
+    for (auto& q : queues) busy += q->busyNs.load() * 1e-9;
+    return busy / (wall * queues.size());
+}
+
+void JobSystem::ResetStats() {
+    for (auto& q : queues) {
+        q->jobs = 0;
+        q->steals = 0;
+        q->busyNs = 0;
+    }
+    statsStart = std::chrono::steady_clock::now();
+}
+
+void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (JobSystem::Current()) JobSystem::Current()->ParallelFor(count, grain, fn);
+    else if (count) fn(0, count);
+}
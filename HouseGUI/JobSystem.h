@@ -0,0 +1,79 @@
+// JobSystem.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Work-stealing job system. Every thread owns a deque: it pushes and pops at
+// the back, idle threads steal from the front of the others. The thread that
+// constructs the system is worker 0 and helps out while it waits on a counter.
+class JobSystem {
+public:
+    typedef std::function<void()> Job;
+    struct Counter {
+        std::atomic<int> value;
+        // jobs waiting for this counter to reach zero, with their own counters
+        std::mutex lock;
+        std::vector<std::pair<Job, Counter*>> parked;
+        Counter() : value(0) {}
+    };
+    struct WorkerStats {
+        uint64_t jobs;
+        uint64_t steals;
+        double busySeconds;
+    };
+
+    JobSystem(int threads = 0);
+    ~JobSystem();
+    // counter is incremented now and decremented when the job finishes; the
+    // job is parked on dependency (if any) and queued once it reaches zero
+    void Run(Job job, Counter* counter = nullptr, Counter* dependency = nullptr);
+    void Wait(Counter& counter);
+    // runs one queued job on the calling thread, if there is any
+    bool Help() { return runOne(threadIndex()); }
+    void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+    int ThreadCount() const { return (int)queues.size(); }
+    std::vector<WorkerStats> Stats() const;
+    // busy time over wall time since the last reset, averaged over all threads
+    double Utilisation() const;
+    void ResetStats();
+    static JobSystem* Current() { return current; }
+private:
+    struct Item {
+        Job job;
+        Counter* counter;
+    };
+    struct Queue {
+        std::mutex lock;
+        std::deque<Item> items;
+        std::atomic<uint64_t> jobs, steals, busyNs;
+        Queue() : jobs(0), steals(0), busyNs(0) {}
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running;
+    std::atomic<int> pending;
+    std::atomic<unsigned> nextQueue;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::chrono::steady_clock::time_point statsStart;
+    static JobSystem* current;
+    void push(Job job, Counter* counter);
+    void finish(Counter& counter);
+    bool runOne(int self);
+    void workerLoop(int index);
+    int threadIndex() const;
+};
+
+// Splits [0, count) into chunks of at least grain and runs them on the current
+// job system, or inline when there is none.
+void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
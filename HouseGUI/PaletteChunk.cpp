@@ -0,0 +1,187 @@
+// PaletteChunk.cpp
+#include "PaletteChunk.h"
+#include <algorithm>
+
+PaletteChunk::PaletteChunk(int height) {
+    Reset(height);
+}
+
+void PaletteChunk::Reset(int height, Value fill) {
+    this->height = height;
+    std::vector<uint64_t>().swap(words);
+    palette.assign(1, fill);
+    counts.assign(1, (uint32_t)Volume());
+    setWidth(0);
+}
+
+void PaletteChunk::setWidth(int newBits) {
+    bits = newBits;
+    bitsShift = 0;
+    while (newBits > 1 << bitsShift) bitsShift++;
+    perWordShift = bits ? 6 - bitsShift : 0;
+    perWordMask = ((size_t)1 << perWordShift) - 1;
+    mask = bits ? ((uint64_t)1 << bits) - 1 : 0;
+}
+
+int PaletteChunk::widthFor(size_t entries) {
+    int width = 1;
+    while (((size_t)1 << width) < entries) width *= 2;
+    return width;
+}
+
+// every cell's index i becomes remap[i], at newBits per cell
+void PaletteChunk::repack(int newBits, const std::vector<uint32_t>& remap) {
+    const size_t volume = Volume();
+    std::vector<uint64_t> packed;
+    if (newBits) {
+        int shift = 0;
+        while (newBits > 1 << shift) shift++;
+        const int wordShift = 6 - shift;
+        const size_t wordMask = ((size_t)1 << wordShift) - 1;
+        packed.assign((volume + wordMask) >> wordShift, 0);
+        for (size_t i = 0; i < volume; i++)
+            packed[i >> wordShift] |= (uint64_t)remap[indexAt(i)] << ((i & wordMask) << shift);
+    }
+    words.swap(packed);
+    setWidth(newBits);
+}
+
+void PaletteChunk::Set(int x, int y, int z, Value v) {
+    const size_t i = index(x, y, z);
+    uint32_t old = indexAt(i);
+    if (palette[old] == v) return;
+    uint32_t p = 0;
+    while (p < palette.size() && palette[p] != v) p++;
+    if (p == palette.size()) {
+        // an entry no cell uses any more, before a wider index
+        p = 0;
+        while (p < counts.size() && counts[p] != 0) p++;
+        if (p < palette.size()) palette[p] = v;
+        else {
+            palette.push_back(v);
+            counts.push_back(0);
+            if (palette.size() > ((size_t)1 << bits)) {
+                std::vector<uint32_t> same(palette.size());
+                for (uint32_t k = 0; k < same.size(); k++) same[k] = k;
+                repack(bits ? bits * 2 : 1, same);
+            }
+        }
+    }
+    uint64_t& word = words[i >> perWordShift];
+    const int shift = (int)((i & perWordMask) << bitsShift);
+    word = (word & ~(mask << shift)) | (uint64_t)p << shift;
+    counts[old]--;
+    if (++counts[p] == Volume()) {
+        words.clear();
+        palette.assign(1, v);
+        counts.assign(1, (uint32_t)Volume());
+        setWidth(0);
+    }
+}
+
+void PaletteChunk::Assign(const Value* cells) {
+    const size_t volume = Volume();
+    if (volume == 0) return;
+    // air first, so layers of it pack to zero words
+    palette.assign(1, Air);
+    counts.assign(1, 0);
+    // palette index + 1 by the value's low byte, checked against the palette;
+    // a branch that almost never misses, where a scan misses at every edge.
+    // Runs of one value, which layers mostly are, skip even that.
+    uint16_t byLowByte[256] = {};
+    byLowByte[Air & 255] = 1;
+    static thread_local std::vector<uint16_t> indices;
+    indices.resize(volume);
+    uint16_t* index = indices.data();
+    Value last = Air;
+    uint16_t lastIndex = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < volume; i++) {
+        Value v = cells[i];
+        if (v != last) {
+            counts[lastIndex] += (uint32_t)run;
+            run = 0;
+            uint32_t slot = byLowByte[v & 255];
+            if (slot == 0 || palette[slot - 1] != v) {
+                slot = 1;
+                while (slot <= palette.size() && palette[slot - 1] != v) slot++;
+                if (slot > palette.size()) {
+                    palette.push_back(v);
+                    counts.push_back(0);
+                }
+                if (!byLowByte[v & 255]) byLowByte[v & 255] = (uint16_t)slot;
+            }
+            last = v;
+            lastIndex = (uint16_t)(slot - 1);
+        }
+        index[i] = lastIndex;
+        run++;
+    }
+    counts[lastIndex] += (uint32_t)run;
+    // no air: the palette starts at the first value
+    const uint16_t first = counts[0] ? 0 : 1;
+    if (palette.size() - first == 1) {
+        Reset(height, palette[first]);
+        return;
+    }
+    palette.erase(palette.begin(), palette.begin() + first);
+    counts.erase(counts.begin(), counts.begin() + first);
+    setWidth(widthFor(palette.size()));
+    std::vector<uint64_t> packed((volume + (1 << perWordShift) - 1) >> perWordShift);
+    // a fixed width unrolls the shifts; a layer is a whole number of words at every width
+    static_assert(Size * Size % 64 == 0, "layers fill whole words");
+    switch (bits) {
+    case 1: pack<1>(index, first, packed.data(), packed.size()); break;
+    case 2: pack<2>(index, first, packed.data(), packed.size()); break;
+    case 4: pack<4>(index, first, packed.data(), packed.size()); break;
+    case 8: pack<8>(index, first, packed.data(), packed.size()); break;
+    default: pack<16>(index, first, packed.data(), packed.size()); break;
+    }
+    words.swap(packed);
+}
+
+template<int Bits>
+void PaletteChunk::pack(const uint16_t* indices, uint16_t first, uint64_t* packed, size_t wordCount) {
+    const int perWord = 64 / Bits;
+    for (size_t w = 0; w < wordCount; w++, indices += perWord) {
+        uint64_t word = 0;
+        for (int k = 0; k < perWord; k++) word |= (uint64_t)(uint16_t)(indices[k] - first) << (k * Bits);
+        packed[w] = word;
+    }
+}
+
+void PaletteChunk::Read(Value* cells) const {
+    const size_t volume = Volume();
+    for (size_t i = 0; i < volume; i++) cells[i] = palette[indexAt(i)];
+}
+
+void PaletteChunk::Compact() {
+    if (bits == 0) return;
+    // air first, so layers of it pack to zero words
+    std::vector<uint32_t> order;
+    for (uint32_t k = 0; k < palette.size(); k++)
+        if (counts[k] && palette[k] == Air) order.push_back(k);
+    for (uint32_t k = 0; k < palette.size(); k++)
+        if (counts[k] && palette[k] != Air) order.push_back(k);
+    if (order.size() == 1) {
+        Reset(height, palette[order[0]]);
+        return;
+    }
+    std::vector<uint32_t> remap(palette.size(), 0);
+    std::vector<Value> used(order.size());
+    std::vector<uint32_t> usedCounts(order.size());
+    for (uint32_t k = 0; k < order.size(); k++) {
+        remap[order[k]] = k;
+        used[k] = palette[order[k]];
+        usedCounts[k] = counts[order[k]];
+    }
+    repack(widthFor(order.size()), remap);
+    palette.swap(used);
+    counts.swap(usedCounts);
+    palette.shrink_to_fit();
+    counts.shrink_to_fit();
+}
+
+size_t PaletteChunk::MemoryBytes() const {
+    return sizeof(*this) + words.capacity() * sizeof(uint64_t) + palette.capacity() * sizeof(Value) + counts.capacity() * sizeof(uint32_t);
+}
@@ -0,0 +1,103 @@
+// PaletteChunk.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Block storage for one chunk: Size x height x Size cells, each an index
+// into a small palette of the values the chunk uses, bit-packed into 64-bit
+// words. Widths are 1, 2, 4, 8 or 16 bits, so an index never straddles two
+// words, and the width doubles when the palette outgrows it. A chunk that
+// holds one value everywhere has no words at all; Set collapses a chunk back
+// to that once the last other value is overwritten.
+//
+// Get is a shift and a mask. Set looks the value up in the palette with a
+// linear scan, which stays short because chunks use few block types, and
+// reuses palette entries nothing refers to any more before it widens.
+//
+// Cells are ordered x fastest, then z, then y, so a layer of air above the
+// ground is a run of zero words that ForEachSolid skips.
+class PaletteChunk {
+public:
+    static constexpr int Size = 16;
+    // 0 is air; otherwise a Scene::BlockType plus one and a rotation
+    typedef uint16_t Value;
+    static constexpr Value Air = 0;
+    static Value Pack(uint8_t type, uint8_t rotation) { return (Value)((type + 1) | rotation << 8); }
+    static uint8_t TypeOf(Value v) { return (uint8_t)((v & 255) - 1); }
+    static uint8_t RotationOf(Value v) { return (uint8_t)(v >> 8); }
+
+    explicit PaletteChunk(int height = 0);
+    // height levels of fill, dropping the words and palette
+    void Reset(int height, Value fill = Air);
+    int Height() const { return height; }
+    Value Get(int x, int y, int z) const {
+        if (bits == 0) return palette[0];
+        size_t i = index(x, y, z);
+        return palette[(words[i >> perWordShift] >> ((i & perWordMask) << bitsShift)) & mask];
+    }
+    void Set(int x, int y, int z, Value v);
+    // every cell at once from Volume() values in storage order, packed at the
+    // narrowest width; much cheaper than a Set per cell
+    void Assign(const Value* cells);
+    // the other way: every cell into Volume() values in storage order
+    void Read(Value* cells) const;
+    // the highest cell of column x, z that is not air, or -1
+    int Top(int x, int z) const {
+        for (int y = height - 1; y >= 0; y--)
+            if (Get(x, y, z) != Air) return y;
+        return -1;
+    }
+    // repacks at the narrowest width for the values in use
+    void Compact();
+    bool Uniform() const { return bits == 0; }
+    int Bits() const { return bits; }
+    size_t PaletteSize() const { return palette.size(); }
+    // what this chunk allocates, and what the same cells take as plain Values
+    size_t MemoryBytes() const;
+    size_t DenseBytes() const { return Volume() * sizeof(Value); }
+    size_t Volume() const { return (size_t)Size * Size * height; }
+
+    // f(x, y, z, value) for every cell that is not air, in storage order
+    template<class F> void ForEachSolid(F f) const {
+        if (bits == 0) {
+            if (palette[0] == Air) return;
+            for (int y = 0; y < height; y++)
+                for (int z = 0; z < Size; z++)
+                    for (int x = 0; x < Size; x++) f(x, y, z, palette[0]);
+            return;
+        }
+        const int perWord = 1 << perWordShift;
+        const size_t volume = Volume();
+        for (size_t w = 0; w < words.size(); w++) {
+            uint64_t word = words[w];
+            // air at index 0 makes all-air words zero
+            if (word == 0 && palette[0] == Air) continue;
+            size_t i = w << perWordShift;
+            for (int k = 0; k < perWord && i < volume; k++, i++, word >>= bits) {
+                Value v = palette[word & mask];
+                if (v == Air) continue;
+                f((int)(i % Size), (int)(i / (Size * Size)), (int)(i / Size % Size), v);
+            }
+        }
+    }
+private:
+    int height;
+    // 0 while uniform; bits == 1 << bitsShift, 64 / bits == 1 << perWordShift
+    int bits, bitsShift, perWordShift;
+    size_t perWordMask;
+    uint64_t mask;
+    std::vector<uint64_t> words;
+    std::vector<Value> palette;
+    // cells per palette entry
+    std::vector<uint32_t> counts;
+    static size_t index(int x, int y, int z) { return ((size_t)y * Size + z) * Size + x; }
+    uint32_t indexAt(size_t i) const {
+        return bits == 0 ? 0 : (uint32_t)((words[i >> perWordShift] >> ((i & perWordMask) << bitsShift)) & mask);
+    }
+    static int widthFor(size_t entries);
+    void repack(int newBits, const std::vector<uint32_t>& remap);
+    void setWidth(int newBits);
+    // wordCount words of palette indices less first, Bits apiece
+    template<int Bits> static void pack(const uint16_t* indices, uint16_t first, uint64_t* packed, size_t wordCount);
+};
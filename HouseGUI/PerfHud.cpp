@@ -0,0 +1,427 @@
+// PerfHud.cpp
+#include "PerfHud.h"
+#include "GLState.h"
+#include "GpuProfiler.h"
+#include "FrameRingBuffer.h"
+#include "TextureResidency.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+// not in the GL 4.6 core header
+static const GLenum GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX = 0x9049;
+static const GLenum TEXTURE_FREE_MEMORY_ATI = 0x87FC;
+
+static uint32_t rgba(int r, int g, int b, int a = 255) {
+    return (uint32_t)r | (uint32_t)g << 8 | (uint32_t)b << 16 | (uint32_t)a << 24;
+}
+
+// the overlay blends premultiplied colors
+static uint32_t premultiply(uint32_t color) {
+    uint32_t a = color >> 24, out = a << 24;
+    for (int shift = 0; shift < 24; shift += 8) out |= (((color >> shift) & 0xFF) * a + 127) / 255 << shift;
+    return out;
+}
+
+static const uint32_t textColor = rgba(235, 235, 235);
+static const uint32_t labelColor = rgba(150, 160, 170);
+static const uint32_t panelColor = rgba(0, 0, 0, 170);
+static const uint32_t graphColor = rgba(40, 40, 40, 200);
+static const uint32_t budgetColor = rgba(110, 110, 110);
+
+// Printable ASCII in a 16 x 6 grid of 6 x 8 cells. Glyphs are 5 x 7, one
+// byte per row with bit 4 the leftmost pixel. Lower case prints as upper
+// case; characters without a glyph print as '?'.
+static const int CellW = 6, CellH = 8, AtlasColumns = 16;
+static const int AtlasW = CellW * AtlasColumns, AtlasH = CellH * 6;
+
+struct Glyph {
+    char c;
+    unsigned char rows[7];
+};
+
+static const Glyph glyphs[] = {
+    { '0', { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E } },
+    { '1', { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { '2', { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F } },
+    { '3', { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E } },
+    { '4', { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 } },
+    { '5', { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E } },
+    { '6', { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E } },
+    { '7', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+    { '8', { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E } },
+    { '9', { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C } },
+    { 'A', { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 } },
+    { 'B', { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E } },
+    { 'C', { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E } },
+    { 'D', { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C } },
+    { 'E', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F } },
+    { 'F', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 } },
+    { 'G', { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F } },
+    { 'H', { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+    { 'I', { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C } },
+    { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+    { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F } },
+    { 'M', { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+    { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+    { 'O', { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+    { 'P', { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 } },
+    { 'Q', { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D } },
+    { 'R', { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 } },
+    { 'S', { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E } },
+    { 'T', { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+    { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+    { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 } },
+    { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A } },
+    { 'X', { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 } },
+    { 'Y', { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 } },
+    { 'Z', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F } },
+    { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C } },
+    { ',', { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 } },
+    { ':', { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 } },
+    { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+    { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+    { '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+    { ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } },
+    { '[', { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E } },
+    { ']', { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E } },
+    { '-', { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 } },
+    { '+', { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 } },
+    { '=', { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 } },
+    { '_', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F } },
+    { '<', { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 } },
+    { '>', { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 } },
+    { '#', { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A } },
+    { '*', { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 } },
+    { '!', { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 } },
+    { '?', { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 } },
+    { '\'', { 0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 } },
+};
+
+static const char* hudVertSrc = R"(
+#version 330 core
+layout(location=0) in vec2 aPos;
+layout(location=1) in vec2 aTex;
+layout(location=2) in vec4 aColor;
+uniform vec2 screenSize;
+out vec2 TexCoord;
+out vec4 Color;
+void main(){
+    TexCoord = aTex;
+    Color = aColor;
+    vec2 p = aPos / screenSize * 2.0 - 1.0;
+    gl_Position = vec4(p.x, -p.y, 0.0, 1.0);
+}
+)";
+
+// texture coordinates are in texels; the panel texture is premultiplied, so
+// the color is too, and white passes the panel through
+static const char* hudFragSrc = R"(
+#version 330 core
+in vec2 TexCoord;
+in vec4 Color;
+uniform sampler2D panel;
+out vec4 FragColor;
+void main(){
+    FragColor = texelFetch(panel, ivec2(TexCoord), 0) * vec4(Color.rgb * Color.a, Color.a);
+}
+)";
+
+PerfHud::PerfHud()
+    : visible(false), VAO(0), VBO(0), EBO(0), shader(0), screenSizeLocation(-1), panelTexture(0), panelSize{ 0, 0 }, panelRect(0.0f),
+    historyHead(0), historyCount(0),
+    counters{ 0 }, targetBytes(0), lastRefresh(std::chrono::steady_clock::now()), refreshDue(true),
+    framesSinceRefresh(0), msSinceRefresh(0.0f), maxMsSinceRefresh(0.0f), fps(0.0f), meanMs(0.0f), maxMs(0.0f),
+    hudMsSinceRefresh(0.0), hudMs(0.0), memoryInfo(0), scale(1), textWidth(0), textHeight(0), graphRect(0.0f)
+{
+    std::fill(frameTimes, frameTimes + History, 0.0f);
+}
+
+PerfHud::~PerfHud() {
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
+    if (VBO) glDeleteBuffers(1, &VBO);
+    if (EBO) glDeleteBuffers(1, &EBO);
+    if (shader) GLState::DeleteProgram(shader);
+    if (panelTexture) GLState::DeleteTextures(1, &panelTexture);
+}
+
+void PerfHud::Init() {
+    shader = createProgram(hudVertSrc, hudFragSrc);
+    GLState::UseProgram(shader);
+    glUniform1i(glGetUniformLocation(shader, "panel"), 0);
+    screenSizeLocation = glGetUniformLocation(shader, "screenSize");
+
+    atlas.assign(AtlasW * AtlasH, 0);
+    auto cell = [&](int index) { return &atlas[(index / AtlasColumns) * CellH * AtlasW + (index % AtlasColumns) * CellW]; };
+    auto draw = [&](int index, const Glyph& g) {
+        unsigned char* dst = cell(index);
+        for (int y = 0; y < 7; y++)
+            for (int x = 0; x < 5; x++)
+                dst[y * AtlasW + x] = g.rows[y] & (0x10 >> x) ? 255 : 0;
+    };
+    // every cell starts out as '?' and the defined glyphs replace theirs
+    const Glyph* unknown = std::find_if(std::begin(glyphs), std::end(glyphs), [](const Glyph& g) { return g.c == '?'; });
+    for (int c = '!'; c < 127; c++) draw(c - 32, *unknown);
+    for (const Glyph& g : glyphs) draw(g.c - 32, g);
+    glGenTextures(1, &panelTexture);
+    GLState::BindTexture(GL_TEXTURE_2D, panelTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // every quad is four vertices and the same six indices; the attribute
+    // pointers are set per draw, since the vertices may sit anywhere in the ring buffer
+    std::vector<GLushort> indices;
+    for (GLushort q = 0; q < MaxQuads; q++)
+        for (GLushort i : { 0, 1, 2, 0, 2, 3 }) indices.push_back((GLushort)(q * 4 + i));
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    GLState::BindVertexArray(0);
+
+    memoryInfo = GLState::HasExtension("GL_NVX_gpu_memory_info") ? 1 : GLState::HasExtension("GL_ATI_meminfo") ? 2 : 0;
+}
+
+void PerfHud::AddFrame(float frameMs, const Counters& c, const RenderGraph& graph) {
+    auto start = std::chrono::steady_clock::now();
+    frameTimes[historyHead] = frameMs;
+    historyHead = (historyHead + 1) % History;
+    historyCount = std::min(historyCount + 1, History);
+    framesSinceRefresh++;
+    msSinceRefresh += frameMs;
+    maxMsSinceRefresh = std::max(maxMsSinceRefresh, frameMs);
+    float seconds = std::chrono::duration<float>(start - lastRefresh).count();
+    if (seconds >= RefreshSeconds) {
+        fps = framesSinceRefresh / seconds;
+        meanMs = msSinceRefresh / framesSinceRefresh;
+        maxMs = maxMsSinceRefresh;
+        hudMs = hudMsSinceRefresh / framesSinceRefresh;
+        framesSinceRefresh = 0;
+        msSinceRefresh = maxMsSinceRefresh = 0.0f;
+        hudMsSinceRefresh = 0.0;
+        lastRefresh = start;
+        // only the shown numbers are copied; hidden, the overlay keeps nothing but the graph
+        if (visible) {
+            counters = c;
+            passTimes = graph.PassTimes();
+            targetBytes = graph.GetStats().allocatedBytes;
+            refreshDue = true;
+        }
+    }
+    hudMsSinceRefresh += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PerfHud::quad(std::vector<Vertex>& out, const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const glm::vec2& d, uint32_t color) {
+    float u = 0.5f, v = panelRect.w + 0.5f;
+    out.push_back({ a.x, a.y, u, v, color });
+    out.push_back({ b.x, b.y, u, v, color });
+    out.push_back({ c.x, c.y, u, v, color });
+    out.push_back({ d.x, d.y, u, v, color });
+}
+
+void PerfHud::rect(std::vector<Vertex>& out, float x, float y, float w, float h, uint32_t color) {
+    quad(out, glm::vec2(x, y), glm::vec2(x + w, y), glm::vec2(x + w, y + h), glm::vec2(x, y + h), color);
+}
+
+void PerfHud::line(std::vector<Vertex>& out, const glm::vec2& a, const glm::vec2& b, float width, uint32_t color) {
+    glm::vec2 d = b - a;
+    float length = glm::length(d);
+    if (length <= 0.0f) return;
+    glm::vec2 n = glm::vec2(-d.y, d.x) / length * (width * 0.5f);
+    quad(out, a + n, b + n, b - n, a - n, color);
+}
+
+// the text colors are opaque, so glyph pixels replace the panel's; each is scale x scale
+int PerfHud::print(int panelWidth, int x, int y, const char* s, uint32_t color) {
+    for (; *s; s++, x += CellW * scale) {
+        int c = toupper((unsigned char)*s);
+        if (c == ' ') continue;
+        if (c < 32 || c > 126) c = '?';
+        const unsigned char* glyph = &atlas[((c - 32) / AtlasColumns) * CellH * AtlasW + ((c - 32) % AtlasColumns) * CellW];
+        for (int gy = 0; gy < 7; gy++)
+            for (int gx = 0; gx < 5; gx++) {
+                if (!glyph[gy * AtlasW + gx]) continue;
+                uint32_t* dst = &panel[(size_t)(y + gy * scale) * panelWidth + x + gx * scale];
+                for (int sy = 0; sy < scale; sy++, dst += panelWidth) std::fill(dst, dst + scale, color);
+            }
+    }
+    return x;
+}
+
+void PerfHud::refreshText(int width, int height) {
+    refreshDue = false;
+    textWidth = width;
+    textHeight = height;
+    scale = std::max(1, height / 480);
+
+    struct Line {
+        std::string text;
+        uint32_t color;
+    };
+    std::vector<Line> lines;
+    char buf[96];
+    auto add = [&](uint32_t color, const char* fmt, auto... args) {
+        snprintf(buf, sizeof(buf), fmt, args...);
+        lines.push_back({ buf, color });
+    };
+    add(textColor, "FPS %.1f  %.2f MS  MAX %.2f", fps, meanMs, maxMs);
+    // the graph takes the place of these lines
+    const int graphLines = 5;
+    for (int i = 0; i < graphLines; i++) lines.push_back({ "", textColor });
+    add(labelColor, "%-14s %8s", "PASS", "CPU MS");
+    for (const RenderGraph::PassTime& p : passTimes) add(textColor, "%-14.14s %8.3f", p.name, p.cpuMs);
+    GpuProfiler* profiler = GpuProfiler::Current();
+    uint64_t triangles = 0;
+    add(labelColor, "%-14s %8s", "ZONE", "GPU MS");
+    if (profiler) {
+        for (const GpuProfiler::ZoneResult& z : profiler->Latest().zones) {
+            add(textColor, "%-14.14s %8.3f", z.name, z.gpuMs);
+            triangles += z.primitives;
+        }
+    }
+    else add(labelColor, "NO GPU PROFILER");
+    GLState::Stats gs = GLState::FrameStats();
+    add(textColor, "DRAWS %llu  STATE %llu", (unsigned long long)gs.draws, (unsigned long long)gs.issued);
+    add(labelColor, "  %llu REDUNDANT SKIPPED", (unsigned long long)gs.elided);
+    if (profiler && profiler->PipelineStatistics()) add(textColor, "TRIANGLES %llu", (unsigned long long)triangles);
+    else add(textColor, "TRIANGLES -");
+    add(textColor, "CULLED %llu", (unsigned long long)counters.culled);
+    size_t textureBytes = TextureResidency::Current() ? TextureResidency::Current()->GetStats().residentBytes : 0;
+    add(textColor, "GPU MEM %.1f MB", (textureBytes + targetBytes) / (1024.0 * 1024.0));
+    add(labelColor, "  TEX %.1f  TARGETS %.1f", textureBytes / (1024.0 * 1024.0), targetBytes / (1024.0 * 1024.0));
+    if (memoryInfo) {
+        // both report kilobytes; ATI gives four values, the first is the free pool
+        GLint available[4] = { 0, 0, 0, 0 };
+        glGetIntegerv(memoryInfo == 1 ? GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX : TEXTURE_FREE_MEMORY_ATI, available);
+        add(labelColor, "  VRAM FREE %d MB", available[0] / 1024);
+    }
+    double hudGpuMs = 0.0;
+    if (profiler)
+        for (const GpuProfiler::ZoneResult& z : profiler->Latest().zones)
+            if (!strcmp(z.name, "hud")) hudGpuMs = z.gpuMs;
+    add(labelColor, "HUD %.3f CPU %.3f GPU", hudMs, hudGpuMs);
+
+    float s = (float)scale, lineH = 10.0f * s, pad = 4.0f * s;
+    size_t columns = 0;
+    for (const Line& l : lines) columns = std::max(columns, l.text.size());
+    float x = 8.0f * s, y = 8.0f * s;
+    int panelW = (int)(columns * CellW * s + 2.0f * pad), panelH = (int)(lines.size() * lineH + 2.0f * pad - 3.0f * s);
+    // one more row, white, for the solid quads to sample
+    panel.assign((size_t)panelW * (panelH + 1), premultiply(panelColor));
+    std::fill(panel.end() - panelW, panel.end(), rgba(255, 255, 255));
+    for (size_t i = 0; i < lines.size(); i++)
+        print(panelW, (int)pad, (int)(pad + i * lineH), lines[i].text.c_str(), lines[i].color);
+    panelRect = glm::vec4(x, y, (float)panelW, (float)panelH);
+    graphRect = glm::vec4(x + pad, y + pad + lineH, panelW - 2.0f * pad, graphLines * lineH - 3.0f * s);
+
+    // reallocated only when the panel grows or shrinks, which is rarely
+    GLState::BindTexture(GL_TEXTURE_2D, panelTexture);
+    if (panelW != panelSize[0] || panelH != panelSize[1]) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, panelW, panelH + 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        panelSize[0] = panelW;
+        panelSize[1] = panelH;
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, panelW, panelH + 1, GL_RGBA, GL_UNSIGNED_BYTE, panel.data());
+}
+
+// frame times oldest to newest, against lines at the 60 and 30 fps budgets,
+// appended to quads
+void PerfHud::buildGraph() {
+    float x = graphRect.x, y = graphRect.y, w = graphRect.z, h = graphRect.w;
+    rect(quads, x, y, w, h, graphColor);
+    float top = 1000.0f / 30.0f;
+    for (int i = 0; i < historyCount; i++) top = std::max(top, frameTimes[i]);
+    // whole 60 fps frames, so the budget lines stay put while the maximum moves
+    top = ceilf(top / (1000.0f / 60.0f)) * (1000.0f / 60.0f);
+    auto plotY = [&](float ms) { return y + h - std::min(ms / top, 1.0f) * h; };
+    float s = (float)scale;
+    line(quads, glm::vec2(x, plotY(1000.0f / 60.0f)), glm::vec2(x + w, plotY(1000.0f / 60.0f)), s, budgetColor);
+    line(quads, glm::vec2(x, plotY(1000.0f / 30.0f)), glm::vec2(x + w, plotY(1000.0f / 30.0f)), s, budgetColor);
+    float step = w / (History - 1);
+    glm::vec2 previous(0.0f);
+    for (int i = 0; i < historyCount; i++) {
+        float ms = frameTimes[(historyHead - historyCount + i + History) % History];
+        glm::vec2 p(x + w - (historyCount - 1 - i) * step, plotY(ms));
+        uint32_t color = ms <= 1000.0f / 58.0f ? rgba(90, 220, 90) : ms <= 1000.0f / 29.0f ? rgba(240, 210, 70) : rgba(240, 80, 70);
+        if (i > 0) line(quads, previous, p, s, color);
+        previous = p;
+    }
+}
+
+void PerfHud::Draw(int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    if (refreshDue || width != textWidth || height != textHeight) refreshText(width, height);
+    // the panel, its texels one to a pixel, then the graph over it
+    quads.clear();
+    float x = panelRect.x, y = panelRect.y, w = panelRect.z, h = panelRect.w;
+    quads.push_back({ x, y, 0.0f, 0.0f, rgba(255, 255, 255) });
+    quads.push_back({ x + w, y, w, 0.0f, rgba(255, 255, 255) });
+    quads.push_back({ x + w, y + h, w, h, rgba(255, 255, 255) });
+    quads.push_back({ x, y + h, 0.0f, h, rgba(255, 255, 255) });
+    buildGraph();
+    size_t count = quads.size();
+    size_t bytes = count * sizeof(Vertex);
+    FrameRingBuffer* ring = FrameRingBuffer::Current();
+    FrameRingBuffer::Allocation a = { nullptr, 0 };
+    if (ring) a = ring->Alloc(bytes);
+    GLuint buffer = VBO;
+    GLintptr offset = 0;
+    if (a.ptr) {
+        memcpy(a.ptr, quads.data(), bytes);
+        buffer = ring->Buffer();
+        offset = a.offset;
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, bytes, quads.data(), GL_STREAM_DRAW);
+    }
+
+    GLState::UseProgram(shader);
+    glUniform2f(screenSizeLocation, (float)width, (float)height);
+    GLState::Disable(GL_DEPTH_TEST);
+    GLState::Disable(GL_CULL_FACE);
+    GLState::Enable(GL_BLEND);
+    GLState::BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D, panelTexture);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, x)));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, u)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, color)));
+    // quads past the index buffer are left out
+    glDrawElements(GL_TRIANGLES, (GLsizei)std::min(count / 4, (size_t)MaxQuads) * 6, GL_UNSIGNED_SHORT, 0);
+    GLState::CountDraw();
+    GLState::Disable(GL_BLEND);
+    GLState::Enable(GL_DEPTH_TEST);
+    hudMsSinceRefresh += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+GLuint PerfHud::compileShader(const char* src, GLenum type) {
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    return s;
+}
+
+GLuint PerfHud::createProgram(const char* vs, const char* fs) {
+    GLuint v = compileShader(vs, GL_VERTEX_SHADER);
+    GLuint f = compileShader(fs, GL_FRAGMENT_SHADER);
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v);
+    glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v);
+    glDeleteShader(f);
+    return p;
+}
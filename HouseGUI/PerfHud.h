@@ -0,0 +1,84 @@
+// PerfHud.h
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "RenderGraph.h"
+
+// On-screen overlay with a frame-time graph and the renderer's counters:
+// FPS, CPU time per render graph pass, GPU time per GpuProfiler zone, draw
+// calls and GL state changes (GLState), triangles, culled objects and GPU
+// memory. Text comes from a built-in 5x7 bitmap font and lines are thin
+// quads. The text panel is rebuilt a few times a second (readable numbers,
+// less work): drawn on the CPU, since it is only glyphs over a rectangle,
+// and uploaded into a texture that every frame draws as one quad. The graph
+// follows every frame, in the same draw. The overlay times itself and shows
+// that too.
+class PerfHud {
+public:
+    struct Counters {
+        // objects the culling dropped from the last scene pass
+        uint64_t culled;
+    };
+    PerfHud();
+    ~PerfHud();
+    void Init();
+    bool Visible() const { return visible; }
+    void SetVisible(bool v) { visible = v; }
+    void Toggle() { visible = !visible; }
+    // once per frame, shown or not, so the graph has a history when it appears
+    void AddFrame(float frameMs, const Counters& counters, const RenderGraph& graph);
+    // into the bound framebuffer, which is width x height pixels
+    void Draw(int width, int height);
+private:
+    static constexpr int History = 120;
+    // 16-bit indices
+    static constexpr int MaxQuads = 16384;
+    static constexpr float RefreshSeconds = 0.25f;
+    struct Vertex {
+        float x, y, u, v;
+        uint32_t color;
+    };
+    bool visible;
+    GLuint VAO, VBO, EBO, shader;
+    GLint screenSizeLocation;
+    // the text panel as last drawn, premultiplied RGBA from the top row
+    // down with a white row below, and where it goes on screen
+    GLuint panelTexture;
+    int panelSize[2];
+    std::vector<uint32_t> panel;
+    glm::vec4 panelRect;
+    // glyph coverage, 255 or 0
+    std::vector<unsigned char> atlas;
+    float frameTimes[History];
+    int historyHead, historyCount;
+    Counters counters;
+    // pass names point into the graph, which outlives the overlay
+    std::vector<RenderGraph::PassTime> passTimes;
+    size_t targetBytes;
+    std::chrono::steady_clock::time_point lastRefresh;
+    bool refreshDue;
+    int framesSinceRefresh;
+    float msSinceRefresh, maxMsSinceRefresh;
+    float fps, meanMs, maxMs;
+    double hudMsSinceRefresh, hudMs;
+    // 0 none, 1 NVX_gpu_memory_info, 2 ATI_meminfo
+    int memoryInfo;
+    int scale, textWidth, textHeight;
+    glm::vec4 graphRect;
+    // the panel quad and the graph, rebuilt every frame
+    std::vector<Vertex> quads;
+    void refreshText(int width, int height);
+    void buildGraph();
+    void quad(std::vector<Vertex>& out, const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const glm::vec2& d, uint32_t color);
+    void rect(std::vector<Vertex>& out, float x, float y, float w, float h, uint32_t color);
+    void line(std::vector<Vertex>& out, const glm::vec2& a, const glm::vec2& b, float width, uint32_t color);
+    // into panel, whose rows are panelWidth pixels; returns the x after the last character
+    int print(int panelWidth, int x, int y, const char* s, uint32_t color);
+    GLuint compileShader(const char* src, GLenum type);
+    GLuint createProgram(const char* vs, const char* fs);
+};
@@ -0,0 +1,341 @@
+// RegionStore.cpp
+#include "RegionStore.h"
+#include "CpuProfiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+static const char regionMagic[4] = { 'H', 'G', 'R', 'G' };
+
+static_assert(sizeof(Scene::Block) == 16 && sizeof(Scene::Instance) == 16, "records split 16-byte structs into byte planes");
+
+namespace {
+    const size_t EdgeBytes = sizeof(WorldGen::Chunk::edges);
+    const size_t MinMatch = 4;
+    const int HashBits = 12;
+    const uint32_t NoPosition = 0xFFFFFFFFu;
+
+    int floorDiv(int a, int b) {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    uint32_t read32(const unsigned char* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    // byte k of every struct, then byte k + 1, ...
+    void shuffle(const unsigned char* src, size_t count, size_t stride, unsigned char* dst) {
+        for (size_t b = 0; b < stride; b++)
+            for (size_t i = 0; i < count; i++) dst[b * count + i] = src[i * stride + b];
+    }
+
+    void unshuffle(const unsigned char* src, size_t count, size_t stride, unsigned char* dst) {
+        for (size_t b = 0; b < stride; b++)
+            for (size_t i = 0; i < count; i++) dst[i * stride + b] = src[b * count + i];
+    }
+
+    // the part of a length the token's four bits cannot hold
+    void putLength(std::vector<unsigned char>& out, size_t n) {
+        for (; n >= 255; n -= 255) out.push_back(255);
+        out.push_back((unsigned char)n);
+    }
+
+    bool getLength(const unsigned char* src, size_t n, size_t& i, size_t& length) {
+        unsigned char b;
+        do {
+            if (i >= n) return false;
+            b = src[i++];
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+
+    // one LZ4-style sequence: a token with the literal and match lengths, the
+    // literals, then a 16-bit offset back to the match; the last sequence has
+    // no match
+    void sequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t literalCount, size_t offset, size_t matchLength) {
+        size_t extra = matchLength ? matchLength - MinMatch : 0;
+        out.push_back((unsigned char)(std::min<size_t>(literalCount, 15) << 4 | std::min<size_t>(extra, 15)));
+        if (literalCount >= 15) putLength(out, literalCount - 15);
+        out.insert(out.end(), literals, literals + literalCount);
+        if (!matchLength) return;
+        out.push_back((unsigned char)(offset & 255));
+        out.push_back((unsigned char)(offset >> 8));
+        if (extra >= 15) putLength(out, extra - 15);
+    }
+
+    void compress(const unsigned char* src, size_t n, std::vector<unsigned char>& out) {
+        uint32_t table[1 << HashBits];
+        std::fill(std::begin(table), std::end(table), NoPosition);
+        out.clear();
+        size_t i = 0, anchor = 0;
+        // the last bytes stay literals, so matches can read four bytes anywhere before them
+        const size_t limit = n > 12 ? n - 12 : 0;
+        while (i < limit) {
+            uint32_t v = read32(src + i);
+            uint32_t h = (v * 2654435761u) >> (32 - HashBits);
+            uint32_t candidate = table[h];
+            table[h] = (uint32_t)i;
+            if (candidate == NoPosition || i - candidate > 65535 || read32(src + candidate) != v) {
+                i++;
+                continue;
+            }
+            size_t length = MinMatch;
+            while (i + length < n - 5 && src[candidate + length] == src[i + length]) length++;
+            sequence(out, src + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+        }
+        sequence(out, src + anchor, n - anchor, 0, 0);
+    }
+
+    bool decompress(const unsigned char* src, size_t n, unsigned char* dst, size_t size) {
+        size_t i = 0, o = 0;
+        while (i < n) {
+            unsigned char token = src[i++];
+            size_t literals = token >> 4;
+            if (literals == 15 && !getLength(src, n, i, literals)) return false;
+            if (literals > n - i || literals > size - o) return false;
+            memcpy(dst + o, src + i, literals);
+            i += literals;
+            o += literals;
+            if (i == n) break;
+            if (n - i < 2) return false;
+            size_t offset = src[i] | (size_t)src[i + 1] << 8;
+            i += 2;
+            size_t length = token & 15;
+            if (length == 15 && !getLength(src, n, i, length)) return false;
+            length += MinMatch;
+            if (offset == 0 || offset > o || length > size - o) return false;
+            // byte by byte: the match may overlap what it writes
+            for (size_t k = 0; k < length; k++) dst[o + k] = dst[o - offset + k];
+            o += length;
+        }
+        return o == size;
+    }
+}
+
+RegionStore::RegionStore(const std::string& directory, const WorldGen& gen, const Scene& scene)
+    : directory(directory), seed(gen.Seed()), prefabCount((uint32_t)scene.PrefabCount()), fingerprint(gen.Fingerprint(scene)),
+    maxHeight(gen.MaxHeight()), saving(false), stats()
+{
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+}
+
+RegionStore::~RegionStore() {
+    Wait();
+}
+
+std::string RegionStore::regionPath(int rx, int rz) const {
+    return directory + "/r." + std::to_string(rx) + "." + std::to_string(rz) + ".hgr";
+}
+
+// a region of this store's world
+bool RegionStore::matches(const Header& h) const {
+    return !memcmp(h.magic, regionMagic, 4) && h.version == Version && h.seed == seed && h.prefabCount == prefabCount && h.fingerprint == fingerprint;
+}
+
+// what a damaged record could hold: block types past the table, prefabs the
+// scene does not have, levels past the world's, positions that are not numbers
+bool RegionStore::valid(const WorldGen::Chunk& chunk, const PaletteChunk::Value* cells, size_t cellCount) const {
+    for (size_t i = 0; i < cellCount; i++) {
+        PaletteChunk::Value v = cells[i];
+        if (v != PaletteChunk::Air && (PaletteChunk::TypeOf(v) >= Scene::BlockTypes || PaletteChunk::RotationOf(v) > 3)) return false;
+    }
+    for (const auto& edge : chunk.edges)
+        for (int8_t level : edge)
+            if (level < -1 || level > maxHeight) return false;
+    auto finite = [](const glm::vec3& p) { return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z); };
+    for (const Scene::Block& b : chunk.billboards)
+        if (b.type >= Scene::BlockTypes || !finite(b.position)) return false;
+    for (const Scene::Instance& inst : chunk.instances)
+        if (inst.prefab >= prefabCount || !finite(inst.position)) return false;
+    return true;
+}
+
+// the cached header of a region, read on first use; call with lock held
+RegionStore::Region& RegionStore::region(int rx, int rz) {
+    auto it = regions.find({ rx, rz });
+    if (it != regions.end()) return it->second;
+    Region& r = regions[{ rx, rz }];
+    r.exists = false;
+    r.file.reset(new std::ifstream(regionPath(rx, rz), std::ios::binary));
+    if (*r.file && r.file->read((char*)&r.header, sizeof(Header)) && matches(r.header) && r.header.regionX == rx && r.header.regionZ == rz)
+        r.exists = true;
+    else
+        r.file.reset();
+    return r;
+}
+
+bool RegionStore::Load(WorldGen::Chunk& chunk) {
+    PROFILE_SCOPE("RegionStore::Load");
+    auto start = std::chrono::steady_clock::now();
+    int rx = floorDiv(chunk.x, RegionSize), rz = floorDiv(chunk.z, RegionSize);
+    int slot = (chunk.z - rz * RegionSize) * RegionSize + (chunk.x - rx * RegionSize);
+    Record record;
+    std::vector<unsigned char> packed;
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        Region& r = region(rx, rz);
+        if (!r.exists) return false;
+        Entry e = r.header.entries[slot];
+        if (e.size < sizeof(Record)) return false;
+        r.file->clear();
+        r.file->seekg(e.offset);
+        if (!r.file->read((char*)&record, sizeof(Record)) || record.packedBytes != e.size - sizeof(Record)) return false;
+        packed.resize(record.packedBytes);
+        if (!r.file->read((char*)packed.data(), packed.size())) return false;
+    }
+    const size_t cellCount = (size_t)PaletteChunk::Size * PaletteChunk::Size * record.height;
+    size_t billboardBytes = (size_t)record.billboardCount * sizeof(Scene::Block), instanceBytes = (size_t)record.instanceCount * sizeof(Scene::Instance);
+    if (record.height > (uint32_t)maxHeight + 1 || record.rawBytes != billboardBytes + instanceBytes + EdgeBytes + cellCount * sizeof(PaletteChunk::Value)) return false;
+    std::vector<unsigned char> raw(record.rawBytes);
+    if (!decompress(packed.data(), packed.size(), raw.data(), raw.size())) return false;
+    chunk.billboards.resize(record.billboardCount);
+    chunk.instances.resize(record.instanceCount);
+    const unsigned char* p = raw.data();
+    unshuffle(p, record.billboardCount, sizeof(Scene::Block), (unsigned char*)chunk.billboards.data());
+    p += billboardBytes;
+    unshuffle(p, record.instanceCount, sizeof(Scene::Instance), (unsigned char*)chunk.instances.data());
+    p += instanceBytes;
+    memcpy(chunk.edges, p, EdgeBytes);
+    p += EdgeBytes;
+    static thread_local std::vector<PaletteChunk::Value> cells;
+    cells.resize(cellCount);
+    unshuffle(p, cellCount, sizeof(PaletteChunk::Value), (unsigned char*)cells.data());
+    if (!valid(chunk, cells.data(), cellCount)) return false;
+    chunk.voxels.Reset((int)record.height);
+    chunk.voxels.Assign(cells.data());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lk(lock);
+    stats.chunksLoaded++;
+    stats.loadedRawBytes += record.rawBytes;
+    stats.loadSeconds += seconds;
+    return true;
+}
+
+bool RegionStore::Save(const Snapshot& chunks) {
+    PROFILE_SCOPE("RegionStore::Save");
+    auto start = std::chrono::steady_clock::now();
+    std::map<std::pair<int, int>, std::vector<const WorldGen::Chunk*>> byRegion;
+    for (const auto& c : chunks) byRegion[{ floorDiv(c->x, RegionSize), floorDiv(c->z, RegionSize) }].push_back(c.get());
+    uint64_t rawBytes = 0, packedBytes = 0;
+    bool ok = true;
+    std::vector<unsigned char> raw, packed, old, out;
+    std::vector<PaletteChunk::Value> cells;
+    for (auto& kv : byRegion) {
+        int rx = kv.first.first, rz = kv.first.second;
+        std::string path = regionPath(rx, rz);
+        // chunks this save does not carry keep their old records
+        old.clear();
+        {
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            if (in) {
+                old.resize((size_t)in.tellg());
+                in.seekg(0);
+                in.read((char*)old.data(), old.size());
+            }
+        }
+        // a region of another world is replaced whole
+        const Header* oldHeader = old.size() >= sizeof(Header) && matches(*(const Header*)old.data()) ? (const Header*)old.data() : nullptr;
+        const WorldGen::Chunk* fresh[RegionSize * RegionSize] = {};
+        for (const WorldGen::Chunk* c : kv.second) fresh[(c->z - rz * RegionSize) * RegionSize + (c->x - rx * RegionSize)] = c;
+
+        Header h = {};
+        memcpy(h.magic, regionMagic, 4);
+        h.version = Version;
+        h.regionX = rx;
+        h.regionZ = rz;
+        h.seed = seed;
+        h.prefabCount = prefabCount;
+        h.fingerprint = fingerprint;
+        out.assign(sizeof(Header), 0);
+        for (int slot = 0; slot < RegionSize * RegionSize; slot++) {
+            const WorldGen::Chunk* c = fresh[slot];
+            if (c) {
+                size_t billboardBytes = c->billboards.size() * sizeof(Scene::Block), instanceBytes = c->instances.size() * sizeof(Scene::Instance);
+                cells.resize(c->voxels.Volume());
+                c->voxels.Read(cells.data());
+                raw.resize(billboardBytes + instanceBytes + EdgeBytes + cells.size() * sizeof(PaletteChunk::Value));
+                unsigned char* p = raw.data();
+                shuffle((const unsigned char*)c->billboards.data(), c->billboards.size(), sizeof(Scene::Block), p);
+                p += billboardBytes;
+                shuffle((const unsigned char*)c->instances.data(), c->instances.size(), sizeof(Scene::Instance), p);
+                p += instanceBytes;
+                memcpy(p, c->edges, EdgeBytes);
+                p += EdgeBytes;
+                shuffle((const unsigned char*)cells.data(), cells.size(), sizeof(PaletteChunk::Value), p);
+                compress(raw.data(), raw.size(), packed);
+                Record record = { (uint32_t)c->billboards.size(), (uint32_t)c->instances.size(), (uint32_t)c->voxels.Height(),
+                    (uint32_t)raw.size(), (uint32_t)packed.size() };
+                h.entries[slot] = { (uint32_t)out.size(), (uint32_t)(sizeof(Record) + packed.size()) };
+                out.insert(out.end(), (const unsigned char*)&record, (const unsigned char*)(&record + 1));
+                out.insert(out.end(), packed.begin(), packed.end());
+                rawBytes += raw.size();
+                packedBytes += packed.size();
+            }
+            else if (oldHeader) {
+                Entry e = oldHeader->entries[slot];
+                if (e.size == 0 || e.offset > old.size() || e.size > old.size() - e.offset) continue;
+                h.entries[slot] = { (uint32_t)out.size(), e.size };
+                out.insert(out.end(), old.begin() + e.offset, old.begin() + e.offset + e.size);
+            }
+        }
+        memcpy(out.data(), &h, sizeof(Header));
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream f(temp, std::ios::binary | std::ios::trunc);
+            f.write((const char*)out.data(), out.size());
+            if (!f) {
+                std::cout << "regions: could not write " << temp << std::endl;
+                ok = false;
+                continue;
+            }
+        }
+        // loads hold the lock while they read, and the cached handle has to be closed before the rename on Windows
+        std::lock_guard<std::mutex> lk(lock);
+        regions.erase({ rx, rz });
+        std::error_code ec;
+        std::filesystem::rename(temp, path, ec);
+        if (ec) {
+            std::cout << "regions: could not replace " << path << ": " << ec.message() << std::endl;
+            ok = false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lk(lock);
+    stats.chunksSaved += chunks.size();
+    stats.savedRawBytes += rawBytes;
+    stats.savedPackedBytes += packedBytes;
+    stats.saveSeconds += seconds;
+    return ok;
+}
+
+bool RegionStore::SaveAsync(Snapshot chunks) {
+    if (saving) return false;
+    if (saver.joinable()) saver.join();
+    saving = true;
+    saver = std::thread([this, chunks = std::move(chunks)]() {
+        CpuProfiler::SetThreadName("region saver");
+        Save(chunks);
+        saving = false;
+    });
+    return true;
+}
+
+void RegionStore::Wait() {
+    if (saver.joinable()) saver.join();
+}
+
+RegionStore::Stats RegionStore::GetStats() const {
+    std::lock_guard<std::mutex> lk(lock);
+    Stats s = stats;
+    s.saving = saving;
+    return s;
+}
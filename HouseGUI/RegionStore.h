@@ -0,0 +1,98 @@
+// RegionStore.h
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "WorldGen.h"
+
+// Saved world chunks, in a directory of region files. A region file holds
+// the chunks of a RegionSize x RegionSize square: a header with an offset
+// table, one entry per chunk, then the chunk records. A record is the
+// chunk's billboards, instances (prefab indices into the scene that
+// generated them), edge levels and cubes, one palette value per cell,
+// compressed: the structs and values are split into byte planes first
+// (positions on a grid share most of their bytes, and layers of one value
+// are runs), then packed with a small LZ4-style codec. The cells are packed
+// back into palette storage on load.
+//
+// The header names the world the region belongs to, by its seed and by a
+// fingerprint of its settings and the scene's prefabs. A region of another
+// world is treated as absent and overwritten by the next save, and a record
+// whose block types, prefab indices or levels do not fit this world counts
+// as damaged, so a chunk is generated again instead of read out of bounds.
+//
+// Saves run on their own thread from snapshots: shared pointers to chunks
+// nobody writes to any more, so taking one is copying pointers. A save
+// rewrites each region it touches into a temporary file, keeping the records
+// of chunks it does not carry, and renames it over the old one. Loads are
+// safe from any thread and see either the old or the new file.
+class RegionStore {
+public:
+    static constexpr int RegionSize = 32;
+    static constexpr uint32_t Version = 3;
+    struct Entry {
+        uint32_t offset, size;
+    };
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        int32_t regionX, regionZ;
+        uint32_t seed, prefabCount;
+        uint64_t fingerprint;
+        Entry entries[RegionSize * RegionSize];
+    };
+    struct Record {
+        uint32_t billboardCount, instanceCount, height, rawBytes, packedBytes;
+    };
+    struct Stats {
+        uint64_t chunksSaved, savedRawBytes, savedPackedBytes;
+        double saveSeconds;
+        uint64_t chunksLoaded, loadedRawBytes;
+        double loadSeconds;
+        bool saving;
+    };
+    typedef std::vector<std::shared_ptr<const WorldGen::Chunk>> Snapshot;
+
+    // the chunks of gen's world, whose instances index the prefabs of scene
+    RegionStore(const std::string& directory, const WorldGen& gen, const Scene& scene);
+    // waits for a save in progress
+    ~RegionStore();
+    RegionStore(const RegionStore&) = delete;
+    RegionStore& operator=(const RegionStore&) = delete;
+    // false when the chunk was never saved or its record is damaged; x and z
+    // of the chunk have to be set
+    bool Load(WorldGen::Chunk& chunk);
+    // false while the previous save still runs
+    bool SaveAsync(Snapshot chunks);
+    bool Save(const Snapshot& chunks);
+    void Wait();
+    Stats GetStats() const;
+private:
+    struct Region {
+        std::unique_ptr<std::ifstream> file;
+        Header header;
+        bool exists;
+    };
+    std::string directory;
+    uint32_t seed, prefabCount;
+    uint64_t fingerprint;
+    int maxHeight;
+    mutable std::mutex lock;
+    std::map<std::pair<int, int>, Region> regions;
+    std::thread saver;
+    std::atomic<bool> saving;
+    // under lock
+    Stats stats;
+    std::string regionPath(int rx, int rz) const;
+    Region& region(int rx, int rz);
+    bool matches(const Header& h) const;
+    bool valid(const WorldGen::Chunk& chunk, const PaletteChunk::Value* cells, size_t cellCount) const;
+};
@@ -0,0 +1,281 @@
+// RenderGraph.cpp
+#include "RenderGraph.h"
+#include "GLState.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+static bool isDepthFormat(GLenum format) {
+    switch (format) {
+    case GL_DEPTH_COMPONENT: case GL_DEPTH_COMPONENT16: case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32: case GL_DEPTH_COMPONENT32F:
+    case GL_DEPTH24_STENCIL8: case GL_DEPTH32F_STENCIL8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool hasStencil(GLenum format) {
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+void RenderGraph::Builder::Read(Resource r) {
+    graph.passes[pass].reads.push_back(r);
+}
+
+void RenderGraph::Builder::Write(Resource r) {
+    graph.passes[pass].writes.push_back(r);
+    graph.resources[r].writers.push_back(pass);
+}
+
+RenderGraph::RenderGraph() : stats{ 0, 0, 0, 0, 0, 0 }, compiled(false) {}
+
+RenderGraph::~RenderGraph() {
+    for (Pass& p : passes)
+        if (p.fbo) glDeleteFramebuffers(1, &p.fbo);
+    for (Physical& p : pool) GLState::DeleteTextures(1, &p.texture);
+}
+
+RenderGraph::Resource RenderGraph::CreateTexture(const std::string& name, const TextureDesc& desc) {
+    resources.push_back({ name, desc, true, false, false, 0, -1, -1, -1, {} });
+    compiled = false;
+    return (Resource)resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::ImportTexture(const std::string& name, GLuint texture, const TextureDesc& desc) {
+    resources.push_back({ name, desc, false, false, false, texture, -1, -1, -1, {} });
+    compiled = false;
+    return (Resource)resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::Backbuffer(int width, int height) {
+    TextureDesc desc = { width, height, GL_RGBA8 };
+    resources.push_back({ "backbuffer", desc, false, true, true, 0, -1, -1, -1, {} });
+    compiled = false;
+    return (Resource)resources.size() - 1;
+}
+
+void RenderGraph::MarkOutput(Resource r) {
+    resources[r].output = true;
+    compiled = false;
+}
+
+void RenderGraph::AddPass(const std::string& name, const SetupFn& setup, const ExecuteFn& execute) {
+    passes.push_back({ name, execute, {}, {}, false, 0, 0.0 });
+    Builder builder(*this, (int)passes.size() - 1);
+    setup(builder);
+    compiled = false;
+}
+
+bool RenderGraph::Compile() {
+    if (!sortPasses()) return false;
+    cullPasses();
+    allocateTransients();
+    createFramebuffers();
+    compiled = true;
+    return true;
+}
+
+// A reader runs after the writers declared before it (after all writers when
+// none is), and a writer runs after the passes still reading the previous
+// contents. Ties keep declaration order.
+bool RenderGraph::sortPasses() {
+    size_t n = passes.size();
+    std::vector<std::vector<int>> edges(n);
+    std::vector<int> incoming(n, 0);
+    auto addEdge = [&](int from, int to) {
+        if (from == to) return;
+        edges[from].push_back(to);
+        incoming[to]++;
+    };
+    for (int p = 0; p < (int)n; p++) {
+        for (Resource r : passes[p].reads) {
+            const std::vector<int>& writers = resources[r].writers;
+            bool earlier = std::any_of(writers.begin(), writers.end(), [&](int w) { return w < p; });
+            for (int w : writers)
+                if (!earlier || w < p) addEdge(w, p);
+                else addEdge(p, w);
+        }
+        for (Resource r : passes[p].writes)
+            for (int w : resources[r].writers)
+                if (w < p) addEdge(w, p);
+    }
+    order.clear();
+    std::vector<bool> done(n, false);
+    for (size_t k = 0; k < n; k++) {
+        int next = -1;
+        for (int p = 0; p < (int)n && next < 0; p++)
+            if (!done[p] && incoming[p] == 0) next = p;
+        if (next < 0) {
+            std::cout << "render graph: passes depend on each other in a cycle" << std::endl;
+            return false;
+        }
+        done[next] = true;
+        order.push_back(next);
+        for (int to : edges[next]) incoming[to]--;
+    }
+    return true;
+}
+
+// walks backwards from the outputs; a pass lives if something live needs what it writes
+void RenderGraph::cullPasses() {
+    std::vector<bool> needed(resources.size(), false);
+    for (size_t r = 0; r < resources.size(); r++) needed[r] = resources[r].output;
+    stats.passes = stats.culledPasses = 0;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        Pass& p = passes[*it];
+        p.live = std::any_of(p.writes.begin(), p.writes.end(), [&](Resource r) { return needed[r]; });
+        if (!p.live) {
+            stats.culledPasses++;
+            continue;
+        }
+        stats.passes++;
+        for (Resource r : p.reads) needed[r] = true;
+    }
+}
+
+// Transients are placed in first-use order into the first pooled texture of
+// the same description that is free by then.
+void RenderGraph::allocateTransients() {
+    std::vector<int> transients;
+    for (ResourceInfo& r : resources) r.firstUse = r.lastUse = r.physical = -1;
+    for (int i = 0; i < (int)order.size(); i++) {
+        Pass& p = passes[order[i]];
+        if (!p.live) continue;
+        for (const std::vector<Resource>* list : { &p.reads, &p.writes })
+            for (Resource r : *list) {
+                ResourceInfo& info = resources[r];
+                if (!info.transient) continue;
+                if (info.firstUse < 0) {
+                    info.firstUse = i;
+                    transients.push_back(r);
+                }
+                info.lastUse = i;
+            }
+    }
+    std::vector<bool> used(pool.size(), false);
+    for (Physical& p : pool) p.busyUntil = -1;
+    stats.transients = (int)transients.size();
+    stats.requestedBytes = 0;
+    for (Resource r : transients) {
+        ResourceInfo& info = resources[r];
+        stats.requestedBytes += textureBytes(info.desc);
+        for (size_t k = 0; k < pool.size() && info.physical < 0; k++)
+            if (pool[k].desc == info.desc && pool[k].busyUntil < info.firstUse) info.physical = (int)k;
+        if (info.physical < 0) {
+            Physical p = { info.desc, 0, -1 };
+            glGenTextures(1, &p.texture);
+            GLState::BindTexture(GL_TEXTURE_2D, p.texture);
+            bool depth = isDepthFormat(info.desc.format);
+            GLenum base = depth ? (hasStencil(info.desc.format) ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT) : GL_RGBA;
+            GLenum type = hasStencil(info.desc.format) ? GL_UNSIGNED_INT_24_8 : depth ? GL_FLOAT : GL_UNSIGNED_BYTE;
+            glTexImage2D(GL_TEXTURE_2D, 0, info.desc.format, info.desc.width, info.desc.height, 0, base, type, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, info.desc.filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, info.desc.filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, info.desc.wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, info.desc.wrap);
+            if (info.desc.wrap == GL_CLAMP_TO_BORDER) {
+                float border[4] = { 1, 1, 1, 1 };
+                glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+            }
+            pool.push_back(p);
+            used.push_back(false);
+            info.physical = (int)pool.size() - 1;
+        }
+        pool[info.physical].busyUntil = info.lastUse;
+        used[info.physical] = true;
+    }
+    // whatever the new graph no longer needs goes back to the driver
+    std::vector<int> remap(pool.size(), -1);
+    std::vector<Physical> kept;
+    for (size_t k = 0; k < pool.size(); k++) {
+        if (used[k]) {
+            remap[k] = (int)kept.size();
+            kept.push_back(pool[k]);
+        }
+        else GLState::DeleteTextures(1, &pool[k].texture);
+    }
+    pool.swap(kept);
+    for (ResourceInfo& r : resources)
+        if (r.physical >= 0) r.physical = remap[r.physical];
+    stats.physical = (int)pool.size();
+    stats.allocatedBytes = 0;
+    for (Physical& p : pool) stats.allocatedBytes += textureBytes(p.desc);
+}
+
+void RenderGraph::createFramebuffers() {
+    for (Pass& p : passes) {
+        if (p.fbo) glDeleteFramebuffers(1, &p.fbo);
+        p.fbo = 0;
+        if (!p.live) continue;
+        bool backbuffer = std::any_of(p.writes.begin(), p.writes.end(), [&](Resource r) { return resources[r].backbuffer; });
+        if (backbuffer) {
+            if (p.writes.size() > 1) std::cout << "render graph: pass " << p.name << " writes the backbuffer and textures" << std::endl;
+            continue;
+        }
+        glGenFramebuffers(1, &p.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, p.fbo);
+        std::vector<GLenum> colors;
+        for (Resource r : p.writes) {
+            GLenum format = resources[r].desc.format;
+            GLenum attachment = hasStencil(format) ? GL_DEPTH_STENCIL_ATTACHMENT
+                : isDepthFormat(format) ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + (GLenum)colors.size();
+            if (attachment >= GL_COLOR_ATTACHMENT0 && attachment <= GL_COLOR_ATTACHMENT15) colors.push_back(attachment);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, Texture(r), 0);
+        }
+        if (colors.empty()) {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        else glDrawBuffers((GLsizei)colors.size(), colors.data());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "render graph: framebuffer of pass " << p.name << " is incomplete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void RenderGraph::Execute() {
+    if (!compiled && !Compile()) return;
+    // passes show up by name in debuggers when KHR_debug (GL 4.3) is there
+    bool groups = glPushDebugGroup && glPopDebugGroup;
+    for (int i : order) {
+        Pass& p = passes[i];
+        if (!p.live) continue;
+        auto start = std::chrono::steady_clock::now();
+        if (groups) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, p.name.c_str());
+        glBindFramebuffer(GL_FRAMEBUFFER, p.fbo);
+        if (!p.writes.empty()) {
+            const TextureDesc& d = resources[p.writes[0]].desc;
+            glViewport(0, 0, d.width, d.height);
+        }
+        p.execute(*this);
+        if (groups) glPopDebugGroup();
+        p.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+std::vector<RenderGraph::PassTime> RenderGraph::PassTimes() const {
+    std::vector<PassTime> times;
+    for (int i : order)
+        if (passes[i].live) times.push_back({ passes[i].name.c_str(), passes[i].cpuMs });
+    return times;
+}
+
+GLuint RenderGraph::Texture(Resource r) const {
+    const ResourceInfo& info = resources[r];
+    return info.physical >= 0 ? pool[info.physical].texture : info.texture;
+}
+
+size_t RenderGraph::textureBytes(const TextureDesc& desc) {
+    size_t texel;
+    switch (desc.format) {
+    case GL_R8: texel = 1; break;
+    case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: texel = 2; break;
+    case GL_RGBA16F: case GL_RG32F: case GL_DEPTH32F_STENCIL8: texel = 8; break;
+    case GL_RGBA32F: texel = 16; break;
+    default: texel = 4; break;
+    }
+    return texel * desc.width * desc.height;
+}
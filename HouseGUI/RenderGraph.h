@@ -0,0 +1,100 @@
+// RenderGraph.h
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// Declarative frame description. Passes say which textures they read and
+// write; Compile() orders them by those dependencies, drops passes whose
+// results nothing uses, and gives each transient texture a physical one from
+// a pool, sharing it between transients of the same description whose
+// lifetimes do not overlap. Execute() binds each pass's framebuffer and
+// viewport and runs it. The pool lives as long as the graph, so a graph that
+// is compiled once and executed every frame allocates nothing per frame.
+class RenderGraph {
+public:
+    typedef int Resource;
+    struct TextureDesc {
+        int width, height;
+        GLenum format;
+        GLenum filter = GL_NEAREST;
+        // GL_CLAMP_TO_BORDER gets a white border, i.e. far depth for shadow maps
+        GLenum wrap = GL_CLAMP_TO_EDGE;
+        bool operator==(const TextureDesc& o) const {
+            return width == o.width && height == o.height && format == o.format && filter == o.filter && wrap == o.wrap;
+        }
+    };
+    class Builder {
+    public:
+        void Read(Resource r);
+        // colour textures are attached in the order they are written
+        void Write(Resource r);
+    private:
+        friend class RenderGraph;
+        Builder(RenderGraph& graph, int pass) : graph(graph), pass(pass) {}
+        RenderGraph& graph;
+        int pass;
+    };
+    typedef std::function<void(Builder&)> SetupFn;
+    typedef std::function<void(const RenderGraph&)> ExecuteFn;
+    struct Stats {
+        int passes, culledPasses;
+        int transients, physical;
+        size_t requestedBytes, allocatedBytes;
+    };
+    struct PassTime {
+        const char* name;
+        double cpuMs;
+    };
+
+    RenderGraph();
+    ~RenderGraph();
+    Resource CreateTexture(const std::string& name, const TextureDesc& desc);
+    Resource ImportTexture(const std::string& name, GLuint texture, const TextureDesc& desc);
+    Resource Backbuffer(int width, int height);
+    // keeps the passes writing r even though no pass reads it
+    void MarkOutput(Resource r);
+    void AddPass(const std::string& name, const SetupFn& setup, const ExecuteFn& execute);
+    bool Compile();
+    void Execute();
+    GLuint Texture(Resource r) const;
+    Stats GetStats() const { return stats; }
+    // CPU time of every pass the last Execute() ran, in execution order
+    std::vector<PassTime> PassTimes() const;
+private:
+    struct ResourceInfo {
+        std::string name;
+        TextureDesc desc;
+        bool transient, backbuffer, output;
+        GLuint texture;
+        int physical;
+        int firstUse, lastUse;
+        std::vector<int> writers;
+    };
+    struct Pass {
+        std::string name;
+        ExecuteFn execute;
+        std::vector<Resource> reads, writes;
+        bool live;
+        GLuint fbo;
+        double cpuMs;
+    };
+    struct Physical {
+        TextureDesc desc;
+        GLuint texture;
+        int busyUntil;
+    };
+    std::vector<ResourceInfo> resources;
+    std::vector<Pass> passes;
+    std::vector<int> order;
+    std::vector<Physical> pool;
+    Stats stats;
+    bool compiled;
+    bool sortPasses();
+    void cullPasses();
+    void allocateTransients();
+    void createFramebuffers();
+    static size_t textureBytes(const TextureDesc& desc);
+};
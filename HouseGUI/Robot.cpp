@@ -2,41 +2,51 @@
 #include "Robot.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <stb/stb_image.h>
+#include "AssetLoader.h"
+#include "TextureResidency.h"
+#include "FrameRingBuffer.h"
+#include "GLState.h"
+#include "CpuProfiler.h"
+#include <cstddef>
+#include <cstring>
 
 extern float getTerrainHeight(float x, float z);
+extern glm::vec2 stepOnGround(const glm::vec3& feet, const glm::vec2& step);
 
 static const char* vertSrc = R"(
 #version 330 core
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec2 aUV;
-uniform mat4 uModel;
+layout(location = 2) in mat4 iModel;
+layout(location = 6) in vec3 iColor;
 uniform mat4 uView;
 uniform mat4 uProj;
 out vec2 vUV;
+flat out vec3 vColor;
 void main() {
     vUV = aUV;
-    gl_Position = uProj * uView * uModel * vec4(aPos, 1.0);
+    vColor = iColor;
+    gl_Position = uProj * uView * iModel * vec4(aPos, 1.0);
 }
 )";
 
 static const char* fragSrc = R"(
 #version 330 core
 in vec2 vUV;
+flat in vec3 vColor;
 out vec4 FragColor;
 uniform sampler2D uTex;
-uniform vec3 uColor;
 uniform int useTex;
 void main() {
     if (useTex == 1)
         FragColor = texture(uTex, vUV);
     else
-        FragColor = vec4(uColor, 1.0);
+        FragColor = vec4(vColor, 1.0);
 }
 )";
 
 Robot::Robot(int, int, float scale)
-    : uniformScale(scale), Velocity(0.0f), Position(0.0f), Yaw(0.0f), walkCycle(0.0f)
+    : uniformScale(scale), Velocity(0.0f), Position(0.0f), Yaw(0.0f), partsInstanced(false), walkCycle(0.0f)
 {
     init();
     loadHeadTextures();
@@ -44,12 +54,14 @@ Robot::Robot(int, int, float scale)
 }
 
 Robot::~Robot() {
-    glDeleteProgram(shader);
+    GLState::DeleteProgram(shader);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteTextures(6, headTextures);
-    glDeleteTextures(1, &headOverlayTexture);
+    GLState::DeleteVertexArrays(1, &VAO);
+    for (GLuint t : headTextures) TextureResidency::Forget(t);
+    TextureResidency::Forget(headOverlayTexture);
+    GLState::DeleteTextures(6, headTextures);
+    GLState::DeleteTextures(1, &headOverlayTexture);
 }
 
 GLuint Robot::compile(const char* src, GLenum type) {
@@ -69,13 +81,11 @@ void Robot::init() {
     glDeleteShader(vs);
     glDeleteShader(fs);
 
-    locModel = glGetUniformLocation(shader, "uModel");
     locView = glGetUniformLocation(shader, "uView");
     locProj = glGetUniformLocation(shader, "uProj");
     useTex = glGetUniformLocation(shader, "useTex");
-    locColor = glGetUniformLocation(shader, "uColor");
 
-    glUseProgram(shader);
+    GLState::UseProgram(shader);
     glUniform1i(useTex, 1);
 
     float verts[] = {
@@ -94,7 +104,7 @@ void Robot::init() {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
-    glBindVertexArray(VAO);
+    GLState::BindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
@@ -103,9 +113,6 @@ void Robot::init() {
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 void Robot::loadHeadTextures() {
@@ -119,49 +126,42 @@ void Robot::loadHeadTextures() {
     };
     glGenTextures(6, headTextures);
     for (int i = 0; i < 6; ++i) {
-        int w, h, c;
-        unsigned char* data = stbi_load(paths[i], &w, &h, &c, 4);
-        glBindTexture(GL_TEXTURE_2D, headTextures[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        stbi_image_free(data);
+        AssetLoader::LoadTexture(headTextures[i], paths[i], false);
+        GLState::BindTexture(GL_TEXTURE_2D, headTextures[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
 }
 
 void Robot::loadHeadOverlayTexture() {
-    int w, h, c;
-    unsigned char* data = stbi_load("textures/skin/head_eyebrows.png", &w, &h, &c, 4);
     glGenTextures(1, &headOverlayTexture);
-    glBindTexture(GL_TEXTURE_2D, headOverlayTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
+    AssetLoader::LoadTexture(headOverlayTexture, "textures/skin/head_eyebrows.png", false);
+    GLState::BindTexture(GL_TEXTURE_2D, headOverlayTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 }
 
-void Robot::drawHead(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale, HeadFace face) {
-    glUniform1i(useTex, 1);
-    glBindTexture(GL_TEXTURE_2D, headTextures[int(face)]);
-    glm::mat4 m = glm::translate(model, offset) * glm::scale(glm::mat4(1.0f), scale);
-    glUniformMatrix4fv(locModel, 1, GL_FALSE, glm::value_ptr(m));
-    glBindVertexArray(VAO);
-    int fi = int(face);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)(fi * 6 * sizeof(unsigned int)));
-    if (face == HeadFace::Front) {
-        glBindTexture(GL_TEXTURE_2D, headOverlayTexture);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)(fi * 6 * sizeof(unsigned int)));
-    }
-    glUniform1i(useTex, 0);
+void Robot::addPart(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale, const glm::vec3& color) {
+    Part p;
+    p.model = glm::translate(model, offset) * glm::scale(glm::mat4(1.0f), scale);
+    p.color = color;
+    parts.push_back(p);
 }
 
-void Robot::drawCubeColor(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale, const glm::vec3& color) {
-    glUniform1i(useTex, 0);
-    glm::mat4 m = glm::translate(model, offset) * glm::scale(glm::mat4(1.0f), scale);
-    glUniformMatrix4fv(locModel, 1, GL_FALSE, glm::value_ptr(m));
-    glUniform3fv(locColor, 1, glm::value_ptr(color));
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr);
+void Robot::drawParts(size_t first, size_t count, int indexCount, int firstIndex) {
+    void* indices = (void*)(firstIndex * sizeof(unsigned int));
+    if (partsInstanced) {
+        glDrawElementsInstancedBaseInstance(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, indices, (GLsizei)count, (GLuint)first);
+        GLState::CountDraw();
+        return;
+    }
+    // with the instance arrays disabled the shader reads the current attribute value
+    for (size_t i = first; i < first + count; i++) {
+        for (int c = 0; c < 4; c++) glVertexAttrib4fv(2 + c, glm::value_ptr(parts[i].model[c]));
+        glVertexAttrib3fv(6, glm::value_ptr(parts[i].color));
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, indices);
+        GLState::CountDraw();
+    }
 }
 
 void Robot::drawLimb(const glm::mat4& parent, const glm::vec3& offset, float yaw, float pitch, float elbow,
@@ -171,18 +171,19 @@ void Robot::drawLimb(const glm::mat4& parent, const glm::vec3& offset, float yaw
     glm::mat4 m = glm::translate(parent, offset);
     m = glm::rotate(m, yaw, glm::vec3(0, 1, 0));
     m = glm::rotate(m, pitch, glm::vec3(1, 0, 0));
-    drawCubeColor(m, glm::vec3(0, -upperSize.y / 2 - gap / 2, 0), upperSize, upperColor);
+    addPart(m, glm::vec3(0, -upperSize.y / 2 - gap / 2, 0), upperSize, upperColor);
     glm::mat4 e = glm::translate(m, glm::vec3(0, -upperSize.y - gap, 0));
     e = glm::rotate(e, elbow, glm::vec3(1, 0, 0));
-    drawCubeColor(e, glm::vec3(0, -lowerSize.y / 2 + gap / 2, 0), lowerSize, lowerColor);
+    addPart(e, glm::vec3(0, -lowerSize.y / 2 + gap / 2, 0), lowerSize, lowerColor);
 }
 
-void Robot::Update(float dt, GLFWwindow* window) {
-    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)  Yaw += TurnSpeed * dt;
-    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) Yaw -= TurnSpeed * dt;
+void Robot::Update(float dt, unsigned keys) {
+    PROFILE_SCOPE("Robot::Update");
+    if (keys & RobotLeft)  Yaw += TurnSpeed * dt;
+    if (keys & RobotRight) Yaw -= TurnSpeed * dt;
     glm::vec3 dir(0.0f);
-    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)    dir += glm::vec3(sinf(glm::radians(Yaw)), 0, cosf(glm::radians(Yaw)));
-    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)  dir -= glm::vec3(sinf(glm::radians(Yaw)), 0, cosf(glm::radians(Yaw)));
+    if (keys & RobotForward) dir += glm::vec3(sinf(glm::radians(Yaw)), 0, cosf(glm::radians(Yaw)));
+    if (keys & RobotBack)    dir -= glm::vec3(sinf(glm::radians(Yaw)), 0, cosf(glm::radians(Yaw)));
     if (glm::length(dir) > 0.0f) {
         Velocity.x = dir.x * MoveSpeed;
         Velocity.z = dir.z * MoveSpeed;
@@ -192,7 +193,12 @@ void Robot::Update(float dt, GLFWwindow* window) {
         Velocity.z = 0;
     }
     Velocity.y += Gravity * dt;
-    Position += Velocity * dt;
+    Position.y += Velocity.y * dt;
+    // from the ground under it, which the walls are measured against
+    glm::vec3 feet(Position.x, getTerrainHeight(Position.x, Position.z), Position.z);
+    glm::vec2 p = stepOnGround(feet, glm::vec2(Velocity.x, Velocity.z) * dt);
+    Position.x = p.x;
+    Position.z = p.y;
     float ground = getTerrainHeight(Position.x, Position.z) + BaseOffset;
     if (Position.y <= ground) {
         Position.y = ground;
@@ -204,7 +210,12 @@ void Robot::Update(float dt, GLFWwindow* window) {
 }
 
 void Robot::Draw(const glm::mat4& view, const glm::mat4& proj) {
-    glUseProgram(shader);
+    PROFILE_SCOPE("Robot::Draw");
+    GLState::UseProgram(shader);
+    // the face overlay is blended over the front face
+    GLState::Enable(GL_BLEND);
+    GLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::ActiveTexture(GL_TEXTURE0);
     glUniformMatrix4fv(locView, 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(locProj, 1, GL_FALSE, glm::value_ptr(proj));
     glm::mat4 model = glm::translate(glm::mat4(1.0f), Position);
@@ -212,15 +223,45 @@ void Robot::Draw(const glm::mat4& view, const glm::mat4& proj) {
     model = glm::scale(model, glm::vec3(uniformScale));
     float swing = sinf(walkCycle) * 0.5f;
     float elbowSwing = -swing;
-    drawHead(model, { 0,5,0 }, { 4,4,4 }, HeadFace::Front);
-    drawHead(model, { 0,5,0 }, { 4,4,4 }, HeadFace::Back);
-    drawHead(model, { 0,5,0 }, { 4,4,4 }, HeadFace::Left);
-    drawHead(model, { 0,5,0 }, { 4,4,4 }, HeadFace::Right);
-    drawHead(model, { 0,5,0 }, { 4,4,4 }, HeadFace::Top);
-    drawHead(model, { 0,5,0 }, { 4,4,4 }, HeadFace::Bottom);
-    drawCubeColor(model, { 0,0,0 }, { 4,6,2 }, { 14 / 255.0f,174 / 255.0f,174 / 255.0f });
+    // the six head faces come first, one part each, then the coloured cubes
+    parts.clear();
+    for (int face = 0; face < 6; face++) addPart(model, { 0,5,0 }, { 4,4,4 }, glm::vec3(1.0f));
+    addPart(model, { 0,0,0 }, { 4,6,2 }, { 14 / 255.0f,174 / 255.0f,174 / 255.0f });
     drawLimb(model, { -3,3,0 }, 0, swing, elbowSwing, { 2,4,2 }, { 2,3,2 }, { 14 / 255.0f,174 / 255.0f,174 / 255.0f }, { 169 / 255.0f,125 / 255.0f,100 / 255.0f });
     drawLimb(model, { 3,3,0 }, 0, -swing, -elbowSwing, { 2,4,2 }, { 2,3,2 }, { 14 / 255.0f,174 / 255.0f,174 / 255.0f }, { 169 / 255.0f,125 / 255.0f,100 / 255.0f });
     drawLimb(model, { -1,-3,0 }, 0, -swing, 0, { 2,3,2 }, { 2,4,2 }, { 73 / 255.0f,70 / 255.0f,151 / 255.0f }, { 73 / 255.0f,70 / 255.0f,151 / 255.0f });
     drawLimb(model, { 1,-3,0 }, 0, swing, 0, { 2,3,2 }, { 2,4,2 }, { 73 / 255.0f,70 / 255.0f,151 / 255.0f }, { 73 / 255.0f,70 / 255.0f,151 / 255.0f });
+
+    GLState::BindVertexArray(VAO);
+    FrameRingBuffer* ring = FrameRingBuffer::Current();
+    FrameRingBuffer::Allocation a = { nullptr, 0 };
+    if (ring) a = ring->Alloc(parts.size() * sizeof(Part));
+    partsInstanced = a.ptr != nullptr;
+    if (partsInstanced) {
+        memcpy(a.ptr, parts.data(), parts.size() * sizeof(Part));
+        glBindBuffer(GL_ARRAY_BUFFER, ring->Buffer());
+        for (int c = 0; c < 4; c++) {
+            glVertexAttribPointer(2 + c, 4, GL_FLOAT, GL_FALSE, sizeof(Part), (void*)(a.offset + offsetof(Part, model) + c * sizeof(glm::vec4)));
+            glVertexAttribDivisor(2 + c, 1);
+            glEnableVertexAttribArray(2 + c);
+        }
+        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(Part), (void*)(a.offset + offsetof(Part, color)));
+        glVertexAttribDivisor(6, 1);
+        glEnableVertexAttribArray(6);
+    }
+    glUniform1i(useTex, 1);
+    for (int face = 0; face < 6; face++) {
+        TextureResidency::Use(headTextures[face]);
+        GLState::BindTexture(GL_TEXTURE_2D, headTextures[face]);
+        drawParts(face, 1, 6, face * 6);
+        if (face == int(HeadFace::Front)) {
+            TextureResidency::Use(headOverlayTexture);
+            GLState::BindTexture(GL_TEXTURE_2D, headOverlayTexture);
+            drawParts(face, 1, 6, face * 6);
+        }
+    }
+    glUniform1i(useTex, 0);
+    drawParts(6, parts.size() - 6, 36, 0);
+    if (partsInstanced)
+        for (int i = 2; i <= 6; i++) glDisableVertexAttribArray(i);
 }
@@ -5,14 +5,18 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <GLFW/glfw3.h>
+#include <vector>
 
 enum class HeadFace { Front, Back, Left, Right, Top, Bottom };
 
+// arrow keys held this frame, read from the window or replayed from a camera path
+enum RobotKeys { RobotLeft = 1, RobotRight = 2, RobotForward = 4, RobotBack = 8 };
+
 class Robot {
 public:
     Robot(int width, int height, float scale = 1.0f);
     ~Robot();
-    void Update(float dt, GLFWwindow* window);
+    void Update(float dt, unsigned keys);
     void Draw(const glm::mat4& view, const glm::mat4& proj);
     glm::vec3 Position;
     float Yaw;
@@ -24,14 +28,21 @@ private:
     static constexpr float TurnSpeed = 0.0f;
     glm::vec3 Velocity;
     GLuint shader, VAO, VBO, EBO, headTextures[6], headOverlayTexture;
-    GLint locModel, locView, locProj, useTex, locColor;
+    GLint locView, locProj, useTex;
+    // per-frame part transforms; uploaded through the frame ring buffer when there is one
+    struct Part {
+        glm::mat4 model;
+        glm::vec3 color;
+    };
+    std::vector<Part> parts;
+    bool partsInstanced;
     float walkCycle;
     void init();
     void loadHeadTextures();
     void loadHeadOverlayTexture();
     GLuint compile(const char* src, GLenum type);
-    void drawHead(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale, HeadFace face);
-    void drawCubeColor(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale, const glm::vec3& color);
+    void addPart(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale, const glm::vec3& color);
+    void drawParts(size_t first, size_t count, int indexCount, int firstIndex);
     void drawLimb(const glm::mat4& parent, const glm::vec3& offset, float yaw, float pitch, float elbow,
         const glm::vec3& upperSize, const glm::vec3& lowerSize,
         const glm::vec3& upperColor, const glm::vec3& lowerColor);
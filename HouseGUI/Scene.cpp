@@ -0,0 +1,388 @@
+// Scene.cpp
+#include "Scene.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char sceneMagic[4] = { 'H', 'G', 'S', 'C' };
+
+// the binary form is these structs as they are in memory
+static_assert(sizeof(Scene::Block) == 16, "Scene::Block layout");
+static_assert(sizeof(Scene::Instance) == 16, "Scene::Instance layout");
+
+static const char* blockTypeNames[Scene::BlockTypes] = {
+    "grass", "log", "stairs", "leaves", "glass",
+    "flower_blue_orchid", "flower_dandelion", "flower_tulip_white", "flower_oxeye_daisy", "flower_rose",
+    "dirt"
+};
+
+static size_t align16(size_t n) {
+    return (n + 15) & ~(size_t)15;
+}
+
+Scene::Scene()
+    : blocks(nullptr), prefabs(nullptr), instances(nullptr), lights(nullptr), entities(nullptr),
+    blockCount(0), prefabCount(0), instanceCount(0), lightCount(0), entityCount(0),
+    base(nullptr), length(0), file(nullptr), mapping(nullptr)
+{
+}
+
+Scene::~Scene() {
+    release();
+}
+
+const char* Scene::BlockTypeName(int type) {
+    return type >= 0 && type < BlockTypes ? blockTypeNames[type] : "unknown";
+}
+
+const Scene::Light* Scene::FindLight(LightKind kind) const {
+    for (size_t i = 0; i < lightCount; i++)
+        if (lights[i].kind == kind) return &lights[i];
+    return nullptr;
+}
+
+const Scene::Entity* Scene::FindEntity(const char* kind) const {
+    for (size_t i = 0; i < entityCount; i++)
+        if (!strncmp(entities[i].kind, kind, sizeof(entities[i].kind))) return &entities[i];
+    return nullptr;
+}
+
+int Scene::FindPrefab(const char* name) const {
+    for (size_t i = 0; i < prefabCount; i++)
+        if (!strncmp(prefabs[i].name, name, sizeof(prefabs[i].name))) return (int)i;
+    return -1;
+}
+
+std::vector<Scene::Column> Scene::Columns(uint32_t prefab, float spacing) const {
+    struct Cell {
+        int x, z, level;
+        const Block* block;
+    };
+    std::vector<Cell> cells;
+    int base = INT32_MAX;
+    const Prefab& p = prefabs[prefab];
+    for (uint32_t k = 0; k < p.blockCount; k++) {
+        const Block& b = blocks[p.firstBlock + k];
+        if ((b.flags & Billboard) || b.type == Leaves) continue;
+        Cell c = { (int)lroundf(b.position.x / spacing), (int)lroundf(b.position.z / spacing), (int)lroundf(b.position.y / spacing), &b };
+        base = std::min(base, c.level);
+        cells.push_back(c);
+    }
+    std::sort(cells.begin(), cells.end(), [](const Cell& a, const Cell& b) {
+        return a.x != b.x ? a.x < b.x : a.z != b.z ? a.z < b.z : a.level < b.level;
+    });
+    std::vector<Column> columns;
+    for (size_t i = 0; i < cells.size();) {
+        size_t end = i + 1, top = i;
+        while (end < cells.size() && cells[end].x == cells[i].x && cells[end].z == cells[i].z) {
+            // a block in the same cell twice does not break the stack
+            if (cells[end].level <= cells[top].level + 1 && top == end - 1) top = end;
+            end++;
+        }
+        if (cells[i].level == base) columns.push_back({ cells[i].block->position.x, cells[i].block->position.z, cells[top].block->position.y });
+        i = end;
+    }
+    return columns;
+}
+
+uint32_t Scene::AddPrefab(const char* name, const Block* first, size_t count, const glm::vec3& impostorCenter, float impostorRadius) {
+    detach();
+    Prefab p = { {}, (uint32_t)ownBlocks.size(), (uint32_t)count, impostorCenter, impostorRadius };
+    strncpy(p.name, name, sizeof(p.name) - 1);
+    ownBlocks.insert(ownBlocks.end(), first, first + count);
+    ownPrefabs.push_back(p);
+    pointAtOwn();
+    return (uint32_t)ownPrefabs.size() - 1;
+}
+
+void Scene::AddInstance(uint32_t prefab, const glm::vec3& position) {
+    detach();
+    ownInstances.push_back({ prefab, position });
+    pointAtOwn();
+}
+
+// copies the mapped arrays into the own vectors and unmaps the file
+void Scene::detach() {
+    if (!base) return;
+    std::vector<Block> b(blocks, blocks + blockCount);
+    std::vector<Prefab> p(prefabs, prefabs + prefabCount);
+    std::vector<Instance> i(instances, instances + instanceCount);
+    std::vector<Light> l(lights, lights + lightCount);
+    std::vector<Entity> e(entities, entities + entityCount);
+    release();
+    ownBlocks.swap(b);
+    ownPrefabs.swap(p);
+    ownInstances.swap(i);
+    ownLights.swap(l);
+    ownEntities.swap(e);
+    pointAtOwn();
+}
+
+bool Scene::Load(const std::string& path) {
+    release();
+    char magic[4] = {};
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cout << "scene: cannot open " << path << std::endl;
+        return false;
+    }
+    in.read(magic, 4);
+    in.close();
+    return memcmp(magic, sceneMagic, 4) ? loadText(path) : loadBinary(path);
+}
+
+void Scene::pointAtOwn() {
+    blocks = ownBlocks.data();
+    blockCount = ownBlocks.size();
+    prefabs = ownPrefabs.data();
+    prefabCount = ownPrefabs.size();
+    instances = ownInstances.data();
+    instanceCount = ownInstances.size();
+    lights = ownLights.data();
+    lightCount = ownLights.size();
+    entities = ownEntities.data();
+    entityCount = ownEntities.size();
+}
+
+bool Scene::loadText(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    int lineNumber = 0;
+    // the prefab between "prefab" and "end", or the anonymous one collecting loose blocks
+    int open = -1;
+    bool anonymous = false;
+    auto fail = [&](const char* what) {
+        std::cout << "scene: " << path << ":" << lineNumber << ": " << what << std::endl;
+        release();
+        return false;
+    };
+    auto name = [](char* dst, size_t size, const std::string& src) {
+        memset(dst, 0, size);
+        memcpy(dst, src.data(), std::min(src.size(), size - 1));
+    };
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream words(line);
+        std::string kind;
+        if (!(words >> kind)) continue;
+        if (kind == "block") {
+            std::string type, word;
+            Block b = { glm::vec3(0.0f), 0, 0, 0, 0 };
+            if (!(words >> type >> b.position.x >> b.position.y >> b.position.z)) return fail("expected block <type> <x y z>");
+            auto it = std::find(std::begin(blockTypeNames), std::end(blockTypeNames), type);
+            if (it == std::end(blockTypeNames)) return fail("unknown block type");
+            b.type = (uint8_t)(it - std::begin(blockTypeNames));
+            while (words >> word) {
+                if (word == "billboard") b.flags |= Billboard;
+                else {
+                    float degrees = (float)atof(word.c_str());
+                    int turns = (int)lroundf(degrees / 90.0f);
+                    if (degrees != turns * 90.0f) return fail("rotations are multiples of 90 degrees");
+                    b.rotation = (uint8_t)(((turns % 4) + 4) % 4);
+                }
+            }
+            if (open < 0) {
+                ownPrefabs.push_back({ {}, (uint32_t)ownBlocks.size(), 0, glm::vec3(0.0f), 0.0f });
+                ownInstances.push_back({ (uint32_t)ownPrefabs.size() - 1, glm::vec3(0.0f) });
+                open = (int)ownPrefabs.size() - 1;
+                anonymous = true;
+            }
+            ownBlocks.push_back(b);
+            ownPrefabs[open].blockCount++;
+            continue;
+        }
+        // anything else ends a run of loose blocks
+        if (anonymous) {
+            open = -1;
+            anonymous = false;
+        }
+        if (kind == "prefab") {
+            std::string prefabName, word;
+            if (open >= 0) return fail("prefab inside a prefab");
+            if (!(words >> prefabName)) return fail("expected prefab <name>");
+            Prefab p = { {}, (uint32_t)ownBlocks.size(), 0, glm::vec3(0.0f), 0.0f };
+            name(p.name, sizeof(p.name), prefabName);
+            if (words >> word) {
+                if (word != "impostor" || !(words >> p.impostorCenter.x >> p.impostorCenter.y >> p.impostorCenter.z >> p.impostorRadius))
+                    return fail("expected impostor <cx cy cz> <radius>");
+            }
+            ownPrefabs.push_back(p);
+            open = (int)ownPrefabs.size() - 1;
+        }
+        else if (kind == "end") {
+            if (open < 0) return fail("end without prefab");
+            open = -1;
+        }
+        else if (kind == "instance") {
+            std::string prefabName;
+            Instance i = { 0, glm::vec3(0.0f) };
+            if (open >= 0) return fail("instance inside a prefab");
+            if (!(words >> prefabName >> i.position.x >> i.position.y >> i.position.z)) return fail("expected instance <prefab> <x y z>");
+            auto it = std::find_if(ownPrefabs.begin(), ownPrefabs.end(), [&](const Prefab& p) { return prefabName == p.name; });
+            if (it == ownPrefabs.end() || prefabName.empty()) return fail("unknown prefab");
+            i.prefab = (uint32_t)(it - ownPrefabs.begin());
+            ownInstances.push_back(i);
+        }
+        else if (kind == "light") {
+            std::string lightKind;
+            Light l = { Sun, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(1.0f) };
+            words >> lightKind;
+            if (lightKind == "sun") {
+                if (!(words >> l.position.x >> l.position.y >> l.position.z >> l.direction.x >> l.direction.y >> l.direction.z
+                    >> l.color.r >> l.color.g >> l.color.b)) return fail("expected light sun <x y z> <dx dy dz> <r g b>");
+            }
+            else if (lightKind == "point") {
+                l.kind = Point;
+                if (!(words >> l.position.x >> l.position.y >> l.position.z >> l.color.r >> l.color.g >> l.color.b))
+                    return fail("expected light point <x y z> <r g b>");
+            }
+            else return fail("lights are sun or point");
+            ownLights.push_back(l);
+        }
+        else if (kind == "entity") {
+            std::string entityKind;
+            Entity e = { {}, glm::vec3(0.0f), 0.0f, 1.0f };
+            if (!(words >> entityKind >> e.position.x >> e.position.y >> e.position.z >> e.yaw)) return fail("expected entity <kind> <x y z> <yaw>");
+            float scale;
+            if (words >> scale) e.scale = scale;
+            name(e.kind, sizeof(e.kind), entityKind);
+            ownEntities.push_back(e);
+        }
+        else return fail("not a block, prefab, end, instance, light or entity line");
+    }
+    if (open >= 0 && !anonymous) return fail("prefab without end");
+    pointAtOwn();
+    return true;
+}
+
+bool Scene::loadBinary(const std::string& path) {
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    GetFileSizeEx(f, &size);
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (m) CloseHandle(m);
+        CloseHandle(f);
+        return false;
+    }
+    file = f;
+    mapping = m;
+    length = (size_t)size.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    fstat(fd, &st);
+    void* view = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (view == MAP_FAILED) return false;
+    length = (size_t)st.st_size;
+#endif
+    base = (const unsigned char*)view;
+
+    // only the small tables are checked; block types are checked where they are drawn
+    const Header* h = (const Header*)base;
+    auto fits = [&](uint64_t offset, uint64_t count, size_t size) { return offset % 16 == 0 && offset <= length && count <= (length - offset) / size; };
+    bool ok = length >= sizeof(Header) && h->version == Version &&
+        fits(h->blocksOffset, h->blockCount, sizeof(Block)) && fits(h->prefabsOffset, h->prefabCount, sizeof(Prefab)) &&
+        fits(h->instancesOffset, h->instanceCount, sizeof(Instance)) && fits(h->lightsOffset, h->lightCount, sizeof(Light)) &&
+        fits(h->entitiesOffset, h->entityCount, sizeof(Entity));
+    if (ok) {
+        blocks = (const Block*)(base + h->blocksOffset);
+        prefabs = (const Prefab*)(base + h->prefabsOffset);
+        instances = (const Instance*)(base + h->instancesOffset);
+        lights = (const Light*)(base + h->lightsOffset);
+        entities = (const Entity*)(base + h->entitiesOffset);
+        blockCount = h->blockCount;
+        prefabCount = h->prefabCount;
+        instanceCount = h->instanceCount;
+        lightCount = h->lightCount;
+        entityCount = h->entityCount;
+        for (size_t i = 0; ok && i < prefabCount; i++)
+            ok = prefabs[i].firstBlock <= blockCount && prefabs[i].blockCount <= blockCount - prefabs[i].firstBlock;
+        for (size_t i = 0; ok && i < instanceCount; i++) ok = instances[i].prefab < prefabCount;
+    }
+    if (!ok) {
+        std::cout << "scene: " << path << " is not a version " << Version << " scene" << std::endl;
+        release();
+    }
+    return ok;
+}
+
+void Scene::release() {
+    if (base) {
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+        CloseHandle((HANDLE)mapping);
+        CloseHandle((HANDLE)file);
+#else
+        munmap((void*)base, length);
+#endif
+    }
+    base = nullptr;
+    length = 0;
+    file = mapping = nullptr;
+    ownBlocks.clear();
+    ownPrefabs.clear();
+    ownInstances.clear();
+    ownLights.clear();
+    ownEntities.clear();
+    pointAtOwn();
+}
+
+bool Scene::WriteBinary(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    Header h = {};
+    memcpy(h.magic, sceneMagic, 4);
+    h.version = Version;
+    h.blockCount = (uint32_t)blockCount;
+    h.prefabCount = (uint32_t)prefabCount;
+    h.instanceCount = (uint32_t)instanceCount;
+    h.lightCount = (uint32_t)lightCount;
+    h.entityCount = (uint32_t)entityCount;
+    size_t offset = align16(sizeof(Header));
+    auto place = [&](uint64_t& field, size_t bytes) {
+        field = offset;
+        offset = align16(offset + bytes);
+    };
+    place(h.blocksOffset, blockCount * sizeof(Block));
+    place(h.prefabsOffset, prefabCount * sizeof(Prefab));
+    place(h.instancesOffset, instanceCount * sizeof(Instance));
+    place(h.lightsOffset, lightCount * sizeof(Light));
+    place(h.entitiesOffset, entityCount * sizeof(Entity));
+    static const char zeros[16] = {};
+    size_t written = 0;
+    auto write = [&](const void* data, size_t bytes) {
+        out.write((const char*)data, (std::streamsize)bytes);
+        written += bytes;
+        out.write(zeros, (std::streamsize)(align16(written) - written));
+        written = align16(written);
+    };
+    write(&h, sizeof(h));
+    write(blocks, blockCount * sizeof(Block));
+    write(prefabs, prefabCount * sizeof(Prefab));
+    write(instances, instanceCount * sizeof(Instance));
+    write(lights, lightCount * sizeof(Light));
+    write(entities, entityCount * sizeof(Entity));
+    return (bool)out;
+}
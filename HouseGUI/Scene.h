@@ -0,0 +1,129 @@
+// Scene.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// What the world is made of: prefabs (named block lists, optionally drawn
+// as an impostor from a distance), their instances, lights and entities
+// (door, robot, hill). Blocks outside a prefab form an anonymous prefab
+// instanced at the origin, so the scene draws in file order.
+//
+// Two forms. The text form is for authoring, one entry per line, # starts
+// a comment, angles in degrees:
+//   light sun <x y z> <dx dy dz> <r g b>   (shadow camera position, direction)
+//   light point <x y z> <r g b>
+//   entity <kind> <x y z> <yaw> [scale]
+//   prefab <name> [impostor <cx cy cz> <radius>]
+//   block <type> <x y z> [rotation] [billboard]
+//   end
+//   instance <prefab> <x y z>
+// Rotations turn about y in quarter turns; billboard blocks face the camera.
+// The binary form (WriteBinary, --compile-scene) is the same arrays laid
+// out back to back after a Header; Load() maps it and points straight into
+// the mapping, so there is nothing to parse and a million blocks load in
+// the time it takes to check the header.
+class Scene {
+public:
+    enum BlockType : uint8_t {
+        Grass, Log, Stairs, Leaves, Glass,
+        FlowerBlueOrchid, FlowerDandelion, FlowerTulipWhite, FlowerOxeyeDaisy, FlowerRose,
+        Dirt,
+        BlockTypes
+    };
+    enum BlockFlags : uint8_t { Billboard = 1 };
+    enum LightKind : uint32_t { Sun = 0, Point = 1 };
+    struct Block {
+        glm::vec3 position;
+        uint8_t type, rotation, flags, reserved;
+    };
+    struct Prefab {
+        char name[32];
+        uint32_t firstBlock, blockCount;
+        // radius 0: no impostor
+        glm::vec3 impostorCenter;
+        float impostorRadius;
+    };
+    struct Instance {
+        uint32_t prefab;
+        glm::vec3 position;
+    };
+    struct Light {
+        uint32_t kind;
+        glm::vec3 position, direction, color;
+    };
+    // a column of a prefab's blocks, at the centre of its highest block
+    struct Column {
+        float x, z, top;
+    };
+    struct Entity {
+        char kind[16];
+        glm::vec3 position;
+        float yaw, scale;
+    };
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t blockCount, prefabCount, instanceCount, lightCount, entityCount, reserved;
+        uint64_t blocksOffset, prefabsOffset, instancesOffset, lightsOffset, entitiesOffset;
+    };
+    static constexpr uint32_t Version = 1;
+
+    Scene();
+    ~Scene();
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    // either form, told apart by the header
+    bool Load(const std::string& path);
+    bool WriteBinary(const std::string& path) const;
+    bool Mapped() const { return base != nullptr; }
+
+    const Block* Blocks() const { return blocks; }
+    size_t BlockCount() const { return blockCount; }
+    const Prefab* Prefabs() const { return prefabs; }
+    size_t PrefabCount() const { return prefabCount; }
+    const Instance* Instances() const { return instances; }
+    size_t InstanceCount() const { return instanceCount; }
+    const Light* Lights() const { return lights; }
+    size_t LightCount() const { return lightCount; }
+    const Entity* Entities() const { return entities; }
+    size_t EntityCount() const { return entityCount; }
+    // the first light or entity of that kind, nullptr if there is none
+    const Light* FindLight(LightKind kind) const;
+    const Entity* FindEntity(const char* kind) const;
+    // -1 if there is no prefab of that name
+    int FindPrefab(const char* name) const;
+    // what the prefab offers to stand on, blocks spacing apart: the columns of
+    // solid blocks (not billboards or leaves) stacked without a gap from its
+    // lowest level. Blocks over a gap, a roof over a room or a lintel over a
+    // door, are left out, since a height grid cannot pass under them.
+    std::vector<Column> Columns(uint32_t prefab, float spacing) const;
+    // for generated content; a mapped scene is copied into memory first
+    uint32_t AddPrefab(const char* name, const Block* blocks, size_t count, const glm::vec3& impostorCenter = glm::vec3(0.0f), float impostorRadius = 0.0f);
+    void AddInstance(uint32_t prefab, const glm::vec3& position);
+    static const char* BlockTypeName(int type);
+private:
+    // the text form is parsed into these; the binary form leaves them empty
+    std::vector<Block> ownBlocks;
+    std::vector<Prefab> ownPrefabs;
+    std::vector<Instance> ownInstances;
+    std::vector<Light> ownLights;
+    std::vector<Entity> ownEntities;
+    const Block* blocks;
+    const Prefab* prefabs;
+    const Instance* instances;
+    const Light* lights;
+    const Entity* entities;
+    size_t blockCount, prefabCount, instanceCount, lightCount, entityCount;
+    const unsigned char* base;
+    size_t length;
+    void* file;
+    void* mapping;
+    bool loadText(const std::string& path);
+    bool loadBinary(const std::string& path);
+    void release();
+    void pointAtOwn();
+    void detach();
+};
@@ -0,0 +1,265 @@
+// ShapeInstancer.cpp
+#include "ShapeInstancer.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <cstddef>
+#include "AssetLoader.h"
+#include "TextureResidency.h"
+#include "GLState.h"
+
+// aGrid = (u, v, face). Face 0 is the hill top or the pyramid lathe, faces
+// 1-4 are the hill base and walls and collapse to a point for pyramids.
+static const char* shapeVertSrc = R"(
+#version 330 core
+layout(location=0) in vec3 aGrid;
+layout(location=1) in vec4 iPosYaw;
+layout(location=2) in vec4 iShape;
+layout(location=3) in float iKind;
+uniform mat4 view, projection, lightSpaceMatrix;
+out vec3 FragPos, Normal;
+out vec4 FragPosLightSpace;
+out vec2 TexCoord;
+flat out int Kind;
+void main(){
+    float size = iShape.x, h = iShape.y, e = iShape.z, uvs = iShape.w;
+    int face = int(aGrid.z + 0.5);
+    vec3 p = vec3(0.0), n = vec3(0.0, 1.0, 0.0);
+    vec2 uv = aGrid.xy;
+    if(iKind < 0.5){
+        float t = aGrid.x;
+        float x = (t - 0.5) * size;
+        float top = h * (1.0 - pow(t, e));
+        if(face == 0){
+            float slope = -h * e / size * pow(t, max(e - 1.0, 0.0));
+            p = vec3(x, top, (aGrid.y - 0.5) * size);
+            n = normalize(vec3(-slope, 1.0, 0.0));
+            uv = aGrid.xy * uvs;
+        } else if(face == 1){
+            p = vec3(x, 0.0, (aGrid.y - 0.5) * size);
+            n = vec3(0.0, -1.0, 0.0);
+            uv = aGrid.xy * uvs;
+        } else if(face < 4){
+            float side = face == 2 ? -0.5 : 0.5;
+            p = vec3(x, aGrid.y * top, side * size);
+            n = vec3(0.0, 0.0, side * 2.0);
+            uv = vec2(t, (1.0 - aGrid.y) * top / size) * uvs;
+        } else {
+            p = vec3(-0.5 * size, aGrid.y * h, (aGrid.x - 0.5) * size);
+            n = vec3(-1.0, 0.0, 0.0);
+            uv = vec2((1.0 - aGrid.y) * h / size, aGrid.x) * uvs;
+        }
+    } else if(face == 0){
+        vec2 apex = vec2(0.0, h), base = vec2(size, 0.0);
+        float t = aGrid.y, t2 = t * t, t3 = t2 * t;
+        vec2 sp = 0.5 * ((2.0 * apex) + (base - apex) * t + (-3.0 * apex + 3.0 * base) * t2 + (2.0 * apex - 2.0 * base) * t3);
+        vec2 d = 0.5 * ((base - apex) + 2.0 * (-3.0 * apex + 3.0 * base) * t + 3.0 * (2.0 * apex - 2.0 * base) * t2);
+        float a = aGrid.x * 6.28318530718;
+        p = vec3(sp.x * cos(a), sp.y, sp.x * sin(a));
+        n = normalize(vec3(-d.y * cos(a), d.x, -d.y * sin(a)));
+    }
+    float c = cos(iPosYaw.w), s = sin(iPosYaw.w);
+    mat3 rot = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+    FragPos = iPosYaw.xyz + rot * p;
+    Normal = rot * n;
+    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
+    TexCoord = uv;
+    Kind = int(iKind + 0.5);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+static const char* shapeFragSrc = R"(
+#version 330 core
+in vec3 FragPos, Normal;
+in vec4 FragPosLightSpace;
+in vec2 TexCoord;
+flat in int Kind;
+uniform sampler2D shadowMap, hillTexture;
+uniform vec3 lightDir, lightColor, viewPos;
+uniform float outlineSize;
+out vec4 FragColor;
+float ShadowCalculation(vec4 fpos){
+    vec3 pc = fpos.xyz / fpos.w;
+    pc = pc * 0.5 + 0.5;
+    float current = pc.z;
+    float shadow = 0.0;
+    vec2 ts = 1.0 / textureSize(shadowMap,0);
+    for(int x=-1;x<=1;x++) for(int y=-1;y<=1;y++){
+        float p = texture(shadowMap, pc.xy + vec2(x,y)*ts).r;
+        shadow += (current - 0.005 > p) ? 1.0 : 0.0;
+    }
+    shadow /= 9.0;
+    if(pc.z > 1.0) shadow = 0.0;
+    return shadow;
+}
+void main(){
+    vec3 albedo = vec3(0.3, 0.8, 0.2);
+    if(Kind == 0){
+        vec2 f = fract(TexCoord);
+        if(f.x < outlineSize || f.x > 1.0 - outlineSize ||
+           f.y < outlineSize || f.y > 1.0 - outlineSize){
+            FragColor = vec4(0,0,0,1);
+            return;
+        }
+        albedo = texture(hillTexture, TexCoord).rgb;
+    }
+    vec3 n = normalize(Normal);
+    vec3 ld = normalize(-lightDir);
+    float diff = max(dot(n,ld), 0.0);
+    vec3 viewD = normalize(viewPos - FragPos);
+    float spec = pow(max(dot(viewD, reflect(-ld,n)),0.0),32.0);
+    vec3 amb = 0.1 * lightColor;
+    float sh = ShadowCalculation(FragPosLightSpace);
+    vec3 light = amb + (1.0 - sh) * (diff + spec) * lightColor;
+    FragColor = vec4(albedo * light, 1.0);
+}
+)";
+
+ShapeInstancer::ShapeInstancer(int segs)
+    : gridSegments(segs), dirty(false),
+    VAO(0), VBO(0), EBO(0), instanceVBO(0), shader(0), textureID(0), indexCount(0)
+{
+}
+
+ShapeInstancer::~ShapeInstancer() {
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
+    if (VBO) glDeleteBuffers(1, &VBO);
+    if (EBO) glDeleteBuffers(1, &EBO);
+    if (instanceVBO) glDeleteBuffers(1, &instanceVBO);
+    if (shader) GLState::DeleteProgram(shader);
+    TextureResidency::Forget(textureID);
+    if (textureID) GLState::DeleteTextures(1, &textureID);
+}
+
+void ShapeInstancer::Init() {
+    generateMesh();
+    shader = createProgram(shapeVertSrc, shapeFragSrc);
+
+    glGenTextures(1, &textureID);
+    GLState::BindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    AssetLoader::LoadTexture(textureID, "textures/grass_carried.png", true);
+
+    GLState::UseProgram(shader);
+    glUniform1f(glGetUniformLocation(shader, "outlineSize"), 0.03f);
+}
+
+void ShapeInstancer::Clear() {
+    instances.clear();
+    dirty = true;
+}
+
+void ShapeInstancer::AddHill(const glm::vec3& pos, float yawDegrees, float baseSize, float height, float exponent, float uvScale) {
+    instances.push_back({ glm::vec4(pos, glm::radians(yawDegrees)), glm::vec4(baseSize, height, exponent, uvScale), (float)HillShape });
+    dirty = true;
+}
+
+void ShapeInstancer::AddPyramid(const glm::vec3& pos, float yawDegrees, float radius, float height) {
+    instances.push_back({ glm::vec4(pos, glm::radians(yawDegrees)), glm::vec4(radius, height, 0.0f, 1.0f), (float)PyramidShape });
+    dirty = true;
+}
+
+void ShapeInstancer::generateMesh() {
+    std::vector<glm::vec3> verts;
+    std::vector<unsigned int> idx;
+    auto grid = [&](int nu, int nv, float face) {
+        unsigned int base = (unsigned int)verts.size();
+        for (int i = 0; i <= nu; i++)
+            for (int j = 0; j <= nv; j++)
+                verts.emplace_back(float(i) / nu, float(j) / nv, face);
+        for (int i = 0; i < nu; i++) {
+            for (int j = 0; j < nv; j++) {
+                unsigned int a = base + i * (nv + 1) + j;
+                unsigned int b = a + nv + 1;
+                idx.push_back(a); idx.push_back(b); idx.push_back(a + 1);
+                idx.push_back(a + 1); idx.push_back(b); idx.push_back(b + 1);
+            }
+        }
+    };
+    grid(gridSegments, gridSegments, 0.0f);
+    grid(1, 1, 1.0f);
+    grid(gridSegments, 1, 2.0f);
+    grid(gridSegments, 1, 3.0f);
+    grid(1, 1, 4.0f);
+    indexCount = static_cast<GLuint>(idx.size());
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glGenBuffers(1, &instanceVBO);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(glm::vec3), verts.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(unsigned int), idx.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, posYaw));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, shape));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, kind));
+    glVertexAttribDivisor(3, 1);
+    GLState::BindVertexArray(0);
+}
+
+GLuint ShapeInstancer::compileShader(const char* src, GLenum type) {
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    return s;
+}
+
+GLuint ShapeInstancer::createProgram(const char* vs, const char* fs) {
+    GLuint v = compileShader(vs, GL_VERTEX_SHADER);
+    GLuint f = compileShader(fs, GL_FRAGMENT_SHADER);
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v);
+    glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v);
+    glDeleteShader(f);
+    return p;
+}
+
+void ShapeInstancer::Draw(const glm::mat4& view,
+    const glm::mat4& proj,
+    const glm::mat4& lightSpaceMatrix,
+    const glm::vec3& lightDir,
+    const glm::vec3& lightColor,
+    const glm::vec3& viewPos,
+    GLuint shadowMap)
+{
+    if (instances.empty()) return;
+    if (dirty) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STATIC_DRAW);
+        dirty = false;
+    }
+
+    GLState::UseProgram(shader);
+    GLState::Disable(GL_BLEND);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    glUniform3fv(glGetUniformLocation(shader, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(shader, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, glm::value_ptr(viewPos));
+
+    TextureResidency::Use(textureID);
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D, textureID);
+    glUniform1i(glGetUniformLocation(shader, "hillTexture"), 0);
+    GLState::ActiveTexture(GL_TEXTURE1);
+    GLState::BindTexture(GL_TEXTURE_2D, shadowMap);
+    glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
+    GLState::BindVertexArray(VAO);
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, (GLsizei)instances.size());
+    GLState::CountDraw();
+}
@@ -0,0 +1,42 @@
+// ShapeInstancer.h
+#pragma once
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Draws any number of procedural hills and smooth pyramids with one shared
+// unit mesh, one program and one instanced draw. The vertex shader displaces
+// the unit grid from per-instance shape parameters.
+class ShapeInstancer {
+public:
+    enum Kind { HillShape = 0, PyramidShape = 1 };
+    ShapeInstancer(int gridSegments = 32);
+    ~ShapeInstancer();
+    void Init();
+    void Clear();
+    // uvScale is the number of texture repeats across the hill base
+    void AddHill(const glm::vec3& pos, float yawDegrees, float baseSize, float height, float exponent = 3.0f, float uvScale = 25.0f);
+    void AddPyramid(const glm::vec3& pos, float yawDegrees, float radius, float height);
+    void Draw(const glm::mat4& view,
+        const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix,
+        const glm::vec3& lightDir,
+        const glm::vec3& lightColor,
+        const glm::vec3& viewPos,
+        GLuint shadowMap);
+    int Count() const { return (int)instances.size(); }
+private:
+    struct Instance {
+        glm::vec4 posYaw;
+        glm::vec4 shape;
+        float kind;
+    };
+    int gridSegments;
+    std::vector<Instance> instances;
+    bool dirty;
+    GLuint VAO, VBO, EBO, instanceVBO, shader, textureID;
+    GLuint indexCount;
+    void generateMesh();
+    GLuint compileShader(const char* src, GLenum type);
+    GLuint createProgram(const char* vs, const char* fs);
+};
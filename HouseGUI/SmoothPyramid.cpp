@@ -1,5 +1,6 @@
 // SmoothPyramid.cpp
 #include "SmoothPyramid.h"
+#include "GLState.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <cmath>
 static glm::vec2 catmullRom(const glm::vec2& p0, const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3, float t) {
@@ -7,17 +8,16 @@ static glm::vec2 catmullRom(const glm::vec2& p0, const glm::vec2& p1, const glm:
     return 0.5f * ((2.0f * p1) + (-p0 + p2) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
 }
 SmoothPyramid::SmoothPyramid(float h, float r, int rs, int hs)
-    : height(h), baseRadius(r), radialSegments(rs), heightSegments(hs),
-    VAO(0), VBO(0), EBO(0), shader(0), indexCount(0) {
+    : TessEdgePixels(8.0f), height(h), baseRadius(r), radialSegments(rs), heightSegments(hs),
+    VAO(0), VBO(0), EBO(0), shader(0), indexCount(0), patchVertexCount(0), tessellated(false) {
 }
 SmoothPyramid::~SmoothPyramid() {
-    if (VAO) glDeleteVertexArrays(1, &VAO);
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
     if (VBO) glDeleteBuffers(1, &VBO);
     if (EBO) glDeleteBuffers(1, &EBO);
-    if (shader) glDeleteProgram(shader);
+    if (shader) GLState::DeleteProgram(shader);
 }
-void SmoothPyramid::Init() {
-    generateMesh();
+void SmoothPyramid::Init(bool tessellate) {
     const char* vs = R"(
 #version 330 core
 layout(location=0) in vec3 aPos;
@@ -55,7 +55,86 @@ void main(){
     FragColor=vec4(color,1.0);
 }
 )";
-    shader = createProgram(vs, fs);
+    // tessellated variant: patches carry (angle fraction, profile t) and the
+    // Catmull-Rom profile is revolved per generated vertex; the angle wraps
+    // so the last patch column closes on the first without a seam
+    const char* tvs = R"(
+#version 410 core
+layout(location=0) in vec2 aParam;
+out vec2 vParam;
+void main(){
+    vParam=aParam;
+}
+)";
+    const char* tcs = R"(
+#version 410 core
+layout(vertices=4) out;
+in vec2 vParam[];
+out vec2 cParam[];
+uniform mat4 model;
+uniform mat4 view;
+uniform vec2 apex;
+uniform vec2 base;
+uniform float pixelScale;
+vec3 surface(vec2 q){
+    float t=q.y, t2=t*t, t3=t2*t;
+    vec2 sp=0.5*((2.0*apex)+(base-apex)*t+(-3.0*apex+3.0*base)*t2+(2.0*apex-2.0*base)*t3);
+    float a=fract(q.x)*6.28318530718;
+    return (view*model*vec4(sp.x*cos(a),sp.y,sp.x*sin(a),1.0)).xyz;
+}
+float edgeFactor(vec2 a, vec2 b){
+    vec3 pa=surface(a), pb=surface(b), pm=surface((a+b)*0.5);
+    float len=length(pm-pa)+length(pb-pm);
+    return clamp(len*pixelScale/max(length(pm),0.05),1.0,64.0);
+}
+void main(){
+    cParam[gl_InvocationID]=vParam[gl_InvocationID];
+    if(gl_InvocationID==0){
+        float e0=edgeFactor(vParam[0],vParam[3]);
+        float e1=edgeFactor(vParam[0],vParam[1]);
+        float e2=edgeFactor(vParam[1],vParam[2]);
+        float e3=edgeFactor(vParam[3],vParam[2]);
+        gl_TessLevelOuter[0]=e0;
+        gl_TessLevelOuter[1]=e1;
+        gl_TessLevelOuter[2]=e2;
+        gl_TessLevelOuter[3]=e3;
+        gl_TessLevelInner[0]=max(e1,e3);
+        gl_TessLevelInner[1]=max(e0,e2);
+    }
+}
+)";
+    const char* tes = R"(
+#version 410 core
+layout(quads, fractional_odd_spacing, ccw) in;
+in vec2 cParam[];
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec2 apex;
+uniform vec2 base;
+out vec3 FragPos;
+out vec3 Normal;
+void main(){
+    vec2 q=mix(mix(cParam[0],cParam[1],gl_TessCoord.x),mix(cParam[3],cParam[2],gl_TessCoord.x),gl_TessCoord.y);
+    float t=q.y, t2=t*t, t3=t2*t;
+    vec2 sp=0.5*((2.0*apex)+(base-apex)*t+(-3.0*apex+3.0*base)*t2+(2.0*apex-2.0*base)*t3);
+    vec2 d=0.5*((base-apex)+2.0*(-3.0*apex+3.0*base)*t+3.0*(2.0*apex-2.0*base)*t2);
+    float a=fract(q.x)*6.28318530718;
+    vec3 n=vec3(-d.y*cos(a),d.x,-d.y*sin(a));
+    FragPos=vec3(model*vec4(sp.x*cos(a),sp.y,sp.x*sin(a),1.0));
+    Normal=mat3(transpose(inverse(model)))*normalize(n);
+    gl_Position=projection*view*vec4(FragPos,1.0);
+}
+)";
+    tessellated = tessellate && GLAD_GL_VERSION_4_0;
+    if (tessellated) {
+        generatePatches(8, 2);
+        shader = createTessProgram(tvs, tcs, tes, fs);
+    }
+    else {
+        generateMesh();
+        shader = createProgram(vs, fs);
+    }
 }
 void SmoothPyramid::generateMesh() {
     std::vector<glm::vec3> vertices;
@@ -84,7 +163,7 @@ void SmoothPyramid::generateMesh() {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
-    glBindVertexArray(VAO);
+    GLState::BindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3) + normals.size() * sizeof(glm::vec3), nullptr, GL_STATIC_DRAW);
     glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), vertices.data());
@@ -95,7 +174,40 @@ void SmoothPyramid::generateMesh() {
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(vertices.size() * sizeof(glm::vec3)));
-    glBindVertexArray(0);
+    GLState::BindVertexArray(0);
+}
+float SmoothPyramid::SurfaceHeight(float x, float z) const {
+    float r = sqrt(x * x + z * z);
+    if (r >= baseRadius) return 0.0f;
+    // the profile's radius grows monotonically with t, so bisect for it
+    glm::vec2 p0 = { baseRadius,0.0f }, p1 = { 0.0f,height };
+    float lo = 0.0f, hi = 1.0f;
+    for (int i = 0; i < 20; ++i) {
+        float mid = 0.5f * (lo + hi);
+        if (catmullRom(p1, p1, p0, p0, mid).x < r) lo = mid;
+        else hi = mid;
+    }
+    return catmullRom(p1, p1, p0, p0, 0.5f * (lo + hi)).y;
+}
+void SmoothPyramid::generatePatches(int radialPatches, int heightPatches) {
+    std::vector<glm::vec2> params;
+    for (int y = 0; y < heightPatches; ++y) {
+        float t1 = (float)y / heightPatches, t2 = (float)(y + 1) / heightPatches;
+        for (int i = 0; i < radialPatches; ++i) {
+            float a1 = (float)i / radialPatches, a2 = (float)(i + 1) / radialPatches;
+            params.emplace_back(a1, t1); params.emplace_back(a2, t1);
+            params.emplace_back(a2, t2); params.emplace_back(a1, t2);
+        }
+    }
+    patchVertexCount = params.size();
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, params.size() * sizeof(glm::vec2), params.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    GLState::BindVertexArray(0);
 }
 GLuint SmoothPyramid::compileShader(const char* src, GLenum t) {
     GLuint s = glCreateShader(t);
@@ -111,15 +223,37 @@ GLuint SmoothPyramid::createProgram(const char* vs, const char* fs) {
     glDeleteShader(v); glDeleteShader(f);
     return p;
 }
+GLuint SmoothPyramid::createTessProgram(const char* vs, const char* tcs, const char* tes, const char* fs) {
+    GLuint v = compileShader(vs, GL_VERTEX_SHADER), c = compileShader(tcs, GL_TESS_CONTROL_SHADER);
+    GLuint e = compileShader(tes, GL_TESS_EVALUATION_SHADER), f = compileShader(fs, GL_FRAGMENT_SHADER);
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v); glAttachShader(p, c); glAttachShader(p, e); glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v); glDeleteShader(c); glDeleteShader(e); glDeleteShader(f);
+    return p;
+}
 void SmoothPyramid::Draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model, const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos) {
-    glUseProgram(shader);
+    GLState::UseProgram(shader);
+    GLState::Disable(GL_BLEND);
     glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, glm::value_ptr(model));
     glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
     glUniform3fv(glGetUniformLocation(shader, "lightDir"), 1, glm::value_ptr(lightDir));
     glUniform3fv(glGetUniformLocation(shader, "lightColor"), 1, glm::value_ptr(lightColor));
     glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, glm::value_ptr(viewPos));
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    GLState::BindVertexArray(VAO);
+    if (tessellated) {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glUniform2f(glGetUniformLocation(shader, "apex"), 0.0f, height);
+        glUniform2f(glGetUniformLocation(shader, "base"), baseRadius, 0.0f);
+        glUniform1f(glGetUniformLocation(shader, "pixelScale"), proj[1][1] * viewport[3] * 0.5f / TessEdgePixels);
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+        glDrawArrays(GL_PATCHES, 0, patchVertexCount);
+        GLState::CountDraw();
+    }
+    else {
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        GLState::CountDraw();
+    }
 }
@@ -7,14 +7,22 @@ class SmoothPyramid {
 public:
     SmoothPyramid(float height, float baseRadius, int radialSegments, int heightSegments);
     ~SmoothPyramid();
-    void Init();
+    void Init(bool tessellate = true);
     void Draw(const glm::mat4& view, const glm::mat4& projection, const glm::mat4& model, const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos);
+    bool Tessellated() const { return tessellated; }
+    // height of the revolved profile above x, z in model space, 0 off the base
+    float SurfaceHeight(float x, float z) const;
+    float BaseRadius() const { return baseRadius; }
+    float TessEdgePixels;
 private:
     float height, baseRadius;
     int radialSegments, heightSegments;
     GLuint VAO, VBO, EBO, shader;
-    GLuint indexCount;
+    GLuint indexCount, patchVertexCount;
+    bool tessellated;
     void generateMesh();
+    void generatePatches(int radialPatches, int heightPatches);
     GLuint compileShader(const char* source, GLenum type);
     GLuint createProgram(const char* vsource, const char* fsource);
+    GLuint createTessProgram(const char* vsource, const char* csource, const char* esource, const char* fsource);
 };
@@ -0,0 +1,370 @@
+// Terrain.cpp
+#include "Terrain.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "AssetLoader.h"
+#include "TextureResidency.h"
+#include "FrameRingBuffer.h"
+#include "GLState.h"
+#include "CpuProfiler.h"
+
+static const char* terrainVertSrc = R"(
+#version 330 core
+layout(location=0) in vec2 aGrid;
+layout(location=1) in vec4 aNode;
+uniform mat4 view, projection, lightSpaceMatrix;
+uniform vec3 viewPos;
+uniform sampler2D heightMap;
+uniform float gridSize, texelSize, heightRes;
+uniform float morphStart[8], morphEnd[8];
+out vec3 FragPos, Normal;
+out vec4 FragPosLightSpace;
+out vec2 TexCoord;
+float heightAt(vec2 w){
+    return textureLod(heightMap, (w / texelSize + 0.5) / heightRes, 0.0).r;
+}
+void main(){
+    int lod = int(aNode.w);
+    vec2 w = aNode.xy + aGrid / gridSize * aNode.z;
+    float d = distance(viewPos, vec3(w.x, heightAt(w), w.y));
+    float k = clamp((d - morphStart[lod]) / (morphEnd[lod] - morphStart[lod]), 0.0, 1.0);
+    vec2 g = aGrid - fract(aGrid * 0.5) * 2.0 * k;
+    w = aNode.xy + g / gridSize * aNode.z;
+    float h = heightAt(w);
+    float e = texelSize;
+    Normal = normalize(vec3(heightAt(w - vec2(e, 0)) - heightAt(w + vec2(e, 0)), 2.0 * e,
+                            heightAt(w - vec2(0, e)) - heightAt(w + vec2(0, e))));
+    FragPos = vec3(w.x, h, w.y);
+    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
+    TexCoord = w;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+static const char* terrainFragSrc = R"(
+#version 330 core
+in vec3 FragPos, Normal;
+in vec4 FragPosLightSpace;
+in vec2 TexCoord;
+uniform sampler2D shadowMap, terrainTexture;
+uniform vec3 lightDir, lightColor, viewPos;
+out vec4 FragColor;
+float ShadowCalculation(vec4 fpos){
+    vec3 pc = fpos.xyz / fpos.w;
+    pc = pc * 0.5 + 0.5;
+    float current = pc.z;
+    float shadow = 0.0;
+    vec2 ts = 1.0 / textureSize(shadowMap,0);
+    for(int x=-1;x<=1;x++) for(int y=-1;y<=1;y++){
+        float p = texture(shadowMap, pc.xy + vec2(x,y)*ts).r;
+        shadow += (current - 0.005 > p) ? 1.0 : 0.0;
+    }
+    shadow /= 9.0;
+    if(pc.z > 1.0) shadow = 0.0;
+    return shadow;
+}
+void main(){
+    vec3 n = normalize(Normal);
+    vec3 ld = normalize(-lightDir);
+    float diff = max(dot(n,ld), 0.0);
+    vec3 viewD = normalize(viewPos - FragPos);
+    vec3 refD = reflect(-ld,n);
+    float spec = pow(max(dot(viewD,refD),0.0),32.0);
+    vec3 amb = 0.1 * lightColor;
+    float sh = ShadowCalculation(FragPosLightSpace);
+    vec3 light = amb + (1.0 - sh) * (diff * lightColor + 0.2 * spec * lightColor);
+    vec4 tex = texture(terrainTexture, TexCoord);
+    FragColor = vec4(tex.rgb * light, 1.0);
+}
+)";
+
+namespace {
+    const float flatRadius = 20.0f;
+    const float blendRadius = 60.0f;
+    const float flatHeight = 0.15f;
+    const float minHeight = -4.0f;
+    const float maxHeight = 10.0f;
+
+    float hash2(int x, int z) {
+        uint32_t h = (uint32_t)x * 374761393u + (uint32_t)z * 668265263u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return (h ^ (h >> 16)) / 4294967295.0f;
+    }
+
+    float valueNoise(float x, float z) {
+        int ix = (int)floorf(x), iz = (int)floorf(z);
+        float fx = x - ix, fz = z - iz;
+        fx = fx * fx * (3.0f - 2.0f * fx);
+        fz = fz * fz * (3.0f - 2.0f * fz);
+        float a = hash2(ix, iz), b = hash2(ix + 1, iz);
+        float c = hash2(ix, iz + 1), d = hash2(ix + 1, iz + 1);
+        return a + (b - a) * fx + (c - a) * fz + (a - b - c + d) * fx * fz;
+    }
+
+    int floorDiv(int a, int b) {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+}
+
+float Terrain::HeightAt(float x, float z) {
+    float n = 0.0f, amp = 1.0f, freq = 1.0f / 48.0f, norm = 0.0f;
+    for (int o = 0; o < 5; o++) {
+        n += amp * valueNoise(x * freq, z * freq);
+        norm += amp;
+        amp *= 0.5f;
+        freq *= 2.0f;
+    }
+    float h = minHeight + (n / norm) * (maxHeight - minHeight);
+    float t = glm::clamp((sqrtf(x * x + z * z) - flatRadius) / (blendRadius - flatRadius), 0.0f, 1.0f);
+    t = t * t * (3.0f - 2.0f * t);
+    return flatHeight + (h - flatHeight) * t;
+}
+
+Terrain::Terrain(int grid, int lods, int tile, int tiles, float texel)
+    : tilesPerFrame(4), gridSize(grid), lodLevels(std::min(lods, 8)), tileTexels(tile), tilesPerSide(tiles),
+    texelSize(texel), heightRes(tile * tiles), tileWorld(tile * texel), tilesStreamed(0),
+    VAO(0), VBO(0), EBO(0), instanceVBO(0), instanceCapacity(0), shader(0), heightTex(0), textureID(0), indexCount(0)
+{
+    rootSize = tileWorld * tilesPerSide * 0.5f;
+    float leafSize = rootSize / float(1 << (lodLevels - 1));
+    for (int i = 0; i < lodLevels; i++)
+        lodRanges.push_back(leafSize * 2.0f * float(1 << i));
+    tileInSlot.assign(tilesPerSide * tilesPerSide, glm::ivec2(INT32_MIN));
+    tileScratch.resize(tileTexels * tileTexels);
+}
+
+Terrain::~Terrain() {
+    if (VAO) GLState::DeleteVertexArrays(1, &VAO);
+    if (VBO) glDeleteBuffers(1, &VBO);
+    if (EBO) glDeleteBuffers(1, &EBO);
+    if (instanceVBO) glDeleteBuffers(1, &instanceVBO);
+    if (shader) GLState::DeleteProgram(shader);
+    if (heightTex) GLState::DeleteTextures(1, &heightTex);
+    TextureResidency::Forget(textureID);
+    if (textureID) GLState::DeleteTextures(1, &textureID);
+}
+
+void Terrain::Init(const glm::vec3& cameraPos) {
+    generateMesh();
+    shader = createProgram(terrainVertSrc, terrainFragSrc);
+
+    glGenTextures(1, &heightTex);
+    GLState::BindTexture(GL_TEXTURE_2D, heightTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, heightRes, heightRes, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    streamTiles(cameraPos, tilesPerSide * tilesPerSide);
+
+    glGenTextures(1, &textureID);
+    GLState::BindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    AssetLoader::LoadTexture(textureID, "textures/grass_carried.png", true);
+
+    GLState::UseProgram(shader);
+    glUniform1f(glGetUniformLocation(shader, "gridSize"), (float)gridSize);
+    glUniform1f(glGetUniformLocation(shader, "texelSize"), texelSize);
+    glUniform1f(glGetUniformLocation(shader, "heightRes"), (float)heightRes);
+    for (int i = 0; i < lodLevels; i++) {
+        float prev = i > 0 ? lodRanges[i - 1] : 0.0f;
+        float start = prev + (lodRanges[i] - prev) * 0.66f;
+        std::string idx = "[" + std::to_string(i) + "]";
+        glUniform1f(glGetUniformLocation(shader, ("morphStart" + idx).c_str()), start);
+        glUniform1f(glGetUniformLocation(shader, ("morphEnd" + idx).c_str()), lodRanges[i]);
+    }
+}
+
+void Terrain::Update(const glm::vec3& cameraPos) {
+    PROFILE_SCOPE("Terrain::Update");
+    streamTiles(cameraPos, tilesPerFrame);
+}
+
+void Terrain::streamTiles(const glm::vec3& cameraPos, int budget) {
+    int ctx = (int)floorf(cameraPos.x / tileWorld);
+    int ctz = (int)floorf(cameraPos.z / tileWorld);
+    int half = tilesPerSide / 2;
+    // nearest missing tiles first so the area under the camera is never stale
+    std::vector<std::pair<int, glm::ivec2>> missing;
+    for (int tz = ctz - half; tz < ctz + half; tz++) {
+        for (int tx = ctx - half; tx < ctx + half; tx++) {
+            int sx = tx - floorDiv(tx, tilesPerSide) * tilesPerSide;
+            int sz = tz - floorDiv(tz, tilesPerSide) * tilesPerSide;
+            if (tileInSlot[sz * tilesPerSide + sx] != glm::ivec2(tx, tz))
+                missing.push_back({ (tx - ctx) * (tx - ctx) + (tz - ctz) * (tz - ctz), glm::ivec2(tx, tz) });
+        }
+    }
+    std::sort(missing.begin(), missing.end(), [](const std::pair<int, glm::ivec2>& a, const std::pair<int, glm::ivec2>& b) { return a.first < b.first; });
+    int count = std::min((int)missing.size(), budget);
+    if (count == 0) return;
+    // heights for all tiles of this batch are generated in parallel, one row per job item
+    size_t texels = (size_t)tileTexels * tileTexels;
+    if (tileScratch.size() < texels * count) tileScratch.resize(texels * count);
+    parallel_for((size_t)count * tileTexels, 16, [&](size_t b, size_t e) {
+        for (size_t r = b; r < e; r++) {
+            int t = (int)(r / tileTexels), j = (int)(r % tileTexels);
+            glm::ivec2 tile = missing[t].second;
+            float* row = &tileScratch[texels * t + (size_t)j * tileTexels];
+            float z = (tile.y * tileTexels + j) * texelSize;
+            for (int i = 0; i < tileTexels; i++)
+                row[i] = HeightAt((tile.x * tileTexels + i) * texelSize, z);
+        }
+    });
+    for (int i = 0; i < count; i++)
+        streamTile(missing[i].second.x, missing[i].second.y, &tileScratch[texels * i]);
+}
+
+void Terrain::streamTile(int tx, int tz, const float* heights) {
+    int sx = tx - floorDiv(tx, tilesPerSide) * tilesPerSide;
+    int sz = tz - floorDiv(tz, tilesPerSide) * tilesPerSide;
+    GLState::BindTexture(GL_TEXTURE_2D, heightTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, sx * tileTexels, sz * tileTexels, tileTexels, tileTexels, GL_RED, GL_FLOAT, heights);
+    tileInSlot[sz * tilesPerSide + sx] = glm::ivec2(tx, tz);
+    tilesStreamed++;
+}
+
+void Terrain::generateMesh() {
+    std::vector<glm::vec2> verts;
+    std::vector<unsigned int> idx;
+    for (int j = 0; j <= gridSize; j++)
+        for (int i = 0; i <= gridSize; i++)
+            verts.emplace_back((float)i, (float)j);
+    for (int j = 0; j < gridSize; j++) {
+        for (int i = 0; i < gridSize; i++) {
+            int a = j * (gridSize + 1) + i;
+            int b = a + gridSize + 1;
+            idx.push_back(a);
+            idx.push_back(b);
+            idx.push_back(a + 1);
+            idx.push_back(a + 1);
+            idx.push_back(b);
+            idx.push_back(b + 1);
+        }
+    }
+    indexCount = (GLuint)idx.size();
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glGenBuffers(1, &instanceVBO);
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(glm::vec2), verts.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(unsigned int), idx.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Node), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    GLState::BindVertexArray(0);
+}
+
+bool Terrain::selectNode(float x, float z, float size, int lod, const glm::vec3& cam, const Frustum& frustum) {
+    glm::vec3 mn(x, minHeight, z), mx(x + size, maxHeight, z + size);
+    glm::vec3 closest = glm::clamp(cam, mn, mx);
+    if (glm::distance(closest, cam) > lodRanges[lod]) return false;
+    if (!frustum.BoxVisible(mn, mx)) return true;
+    if (lod == 0) {
+        nodes.push_back({ x, z, size, (float)lod });
+        return true;
+    }
+    if (glm::distance(closest, cam) > lodRanges[lod - 1]) {
+        nodes.push_back({ x, z, size, (float)lod });
+        return true;
+    }
+    float h = size * 0.5f;
+    float cx[4] = { x, x + h, x, x + h };
+    float cz[4] = { z, z, z + h, z + h };
+    for (int c = 0; c < 4; c++) {
+        if (!selectNode(cx[c], cz[c], h, lod - 1, cam, frustum))
+            nodes.push_back({ cx[c], cz[c], h, (float)lod });
+    }
+    return true;
+}
+
+GLuint Terrain::compileShader(const char* src, GLenum type) {
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    return s;
+}
+
+GLuint Terrain::createProgram(const char* vs, const char* fs) {
+    GLuint v = compileShader(vs, GL_VERTEX_SHADER);
+    GLuint f = compileShader(fs, GL_FRAGMENT_SHADER);
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v);
+    glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v);
+    glDeleteShader(f);
+    return p;
+}
+
+void Terrain::Draw(const glm::mat4& view,
+    const glm::mat4& proj,
+    const glm::mat4& lightSpaceMatrix,
+    const glm::vec3& lightDir,
+    const glm::vec3& lightColor,
+    const glm::vec3& viewPos,
+    GLuint shadowMap)
+{
+    float leafSize = rootSize / float(1 << (lodLevels - 1));
+    float rx = floorf(viewPos.x / leafSize) * leafSize - rootSize * 0.5f;
+    float rz = floorf(viewPos.z / leafSize) * leafSize - rootSize * 0.5f;
+    nodes.clear();
+    selectNode(rx, rz, rootSize, lodLevels - 1, viewPos, Frustum(proj * view));
+    if (nodes.empty()) return;
+
+    GLState::UseProgram(shader);
+    GLState::Disable(GL_BLEND);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
+    glUniformMatrix4fv(glGetUniformLocation(shader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    glUniform3fv(glGetUniformLocation(shader, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(shader, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, glm::value_ptr(viewPos));
+    TextureResidency::Use(textureID);
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D, textureID);
+    glUniform1i(glGetUniformLocation(shader, "terrainTexture"), 0);
+    GLState::ActiveTexture(GL_TEXTURE1);
+    GLState::BindTexture(GL_TEXTURE_2D, shadowMap);
+    glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
+    GLState::ActiveTexture(GL_TEXTURE2);
+    GLState::BindTexture(GL_TEXTURE_2D, heightTex);
+    glUniform1i(glGetUniformLocation(shader, "heightMap"), 2);
+
+    // the node list goes through the frame ring; without one, into storage that only grows
+    size_t bytes = nodes.size() * sizeof(Node);
+    FrameRingBuffer* ring = FrameRingBuffer::Current();
+    FrameRingBuffer::Allocation a = { nullptr, 0 };
+    if (ring) a = ring->Alloc(bytes);
+    GLState::BindVertexArray(VAO);
+    if (a.ptr) {
+        memcpy(a.ptr, nodes.data(), bytes);
+        glBindBuffer(GL_ARRAY_BUFFER, ring->Buffer());
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Node), (void*)a.offset);
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (nodes.size() > instanceCapacity) {
+            instanceCapacity = std::max(nodes.size(), instanceCapacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Node), nullptr, GL_DYNAMIC_DRAW);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, nodes.data());
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Node), (void*)0);
+    }
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, (GLsizei)nodes.size());
+    GLState::CountDraw();
+}
@@ -0,0 +1,53 @@
+// Terrain.h
+#pragma once
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+class Frustum;
+
+// CDLOD heightfield terrain. A quadtree of one shared grid patch is selected
+// around the camera each frame and drawn instanced; heights come from a
+// toroidal height texture whose tiles are regenerated as the camera moves.
+class Terrain {
+public:
+    Terrain(int gridSize = 32, int lodLevels = 5, int tileTexels = 64, int tilesPerSide = 16, float texelSize = 0.5f);
+    ~Terrain();
+    void Init(const glm::vec3& cameraPos);
+    void Update(const glm::vec3& cameraPos);
+    void Draw(const glm::mat4& view,
+        const glm::mat4& proj,
+        const glm::mat4& lightSpaceMatrix,
+        const glm::vec3& lightDir,
+        const glm::vec3& lightColor,
+        const glm::vec3& viewPos,
+        GLuint shadowMap);
+    static float HeightAt(float x, float z);
+    int NodeCount() const { return (int)nodes.size(); }
+    int VisibleTriangles() const { return (int)nodes.size() * gridSize * gridSize * 2; }
+    int TilesStreamed() const { return tilesStreamed; }
+    int tilesPerFrame;
+private:
+    struct Node { float x, z, size, lod; };
+    int gridSize, lodLevels, tileTexels, tilesPerSide;
+    float texelSize;
+    int heightRes;
+    float tileWorld;
+    float rootSize;
+    std::vector<Node> nodes;
+    std::vector<float> lodRanges;
+    std::vector<glm::ivec2> tileInSlot;
+    std::vector<float> tileScratch;
+    int tilesStreamed;
+    GLuint VAO, VBO, EBO, instanceVBO;
+    // nodes instanceVBO has storage for, when there is no ring buffer
+    size_t instanceCapacity;
+    GLuint shader, heightTex, textureID;
+    GLuint indexCount;
+    void generateMesh();
+    void streamTile(int tx, int tz, const float* heights);
+    void streamTiles(const glm::vec3& cameraPos, int budget);
+    bool selectNode(float x, float z, float size, int lod, const glm::vec3& cam, const Frustum& frustum);
+    GLuint compileShader(const char* src, GLenum type);
+    GLuint createProgram(const char* vs, const char* fs);
+};
@@ -0,0 +1,230 @@
+// TerrainQuery.cpp
+#include "TerrainQuery.h"
+#include "Terrain.h"
+#include "Hill.h"
+#include "SmoothPyramid.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERRAIN_QUERY_SSE2 1
+#endif
+
+TerrainQuery::TerrainQuery(int res, float cell)
+    : resolution(res), cellSize(cell), invCellSize(1.0f / cell), origin(0.0f), flat(false), flatHeight(0.0f) {
+}
+
+void TerrainQuery::Build(const glm::vec2& center) {
+    flat = false;
+    origin = center - glm::vec2(resolution * cellSize * 0.5f);
+    heights.resize((size_t)resolution * resolution);
+    parallel_for(resolution, 8, [&](size_t b, size_t e) {
+        for (int j = (int)b; j < (int)e; j++) {
+            float z = origin.y + j * cellSize;
+            for (int i = 0; i < resolution; i++)
+                heights[(size_t)j * resolution + i] = Terrain::HeightAt(origin.x + i * cellSize, z);
+        }
+    });
+}
+
+void TerrainQuery::BuildFlat(const glm::vec2& center, float height) {
+    flat = true;
+    flatHeight = height;
+    origin = center - glm::vec2(resolution * cellSize * 0.5f);
+    heights.assign((size_t)resolution * resolution, height);
+}
+
+float TerrainQuery::outside(float x, float z) const {
+    return flat ? flatHeight : Terrain::HeightAt(x, z);
+}
+
+void TerrainQuery::AddHill(const Hill& hill, const glm::mat4& model) {
+    addSurface(model, hill.BaseSize() * 0.5f, [&](float x, float z) { return hill.SurfaceHeight(x, z); });
+}
+
+void TerrainQuery::AddPyramid(const SmoothPyramid& pyramid, const glm::mat4& model) {
+    addSurface(model, pyramid.BaseRadius(), [&](float x, float z) { return pyramid.SurfaceHeight(x, z); });
+}
+
+void TerrainQuery::addSurface(const glm::mat4& model, float half, const std::function<float(float, float)>& surface) {
+    // the shapes draw with vec3(model * p), so only the affine part matters
+    glm::mat3 a(model);
+    glm::vec3 b(model[3]);
+    glm::mat3 inv = glm::inverse(a);
+    glm::vec2 mn(1e9f), mx(-1e9f);
+    for (int c = 0; c < 4; c++) {
+        glm::vec3 w = a * glm::vec3(c & 1 ? half : -half, 0.0f, c & 2 ? half : -half) + b;
+        mn = glm::min(mn, glm::vec2(w.x, w.z));
+        mx = glm::max(mx, glm::vec2(w.x, w.z));
+    }
+    int i0 = std::max(0, (int)floorf((mn.x - origin.x) * invCellSize));
+    int i1 = std::min(resolution - 1, (int)ceilf((mx.x - origin.x) * invCellSize));
+    int j0 = std::max(0, (int)floorf((mn.y - origin.y) * invCellSize));
+    int j1 = std::min(resolution - 1, (int)ceilf((mx.y - origin.y) * invCellSize));
+    for (int j = j0; j <= j1; j++) {
+        for (int i = i0; i <= i1; i++) {
+            glm::vec3 w(origin.x + i * cellSize, b.y, origin.y + j * cellSize);
+            glm::vec3 p = inv * (w - b);
+            if (p.x < -half || p.x > half || p.z < -half || p.z > half) continue;
+            float top = (a * glm::vec3(p.x, surface(p.x, p.z), p.z) + b).y;
+            float& h = heights[(size_t)j * resolution + i];
+            h = std::max(h, top);
+        }
+    }
+}
+
+void TerrainQuery::AddBox(const glm::vec2& mn, const glm::vec2& mx, float top) {
+    int i0 = std::max(0, (int)ceilf((mn.x - origin.x) * invCellSize));
+    int i1 = std::min(resolution - 1, (int)floorf((mx.x - origin.x) * invCellSize));
+    int j0 = std::max(0, (int)ceilf((mn.y - origin.y) * invCellSize));
+    int j1 = std::min(resolution - 1, (int)floorf((mx.y - origin.y) * invCellSize));
+    for (int j = j0; j <= j1; j++)
+        for (int i = i0; i <= i1; i++) {
+            float& h = heights[(size_t)j * resolution + i];
+            h = std::max(h, top);
+        }
+}
+
+bool TerrainQuery::Contains(float x, float z) const {
+    float gx = (x - origin.x) * invCellSize, gz = (z - origin.y) * invCellSize;
+    return !heights.empty() && gx >= 0.0f && gz >= 0.0f && gx < resolution - 1 && gz < resolution - 1;
+}
+
+float TerrainQuery::HeightAt(float x, float z) const {
+    if (!Contains(x, z)) return outside(x, z);
+    float gx = (x - origin.x) * invCellSize, gz = (z - origin.y) * invCellSize;
+    int i = (int)gx, j = (int)gz;
+    float tx = gx - i, tz = gz - j;
+    float h0 = at(i, j) + (at(i + 1, j) - at(i, j)) * tx;
+    float h1 = at(i, j + 1) + (at(i + 1, j + 1) - at(i, j + 1)) * tx;
+    return h0 + (h1 - h0) * tz;
+}
+
+float TerrainQuery::TopAt(float x, float z) const {
+    if (!Contains(x, z)) return outside(x, z);
+    int i = (int)((x - origin.x) * invCellSize), j = (int)((z - origin.y) * invCellSize);
+    return std::max(std::max(at(i, j), at(i + 1, j)), std::max(at(i, j + 1), at(i + 1, j + 1)));
+}
+
+glm::vec3 TerrainQuery::NormalAt(float x, float z) const {
+    if (!Contains(x, z)) {
+        float e = cellSize;
+        return glm::normalize(glm::vec3(outside(x - e, z) - outside(x + e, z), 2.0f * e,
+            outside(x, z - e) - outside(x, z + e)));
+    }
+    float gx = (x - origin.x) * invCellSize, gz = (z - origin.y) * invCellSize;
+    int i = (int)gx, j = (int)gz;
+    float tx = gx - i, tz = gz - j;
+    float dx = (at(i + 1, j) - at(i, j)) * (1.0f - tz) + (at(i + 1, j + 1) - at(i, j + 1)) * tz;
+    float dz = (at(i, j + 1) - at(i, j)) * (1.0f - tx) + (at(i + 1, j + 1) - at(i + 1, j)) * tx;
+    return glm::normalize(glm::vec3(-dx * invCellSize, 1.0f, -dz * invCellSize));
+}
+
+void TerrainQuery::HeightsAt(const float* xs, const float* zs, float* out, size_t count) const {
+    size_t n = 0;
+#ifdef TERRAIN_QUERY_SSE2
+    if (!heights.empty()) {
+        const __m128 ox = _mm_set1_ps(origin.x), oz = _mm_set1_ps(origin.y);
+        const __m128 inv = _mm_set1_ps(invCellSize);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 limit = _mm_set1_ps((float)(resolution - 1));
+        const __m128 maxIndex = _mm_set1_ps((float)(resolution - 2));
+        alignas(16) int ii[4], jj[4];
+        alignas(16) float c00[4], c10[4], c01[4], c11[4];
+        for (; n + 4 <= count; n += 4) {
+            __m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xs + n), ox), inv);
+            __m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(zs + n), oz), inv);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(gx, zero), _mm_cmpge_ps(gz, zero)),
+                _mm_and_ps(_mm_cmplt_ps(gx, limit), _mm_cmplt_ps(gz, limit)));
+            // clamped lanes are patched below, this only keeps the gather in bounds
+            __m128 cx = _mm_min_ps(_mm_max_ps(gx, zero), limit);
+            __m128 cz = _mm_min_ps(_mm_max_ps(gz, zero), limit);
+            __m128 fx = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(cx)), maxIndex);
+            __m128 fz = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(cz)), maxIndex);
+            __m128 tx = _mm_sub_ps(cx, fx), tz = _mm_sub_ps(cz, fz);
+            _mm_store_si128((__m128i*)ii, _mm_cvttps_epi32(fx));
+            _mm_store_si128((__m128i*)jj, _mm_cvttps_epi32(fz));
+            for (int k = 0; k < 4; k++) {
+                const float* row = &heights[(size_t)jj[k] * resolution + ii[k]];
+                c00[k] = row[0];
+                c10[k] = row[1];
+                c01[k] = row[resolution];
+                c11[k] = row[resolution + 1];
+            }
+            __m128 h00 = _mm_load_ps(c00), h10 = _mm_load_ps(c10);
+            __m128 h01 = _mm_load_ps(c01), h11 = _mm_load_ps(c11);
+            __m128 h0 = _mm_add_ps(h00, _mm_mul_ps(_mm_sub_ps(h10, h00), tx));
+            __m128 h1 = _mm_add_ps(h01, _mm_mul_ps(_mm_sub_ps(h11, h01), tx));
+            _mm_storeu_ps(out + n, _mm_add_ps(h0, _mm_mul_ps(_mm_sub_ps(h1, h0), tz)));
+            int mask = _mm_movemask_ps(inside);
+            if (mask != 0xF) {
+                for (int k = 0; k < 4; k++)
+                    if (!(mask & (1 << k))) out[n + k] = outside(xs[n + k], zs[n + k]);
+            }
+        }
+    }
+#endif
+    for (; n < count; n++)
+        out[n] = HeightAt(xs[n], zs[n]);
+}
+
+void TerrainQuery::NormalsAt(const float* xs, const float* zs, float* nx, float* ny, float* nz, size_t count) const {
+    size_t n = 0;
+#ifdef TERRAIN_QUERY_SSE2
+    if (!heights.empty()) {
+        const __m128 ox = _mm_set1_ps(origin.x), oz = _mm_set1_ps(origin.y);
+        const __m128 inv = _mm_set1_ps(invCellSize);
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        const __m128 limit = _mm_set1_ps((float)(resolution - 1));
+        const __m128 maxIndex = _mm_set1_ps((float)(resolution - 2));
+        const __m128 negInv = _mm_set1_ps(-invCellSize);
+        alignas(16) int ii[4], jj[4];
+        alignas(16) float c00[4], c10[4], c01[4], c11[4];
+        for (; n + 4 <= count; n += 4) {
+            __m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xs + n), ox), inv);
+            __m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(zs + n), oz), inv);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(gx, zero), _mm_cmpge_ps(gz, zero)),
+                _mm_and_ps(_mm_cmplt_ps(gx, limit), _mm_cmplt_ps(gz, limit)));
+            // clamped lanes are patched below, this only keeps the gather in bounds
+            __m128 cx = _mm_min_ps(_mm_max_ps(gx, zero), limit);
+            __m128 cz = _mm_min_ps(_mm_max_ps(gz, zero), limit);
+            __m128 fx = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(cx)), maxIndex);
+            __m128 fz = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(cz)), maxIndex);
+            __m128 tx = _mm_sub_ps(cx, fx), tz = _mm_sub_ps(cz, fz);
+            _mm_store_si128((__m128i*)ii, _mm_cvttps_epi32(fx));
+            _mm_store_si128((__m128i*)jj, _mm_cvttps_epi32(fz));
+            for (int k = 0; k < 4; k++) {
+                const float* row = &heights[(size_t)jj[k] * resolution + ii[k]];
+                c00[k] = row[0];
+                c10[k] = row[1];
+                c01[k] = row[resolution];
+                c11[k] = row[resolution + 1];
+            }
+            __m128 h00 = _mm_load_ps(c00), h10 = _mm_load_ps(c10);
+            __m128 h01 = _mm_load_ps(c01), h11 = _mm_load_ps(c11);
+            __m128 dx = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(h10, h00), _mm_sub_ps(one, tz)), _mm_mul_ps(_mm_sub_ps(h11, h01), tz));
+            __m128 dz = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(h01, h00), _mm_sub_ps(one, tx)), _mm_mul_ps(_mm_sub_ps(h11, h10), tx));
+            __m128 vx = _mm_mul_ps(dx, negInv), vz = _mm_mul_ps(dz, negInv);
+            __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vz, vz)), one));
+            __m128 rcp = _mm_div_ps(one, len);
+            _mm_storeu_ps(nx + n, _mm_mul_ps(vx, rcp));
+            _mm_storeu_ps(ny + n, rcp);
+            _mm_storeu_ps(nz + n, _mm_mul_ps(vz, rcp));
+            int mask = _mm_movemask_ps(inside);
+            if (mask != 0xF) {
+                for (int k = 0; k < 4; k++) {
+                    if (mask & (1 << k)) continue;
+                    glm::vec3 v = NormalAt(xs[n + k], zs[n + k]);
+                    nx[n + k] = v.x; ny[n + k] = v.y; nz[n + k] = v.z;
+                }
+            }
+        }
+    }
+#endif
+    for (; n < count; n++) {
+        glm::vec3 v = NormalAt(xs[n], zs[n]);
+        nx[n] = v.x; ny[n] = v.y; nz[n] = v.z;
+    }
+}
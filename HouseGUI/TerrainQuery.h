@@ -0,0 +1,45 @@
+// TerrainQuery.h
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Hill;
+class SmoothPyramid;
+
+// Cached CPU height grid for ground queries. Built from the procedural
+// terrain, or flat where something else replaces it, then raised by hills
+// and block footprints placed on top of it. Points outside the grid fall
+// back to Terrain::HeightAt, or to the flat height.
+class TerrainQuery {
+public:
+    TerrainQuery(int resolution = 512, float cellSize = 0.25f);
+    void Build(const glm::vec2& center);
+    // every cell at height, for a generated world that hides the heightfield
+    void BuildFlat(const glm::vec2& center, float height);
+    void AddHill(const Hill& hill, const glm::mat4& model);
+    void AddPyramid(const SmoothPyramid& pyramid, const glm::mat4& model);
+    void AddBox(const glm::vec2& mn, const glm::vec2& mx, float top);
+    float HeightAt(float x, float z) const;
+    // the highest grid point around x, z: what a body there touches, without
+    // the ramp HeightAt blends between a raised column and its neighbours
+    float TopAt(float x, float z) const;
+    glm::vec3 NormalAt(float x, float z) const;
+    // batched SoA queries, four agents per SIMD lane group
+    void HeightsAt(const float* xs, const float* zs, float* heights, size_t count) const;
+    void NormalsAt(const float* xs, const float* zs, float* nx, float* ny, float* nz, size_t count) const;
+    bool Contains(float x, float z) const;
+private:
+    int resolution;
+    float cellSize, invCellSize;
+    glm::vec2 origin;
+    std::vector<float> heights;
+    bool flat;
+    float flatHeight;
+    float at(int i, int j) const { return heights[(size_t)j * resolution + i]; }
+    float outside(float x, float z) const;
+    // raises the cells over a shape's square footprint, half wide in model
+    // space, to surface(x, z) taken through model
+    void addSurface(const glm::mat4& model, float half, const std::function<float(float, float)>& surface);
+};
@@ -0,0 +1,231 @@
+// TextureResidency.cpp
+#include "TextureResidency.h"
+#include "AssetLoader.h"
+#include "GLState.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+TextureResidency* TextureResidency::current = nullptr;
+
+TextureResidency::TextureResidency(size_t budgetBytes)
+    : MipDropFrames(120), budget(budgetBytes), resident(0), frame(0), evictions(0), mipDrops(0), streamIns(0),
+    streamInMsTotal(0.0), streamInMsMax(0.0)
+{
+    current = this;
+}
+
+TextureResidency::~TextureResidency() {
+    if (current == this) current = nullptr;
+}
+
+size_t TextureResidency::chainBytes(int width, int height, bool mipmaps) {
+    size_t bytes = (size_t)width * height * 4;
+    while (mipmaps && (width > 1 || height > 1)) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        bytes += (size_t)width * height * 4;
+    }
+    return bytes;
+}
+
+int TextureResidency::levelCount(int width, int height, bool mipmaps) {
+    int levels = 1;
+    while (mipmaps && (width > 1 || height > 1)) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+void TextureResidency::Average(const unsigned char* pixels, int width, int height, unsigned char* average) {
+    size_t count = (size_t)width * height, sum[4] = {};
+    for (size_t i = 0; i < count; i++)
+        for (int c = 0; c < 4; c++) sum[c] += pixels[i * 4 + c];
+    for (int c = 0; c < 4; c++) average[c] = (unsigned char)(count ? sum[c] / count : 0);
+}
+
+void TextureResidency::Loaded(GLuint texture, const char* path, bool flip, bool mipmaps, int width, int height, const unsigned char* average) {
+    if (current) current->loaded(texture, path, flip, mipmaps, width, height, average);
+}
+
+void TextureResidency::Forget(GLuint texture) {
+    if (!current) return;
+    auto it = current->textures.find(texture);
+    if (it == current->textures.end()) return;
+    current->resident -= it->second.bytes;
+    current->textures.erase(it);
+}
+
+void TextureResidency::Track(GLuint texture, size_t bytes) {
+    if (!current) return;
+    Entry& e = current->textures[texture];
+    current->resident -= e.bytes;
+    e.width = e.height = 0;
+    e.state = Full;
+    e.pinned = true;
+    e.streaming = false;
+    e.lastUse = current->frame;
+    e.bytes = bytes;
+    current->resident += e.bytes;
+}
+
+uint64_t TextureResidency::Version(GLuint texture) {
+    if (!current) return 0;
+    auto it = current->textures.find(texture);
+    return it == current->textures.end() ? 0 : it->second.version;
+}
+
+bool TextureResidency::Resident(GLuint texture) {
+    if (!current) return true;
+    auto it = current->textures.find(texture);
+    return it == current->textures.end() || it->second.state == Full;
+}
+
+bool TextureResidency::FullSize(GLuint texture, int& width, int& height) {
+    if (!current) return false;
+    auto it = current->textures.find(texture);
+    if (it == current->textures.end() || it->second.pinned) return false;
+    width = it->second.width;
+    height = it->second.height;
+    return true;
+}
+
+void TextureResidency::loaded(GLuint texture, const char* path, bool flip, bool mipmaps, int width, int height, const unsigned char* average) {
+    auto it = textures.find(texture);
+    if (it == textures.end()) {
+        Entry e;
+        e.bytes = 0;
+        e.state = Full;
+        e.pinned = false;
+        e.version = 0;
+        e.streaming = false;
+        it = textures.emplace(texture, e).first;
+    }
+    Entry& e = it->second;
+    if (e.streaming) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - e.requested).count();
+        streamInMsTotal += ms;
+        streamInMsMax = std::max(streamInMsMax, ms);
+        streamIns++;
+        e.streaming = false;
+    }
+    if (e.state != Full) {
+        // the cut-down texture had its level range clamped; open it up again
+        // and rebuild the chain that the clamp kept glGenerateMipmap from filling
+        GLState::BindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+        if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    resident -= e.bytes;
+    e.path = path;
+    e.flip = flip;
+    e.mipmaps = mipmaps;
+    e.width = width;
+    e.height = height;
+    memcpy(e.average, average, 4);
+    e.dropped = 0;
+    e.state = Full;
+    e.version++;
+    e.lastUse = frame;
+    e.bytes = chainBytes(width, height, mipmaps);
+    resident += e.bytes;
+}
+
+void TextureResidency::touch(GLuint texture) {
+    auto it = textures.find(texture);
+    if (it == textures.end()) return;
+    Entry& e = it->second;
+    e.lastUse = frame;
+    if (e.state == Full || e.streaming) return;
+    // a reduced texture still looks right from afar, so it only comes back
+    // when that fits the budget; an evicted one always does
+    if (e.state == Reduced && resident - e.bytes + chainBytes(e.width, e.height, e.mipmaps) > budget) return;
+    e.streaming = true;
+    e.requested = std::chrono::steady_clock::now();
+    AssetLoader::LoadTexture(texture, e.path.c_str(), e.flip, e.mipmaps, false);
+}
+
+void TextureResidency::dropTopMip(GLuint texture, Entry& e) {
+    int w = std::max(1, e.width >> (e.dropped + 1)), h = std::max(1, e.height >> (e.dropped + 1));
+    const int levels = levelCount(w, h, true);
+    // without GL 4.3 copies the texture goes straight to its average colour
+    if ((w == 1 && h == 1) || !glCopyImageSubData) {
+        evict(texture, e);
+        return;
+    }
+    // levels 1.. into a scratch texture of the reduced size
+    GLuint scratch;
+    glGenTextures(1, &scratch);
+    GLState::BindTexture(GL_TEXTURE_2D, scratch);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, w, h);
+    for (int level = 0, lw = w, lh = h; level < levels; level++, lw = std::max(1, lw / 2), lh = std::max(1, lh / 2))
+        glCopyImageSubData(texture, GL_TEXTURE_2D, level + 1, 0, 0, 0, scratch, GL_TEXTURE_2D, level, 0, 0, 0, lw, lh, 1);
+    // then the texture's own levels respecified at that size, the old last one emptied, and the copy back
+    GLState::BindTexture(GL_TEXTURE_2D, texture);
+    for (int level = 0, lw = w, lh = h; level < levels; level++, lw = std::max(1, lw / 2), lh = std::max(1, lh / 2))
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, lw, lh, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, levels, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    for (int level = 0, lw = w, lh = h; level < levels; level++, lw = std::max(1, lw / 2), lh = std::max(1, lh / 2))
+        glCopyImageSubData(scratch, GL_TEXTURE_2D, level, 0, 0, 0, texture, GL_TEXTURE_2D, level, 0, 0, 0, lw, lh, 1);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &scratch);
+    e.dropped++;
+    e.state = Reduced;
+    resident -= e.bytes;
+    e.bytes = chainBytes(w, h, true);
+    resident += e.bytes;
+    mipDrops++;
+}
+
+void TextureResidency::evict(GLuint texture, Entry& e) {
+    int w = std::max(1, e.width >> e.dropped), h = std::max(1, e.height >> e.dropped);
+    const int levels = levelCount(w, h, e.mipmaps);
+    GLState::BindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, e.average);
+    for (int level = 1; level < levels; level++) glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    e.state = Evicted;
+    resident -= e.bytes;
+    e.bytes = 4;
+    resident += e.bytes;
+    evictions++;
+}
+
+void TextureResidency::EndFrame() {
+    if (resident > budget) {
+        std::vector<std::pair<uint64_t, GLuint>> lru;
+        for (auto& t : textures)
+            if (t.second.lastUse < frame && t.second.state != Evicted && !t.second.streaming && !t.second.pinned)
+                lru.emplace_back(t.second.lastUse, t.first);
+        std::sort(lru.begin(), lru.end());
+        for (auto& c : lru) {
+            if (resident <= budget) break;
+            Entry& e = textures[c.second];
+            if (e.mipmaps && frame - e.lastUse < (uint64_t)MipDropFrames) dropTopMip(c.second, e);
+            else evict(c.second, e);
+        }
+        GLState::BindTexture(GL_TEXTURE_2D, 0);
+    }
+    frame++;
+}
+
+TextureResidency::Stats TextureResidency::GetStats() const {
+    Stats s = {};
+    s.residentBytes = resident;
+    s.budgetBytes = budget;
+    s.textures = (int)textures.size();
+    for (auto& t : textures) {
+        if (t.second.state == Reduced) s.reduced++;
+        if (t.second.state == Evicted) s.evicted++;
+        if (t.second.streaming) s.streaming++;
+    }
+    s.evictions = evictions;
+    s.mipDrops = mipDrops;
+    s.streamIns = streamIns;
+    s.avgStreamInMs = streamIns ? streamInMsTotal / streamIns : 0.0;
+    s.maxStreamInMs = streamInMsMax;
+    return s;
+}
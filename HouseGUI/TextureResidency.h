@@ -0,0 +1,90 @@
+// TextureResidency.h
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <glad/glad.h>
+
+// Keeps file-backed textures under a memory budget. AssetLoader reports every
+// texture whose full-resolution texels land, draw code calls Use() before
+// binding one, and EndFrame() walks the least recently used textures when
+// the budget is exceeded: ones seen in the last few frames lose their top mip,
+// older ones are cut down to a single texel of their average colour. The next
+// Use() of a cut-down texture streams it back in through AssetLoader.
+//
+// Nothing is read back from the GPU. Dropping a mip copies the remaining
+// levels down a level on the GPU, through a scratch texture, and frees the
+// old last level; the average colour is taken from the pixels AssetLoader
+// uploads. Levels a texture no longer has are respecified as empty, so their
+// memory goes back to the driver. Copies need matching sized formats, so the
+// textures are GL_RGBA8 throughout.
+//
+// Textures built from file-backed ones, like BlockBatch's texture array, are
+// tracked too: they count against the budget but are never cut down. Their
+// owner compares Version() of each source with the one it copied, and Use()s
+// a source it copied while cut down so that it streams back in.
+class TextureResidency {
+public:
+    struct Stats {
+        size_t residentBytes, budgetBytes;
+        int textures, reduced, evicted, streaming;
+        uint64_t evictions, mipDrops, streamIns;
+        double avgStreamInMs, maxStreamInMs;
+    };
+    TextureResidency(size_t budgetBytes);
+    ~TextureResidency();
+    void SetBudget(size_t bytes) { budget = bytes; }
+    // textures that went unused for fewer frames than this only lose mips
+    int MipDropFrames;
+    void EndFrame();
+    Stats GetStats() const;
+    static TextureResidency* Current() { return current; }
+    // no-ops without a current manager
+    static void Use(GLuint texture) { if (current) current->touch(texture); }
+    // average is the texture's average colour, RGBA
+    static void Loaded(GLuint texture, const char* path, bool flip, bool mipmaps, int width, int height, const unsigned char* average);
+    // the average colour of width x height RGBA pixels, for Loaded
+    static void Average(const unsigned char* pixels, int width, int height, unsigned char* average);
+    static void Forget(GLuint texture);
+    // a texture that is not file-backed, held at bytes until Forget()
+    static void Track(GLuint texture, size_t bytes);
+    // bumped whenever the full-resolution texels of texture land; 0 for
+    // textures that are not tracked
+    static uint64_t Version(GLuint texture);
+    // whether all of texture is resident; true for textures that are not tracked
+    static bool Resident(GLuint texture);
+    // the full-resolution size of a tracked texture, resident or not
+    static bool FullSize(GLuint texture, int& width, int& height);
+private:
+    enum State { Full, Reduced, Evicted };
+    struct Entry {
+        std::string path;
+        bool flip, mipmaps;
+        int width, height;
+        unsigned char average[4];
+        // number of top levels currently dropped; 0 when Full
+        int dropped;
+        State state;
+        // never cut down: Track()ed textures
+        bool pinned;
+        uint64_t version;
+        uint64_t lastUse;
+        size_t bytes;
+        bool streaming;
+        std::chrono::steady_clock::time_point requested;
+    };
+    std::unordered_map<GLuint, Entry> textures;
+    size_t budget, resident;
+    uint64_t frame;
+    uint64_t evictions, mipDrops, streamIns;
+    double streamInMsTotal, streamInMsMax;
+    static TextureResidency* current;
+    void touch(GLuint texture);
+    void loaded(GLuint texture, const char* path, bool flip, bool mipmaps, int width, int height, const unsigned char* average);
+    void dropTopMip(GLuint texture, Entry& e);
+    void evict(GLuint texture, Entry& e);
+    static size_t chainBytes(int width, int height, bool mipmaps);
+    static int levelCount(int width, int height, bool mipmaps);
+};
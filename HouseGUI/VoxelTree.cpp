@@ -0,0 +1,147 @@
+// VoxelTree.cpp
+#include "VoxelTree.h"
+#include "CpuProfiler.h"
+#include <algorithm>
+#include <bit>
+
+namespace {
+    glm::ivec3 childCorner(int c, int size) {
+        return glm::ivec3(c & 3, c >> 4, (c >> 2) & 3) * size;
+    }
+
+    // the cells of [mn, mx) in [a, b) that are not air
+    void visitBox(const glm::ivec3& a, const glm::ivec3& b, const glm::ivec3& mn, const glm::ivec3& mx, BlockStore::Value v, const BlockStore::Visitor& f) {
+        glm::ivec3 s = glm::max(a, mn), e = glm::min(b, mx);
+        for (int y = s.y; y < e.y; y++)
+            for (int z = s.z; z < e.z; z++)
+                for (int x = s.x; x < e.x; x++) f(x, y, z, v);
+    }
+}
+
+VoxelTree::VoxelTree(const BlockStore& source)
+    : depth(0), root(NoNode), rootValue(PaletteChunk::Air)
+{
+    PROFILE_SCOPE("VoxelTree::Build");
+    lo = source.Min();
+    glm::ivec3 extent = source.Max() - lo;
+    int side = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1));
+    while ((1 << (2 * depth)) < side) depth++;
+    hi = lo + (1 << (2 * depth));
+    Node node;
+    if (build(source, lo, depth, node, rootValue)) {
+        root = (uint32_t)nodes.size();
+        nodes.push_back(node);
+    }
+    nodes.shrink_to_fit();
+    values.shrink_to_fit();
+}
+
+bool VoxelTree::build(const BlockStore& source, const glm::ivec3& corner, int level, Node& node, Value& value) {
+    const int size = 1 << (2 * level);
+    if (glm::any(glm::greaterThanEqual(corner, source.Max())) || glm::any(glm::lessThanEqual(corner + size, source.Min()))) {
+        value = PaletteChunk::Air;
+        return false;
+    }
+    if (level == 0) {
+        value = source.Get(corner.x, corner.y, corner.z);
+        return false;
+    }
+    // children first; their own children are already stored by the time they are
+    Node kids[64];
+    Value kidValues[64];
+    uint64_t childMask = 0, solidMask = 0;
+    int kidCount = 0, valueCount = 0;
+    for (int c = 0; c < 64; c++) {
+        Node kid;
+        Value v;
+        if (build(source, corner + childCorner(c, size / 4), level - 1, kid, v)) {
+            childMask |= (uint64_t)1 << c;
+            kids[kidCount++] = kid;
+        }
+        else if (v != PaletteChunk::Air) {
+            solidMask |= (uint64_t)1 << c;
+            kidValues[valueCount++] = v;
+        }
+    }
+    if (childMask == 0) {
+        // all air, or all one solid value
+        if (solidMask == 0 || (solidMask == ~(uint64_t)0 && std::all_of(kidValues + 1, kidValues + 64, [&](Value v) { return v == kidValues[0]; }))) {
+            value = solidMask ? kidValues[0] : PaletteChunk::Air;
+            return false;
+        }
+    }
+    node.childMask = childMask;
+    node.solidMask = solidMask;
+    node.firstChild = (uint32_t)nodes.size();
+    node.firstValue = (uint32_t)values.size();
+    nodes.insert(nodes.end(), kids, kids + kidCount);
+    values.insert(values.end(), kidValues, kidValues + valueCount);
+    return true;
+}
+
+BlockStore::Value VoxelTree::Get(int x, int y, int z) const {
+    glm::ivec3 local = glm::ivec3(x, y, z) - lo;
+    const int side = 1 << (2 * depth);
+    if (local.x < 0 || local.y < 0 || local.z < 0 || local.x >= side || local.y >= side || local.z >= side) return PaletteChunk::Air;
+    if (root == NoNode) return rootValue;
+    const Node* node = &nodes[root];
+    for (int shift = 2 * (depth - 1);; shift -= 2) {
+        uint64_t bit = (uint64_t)1 << childIndex(local, shift);
+        if (node->childMask & bit) node = &nodes[node->firstChild + std::popcount(node->childMask & (bit - 1))];
+        else if (node->solidMask & bit) return values[node->firstValue + std::popcount(node->solidMask & (bit - 1))];
+        else return PaletteChunk::Air;
+    }
+}
+
+BlockStore::Value VoxelTree::cell(const glm::ivec3& p, glm::ivec3& mn, glm::ivec3& mx) const {
+    if (root == NoNode) {
+        mn = lo;
+        mx = hi;
+        return rootValue;
+    }
+    glm::ivec3 local = p - lo, corner = lo;
+    const Node* node = &nodes[root];
+    for (int shift = 2 * (depth - 1);; shift -= 2) {
+        int c = childIndex(local, shift);
+        uint64_t bit = (uint64_t)1 << c;
+        corner += childCorner(c, 1 << shift);
+        if (node->childMask & bit) {
+            node = &nodes[node->firstChild + std::popcount(node->childMask & (bit - 1))];
+            continue;
+        }
+        mn = corner;
+        mx = corner + (1 << shift);
+        if (node->solidMask & bit) return values[node->firstValue + std::popcount(node->solidMask & (bit - 1))];
+        return PaletteChunk::Air;
+    }
+}
+
+void VoxelTree::ForEachSolid(const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& f) const {
+    if (glm::any(glm::greaterThanEqual(mn, hi)) || glm::any(glm::lessThanEqual(mx, lo))) return;
+    if (root == NoNode) {
+        if (rootValue != PaletteChunk::Air) visitBox(lo, hi, mn, mx, rootValue, f);
+        return;
+    }
+    visit(nodes[root], lo, depth, mn, mx, f);
+}
+
+// children that miss the box and air children are skipped whole
+void VoxelTree::visit(const Node& node, const glm::ivec3& corner, int level, const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& f) const {
+    const int size = 1 << (2 * (level - 1));
+    uint64_t children = node.childMask | node.solidMask;
+    while (children) {
+        int c = std::countr_zero(children);
+        uint64_t bit = (uint64_t)1 << c;
+        children &= children - 1;
+        glm::ivec3 a = corner + childCorner(c, size), b = a + size;
+        if (glm::any(glm::greaterThanEqual(a, mx)) || glm::any(glm::lessThanEqual(b, mn))) continue;
+        if (node.childMask & bit)
+            visit(nodes[node.firstChild + std::popcount(node.childMask & (bit - 1))], a, level - 1, mn, mx, f);
+        else
+            visitBox(a, b, mn, mx, values[node.firstValue + std::popcount(node.solidMask & (bit - 1))], f);
+    }
+}
+
+size_t VoxelTree::MemoryBytes() const {
+    return sizeof(*this) + nodes.capacity() * sizeof(Node) + values.capacity() * sizeof(Value);
+}
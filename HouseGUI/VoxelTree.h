@@ -0,0 +1,48 @@
+// VoxelTree.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BlockStore.h"
+
+// The world as a sparse 64-tree: a cube 4^depth blocks on a side, split into
+// 4 x 4 x 4 children at every level. A child that holds one value throughout
+// is not split further, so the sky above the ground, the dirt under it and
+// the space around the world cost one bit each in their parent. A node keeps
+// two 64-bit masks, for the children that are nodes and the ones of one
+// solid value; the child nodes are stored together and the solid values
+// too, and a child is found by counting the mask bits below it.
+//
+// The tree is built once from another store and is read-only.
+class VoxelTree : public BlockStore {
+public:
+    // the blocks of source, in a tree just deep enough for its box
+    explicit VoxelTree(const BlockStore& source);
+    const char* Name() const override { return "tree"; }
+    Value Get(int x, int y, int z) const override;
+    void ForEachSolid(const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& visit) const override;
+    size_t MemoryBytes() const override;
+    int Depth() const { return depth; }
+    size_t NodeCount() const { return nodes.size(); }
+protected:
+    Value cell(const glm::ivec3& p, glm::ivec3& mn, glm::ivec3& mx) const override;
+private:
+    struct Node {
+        uint64_t childMask, solidMask;
+        uint32_t firstChild, firstValue;
+    };
+    static constexpr uint32_t NoNode = 0xFFFFFFFFu;
+    int depth;
+    // the root's value while the whole tree is one value
+    uint32_t root;
+    Value rootValue;
+    std::vector<Node> nodes;
+    std::vector<Value> values;
+    // child c of a node is at x = c & 3, z = (c >> 2) & 3, y = c >> 4
+    static int childIndex(const glm::ivec3& local, int shift) {
+        return ((local.x >> shift) & 3) | ((local.z >> shift) & 3) << 2 | ((local.y >> shift) & 3) << 4;
+    }
+    // false and value when the cube at corner, 4^level on a side, is uniform
+    bool build(const BlockStore& source, const glm::ivec3& corner, int level, Node& node, Value& value);
+    void visit(const Node& node, const glm::ivec3& corner, int level, const glm::ivec3& mn, const glm::ivec3& mx, const Visitor& f) const;
+};
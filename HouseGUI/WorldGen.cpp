@@ -0,0 +1,420 @@
+// WorldGen.cpp
+#include "WorldGen.h"
+#include "BlockStore.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WORLD_GEN_SSE2 1
+#endif
+
+namespace {
+    // in columns from the origin: flat up to flatRadius, full height from blendRadius
+    const float flatRadius = 20.0f;
+    const float blendRadius = 60.0f;
+    const int octaves = 4;
+    const float baseFrequency = 1.0f / 32.0f;
+    // 1 + 1/2 + 1/4 + 1/8
+    const float invAmplitudeSum = 1.0f / 1.875f;
+    const uint32_t octaveSalt = 0x9E3779B9u;
+    const uint32_t houseSalt = 0x68E31DA4u, treeSalt = 0xB5297A4Du, flowerSalt = 0x1B56C4E9u;
+
+    uint32_t hash(int x, int z, uint32_t seed) {
+        uint32_t h = (uint32_t)x * 374761393u + (uint32_t)z * 668265263u + seed * 2246822519u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return h ^ (h >> 16);
+    }
+
+    // [0, 1) from the top 24 bits, which convert to float exactly
+    float unit(uint32_t h) {
+        return (float)(int)(h >> 8) * (1.0f / 16777216.0f);
+    }
+
+    int floorInt(float x) {
+        int i = (int)x;
+        return (float)i > x ? i - 1 : i;
+    }
+
+    float smooth(float t) {
+        return t * t * (3.0f - 2.0f * t);
+    }
+
+    // the SSE2 path below does the same operations in the same order, so
+    // both give the same bits
+    float valueNoise(float x, float z, uint32_t seed) {
+        int ix = floorInt(x), iz = floorInt(z);
+        float fx = smooth(x - (float)ix), fz = smooth(z - (float)iz);
+        float a = unit(hash(ix, iz, seed)), b = unit(hash(ix + 1, iz, seed));
+        float c = unit(hash(ix, iz + 1, seed)), d = unit(hash(ix + 1, iz + 1, seed));
+        float ab = a + (b - a) * fx;
+        float cd = c + (d - c) * fx;
+        return ab + (cd - ab) * fz;
+    }
+
+#ifdef WORLD_GEN_SSE2
+    // SSE2 has no 32-bit multiply; two 64-bit ones cover the even and odd lanes
+    __m128i mullo(__m128i a, __m128i b) {
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    // hash() of four x with one z; zTerm is the z and seed part of the sum
+    __m128 unit4(__m128i x, __m128i zTerm) {
+        __m128i h = _mm_add_epi32(mullo(x, _mm_set1_epi32((int)374761393u)), zTerm);
+        h = mullo(_mm_xor_si128(h, _mm_srli_epi32(h, 13)), _mm_set1_epi32((int)1274126177u));
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+    }
+
+    __m128 valueNoise4(__m128 x, float z, uint32_t seed) {
+        __m128i ix = _mm_cvttps_epi32(x);
+        __m128 fxi = _mm_cvtepi32_ps(ix);
+        // truncation rounds negatives up; the compare mask is -1 where it did
+        __m128i above = _mm_castps_si128(_mm_cmpgt_ps(fxi, x));
+        ix = _mm_add_epi32(ix, above);
+        __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+        fx = _mm_mul_ps(_mm_mul_ps(fx, fx), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), fx)));
+        int iz = floorInt(z);
+        __m128 fz = _mm_set1_ps(smooth(z - (float)iz));
+        __m128i z0 = _mm_set1_epi32((int)((uint32_t)iz * 668265263u + seed * 2246822519u));
+        __m128i z1 = _mm_set1_epi32((int)((uint32_t)(iz + 1) * 668265263u + seed * 2246822519u));
+        __m128i ix1 = _mm_add_epi32(ix, _mm_set1_epi32(1));
+        __m128 a = unit4(ix, z0), b = unit4(ix1, z0);
+        __m128 c = unit4(ix, z1), d = unit4(ix1, z1);
+        __m128 ab = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fx));
+        __m128 cd = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), fx));
+        return _mm_add_ps(ab, _mm_mul_ps(_mm_sub_ps(cd, ab), fz));
+    }
+#endif
+
+    // f(x, y, z) for the cells of a chunk that have air above or beside them,
+    // from a 16-bit mask of solid cells per row, y and z, with a layer of air
+    // over the top one; past the chunk's sides the neighbouring columns are
+    // solid up to their edge levels
+    template<class F> void forEachVisible(const int8_t (&edges)[4][WorldGen::ChunkSize], const uint16_t* solid, int height, F f) {
+        static_assert(WorldGen::ChunkSize == 16, "a row of cells is a 16-bit mask");
+        const int n = WorldGen::ChunkSize;
+        for (int y = 0; y < height; y++) {
+            uint32_t front = 0, back = 0;
+            for (int x = 0; x < n; x++) {
+                front |= (uint32_t)(y <= edges[2][x]) << x;
+                back |= (uint32_t)(y <= edges[3][x]) << x;
+            }
+            const uint16_t* layer = solid + y * n;
+            for (int z = 0; z < n; z++) {
+                uint32_t row = layer[z];
+                if (!row) continue;
+                // a cell is hidden when the cells above and on all four sides are solid
+                uint32_t left = row << 1 | (uint32_t)(y <= edges[0][z]);
+                uint32_t right = row >> 1 | (uint32_t)(y <= edges[1][z]) << (n - 1);
+                uint32_t hidden = layer[z + n] & left & right & (z > 0 ? layer[z - 1] : front) & (z < n - 1 ? layer[z + 1] : back);
+                for (uint32_t seen = row & ~hidden; seen; seen &= seen - 1) f(std::countr_zero(seen), y, z);
+            }
+        }
+    }
+}
+
+WorldGen::Settings WorldGen::DefaultSettings(uint32_t seed) {
+    Settings s;
+    s.seed = seed;
+    s.chunks = 16;
+    s.maxHeight = 12;
+    s.spacing = 0.4f;
+    s.treeChance = 0.12f;
+    s.houseChance = 0.1f;
+    s.flowerChance = 0.03f;
+    s.clearExtent = 4.8f;
+    return s;
+}
+
+WorldGen::WorldGen(const Settings& s, const Scene& scene)
+    : settings(s), clearColumns((int)roundf(s.clearExtent / s.spacing)), housePrefab(-1), houseReach(0)
+{
+    for (const char* name : { "tree7", "tree10", "tree12" }) {
+        int p = scene.FindPrefab(name);
+        if (p >= 0) treePrefabs.push_back((uint32_t)p);
+    }
+    int house = scene.FindPrefab("house");
+    if (house >= 0) {
+        const Scene::Prefab& prefab = scene.Prefabs()[house];
+        for (uint32_t b = 0; b < prefab.blockCount; b++) {
+            const Scene::Block& block = scene.Blocks()[prefab.firstBlock + b];
+            int dx = (int)lroundf(block.position.x / s.spacing), dz = (int)lroundf(block.position.z / s.spacing);
+            houseReach = std::max(houseReach, std::max(abs(dx), abs(dz)));
+            if (fabsf(block.position.y) < s.spacing * 0.5f) houseFloor.push_back({ dx, dz });
+        }
+        // the flattened ground around the house has to stay inside its chunk
+        if (houseReach + 1 <= ChunkSize / 2 - 2) housePrefab = house;
+    }
+}
+
+glm::vec3 WorldGen::ChunkOrigin(const Chunk& chunk) const {
+    return glm::vec3(chunk.x * ChunkSize * settings.spacing, 0.0f, chunk.z * ChunkSize * settings.spacing);
+}
+
+bool WorldGen::cleared(int i, int j) const {
+    return abs(i) <= clearColumns && abs(j) <= clearColumns;
+}
+
+// levels of columns x0 .. x0 + count - 1 in row z
+void WorldGen::columnLevels(int x0, int z, int count, int* levels) const {
+    const float zf = (float)z;
+    const float zz = zf * zf;
+    const float invBlend = 1.0f / (blendRadius - flatRadius);
+    const float heightScale = 2.0f * settings.maxHeight;
+    int n = 0;
+#ifdef WORLD_GEN_SSE2
+    for (; n + 4 <= count; n += 4) {
+        __m128 x = _mm_cvtepi32_ps(_mm_setr_epi32(x0 + n, x0 + n + 1, x0 + n + 2, x0 + n + 3));
+        __m128 sum = _mm_setzero_ps();
+        float amp = 1.0f, freq = baseFrequency;
+        for (int o = 0; o < octaves; o++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amp), valueNoise4(_mm_mul_ps(x, _mm_set1_ps(freq)), zf * freq, settings.seed + o * octaveSalt)));
+            amp *= 0.5f;
+            freq *= 2.0f;
+        }
+        __m128 h = _mm_mul_ps(sum, _mm_set1_ps(invAmplitudeSum));
+        __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_set1_ps(zz)));
+        __m128 t = _mm_mul_ps(_mm_sub_ps(r, _mm_set1_ps(flatRadius)), _mm_set1_ps(invBlend));
+        t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        t = _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), t)));
+        __m128i level = _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(h, h), _mm_set1_ps(heightScale)), t));
+        _mm_storeu_si128((__m128i*)(levels + n), level);
+        for (int k = 0; k < 4; k++) levels[n + k] = std::min(levels[n + k], settings.maxHeight);
+    }
+#endif
+    for (; n < count; n++) {
+        float x = (float)(x0 + n);
+        float sum = 0.0f, amp = 1.0f, freq = baseFrequency;
+        for (int o = 0; o < octaves; o++) {
+            sum = sum + amp * valueNoise(x * freq, zf * freq, settings.seed + o * octaveSalt);
+            amp *= 0.5f;
+            freq *= 2.0f;
+        }
+        float h = sum * invAmplitudeSum;
+        float r = sqrtf(x * x + zz);
+        float t = std::min(std::max((r - flatRadius) * invBlend, 0.0f), 1.0f);
+        t = smooth(t);
+        levels[n] = std::min((int)(h * h * heightScale * t), settings.maxHeight);
+    }
+}
+
+void WorldGen::GenerateChunk(Chunk& chunk) const {
+    PROFILE_SCOPE("WorldGen::GenerateChunk");
+    // the chunk's columns and a ring of neighbours, rows padded to whole lane groups
+    const int Rows = ChunkSize + 2, Stride = (ChunkSize + 2 + 3) & ~3;
+    int levels[Rows][Stride];
+    const int i0 = chunk.x * ChunkSize, j0 = chunk.z * ChunkSize;
+    const float s = settings.spacing;
+    for (int r = 0; r < Rows; r++) {
+        columnLevels(i0 - 1, j0 - 1 + r, Stride, levels[r]);
+        // the hand-placed grass plane is at level 0
+        for (int c = 0; c < Rows; c++)
+            if (cleared(i0 - 1 + c, j0 - 1 + r)) levels[r][c] = 0;
+    }
+    auto level = [&](int li, int lj) -> int& { return levels[lj + 1][li + 1]; };
+
+    // columns trees and flowers keep away from, and columns whose top block is covered
+    bool occupied[ChunkSize][ChunkSize] = {}, covered[ChunkSize][ChunkSize] = {};
+    chunk.billboards.clear();
+    chunk.instances.clear();
+
+    // at most one house, in the middle of the chunk on ground flattened to its level
+    const int mid = ChunkSize / 2, flat = houseReach + 1;
+    if (housePrefab >= 0 && unit(hash(chunk.x, chunk.z, settings.seed ^ houseSalt)) < settings.houseChance &&
+        !cleared(i0 + mid - flat, j0 + mid - flat) && !cleared(i0 + mid + flat, j0 + mid + flat) &&
+        !cleared(i0 + mid - flat, j0 + mid + flat) && !cleared(i0 + mid + flat, j0 + mid - flat)) {
+        int l = level(mid, mid);
+        for (int lj = mid - flat; lj <= mid + flat; lj++)
+            for (int li = mid - flat; li <= mid + flat; li++) level(li, lj) = l;
+        // tree crowns reach two columns out
+        for (int lj = std::max(0, mid - flat - 2); lj <= std::min(ChunkSize - 1, mid + flat + 2); lj++)
+            for (int li = std::max(0, mid - flat - 2); li <= std::min(ChunkSize - 1, mid + flat + 2); li++) occupied[lj][li] = true;
+        for (const Footprint& f : houseFloor) covered[mid + f.dz][mid + f.dx] = true;
+        chunk.instances.push_back({ (uint32_t)housePrefab, glm::vec3((i0 + mid) * s, l * s, (j0 + mid) * s) });
+    }
+
+    // one candidate per 4x4 cell, kept off the cell border so trunks are at least three columns apart
+    if (!treePrefabs.empty()) {
+        for (int cz = 0; cz < ChunkSize; cz += 4) {
+            for (int cx = 0; cx < ChunkSize; cx += 4) {
+                uint32_t h = hash(i0 + cx, j0 + cz, settings.seed ^ treeSalt);
+                if (unit(h) >= settings.treeChance) continue;
+                int li = cx + 1 + (h & 1), lj = cz + 1 + ((h >> 1) & 1);
+                int i = i0 + li, j = j0 + lj;
+                if (occupied[lj][li] || (abs(i) <= clearColumns + 3 && abs(j) <= clearColumns + 3)) continue;
+                uint32_t prefab = treePrefabs[(h >> 2) % treePrefabs.size()];
+                chunk.instances.push_back({ prefab, glm::vec3(i * s, level(li, lj) * s, j * s) });
+                covered[lj][li] = true;
+                for (int dz = -1; dz <= 1; dz++)
+                    for (int dx = -1; dx <= 1; dx++) occupied[lj + dz][li + dx] = true;
+            }
+        }
+    }
+
+    int tops[ChunkSize][ChunkSize], tallest = -1;
+    for (int lj = 0; lj < ChunkSize; lj++) {
+        for (int li = 0; li < ChunkSize; li++) {
+            int i = i0 + li, j = j0 + lj;
+            if (cleared(i, j)) {
+                tops[lj][li] = -1;
+                continue;
+            }
+            int top = level(li, lj);
+            tops[lj][li] = top;
+            tallest = std::max(tallest, top);
+            if (covered[lj][li] || occupied[lj][li]) continue;
+            uint32_t h = hash(i, j, settings.seed ^ flowerSalt);
+            if (unit(h) >= settings.flowerChance) continue;
+            // the low hash bits pick the flower and nudge it off the column centre
+            glm::vec3 jitter(((h & 15) / 15.0f - 0.5f) * 0.5f * s, 0.5f, (((h >> 4) & 15) / 15.0f - 0.5f) * 0.5f * s);
+            uint8_t type = (uint8_t)(Scene::FlowerBlueOrchid + (h >> 8) % 5);
+            chunk.billboards.push_back({ glm::vec3(li * s, top * s, lj * s) + jitter, type, 0, Scene::Billboard, 0 });
+        }
+    }
+    for (int k = 0; k < ChunkSize; k++) {
+        chunk.edges[0][k] = (int8_t)level(-1, k);
+        chunk.edges[1][k] = (int8_t)level(ChunkSize, k);
+        chunk.edges[2][k] = (int8_t)level(k, -1);
+        chunk.edges[3][k] = (int8_t)level(k, ChunkSize);
+    }
+
+    static_assert(ChunkSize == PaletteChunk::Size, "a chunk's columns are one palette chunk");
+    chunk.voxels.Reset(tallest + 1);
+    if (tallest < 0) return;
+    const PaletteChunk::Value dirt = PaletteChunk::Pack(Scene::Dirt, 0), grass = PaletteChunk::Pack(Scene::Grass, 0);
+    // layer by layer, as the palette chunk stores them; only the solid cells are written
+    static thread_local std::vector<PaletteChunk::Value> cells;
+    cells.assign(chunk.voxels.Volume(), PaletteChunk::Air);
+    const size_t layer = ChunkSize * ChunkSize;
+    for (int lj = 0; lj < ChunkSize; lj++)
+        for (int li = 0; li < ChunkSize; li++) {
+            int top = tops[lj][li];
+            if (top < 0) continue;
+            PaletteChunk::Value* cell = cells.data() + lj * ChunkSize + li;
+            for (int y = 0; y < top; y++) cell[y * layer] = dirt;
+            if (!covered[lj][li]) cell[top * layer] = grass;
+        }
+    chunk.voxels.Assign(cells.data());
+}
+
+void WorldGen::VisibleBlocks(const Chunk& chunk, std::vector<Scene::Block>& blocks) const {
+    const PaletteChunk& voxels = chunk.voxels;
+    const int height = voxels.Height();
+    const float s = settings.spacing;
+    static thread_local std::vector<uint16_t> solid;
+    solid.assign((size_t)(height + 1) * ChunkSize, 0);
+    voxels.ForEachSolid([&](int x, int y, int z, PaletteChunk::Value) { solid[y * ChunkSize + z] |= (uint16_t)(1 << x); });
+    forEachVisible(chunk.edges, solid.data(), height, [&](int x, int y, int z) {
+        PaletteChunk::Value v = voxels.Get(x, y, z);
+        blocks.push_back({ glm::vec3(x * s, y * s, z * s), PaletteChunk::TypeOf(v), PaletteChunk::RotationOf(v), 0, 0 });
+    });
+}
+
+void WorldGen::VisibleBlocks(const BlockStore& store, const Chunk& chunk, std::vector<Scene::Block>& blocks) const {
+    const glm::ivec3 corner(chunk.x * ChunkSize, 0, chunk.z * ChunkSize);
+    const int height = store.Max().y;
+    const float s = settings.spacing;
+    // the values too, as the scan passes them, so a visible cell is not looked up again
+    static thread_local std::vector<uint16_t> solid;
+    static thread_local std::vector<PaletteChunk::Value> cells;
+    solid.assign((size_t)(height + 1) * ChunkSize, 0);
+    cells.resize((size_t)height * ChunkSize * ChunkSize);
+    store.ForEachSolid(corner, corner + glm::ivec3(ChunkSize, height, ChunkSize), [&](int x, int y, int z, PaletteChunk::Value v) {
+        x -= corner.x;
+        z -= corner.z;
+        solid[y * ChunkSize + z] |= (uint16_t)(1 << x);
+        cells[(y * ChunkSize + z) * ChunkSize + x] = v;
+    });
+    forEachVisible(chunk.edges, solid.data(), height, [&](int x, int y, int z) {
+        PaletteChunk::Value v = cells[(y * ChunkSize + z) * ChunkSize + x];
+        blocks.push_back({ glm::vec3(x * s, y * s, z * s), PaletteChunk::TypeOf(v), PaletteChunk::RotationOf(v), 0, 0 });
+    });
+}
+
+double WorldGen::GenerateChunks() {
+    PROFILE_SCOPE("WorldGen::GenerateChunks");
+    auto start = std::chrono::steady_clock::now();
+    const int n = settings.chunks;
+    chunks.assign((size_t)n * n, Chunk());
+    for (size_t k = 0; k < chunks.size(); k++) {
+        chunks[k].x = (int)(k % n) - n / 2;
+        chunks[k].z = (int)(k / n) - n / 2;
+    }
+    parallel_for(chunks.size(), 1, [&](size_t b, size_t e) {
+        for (size_t k = b; k < e; k++) GenerateChunk(chunks[k]);
+    });
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+WorldGen::Stats WorldGen::AddTo(Scene& scene, const BlockStore& store) const {
+    Stats stats = {};
+    stats.chunks = chunks.size();
+    char name[32];
+    std::vector<Scene::Block> blocks;
+    for (const Chunk& c : chunks) {
+        blocks.clear();
+        VisibleBlocks(store, c, blocks);
+        blocks.insert(blocks.end(), c.billboards.begin(), c.billboards.end());
+        if (!blocks.empty()) {
+            snprintf(name, sizeof(name), "chunk %d %d", c.x, c.z);
+            scene.AddInstance(scene.AddPrefab(name, blocks.data(), blocks.size()), ChunkOrigin(c));
+        }
+        for (const Scene::Instance& inst : c.instances) {
+            scene.AddInstance(inst.prefab, inst.position);
+            if ((int)inst.prefab == housePrefab) stats.houses++;
+            else stats.trees++;
+        }
+        stats.blocks += blocks.size();
+        stats.flowers += c.billboards.size();
+    }
+    return stats;
+}
+
+uint64_t WorldGen::Checksum() const {
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](const void* data, size_t size) {
+        const unsigned char* p = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 1099511628211ull;
+    };
+    for (const Chunk& c : chunks) {
+        c.voxels.ForEachSolid([&](int x, int y, int z, PaletteChunk::Value v) {
+            int cell[4] = { x, y, z, v };
+            mix(cell, sizeof(cell));
+        });
+        mix(c.edges, sizeof(c.edges));
+        mix(c.billboards.data(), c.billboards.size() * sizeof(Scene::Block));
+        mix(c.instances.data(), c.instances.size() * sizeof(Scene::Instance));
+    }
+    return h;
+}
+
+uint64_t WorldGen::Fingerprint(const Scene& scene) const {
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](const void* data, size_t size) {
+        const unsigned char* p = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 1099511628211ull;
+    };
+    // not the chunk count, which only says how many are generated at once
+    mix(&settings.seed, sizeof(settings.seed));
+    mix(&settings.maxHeight, sizeof(settings.maxHeight));
+    mix(&settings.spacing, sizeof(settings.spacing));
+    mix(&settings.treeChance, sizeof(settings.treeChance));
+    mix(&settings.houseChance, sizeof(settings.houseChance));
+    mix(&settings.flowerChance, sizeof(settings.flowerChance));
+    mix(&settings.clearExtent, sizeof(settings.clearExtent));
+    for (size_t p = 0; p < scene.PrefabCount(); p++) {
+        const Scene::Prefab& prefab = scene.Prefabs()[p];
+        mix(prefab.name, strnlen(prefab.name, sizeof(prefab.name)));
+        mix(&prefab.blockCount, sizeof(prefab.blockCount));
+    }
+    return h;
+}
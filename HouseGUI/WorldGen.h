@@ -0,0 +1,100 @@
+// WorldGen.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "PaletteChunk.h"
+#include "Scene.h"
+
+class BlockStore;
+
+// Procedural block world around the hand-placed scene. The world is a grid
+// of chunks of ChunkSize x ChunkSize block columns. Column heights come from
+// value noise (four columns per SSE2 lane group) that flattens out towards
+// the origin, where the scene's own grass plane is left alone. Each column
+// is grass over dirt, kept in the chunk's palette storage, which is the only
+// copy of its cube blocks; grass under a house floor or a trunk is left out.
+// Trees, houses and flowers are placed from per-cell hashes; trees and
+// houses are instances of the scene's tree7/tree10/tree12 and house
+// prefabs, flowers are billboards kept in a list beside the cubes.
+//
+// Only the cubes with air above or beside them are drawn. VisibleBlocks
+// finds them from the storage, with the levels of the columns around the
+// chunk standing in for the neighbouring chunks. Once the chunks are handed
+// to a BlockStore, which takes their storage over, it finds them there.
+//
+// A chunk depends only on the seed and its coordinates, so chunks are
+// generated in parallel and the result does not depend on the thread count.
+class WorldGen {
+public:
+    static constexpr int ChunkSize = 16;
+    struct Settings {
+        uint32_t seed;
+        // chunks per side, centred on the origin
+        int chunks;
+        int maxHeight;
+        // between neighbouring block centres
+        float spacing;
+        // chances per 4x4 column cell, per chunk and per grass column
+        float treeChance, houseChance, flowerChance;
+        // columns within this half extent around the origin stay empty
+        float clearExtent;
+    };
+    struct Chunk {
+        int x, z;
+        // grass on dirt down to level 0, up to the tallest column
+        PaletteChunk voxels;
+        // the top levels of the columns just outside the chunk: at x = -1 and
+        // x = ChunkSize by row, then at z = -1 and z = ChunkSize by column
+        int8_t edges[4][ChunkSize];
+        // flowers, relative to the chunk origin
+        std::vector<Scene::Block> billboards;
+        // tree and house instances in world space
+        std::vector<Scene::Instance> instances;
+    };
+    struct Stats {
+        size_t chunks, blocks, trees, houses, flowers;
+    };
+    static Settings DefaultSettings(uint32_t seed);
+    // the prefabs are looked up in scene, which Generate adds to
+    WorldGen(const Settings& settings, const Scene& scene);
+    // every chunk on the current job system; returns the seconds it took
+    double GenerateChunks();
+    // one prefab and instance per chunk and the chunk's trees and houses, in
+    // chunk order; the cubes are read from blocks, which holds the chunks
+    Stats AddTo(Scene& scene, const BlockStore& blocks) const;
+    // the chunk at chunk.x, chunk.z; safe to call from several threads
+    void GenerateChunk(Chunk& chunk) const;
+    // appends the cubes of chunk that have air above or beside them, relative
+    // to the chunk origin
+    void VisibleBlocks(const Chunk& chunk, std::vector<Scene::Block>& blocks) const;
+    // the same from a store holding the chunk's cubes
+    void VisibleBlocks(const BlockStore& store, const Chunk& chunk, std::vector<Scene::Block>& blocks) const;
+    const std::vector<Chunk>& Chunks() const { return chunks; }
+    // for a store to take the voxels over
+    std::vector<Chunk>& Chunks() { return chunks; }
+    glm::vec3 ChunkOrigin(const Chunk& chunk) const;
+    float Spacing() const { return settings.spacing; }
+    uint32_t Seed() const { return settings.seed; }
+    int MaxHeight() const { return settings.maxHeight; }
+    // FNV-1a over the generated blocks, billboards and instances
+    uint64_t Checksum() const;
+    // FNV-1a over the settings that shape a chunk and the names and sizes of
+    // the scene's prefabs, which instances point at by index; chunks saved
+    // under another fingerprint belong to another world
+    uint64_t Fingerprint(const Scene& scene) const;
+private:
+    struct Footprint { int dx, dz; };
+    Settings settings;
+    int clearColumns;
+    // those of tree7, tree10 and tree12 that the scene has
+    std::vector<uint32_t> treePrefabs;
+    int housePrefab;
+    // columns the house floor covers, relative to the column it is placed on
+    std::vector<Footprint> houseFloor;
+    int houseReach;
+    std::vector<Chunk> chunks;
+    void columnLevels(int x0, int z, int count, int* levels) const;
+    bool cleared(int i, int j) const;
+};
@@ -1,5 +1,5 @@
-﻿#include <GLFW/glfw3.h>
-#include <glad/glad.h>
+﻿#include <glad/glad.h>
+#include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -10,11 +10,49 @@
 #include "Flower.h"
 #include "Leaves.h"
 #include "Glass.h"
+#include "Dirt.h"
 #include "Door.h"
 #include "Robot.h"
 #include "Hill.h"
+#include "SmoothPyramid.h"
+#include "Impostor.h"
+#include "Terrain.h"
+#include "TerrainQuery.h"
+#include "ShapeInstancer.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "ImageCache.h"
+#include "AssetLoader.h"
+#include "AssetPack.h"
+#include "TextureResidency.h"
+#include "FrameRingBuffer.h"
+#include "BlockBatch.h"
+#include "GLState.h"
+#include "RenderGraph.h"
+#include "HeadlessContext.h"
+#include "CameraPath.h"
+#include "Benchmark.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
+#include "PerfHud.h"
+#include "Scene.h"
+#include "WorldGen.h"
+#include "ChunkStreamer.h"
+#include "RegionStore.h"
+#include "ChunkGridStore.h"
+#include "VoxelTree.h"
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
 
 Camera camera(glm::vec3(0.0f, 2.0f, 10.0f));
 float lastX = 400.0f, lastY = 300.0f;
@@ -25,17 +63,56 @@ GrassBlock* grassBlock = nullptr;
 Stairs* stairs = nullptr;
 Leaves* leaves = nullptr;
 Panel* glassPanel = nullptr;
+Dirt* dirtBlock = nullptr;
 Door* door = nullptr;
 Flower* flowers[5] = { nullptr };
 Robot* robot = nullptr;
 Hill* hill = nullptr;
+SmoothPyramid* pyramid = nullptr;
+Terrain* terrain = nullptr;
+TerrainQuery* terrainQuery = nullptr;
+ShapeInstancer* shapes = nullptr;
+JobSystem* jobs = nullptr;
+AssetLoader* assets = nullptr;
+AssetPack* assetPack = nullptr;
+TextureResidency* residency = nullptr;
+FrameRingBuffer* ring = nullptr;
+BlockBatch* blockBatch = nullptr;
+struct DrawItem {
+    BlockBase* block;
+    glm::mat4 model;
+};
+std::vector<DrawItem> drawList;
+std::vector<char> drawVisible;
+std::vector<int> batchSlots;
+std::vector<const glm::mat4*> batchModels;
+// blocks the frustum test dropped in the last camera view's flushDraws
+size_t culledObjects = 0;
+int shapeCount = 64;
 GLuint sceneShader = 0;
+Scene* scene = nullptr;
+// generated around the scene with --world, all at once or streamed around the camera
+WorldGen* world = nullptr;
+ChunkStreamer* streamer = nullptr;
+// where the streamed world is saved, with --world-dir
+RegionStore* regionStore = nullptr;
+// the blocks of a generated world, which meshing, the ground columns and picking read;
+// chunks or a tree with --world-store. A streamed world keeps its blocks in the streamer's
+// chunks, which come and go, and has none
+BlockStore* blockStore = nullptr;
+// what each Scene::BlockType draws with
+BlockBase* blockTypes[Scene::BlockTypes] = { nullptr };
+// per scene prefab, nullptr for prefabs without one
+std::vector<Impostor*> prefabImpostors;
+float impostorDistance = 25.0f;
+bool impostorsEnabled = true;
 const float TurnSpeed = 90.0f;
 
+// the scene's lights replace these
 glm::vec3 dirLightColor(2.0f, 2.0f, 2.0f);
+glm::vec3 cornerLightPos(0.0f, 5.0f, 0.0f);
 glm::vec3 cornerLightColor(1.0f, 5.0f, 1.0f);
 
-const float hillBaseRadius = 9.0f;
 const float grassPlaneSize = 25.0f;
 const float blockSize = 0.2f;
 const float spacing = blockSize * 2.0f;
@@ -45,8 +122,8 @@ const float robotBaseOffset = 0.6f;
 
 const float hillMaxHeight = 1.0f;
 const float hillExponent = 3.0f;
-glm::vec3 hillCenter(0.0f, 0.08f, planeOffset + hillBaseRadius - 17.8f);
 
+int screenWidth = 800, screenHeight = 600;
 glm::mat4 projection;
 glm::vec3 robotPos(2.0f, 2.0f, 0.0f);
 float robotYaw = 0.0f;
@@ -64,6 +141,39 @@ void scroll_callback(GLFWwindow* window, double, double yoff) {
     camera.ProcessMouseScroll((float)yoff);
 }
 
+const float groundY = 0.2f;
+
+float getTerrainHeight(float x, float z) {
+    float height = terrainQuery ? terrainQuery->HeightAt(x, z) : groundY;
+    // streamed chunks come and go, so their columns are asked for instead of added to the query
+    float top;
+    if (streamer && streamer->HeightAt(x, z, top)) height = std::max(height, top);
+    return height;
+}
+
+// the highest ground a body at x, z touches, for telling a step from a wall
+float getTerrainTop(float x, float z) {
+    float height = terrainQuery ? terrainQuery->TopAt(x, z) : groundY;
+    float top;
+    if (streamer && streamer->HeightAt(x, z, top)) height = std::max(height, top);
+    return height;
+}
+
+// where a body with its feet at feet ends up after moving step over the ground. It climbs a
+// block at a time; a higher column is a wall that stops it, and it slides along, instead of
+// being lifted onto its top. Going downhill, such as away from a wall, is always allowed.
+glm::vec2 stepOnGround(const glm::vec3& feet, const glm::vec2& step) {
+    float here = getTerrainHeight(feet.x, feet.z);
+    auto open = [&](float x, float z) {
+        return getTerrainTop(x, z) <= feet.y + spacing || getTerrainHeight(x, z) <= here;
+    };
+    glm::vec2 p(feet.x, feet.z);
+    if (open(p.x + step.x, p.y + step.y)) return p + step;
+    if (open(p.x + step.x, p.y)) return glm::vec2(p.x + step.x, p.y);
+    if (open(p.x, p.y + step.y)) return glm::vec2(p.x, p.y + step.y);
+    return p;
+}
+
 void processInput(GLFWwindow* w, float dt) {
     if (glfwGetKey(w, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(w, true);
     float speed = 5.0f * dt;
@@ -73,30 +183,38 @@ void processInput(GLFWwindow* w, float dt) {
     if (glfwGetKey(w, GLFW_KEY_D) == GLFW_PRESS) camera.ProcessKeyboard(RIGHT, speed);
     if (glfwGetKey(w, GLFW_KEY_SPACE) == GLFW_PRESS) camera.Position.y += speed;
     if (glfwGetKey(w, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) camera.Position.y -= speed;
+    if (terrainQuery) {
+        float floorY = getTerrainHeight(camera.Position.x, camera.Position.z) + 0.3f;
+        if (camera.Position.y < floorY) camera.Position.y = floorY;
+    }
 }
 
 
-const float groundY = 0.2f;
-
-float getTerrainHeight(float x, float z) {
-    return groundY;
+unsigned robotKeys(GLFWwindow* w) {
+    unsigned keys = 0;
+    if (glfwGetKey(w, GLFW_KEY_LEFT) == GLFW_PRESS) keys |= RobotLeft;
+    if (glfwGetKey(w, GLFW_KEY_RIGHT) == GLFW_PRESS) keys |= RobotRight;
+    if (glfwGetKey(w, GLFW_KEY_UP) == GLFW_PRESS) keys |= RobotForward;
+    if (glfwGetKey(w, GLFW_KEY_DOWN) == GLFW_PRESS) keys |= RobotBack;
+    return keys;
 }
 
-void updateRobot(float dt, GLFWwindow* w) {
+void updateRobot(float dt, unsigned keys) {
     static glm::vec3 vel(0.0f);
     vel.y += gravity * dt;
     robotPos.y += vel.y * dt;
 
-    if (robotPos.y <= groundY) {
-        robotPos.y = groundY;
+    float ground = getTerrainHeight(robotPos.x, robotPos.z);
+    if (robotPos.y <= ground) {
+        robotPos.y = ground;
         vel.y = 0.0f;
 
-        if (glfwGetKey(w, GLFW_KEY_LEFT) == GLFW_PRESS)  robotYaw += TurnSpeed * dt;
-        if (glfwGetKey(w, GLFW_KEY_RIGHT) == GLFW_PRESS)  robotYaw -= TurnSpeed * dt;
+        if (keys & RobotLeft)  robotYaw += TurnSpeed * dt;
+        if (keys & RobotRight)  robotYaw -= TurnSpeed * dt;
 
         glm::vec3 dir(0.0f);
-        if (glfwGetKey(w, GLFW_KEY_UP) == GLFW_PRESS)  dir += glm::vec3(sinf(glm::radians(robotYaw)), 0, cosf(glm::radians(robotYaw)));
-        if (glfwGetKey(w, GLFW_KEY_DOWN) == GLFW_PRESS)  dir -= glm::vec3(sinf(glm::radians(robotYaw)), 0, cosf(glm::radians(robotYaw)));
+        if (keys & RobotForward)  dir += glm::vec3(sinf(glm::radians(robotYaw)), 0, cosf(glm::radians(robotYaw)));
+        if (keys & RobotBack)  dir -= glm::vec3(sinf(glm::radians(robotYaw)), 0, cosf(glm::radians(robotYaw)));
 
         if (glm::length(dir) > 0.0f) {
             vel.x = dir.x * robotSpeed;
@@ -107,213 +225,223 @@ void updateRobot(float dt, GLFWwindow* w) {
         }
     }
 
-    robotPos.x += vel.x * dt;
-    robotPos.z += vel.z * dt;
+    glm::vec2 p = stepOnGround(robotPos, glm::vec2(vel.x, vel.z) * dt);
+    robotPos.x = p.x;
+    robotPos.z = p.y;
 }
 
 
 
 
-void addLayer(const std::vector<std::vector<int>>& layer, const glm::vec3& centerPos, float height,
-    const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
-    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    int s = (int)layer.size();
-    if (s > 25 || s % 2 == 0) return;
-    for (int i = 0; i < s; i++) for (int j = 0; j < s; j++) {
-        glm::vec3 position = centerPos + glm::vec3(i * spacing - (s - 1) * spacing * 0.5f, height, j * spacing - (s - 1) * spacing * 0.5f);
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-        if (layer[i][j] == 2) oakLogCube->Draw(view, proj, model, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-        else if (layer[i][j] == 3) stairs->Draw(view, proj, model, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-        else if (layer[i][j] == 4) leaves->Draw(view, proj, model, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    }
+void queueDraw(BlockBase* block, const glm::mat4& model) {
+    drawList.push_back({ block, model });
 }
 
-void createGrassLayer(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
+// culls the queued blocks against the view frustum in parallel, then draws the survivors in order;
+// the culling counts are kept for the camera view only, so the other passes do not overwrite them
+void flushDraws(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
     const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    int size = (int)grassPlaneSize;
-    for (int i = 0; i < size; i++) for (int j = 0; j < size; j++) {
-        if (i >= 11 && i <= 13 && j >= 11 && j <= 13) continue;
-        if (i == 12 && j == 14) continue;
-        glm::vec3 position(i * spacing - planeOffset, 0.0f, j * spacing - planeOffset);
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-        grassBlock->Draw(view, proj, model, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    GLuint shadowMap, bool cameraView = false) {
+    PROFILE_SCOPE("flushDraws");
+    // with GPU culling the batch sees every opaque block and decides visibility itself
+    bool gpuCulled = false;
+    if (blockBatch && blockBatch->Culling() && blockBatch->Ready()) {
+        batchSlots.clear();
+        batchModels.clear();
+        for (const DrawItem& d : drawList) {
+            if (!d.block || d.block->batchSlot < 0) continue;
+            batchSlots.push_back(d.block->batchSlot);
+            batchModels.push_back(&d.model);
+        }
+        gpuCulled = blockBatch->DrawCulled(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap, batchSlots, batchModels, cameraView);
+    }
+    Frustum frustum(proj * view);
+    drawVisible.resize(drawList.size());
+    std::atomic<size_t> culled(0);
+    parallel_for(drawList.size(), 128, [&](size_t b, size_t e) {
+        size_t n = 0;
+        for (size_t i = b; i < e; i++) {
+            const DrawItem& d = drawList[i];
+            bool gpu = d.block && gpuCulled && d.block->batchSlot >= 0;
+            drawVisible[i] = d.block && !gpu && frustum.SphereVisible(glm::vec3(d.model[3]), d.block->size * 1.8f);
+            if (d.block && !gpu && !drawVisible[i]) n++;
+        }
+        culled += n;
+    });
+    if (cameraView) culledObjects = culled;
+    // opaque blocks go out first in one multi-draw; the rest keep their order
+    if (!gpuCulled && blockBatch && blockBatch->Ready()) {
+        batchSlots.clear();
+        batchModels.clear();
+        for (size_t i = 0; i < drawList.size(); i++) {
+            if (!drawVisible[i] || drawList[i].block->batchSlot < 0) continue;
+            batchSlots.push_back(drawList[i].block->batchSlot);
+            batchModels.push_back(&drawList[i].model);
+        }
+        if (blockBatch->Draw(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap, batchSlots, batchModels)) {
+            for (size_t i = 0; i < drawList.size(); i++)
+                if (drawVisible[i] && drawList[i].block->batchSlot >= 0) drawVisible[i] = 0;
+        }
     }
+    // consecutive visible items of one block become a single instanced draw,
+    // which keeps the submission order of the blended blocks
+    FrameRingBuffer* ring = FrameRingBuffer::Current();
+    for (size_t i = 0; i < drawList.size();) {
+        if (!drawVisible[i]) { i++; continue; }
+        BlockBase* block = drawList[i].block;
+        size_t end = i + 1;
+        while (end < drawList.size() && (!drawVisible[end] || drawList[end].block == block)) end++;
+        FrameRingBuffer::Allocation a = { nullptr, 0 };
+        if (ring) a = ring->Alloc((end - i) * sizeof(glm::mat4));
+        if (a.ptr) {
+            glm::mat4* models = (glm::mat4*)a.ptr;
+            GLsizei count = 0;
+            for (size_t k = i; k < end; k++)
+                if (drawVisible[k]) models[count++] = drawList[k].model;
+            block->DrawInstanced(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap, ring->Buffer(), a.offset, count);
+        }
+        else {
+            for (size_t k = i; k < end; k++)
+                if (drawVisible[k]) block->Draw(view, proj, drawList[k].model, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+        }
+        i = end;
+    }
+    drawList.clear();
 }
 
-void createFlowers(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
-    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    const char* ft[5] = { "flower_blue_orchid.png","flower_dandelion.png","flower_tulip_white.png","flower_oxeye_daisy.png","flower_rose.png" };
-    struct FlowerPos { int x, z, ti; } fp[] = {
-        {22,4,0},{3,3,1},{7,5,2},{19,4,3},{15,6,4},{5,2,0},{17,3,1},{9,4,2},{13,5,3},{21,6,4},
-        {4,8,0},{20,9,1},{8,7,2},{16,8,3},{12,7,4},{6,9,0},{18,7,1},{10,8,2},{14,9,3},{22,8,4},
-        {3,15,0},{21,16,1},{7,17,2},{19,15,3},{15,16,4},{5,18,0},{17,19,1},{9,20,2},{13,18,3},{21,20,4},
-        {2,6,0},{4,12,1},{3,9,2},{2,15,3},{4,18,4},{3,21,0},{2,12,1},{4,15,2},{3,18,3},{2,9,4},
-        {20,6,0},{22,12,1},{21,9,2},{20,15,3},{22,18,4},{21,21,0},{20,12,1},{22,15,2},{21,18,3},{20,9,4},
-        {8,22,0},{16,22,1},{12,21,2},{14,20,3},{10,19,4},{6,20,0},{18,21,1},{11,22,2},{15,19,3},{7,21,4}
-    };
-    static Flower* fl[5] = { nullptr };
-    if (!fl[0]) for (int i = 0; i < 5; i++) { fl[i] = new Flower(0.1f, ft[i]); fl[i]->Init(); }
-    for (auto& p : fp) {
-        float xOff = (((p.x * 13 + p.z * 17) % 7) / 10.0f - 0.35f) * 0.4f;
-        float zOff = (((p.x * 19 + p.z * 23) % 7) / 10.0f - 0.35f) * 0.4f;
-        float yOff = (((p.x * 29 + p.z * 31) % 5) / 10.0f) * 0.15f;
-        glm::vec3 pos(p.x * spacing - planeOffset + xOff, 0.5f + yOff, p.z * spacing - planeOffset + zOff);
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), pos);
-        glm::vec3 toCam = glm::normalize(camera.Position - pos);
+// a scene block placed at offset; billboards turn to face viewPos
+glm::mat4 blockModel(const Scene::Block& s, const glm::vec3& offset, const glm::vec3& viewPos) {
+    glm::vec3 pos = offset + s.position;
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), pos);
+    if (s.rotation) model = glm::rotate(model, glm::radians(s.rotation * 90.0f), glm::vec3(0, 1, 0));
+    if (s.flags & Scene::Billboard) {
+        glm::vec3 toCam = glm::normalize(viewPos - pos);
         float a = atan2(toCam.x, toCam.z);
-        m = glm::rotate(m, a, glm::vec3(0, 1, 0));
-        m = glm::rotate(m, glm::pi<float>(), glm::vec3(1, 0, 0));
-        fl[p.ti]->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+        model = glm::rotate(model, a, glm::vec3(0, 1, 0));
+        model = glm::rotate(model, glm::pi<float>(), glm::vec3(1, 0, 0));
     }
+    return model;
+}
+
+// the blocks of one prefab, placed at position; big prefabs are expanded in parallel
+void queuePrefab(const Scene::Prefab& prefab, const glm::vec3& position, const glm::vec3& viewPos) {
+    const Scene::Block* blocks = scene->Blocks() + prefab.firstBlock;
+    size_t first = drawList.size();
+    drawList.resize(first + prefab.blockCount);
+    parallel_for(prefab.blockCount, 256, [&](size_t b, size_t e) {
+        for (size_t k = b; k < e; k++) {
+            const Scene::Block& s = blocks[k];
+            DrawItem& d = drawList[first + k];
+            d.block = s.type < Scene::BlockTypes ? blockTypes[s.type] : nullptr;
+            d.model = blockModel(s, position, viewPos);
+        }
+    });
 }
 
+// prefabs with an impostor switch to it beyond impostorDistance
+void drawInstance(const Scene::Instance& inst, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos) {
+    Impostor* imp = prefabImpostors[inst.prefab];
+    if (impostorsEnabled && imp && glm::distance(viewPos, inst.position + imp->Center()) > impostorDistance)
+        imp->Draw(view, proj, inst.position, lightDir, lightColor, viewPos);
+    else
+        queuePrefab(scene->Prefabs()[inst.prefab], inst.position, viewPos);
+}
 
+// every prefab instance in file order
+void drawInstances(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& lightDir,
+    const glm::vec3& lightColor, const glm::vec3& viewPos) {
+    PROFILE_SCOPE("drawInstances");
+    for (size_t i = 0; i < scene->InstanceCount(); i++)
+        drawInstance(scene->Instances()[i], view, proj, lightDir, lightColor, viewPos);
+}
 
-void createGlassPanels(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
+// the streamed chunks' meshes now, their flowers, trees and houses with the scene blocks
+void drawStreamed(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
     const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
     GLuint shadowMap) {
-    glm::vec3 pp[] = {
-        {1,0.4f,1},{1,0.4f,0},{1,0.4f,-1},
-        {-1,0.4f,1},{-1,0.4f,0},{-1,0.4f,-1},
-        {0,0.4f,1},{-0.5f,0.4f,1},{0.5f,0.4f,1},
-        {0,0.4f,-1},{-0.5f,0.4f,-1},{0.5f,0.4f,-1}
-    };
-    for (auto& p : pp) {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), p);
-        if (p.x == 1 || p.x == -1) m = glm::rotate(m, glm::radians(90.0f), glm::vec3(0, 1, 0));
-        glassPanel->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    PROFILE_SCOPE("drawStreamed");
+    streamer->Draw(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    for (const ChunkStreamer::Chunk* c : streamer->Resident()) {
+        for (const Scene::Block& b : c->billboards)
+            queueDraw(blockTypes[b.type], blockModel(b, glm::vec3(0.0f), viewPos));
+        for (const Scene::Instance& inst : c->data->instances)
+            drawInstance(inst, view, proj, lightDir, lightColor, viewPos);
     }
 }
 
-void createDoor(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
+void drawDoor(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
     const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
     GLuint shadowMap) {
-    static Door* d = nullptr;
-    if (!d) { d = new Door(0.5f); d->Init(); }
-    float off = (grassPlaneSize - 1) * spacing * 0.5f;
-    glm::vec3 pos(12 * spacing - off, 0.2f, 14 * spacing - off);
-    glm::mat4 m = glm::translate(glm::mat4(1.0f), pos);
-    d->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-}
-
-void createTree(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& pos, int height,
-    const glm::mat4& lightSpaceMatrix, const glm::vec3& lightDir,
-    const glm::vec3& lightColor, const glm::vec3& viewPos, GLuint shadowMap) {
-    for (int i = 0; i < height; i++) {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), pos + glm::vec3(0.0f, i * 0.4f, 0.0f));
-        oakLogCube->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    }
-    auto drawL = [&](const glm::vec3& p) {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), p);
-        leaves->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-        };
-    for (int x = -2; x <= 2; x++)
-        for (int z = -2; z <= 2; z++)
-            drawL(pos + glm::vec3(x * 0.4f, (height - 3) * 0.4f, z * 0.4f));
-    for (int x = -2; x <= 2; x++)
-        for (int z = -2; z <= 2; z++)
-            drawL(pos + glm::vec3(x * 0.4f, (height - 2) * 0.4f, z * 0.4f));
-    for (int x = -1; x <= 1; x++)
-        for (int z = -1; z <= 1; z++)
-            drawL(pos + glm::vec3(x * 0.4f, (height - 1) * 0.4f, z * 0.4f));
-    drawL(pos + glm::vec3(0.0f, height * 0.4f, 0.0f));
-}
-
-void createAllTrees(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
+    const Scene::Entity* e = scene->FindEntity("door");
+    if (!e) return;
+    glm::mat4 m = glm::translate(glm::mat4(1.0f), e->position);
+    if (e->yaw != 0.0f) m = glm::rotate(m, glm::radians(e->yaw), glm::vec3(0, 1, 0));
+    door->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+}
+
+void renderScene(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
     const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    float off = (grassPlaneSize - 1) * spacing * 0.5f;
-    glm::ivec3 tp[] = {
-        { 2,  2, 7},
-        { 2, 22, 7},
-        {22,  2, 7},
-        {22, 22, 7},
-        {22, 12, 7},
-        { 5,-15, 12},
-        { 10,-5, 10},
-        { 15,10, 12},
-        { 20,-12, 12},
+    GLuint shadowMap, bool cameraView = false) {
+    PROFILE_SCOPE("renderScene");
+    drawInstances(view, proj, lightDir, lightColor, viewPos);
+    if (streamer) drawStreamed(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    drawDoor(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    flushDraws(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap, cameraView);
+}
 
-    };
-    for (auto& t : tp) {
-        glm::vec3 pos(t.x * spacing - off, 0.0f, t.y * spacing - off);
-        createTree(view, proj, pos, t.z, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    }
+void printGraphStats(const char* label, const RenderGraph& graph) {
+    RenderGraph::Stats gs = graph.GetStats();
+    std::cout << label << ": " << gs.passes << " passes (" << gs.culledPasses << " culled), "
+        << gs.transients << " transient textures in " << gs.physical << ", "
+        << gs.allocatedBytes / 1024 << " KB (" << (gs.requestedBytes - gs.allocatedBytes) / 1024 << " KB saved by aliasing)" << std::endl;
 }
 
-void createLeaves(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
-    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    glm::vec3 lp[] = {
-        {0.0f,1.2f,0.0f},{0.0f,1.4f,0.0f},{0.0f,1.6f,0.0f},
-        {0.4f,1.2f,0.0f},{-0.4f,1.2f,0.0f},{0.0f,1.2f,0.4f},{0.0f,1.2f,-0.4f},
-        {0.4f,1.2f,0.4f},{-0.4f,1.2f,0.4f},{0.4f,1.2f,-0.4f},{-0.4f,1.2f,-0.4f},
-        {0.4f,1.4f,0.0f},{-0.4f,1.4f,0.0f},{0.0f,1.4f,0.4f},{0.0f,1.4f,-0.4f},
-        {0.4f,1.6f,0.0f},{-0.4f,1.6f,0.0f},{0.0f,1.6f,0.4f},{0.0f,1.6f,-0.4f}
+// what a prefab's impostor is baked from: its blocks and the sphere they are framed in
+uint64_t impostorSource(const Scene::Prefab& prefab) {
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](const void* data, size_t size) {
+        const unsigned char* p = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 1099511628211ull;
     };
-    for (auto& p : lp) {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), p);
-        leaves->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    for (uint32_t i = 0; i < prefab.blockCount; i++) {
+        const Scene::Block& b = scene->Blocks()[prefab.firstBlock + i];
+        mix(&b.position, sizeof(b.position));
+        mix(&b.type, sizeof(b.type));
+        mix(&b.rotation, sizeof(b.rotation));
+        mix(&b.flags, sizeof(b.flags));
     }
-}
-void createHouse(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
-    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    float off = (grassPlaneSize - 1) * spacing * 0.5f;
-    glm::vec3 base(12 * spacing - off, -0.2f, 12 * spacing - off);
-    std::vector<std::vector<int>> l1 = { {2,2,2},{2,2,2},{2,2,2} };
-    addLayer(l1, base, 0.2f, view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    for (int h = 0; h < 4; h++) {
-        float y = h * 0.4f + 0.2f;
-        for (int x = -2; x <= 2; x++) for (int z = -2; z <= 2; z++) {
-            if (x > -2 && x < 2 && z > -2 && z < 2) continue;
-            if (h < 2 && z == 2 && x == 0) continue;
-            glm::mat4 m = glm::translate(glm::mat4(1.0f), base + glm::vec3(x * spacing, y, z * spacing));
-            if ((x == -2 || x == 2) && (z == -2 || z == 2)) oakLogCube->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-            else if (h == 2) {
-                if (z == 2 && x == 0) continue;
-                if (z == 2 || z == -2) { m = glm::rotate(m, glm::radians(180.0f), glm::vec3(0, 1, 0)); glassPanel->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap); }
-                else if (x == -2 || x == 2) { m = glm::rotate(m, glm::radians(90.0f), glm::vec3(0, 1, 0)); glassPanel->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap); }
-            }
-            else oakLogCube->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-        }
-    }
-    glm::mat4 dM = glm::translate(glm::mat4(1.0f), base + glm::vec3(0, 0.2f, 2 * spacing));
-    oakLogCube->Draw(view, proj, dM, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    float rh = 3 * 0.4f + 0.6f;
-    for (int x = -2; x <= 2; x++) for (int z = -2; z <= 2; z++) {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), base + glm::vec3(x * spacing, rh, z * spacing));
-        if (z == -2) m = glm::rotate(m, glm::radians(270.0f), glm::vec3(0, 1, 0));
-        else if (z == 2) m = glm::rotate(m, glm::radians(90.0f), glm::vec3(0, 1, 0));
-        else if (x == -2) m = glm::rotate(m, glm::radians(0.0f), glm::vec3(0, 1, 0));
-        else if (x == 2) m = glm::rotate(m, glm::radians(180.0f), glm::vec3(0, 1, 0));
-        stairs->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    }
-    rh += 0.4f;
-    for (int x = -1; x <= 1; x++) for (int z = -1; z <= 1; z++) {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), base + glm::vec3(x * spacing, rh, z * spacing));
-        if (z == -1) m = glm::rotate(m, glm::radians(270.0f), glm::vec3(0, 1, 0));
-        else if (z == 1) m = glm::rotate(m, glm::radians(90.0f), glm::vec3(0, 1, 0));
-        else if (x == -1) m = glm::rotate(m, glm::radians(0.0f), glm::vec3(0, 1, 0));
-        else if (x == 1) m = glm::rotate(m, glm::radians(180.0f), glm::vec3(0, 1, 0));
-        stairs->Draw(view, proj, m, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    }
-    rh += 0.4f;
-    glm::mat4 tM = glm::translate(glm::mat4(1.0f), base + glm::vec3(0, rh, 0));
-    oakLogCube->Draw(view, proj, tM, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+    mix(&prefab.impostorCenter, sizeof(prefab.impostorCenter));
+    mix(&prefab.impostorRadius, sizeof(prefab.impostorRadius));
+    return h;
 }
 
-void renderScene(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix,
-    const glm::vec3& lightDir, const glm::vec3& lightColor, const glm::vec3& viewPos,
-    GLuint shadowMap) {
-    createGrassLayer(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    createAllTrees(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    createHouse(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    createFlowers(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
-    createDoor(view, proj, lightSpaceMatrix, lightDir, lightColor, viewPos, shadowMap);
+// impostors missing from the cache are baked in one graph, so their depth buffers share memory
+void bakeImpostors(bool force) {
+    PROFILE_SCOPE("bakeImpostors");
+    impostorsEnabled = false;
+    glm::vec3 noLight(0.0f);
+    RenderGraph bakes;
+    prefabImpostors.assign(scene->PrefabCount(), nullptr);
+    for (size_t i = 0; i < scene->PrefabCount(); i++) {
+        const Scene::Prefab& prefab = scene->Prefabs()[i];
+        if (prefab.impostorRadius <= 0.0f) continue;
+        Impostor* imp = new Impostor(std::string(prefab.name, strnlen(prefab.name, sizeof(prefab.name))), prefab.impostorCenter, prefab.impostorRadius,
+            impostorSource(prefab));
+        if (imp->Init(force)) {
+            imp->AddBakePass(bakes, [imp, &prefab, &noLight](const glm::mat4& v, const glm::mat4& p) {
+                if (assets) assets->Finish();
+                queuePrefab(prefab, glm::vec3(0.0f), imp->Center());
+                flushDraws(v, p, glm::mat4(1.0f), noLight, noLight, imp->Center(), 0);
+                });
+        }
+        prefabImpostors[i] = imp;
+    }
+    if (bakes.Compile()) {
+        bakes.Execute();
+        if (bakes.GetStats().passes > 0) printGraphStats("impostor bake", bakes);
+    }
+    impostorsEnabled = true;
 }
 
 GLuint compileShader(const char* src, GLenum type) {
@@ -344,23 +472,545 @@ const char* sceneVertexShaderSource = "#version 330 core\nlayout(location=0) in
 
 const char* sceneFragmentShaderSource = "#version 330 core\nin vec3 FragPos;\nin vec3 Normal;\nin vec4 FragPosLightSpace;\nuniform sampler2D shadowMap;\nuniform vec3 lightDir;\nuniform vec3 lightColor;\nuniform vec3 cornerLightPos;\nuniform vec3 cornerLightColor;\nuniform vec3 viewPos;\nout vec4 FragColor;\nfloat ShadowCalculation(vec4 fragPosLightSpace){vec3 projCoords=fragPosLightSpace.xyz/fragPosLightSpace.w;projCoords=projCoords*0.5+0.5;float closestDepth=texture(shadowMap,projCoords.xy).r;float currentDepth=projCoords.z;float shadow=0.0;vec2 texelSize=1.0/textureSize(shadowMap,0);for(int x=-1;x<=1;x++){for(int y=-1;y<=1;y++){float pcfDepth=texture(shadowMap,projCoords.xy+vec2(x,y)*texelSize).r;shadow+=currentDepth-0.005>pcfDepth?1.0:0.0;}}shadow/=9.0;if(projCoords.z>1.0)shadow=0.0;return shadow;}void main(){vec3 norm=normalize(Normal);vec3 lightDirNorm=normalize(-lightDir);float diff=max(dot(norm,lightDirNorm),0.0);vec3 diffuse=diff*lightColor;vec3 viewDir=normalize(viewPos-FragPos);vec3 reflectDir=reflect(-lightDirNorm,norm);float spec=pow(max(dot(viewDir,reflectDir),0.0),32.0);vec3 specular=spec*lightColor;vec3 ambient=0.1*lightColor;float shadow=ShadowCalculation(FragPosLightSpace);vec3 result=(ambient+(1.0-shadow)*(diffuse+specular));vec3 cornerLightDir=normalize(cornerLightPos-FragPos);float diff2=max(dot(norm,cornerLightDir),0.0);vec3 diffuse2=diff2*cornerLightColor;vec3 reflectDir2=reflect(-cornerLightDir,norm);float spec2=pow(max(dot(viewDir,reflectDir2),0.0),32.0);vec3 specular2=spec2*cornerLightColor;result+=ambient+(diffuse2+specular2);FragColor=vec4(result,1.0);}";
 
-int main() {
-    glfwInit();
-    GLFWwindow* win = glfwCreateWindow(800, 600, "Upgraded Project", nullptr, nullptr);
-    if (!win) { glfwTerminate(); return -1; }
-    glfwMakeContextCurrent(win);
-    glfwSetCursorPosCallback(win, mouse_callback);
-    glfwSetScrollCallback(win, scroll_callback);
-    glfwSetInputMode(win, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) return -1;
-    glEnable(GL_DEPTH_TEST);
+Hill* createHill() {
+    return new Hill(4.0f, 1.0f, 16, 3.0f);
+}
+
+std::vector<std::string> textureFiles() {
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (auto& e : std::filesystem::recursive_directory_iterator("textures", ec))
+        if (e.is_regular_file() && e.path().extension() == ".png") files.push_back(e.path().generic_string());
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// decodes every texture in both orientations and pre-builds the hill mesh
+int bakeAssetPack(const char* path) {
+    AssetPackWriter writer;
+    std::vector<std::string> files = textureFiles();
+    for (int flip = 0; flip < 2; flip++)
+        for (auto& f : files) {
+            int w, h;
+            const unsigned char* pixels = ImageCache::Load(f.c_str(), flip != 0, &w, &h);
+            if (pixels) writer.AddTexture((flip ? "1:" : "0:") + f, f.c_str(), w, h, pixels);
+            else std::cout << "Failed to load " << f << "\n";
+        }
+    ImageCache::Clear();
+    Hill* h = createHill();
+    h->Bake(writer);
+    delete h;
+    if (!writer.Write(path)) return -1;
+    std::cout << "wrote " << writer.Count() << " entries to " << path << " (" << std::filesystem::file_size(path) << " bytes)" << std::endl;
+    return 0;
+}
+
+// the text scene as the binary form Load() maps; no GL needed
+int compileScene(const char* in, const char* out) {
+    Scene s;
+    if (!s.Load(in)) return -1;
+    if (s.Mapped()) std::cout << in << " is already a binary scene" << std::endl;
+    if (!s.WriteBinary(out)) return -1;
+    std::cout << "wrote " << s.BlockCount() << " blocks, " << s.PrefabCount() << " prefabs, " << s.InstanceCount() << " instances to " << out
+              << " (" << std::filesystem::file_size(out) << " bytes)" << std::endl;
+    return 0;
+}
+
+// the compiled scene when it is at least as new as the text one
+std::string defaultScenePath() {
+    std::error_code ec;
+    auto bin = std::filesystem::last_write_time("scene.bin", ec);
+    if (ec) return "scene.txt";
+    auto txt = std::filesystem::last_write_time("scene.txt", ec);
+    return ec || bin >= txt ? "scene.bin" : "scene.txt";
+}
+
+// The first run is the cold one as far as this process is concerned; drop the
+// OS file cache beforehand to include disk reads in it.
+void benchAssetLoading(const char* packPath) {
+    std::vector<std::string> files = textureFiles();
+    GLuint tex;
+    glGenTextures(1, &tex);
+    GLState::BindTexture(GL_TEXTURE_2D, tex);
+    const int runs = 6;
+    double png[runs], packed[runs];
+    for (int r = 0; r < runs; r++) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        ImageCache::Clear();
+        for (auto& f : files) {
+            int w, h;
+            const unsigned char* pixels = ImageCache::Load(f.c_str(), true, &w, &h);
+            if (!pixels) continue;
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glFinish();
+        auto t1 = std::chrono::high_resolution_clock::now();
+        AssetPack pack;
+        if (!pack.Open(packPath)) {
+            std::cout << "no asset pack at " << packPath << ", run with --bake-pack first" << std::endl;
+            GLState::DeleteTextures(1, &tex);
+            return;
+        }
+        for (auto& f : files) {
+            const AssetPack::Entry* e = pack.Find("1:" + f);
+            if (e) AssetPack::UploadTexture(*e, pack.Data(*e), true);
+        }
+        glFinish();
+        auto t2 = std::chrono::high_resolution_clock::now();
+        png[r] = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        packed[r] = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+    ImageCache::Clear();
+    GLState::DeleteTextures(1, &tex);
+    double pngWarm = 0.0, packWarm = 0.0;
+    for (int r = 1; r < runs; r++) {
+        pngWarm += png[r] / (runs - 1);
+        packWarm += packed[r] / (runs - 1);
+    }
+    std::cout << files.size() << " textures with mips: png cold " << png[0] << " ms, warm " << pngWarm
+        << " ms; pack cold " << packed[0] << " ms, warm " << packWarm << " ms" << std::endl;
+}
+
+void benchTerrainQuery() {
+    const size_t agents = 4096;
+    const int ticks = 1000;
+    std::vector<float> xs(agents), zs(agents), hs(agents), nx(agents), ny(agents), nz(agents);
+    srand(1);
+    for (size_t i = 0; i < agents; i++) {
+        xs[i] = (rand() / (float)RAND_MAX - 0.5f) * 60.0f;
+        zs[i] = (rand() / (float)RAND_MAX - 0.5f) * 60.0f;
+    }
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < ticks; t++) terrainQuery->HeightsAt(xs.data(), zs.data(), hs.data(), agents);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < ticks; t++) terrainQuery->NormalsAt(xs.data(), zs.data(), nx.data(), ny.data(), nz.data(), agents);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float err = 0.0f;
+    for (size_t i = 0; i < agents; i++) err = std::max(err, fabsf(hs[i] - terrainQuery->HeightAt(xs[i], zs[i])));
+    std::cout << agents << " agents: heights " << std::chrono::duration<double, std::micro>(t1 - t0).count() / ticks
+        << " us/tick, normals " << std::chrono::duration<double, std::micro>(t2 - t1).count() / ticks
+        << " us/tick, max error " << err << std::endl;
+}
+
+// the same world on 1, 2, 4 ... threads; the checksums have to match
+int benchWorldGen(const WorldGen::Settings& settings) {
+    WorldGen gen(settings, *scene);
+    int most = std::max(4, (int)std::thread::hardware_concurrency());
+    for (int threads = 1;; threads = std::min(threads * 2, most)) {
+        JobSystem js(threads);
+        double best = 1e9;
+        for (int run = 0; run < 3; run++) best = std::min(best, gen.GenerateChunks());
+        std::cout << "world: " << threads << " threads, " << gen.Chunks().size() << " chunks in " << best * 1000.0 << " ms, "
+                  << (int)(gen.Chunks().size() / best) << " chunks/s, checksum " << std::hex << gen.Checksum() << std::dec << std::endl;
+        if (threads == most) break;
+    }
+
+    // palette storage of every cube against the list of visible blocks a chunk used to keep
+    size_t voxelBytes = 0, listBytes = 0, uniform = 0, widths[17] = {};
+    std::vector<Scene::Block> blocks;
+    auto m0 = std::chrono::steady_clock::now();
+    for (const WorldGen::Chunk& c : gen.Chunks()) {
+        blocks.clear();
+        gen.VisibleBlocks(c, blocks);
+        voxelBytes += c.voxels.MemoryBytes();
+        listBytes += sizeof(std::vector<Scene::Block>) + (blocks.size() + c.billboards.size()) * sizeof(Scene::Block);
+        if (c.voxels.Uniform()) uniform++;
+        widths[c.voxels.Bits()]++;
+    }
+    auto m1 = std::chrono::steady_clock::now();
+    size_t n = gen.Chunks().size();
+    std::cout << "voxels: " << voxelBytes / n << " bytes/chunk against " << listBytes / n << " as block lists ("
+              << (double)listBytes / voxelBytes << ":1), visible blocks in " << std::chrono::duration<double, std::micro>(m1 - m0).count() / n
+              << " us/chunk; " << uniform << " uniform, " << widths[1] << " at 1 bit, "
+              << widths[2] << " at 2, " << widths[4] << " at 4, " << widths[8] + widths[16] << " wider" << std::endl;
+
+    // the same random lookups and full scans on both layouts
+    std::vector<std::vector<PaletteChunk::Value>> dense(n);
+    for (size_t k = 0; k < n; k++) {
+        const PaletteChunk& v = gen.Chunks()[k].voxels;
+        dense[k].resize(v.Volume());
+        size_t i = 0;
+        for (int y = 0; y < v.Height(); y++)
+            for (int z = 0; z < PaletteChunk::Size; z++)
+                for (int x = 0; x < PaletteChunk::Size; x++) dense[k][i++] = v.Get(x, y, z);
+    }
+    const int lookups = 4000000;
+    uint32_t seed = 12345;
+    std::vector<uint32_t> points(lookups);
+    for (uint32_t& p : points) {
+        seed = seed * 1664525u + 1013904223u;
+        p = seed;
+    }
+    uint64_t sumPalette = 0, sumDense = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t p : points) {
+        const PaletteChunk& v = gen.Chunks()[(p >> 16) % n].voxels;
+        if (v.Height()) sumPalette += v.Get(p & 15, (p >> 8) % v.Height(), (p >> 4) & 15);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint32_t p : points) {
+        size_t k = (p >> 16) % n;
+        int height = gen.Chunks()[k].voxels.Height();
+        if (height) sumDense += dense[k][((size_t)((p >> 8) % height) * PaletteChunk::Size + ((p >> 4) & 15)) * PaletteChunk::Size + (p & 15)];
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    size_t solidPalette = 0, solidDense = 0;
+    for (const WorldGen::Chunk& c : gen.Chunks()) c.voxels.ForEachSolid([&](int, int, int, PaletteChunk::Value) { solidPalette++; });
+    auto t3 = std::chrono::steady_clock::now();
+    for (const auto& d : dense)
+        for (PaletteChunk::Value value : d) solidDense += value != PaletteChunk::Air;
+    auto t4 = std::chrono::steady_clock::now();
+    auto ns = [](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b, double count) {
+        return std::chrono::duration<double, std::nano>(b - a).count() / count;
+    };
+    std::cout << "voxels: get " << ns(t0, t1, lookups) << " ns against " << ns(t1, t2, lookups) << " dense"
+              << (sumPalette == sumDense ? "" : " (mismatch)") << "; scan " << ns(t2, t3, (double)n) / 1000.0 << " us/chunk against "
+              << ns(t3, t4, (double)n) / 1000.0 << " dense, " << solidPalette << " solid" << (solidPalette == solidDense ? "" : " (mismatch)") << std::endl;
+    return sumPalette == sumDense && solidPalette == solidDense ? 0 : -1;
+}
+
+// saves a world into a scratch directory and loads it back; the loaded chunks have to match
+int benchRegions(const WorldGen::Settings& settings) {
+    WorldGen gen(settings, *scene);
+    gen.GenerateChunks();
+    RegionStore::Snapshot snapshot;
+    for (const WorldGen::Chunk& c : gen.Chunks()) snapshot.push_back(std::make_shared<const WorldGen::Chunk>(c));
+    const std::string dir = "bench-regions";
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    int result = 0;
+    {
+        RegionStore store(dir, gen, *scene);
+        if (!store.Save(snapshot)) result = -1;
+        RegionStore::Stats s = store.GetStats();
+        std::cout << "regions: saved " << s.chunksSaved << " chunks in " << s.saveSeconds * 1000.0 << " ms, "
+                  << (int)(s.chunksSaved / s.saveSeconds) << " chunks/s, " << s.savedRawBytes / s.saveSeconds / 1048576.0 << " MB/s; "
+                  << s.savedRawBytes / 1024 << " KB packed to " << s.savedPackedBytes / 1024 << " KB ("
+                  << (double)s.savedRawBytes / std::max<uint64_t>(s.savedPackedBytes, 1) << ":1)" << std::endl;
+    }
+    {
+        // a new store, so nothing is cached from the save
+        RegionStore store(dir, gen, *scene);
+        size_t mismatched = 0;
+        for (const WorldGen::Chunk& c : gen.Chunks()) {
+            WorldGen::Chunk loaded;
+            loaded.x = c.x;
+            loaded.z = c.z;
+            if (!store.Load(loaded) || loaded.billboards.size() != c.billboards.size() || loaded.instances.size() != c.instances.size() ||
+                memcmp(loaded.billboards.data(), c.billboards.data(), c.billboards.size() * sizeof(Scene::Block)) ||
+                memcmp(loaded.instances.data(), c.instances.data(), c.instances.size() * sizeof(Scene::Instance)) ||
+                memcmp(loaded.edges, c.edges, sizeof(c.edges)) || loaded.voxels.Height() != c.voxels.Height()) {
+                mismatched++;
+                continue;
+            }
+            std::vector<PaletteChunk::Value> a(c.voxels.Volume()), b(c.voxels.Volume());
+            c.voxels.Read(a.data());
+            loaded.voxels.Read(b.data());
+            if (a != b) mismatched++;
+        }
+        RegionStore::Stats s = store.GetStats();
+        std::cout << "regions: loaded " << s.chunksLoaded << " chunks in " << s.loadSeconds * 1000.0 << " ms, "
+                  << (int)(s.chunksLoaded / s.loadSeconds) << " chunks/s, " << s.loadedRawBytes / s.loadSeconds / 1048576.0 << " MB/s, "
+                  << mismatched << " mismatched" << std::endl;
+        if (mismatched) result = -1;
+    }
+    std::filesystem::remove_all(dir, ec);
+    return result;
+}
+
+// the same world in both stores: memory, lookups, box scans and rays, which have to agree
+int benchBlockStores(const WorldGen::Settings& settings) {
+    WorldGen gen(settings, *scene);
+    gen.GenerateChunks();
+    auto t0 = std::chrono::steady_clock::now();
+    ChunkGridStore chunks(gen.Chunks());
+    auto t1 = std::chrono::steady_clock::now();
+    VoxelTree tree(chunks);
+    auto t2 = std::chrono::steady_clock::now();
+    glm::ivec3 lo = chunks.Min(), hi = chunks.Max(), extent = hi - lo;
+    std::cout << "blocks: " << extent.x << "x" << extent.y << "x" << extent.z << "; chunks " << chunks.MemoryBytes() / 1024 << " KB built in "
+              << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms, tree " << tree.MemoryBytes() / 1024 << " KB ("
+              << tree.NodeCount() << " nodes, depth " << tree.Depth() << ") built in " << std::chrono::duration<double, std::milli>(t2 - t1).count()
+              << " ms; dense " << (size_t)extent.x * extent.y * extent.z * sizeof(BlockStore::Value) / 1024 << " KB" << std::endl;
+
+    uint32_t seed = 12345;
+    auto next = [&]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    const int lookups = 2000000, boxes = 200, rays = 20000;
+    std::vector<glm::ivec3> points(lookups);
+    for (glm::ivec3& p : points) p = lo + glm::ivec3(next() % extent.x, next() % extent.y, next() % extent.z);
+    // from above the ground, looking down at 10 to 80 degrees
+    std::vector<glm::vec3> origins(rays), directions(rays);
+    for (int r = 0; r < rays; r++) {
+        // off the block faces, where either store may round a grazing ray to either side
+        origins[r] = glm::vec3(lo) + glm::vec3(next() % extent.x + 0.25f, extent.y + 4.25f + next() % 32, next() % extent.z + 0.75f);
+        float yaw = glm::radians(next() % 3600 * 0.1f), pitch = glm::radians(10.0f + next() % 700 * 0.1f);
+        directions[r] = glm::vec3(cosf(pitch) * cosf(yaw), -sinf(pitch), cosf(pitch) * sinf(yaw));
+    }
+    uint64_t firstSum = 0;
+    size_t firstSolid = 0;
+    bool agree = true;
+    for (const BlockStore* store : { (const BlockStore*)&chunks, (const BlockStore*)&tree }) {
+        auto s0 = std::chrono::steady_clock::now();
+        uint64_t sum = 0;
+        for (const glm::ivec3& p : points) sum += store->Get(p.x, p.y, p.z);
+        auto s1 = std::chrono::steady_clock::now();
+        size_t solid = 0;
+        uint32_t boxSeed = 99;
+        for (int b = 0; b < boxes; b++) {
+            boxSeed = boxSeed * 1664525u + 1013904223u;
+            glm::ivec3 mn = lo + glm::ivec3((boxSeed >> 8) % extent.x, 0, (boxSeed >> 16) % extent.z);
+            store->ForEachSolid(mn, mn + 32, [&](int x, int y, int z, BlockStore::Value v) { solid += 1 + ((x ^ y ^ z ^ v) & 1); });
+        }
+        auto s2 = std::chrono::steady_clock::now();
+        size_t hits = 0;
+        double distance = 0.0;
+        for (int r = 0; r < rays; r++) {
+            BlockStore::Hit hit;
+            if (store->Raycast(origins[r], directions[r], 512.0f, hit)) {
+                hits++;
+                distance += hit.distance;
+                sum += hit.block.x * 31 + hit.block.y * 17 + hit.block.z + hit.value;
+            }
+        }
+        auto s3 = std::chrono::steady_clock::now();
+        if (store == &chunks) {
+            firstSum = sum;
+            firstSolid = solid;
+        }
+        else agree = sum == firstSum && solid == firstSolid;
+        std::cout << "blocks: " << store->Name() << ": get " << std::chrono::duration<double, std::nano>(s1 - s0).count() / lookups << " ns, 32^3 box "
+                  << std::chrono::duration<double, std::micro>(s2 - s1).count() / boxes << " us, ray "
+                  << std::chrono::duration<double, std::nano>(s3 - s2).count() / rays << " ns (" << hits << " hits, mean "
+                  << distance / std::max<size_t>(hits, 1) << " blocks)" << std::endl;
+    }
+    std::cout << "blocks: the stores " << (agree ? "agree" : "disagree") << std::endl;
+    return agree ? 0 : -1;
+}
+
+// seconds since startup; glfwGetTime needs glfwInit, which headless runs skip
+double elapsedSeconds() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// reads an RGBA8 texture back and writes it as a binary PPM, top row first
+bool saveFramePPM(const char* path, GLuint texture, int width, int height) {
+    std::vector<unsigned char> pixels((size_t)width * height * 3);
+    GLState::BindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out << "P6\n" << width << " " << height << "\n255\n";
+    for (int y = height - 1; y >= 0; y--)
+        out.write((const char*)pixels.data() + (size_t)y * width * 3, (std::streamsize)width * 3);
+    return (bool)out;
+}
+
+int main(int argc, char** argv) {
+    elapsedSeconds();
+    CpuProfiler::SetThreadName("main");
+    bool bakeOnly = false, benchQuery = false, tessellation = true, jobStats = false, syncAssets = false;
+    bool benchAssets = false, textureStats = false, ringBuffer = true, ringStats = false, multiDraw = true;
+    bool gpuCull = false, cullStats = false, glStats = false, graphStats = false;
+    bool headless = false, cameraSet = false, showHud = false;
+    int headlessFrames = 60;
+    const char* outputPath = nullptr;
+    bool benchmark = false, gpuStats = false;
+    int benchWarmup = 30;
+    const char* benchPathFile = nullptr;
+    std::string benchOut = "benchmark";
+    const char* recordPath = nullptr;
+    std::string tracePath = "trace.json";
+    bool traceAtStart = false;
+    double traceSeconds = 10.0;
+    glm::vec3 cameraPos(0.0f);
+    float cameraYaw = -90.0f, cameraPitch = 0.0f;
+    float textureBudgetMB = 256.0f;
+    const char* packPath = "assets.pack";
+    std::string scenePath;
+    bool worldEnabled = false, benchWorld = false, streamWorld = false, streamStats = false, benchRegion = false, benchBlocks = false;
+    bool worldTree = false;
+    const char* worldDir = nullptr;
+    ChunkStreamer::Settings streamSettings = ChunkStreamer::DefaultSettings();
+    WorldGen::Settings worldSettings = WorldGen::DefaultSettings(1);
+    int threadCount = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bake-impostors")) bakeOnly = true;
+        else if (!strcmp(argv[i], "--bench-terrain-query")) benchQuery = true;
+        else if (!strcmp(argv[i], "--no-tessellation")) tessellation = false;
+        else if (!strcmp(argv[i], "--shapes") && i + 1 < argc) shapeCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) threadCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--job-stats")) jobStats = true;
+        else if (!strcmp(argv[i], "--sync-assets")) syncAssets = true;
+        else if (!strcmp(argv[i], "--pack") && i + 1 < argc) packPath = argv[++i];
+        else if (!strcmp(argv[i], "--bake-pack") && i + 1 < argc) return bakeAssetPack(argv[++i]);
+        else if (!strcmp(argv[i], "--scene") && i + 1 < argc) scenePath = argv[++i];
+        else if (!strcmp(argv[i], "--compile-scene") && i + 2 < argc) return compileScene(argv[i + 1], argv[i + 2]);
+        else if (!strcmp(argv[i], "--world") && i + 1 < argc) { worldSettings.seed = (uint32_t)strtoul(argv[++i], nullptr, 10); worldEnabled = true; }
+        else if (!strcmp(argv[i], "--world-chunks") && i + 1 < argc) worldSettings.chunks = std::max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "--world-height") && i + 1 < argc) worldSettings.maxHeight = std::min(std::max(atoi(argv[++i]), 1), 126);
+        else if (!strcmp(argv[i], "--world-store") && i + 1 < argc) worldTree = !strcmp(argv[++i], "tree");
+        else if (!strcmp(argv[i], "--bench-world")) benchWorld = true;
+        else if (!strcmp(argv[i], "--bench-blocks")) benchBlocks = true;
+        else if (!strcmp(argv[i], "--stream-world")) { streamWorld = true; worldEnabled = true; }
+        else if (!strcmp(argv[i], "--stream-radius") && i + 1 < argc) {
+            streamSettings.loadRadius = std::max((float)atof(argv[++i]), 1.0f);
+            streamSettings.unloadRadius = streamSettings.loadRadius + 2.0f;
+        }
+        else if (!strcmp(argv[i], "--stream-budget") && i + 1 < argc) streamSettings.uploadBytesPerFrame = (size_t)(atof(argv[++i]) * 1024.0);
+        else if (!strcmp(argv[i], "--stream-stats")) streamStats = true;
+        else if (!strcmp(argv[i], "--world-dir") && i + 1 < argc) worldDir = argv[++i];
+        else if (!strcmp(argv[i], "--bench-regions")) benchRegion = true;
+        else if (!strcmp(argv[i], "--bench-assets")) benchAssets = true;
+        else if (!strcmp(argv[i], "--texture-budget") && i + 1 < argc) textureBudgetMB = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--texture-stats")) textureStats = true;
+        else if (!strcmp(argv[i], "--no-ring-buffer")) ringBuffer = false;
+        else if (!strcmp(argv[i], "--ring-stats")) ringStats = true;
+        else if (!strcmp(argv[i], "--no-mdi")) multiDraw = false;
+        else if (!strcmp(argv[i], "--gpu-cull")) gpuCull = true;
+        else if (!strcmp(argv[i], "--cull-stats")) cullStats = true;
+        else if (!strcmp(argv[i], "--gl-stats")) glStats = true;
+        else if (!strcmp(argv[i], "--graph-stats")) graphStats = true;
+        else if (!strcmp(argv[i], "--gpu-stats")) gpuStats = true;
+        else if (!strcmp(argv[i], "--hud")) showHud = true;
+        else if (!strcmp(argv[i], "--impostor-distance") && i + 1 < argc) impostorDistance = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--headless")) headless = true;
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc) headlessFrames = std::max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc) outputPath = argv[++i];
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            int w, h;
+            if (sscanf(argv[++i], "%dx%d", &w, &h) == 2 && w > 0 && h > 0) { screenWidth = w; screenHeight = h; }
+        }
+        else if (!strcmp(argv[i], "--benchmark")) benchmark = true;
+        else if (!strcmp(argv[i], "--bench-path") && i + 1 < argc) { benchPathFile = argv[++i]; benchmark = true; }
+        else if (!strcmp(argv[i], "--bench-out") && i + 1 < argc) benchOut = argv[++i];
+        else if (!strcmp(argv[i], "--bench-warmup") && i + 1 < argc) benchWarmup = std::max(atoi(argv[++i]), 0);
+        else if (!strcmp(argv[i], "--record-path") && i + 1 < argc) recordPath = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc) { tracePath = argv[++i]; traceAtStart = true; }
+        else if (!strcmp(argv[i], "--trace-seconds") && i + 1 < argc) traceSeconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--camera") && i + 5 < argc) {
+            cameraPos = glm::vec3((float)atof(argv[i + 1]), (float)atof(argv[i + 2]), (float)atof(argv[i + 3]));
+            cameraYaw = (float)atof(argv[i + 4]);
+            cameraPitch = (float)atof(argv[i + 5]);
+            cameraSet = true;
+            i += 5;
+        }
+    }
+    if (traceAtStart) CpuProfiler::Start();
+    auto saveTrace = [&]() {
+        if (CpuProfiler::WriteTrace(tracePath, traceSeconds)) std::cout << "wrote the last " << traceSeconds << " s of CPU trace to " << tracePath << std::endl;
+        else std::cout << "could not write " << tracePath << std::endl;
+    };
+    if (scenePath.empty()) scenePath = defaultScenePath();
+    scene = new Scene();
+    auto sceneStart = std::chrono::steady_clock::now();
+    if (!scene->Load(scenePath)) { delete scene; return -1; }
+    std::cout << "scene: " << scene->BlockCount() << " blocks, " << scene->PrefabCount() << " prefabs, " << scene->InstanceCount() << " instances from "
+              << scenePath << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sceneStart).count() << " ms" << std::endl;
+    if (benchWorld || benchRegion || benchBlocks) {
+        int result = benchWorld ? benchWorldGen(worldSettings) : benchRegion ? benchRegions(worldSettings) : benchBlockStores(worldSettings);
+        delete scene;
+        return result;
+    }
+    if (const Scene::Entity* e = scene->FindEntity("robot")) {
+        robotPos = e->position;
+        robotYaw = e->yaw;
+    }
+    if (cameraSet) {
+        camera.Position = cameraPos;
+        camera.SetOrientation(cameraYaw, cameraPitch);
+    }
+    // headless frames and benchmark runs are compared between builds, so they need the final textures from the start
+    if (headless || benchmark) syncAssets = true;
+    CameraPath benchPath, recordedPath;
+    if (benchmark) {
+        if (benchPathFile) {
+            if (!benchPath.Load(benchPathFile)) return -1;
+        }
+        else {
+            // one turn around the house while the robot walks off and turns
+            benchPath = CameraPath::Orbit(glm::vec3(0.0f, 1.0f, 0.0f), 12.0f, 4.0f, 20.0f);
+            benchPath.AddInput(2.0f, RobotForward);
+            benchPath.AddInput(6.0f, RobotForward | RobotLeft);
+            benchPath.AddInput(8.0f, RobotForward);
+            benchPath.AddInput(12.0f, 0);
+        }
+    }
+    GLFWwindow* win = nullptr;
+    HeadlessContext* headlessContext = nullptr;
+    GLADloadproc loadProc;
+    if (headless) {
+        headlessContext = new HeadlessContext();
+        if (!headlessContext->Init()) { delete headlessContext; return -1; }
+        loadProc = (GLADloadproc)HeadlessContext::GetProcAddress;
+    }
+    else {
+        glfwInit();
+        if (bakeOnly) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        win = glfwCreateWindow(screenWidth, screenHeight, "Upgraded Project", nullptr, nullptr);
+        if (!win) { glfwTerminate(); return -1; }
+        glfwMakeContextCurrent(win);
+        glfwSetCursorPosCallback(win, mouse_callback);
+        glfwSetScrollCallback(win, scroll_callback);
+        glfwSetInputMode(win, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        loadProc = (GLADloadproc)glfwGetProcAddress;
+    }
+    if (!gladLoadGLLoader(loadProc)) return -1;
+    // glad only loads the GL 4.6 name; 4.5 drivers (llvmpipe among them) have it as ARB_indirect_parameters
+    if (!glMultiDrawElementsIndirectCount)
+        glad_glMultiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC)loadProc("glMultiDrawElementsIndirectCountARB");
+    GLState::Enable(GL_DEPTH_TEST);
     glClearColor(0, 0, 0, 1);
 
+    jobs = new JobSystem(threadCount);
+    if (worldEnabled) world = new WorldGen(worldSettings, *scene);
+    // the world's chunk prefabs come after the hand-placed ones
+    const size_t scenePrefabs = scene->PrefabCount();
+    if (world && !streamWorld) {
+        double seconds = world->GenerateChunks();
+        // the store takes the chunks' cubes over, so they are held once
+        blockStore = new ChunkGridStore(world->Chunks());
+        if (worldTree) {
+            BlockStore* chunks = blockStore;
+            blockStore = new VoxelTree(*chunks);
+            delete chunks;
+        }
+        WorldGen::Stats ws = world->AddTo(*scene, *blockStore);
+        std::cout << "world: seed " << worldSettings.seed << ", " << ws.chunks << " chunks in " << seconds * 1000.0 << " ms ("
+                  << (int)(ws.chunks / seconds) << " chunks/s on " << jobs->ThreadCount() << " threads), " << ws.blocks << " blocks, "
+                  << ws.trees << " trees, " << ws.houses << " houses, " << ws.flowers << " flowers" << std::endl;
+        std::cout << "world: blocks in " << blockStore->Name() << ", " << blockStore->MemoryBytes() / 1024 << " KB" << std::endl;
+    }
+    else if (world && worldTree)
+        std::cout << "--world-store only applies to a generated world; streamed chunks keep their own blocks" << std::endl;
+    if (benchAssets) benchAssetLoading(packPath);
+    // a baked pack replaces PNG decoding and hill meshing when it is present
+    assetPack = new AssetPack();
+    if (assetPack->Open(packPath)) {
+        AssetPack::SetCurrent(assetPack);
+        std::cout << "using " << packPath << " (" << assetPack->Entries().size() << " entries)" << std::endl;
+    }
+    if (ringBuffer) {
+        // GPU culling uploads every instance, not only the visible ones
+        ring = new FrameRingBuffer(gpuCull ? 16 << 20 : 4 << 20);
+        if (!ring->Init()) {
+            std::cout << "persistent buffers need GL 4.4, drawing without the ring buffer" << std::endl;
+            delete ring;
+            ring = nullptr;
+        }
+    }
+    residency = new TextureResidency((size_t)(textureBudgetMB * 1024.0f * 1024.0f));
+    // textures stream in after the first frame; until then objects sample a grey placeholder
+    if (!syncAssets) assets = new AssetLoader();
+
     oakLogCube = new OakLog(0.2f);      oakLogCube->Init();
     grassBlock = new GrassBlock(0.2f);  grassBlock->Init();
     stairs = new Stairs(0.2f);      stairs->Init();
     leaves = new Leaves(0.2f);      leaves->Init();
     glassPanel = new Panel(0.2f);       glassPanel->Init();
+    dirtBlock = new Dirt(0.2f);         dirtBlock->Init();
     door = new Door(0.5f);        door->Init();
 
     const char* ft[5] = {
@@ -374,48 +1024,152 @@ int main() {
         flowers[i] = new Flower(0.1f, ft[i]);
         flowers[i]->Init();
     }
+    BlockBase* types[Scene::BlockTypes] = { grassBlock, oakLogCube, stairs, leaves, glassPanel, flowers[0], flowers[1], flowers[2], flowers[3], flowers[4], dirtBlock };
+    std::copy(std::begin(types), std::end(types), blockTypes);
+    if (world && streamWorld) {
+        if (worldDir) regionStore = new RegionStore(worldDir, *world, *scene);
+        streamer = new ChunkStreamer(*world, *scene, blockTypes, streamSettings, regionStore);
+    }
+    if (multiDraw && ring) {
+        blockBatch = new BlockBatch();
+        if (!blockBatch->Init({ grassBlock, oakLogCube, stairs, leaves, glassPanel, dirtBlock })) {
+            std::cout << "multi-draw indirect needs GL 4.3 and shader draw parameters, drawing blocks per type" << std::endl;
+            delete blockBatch;
+            blockBatch = nullptr;
+        }
+        else if (gpuCull && !blockBatch->InitCulling())
+            std::cout << "GPU culling needs compute shaders and glMultiDrawElementsIndirectCount, culling on the CPU" << std::endl;
+    }
+
+    bakeImpostors(bakeOnly);
+    if (bakeOnly) {
+        delete blockBatch;
+        delete oakLogCube; delete grassBlock; delete stairs; delete leaves; delete glassPanel; delete dirtBlock; delete door;
+        for (auto& f : flowers) delete f;
+        for (Impostor* imp : prefabImpostors) delete imp;
+        delete streamer;
+        delete regionStore;
+        delete blockStore;
+        delete world;
+        delete scene;
+        delete assets;
+        delete residency;
+        delete ring;
+        delete assetPack;
+        delete jobs;
+        if (headless) delete headlessContext;
+        else glfwTerminate();
+        return 0;
+    }
 
-    hill = new Hill(4.0f, 1.0f, 16, 3.0f);
-    hill->Init();
+    hill = createHill();
+    hill->Init(tessellation);
+    terrain = new Terrain();
+    terrain->Init(camera.Position);
     robot = new Robot(0, 0, 1.0f / 20.0f);
-    projection = glm::perspective(glm::radians(camera.Zoom), 800.0f / 600.0f, 0.1f, 100.0f);
+    projection = glm::perspective(glm::radians(camera.Zoom), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
     GLuint depthShader = createProgram(depthVertexShaderSource, depthFragmentShaderSource);
     sceneShader = createProgram(sceneVertexShaderSource, sceneFragmentShaderSource);
-    const unsigned SHW = 1024, SHH = 1024;
-    GLuint depthFBO, depthMap;
-    glGenFramebuffers(1, &depthFBO);
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHW, SHH, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float bc[4] = { 1,1,1,1 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, bc);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE); glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    const int SHW = 1024, SHH = 1024;
     glm::vec3 lightDir(0.4f, -1.0f, 0.4f);
     glm::vec3 lightPos(0.1f, 1.0f, 2.0f);
+    if (const Scene::Light* sun = scene->FindLight(Scene::Sun)) {
+        lightDir = sun->direction;
+        lightPos = sun->position;
+        dirLightColor = sun->color;
+    }
+    if (const Scene::Light* point = scene->FindLight(Scene::Point)) {
+        cornerLightPos = point->position;
+        cornerLightColor = point->color;
+    }
     glm::mat4 lV = glm::lookAt(lightPos, glm::vec3(0), glm::vec3(0, 1, 0));
     glm::mat4 lP = glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 1.0f, 50.0f);
     glm::mat4 lightSpace = lP * lV;
-    glm::vec3 hillPosition(0.0f, 0.08f, planeOffset + hillBaseRadius - 17.8f);
-    glm::vec3 hillRotation(0.0f, -90.0f, 0.0f);
-    while (!glfwWindowShouldClose(win)) {
-        float now = (float)glfwGetTime();
-        static float last = now;
-        float dt = now - last;
-        last = now;
+    glm::vec3 hillPosition(0.0f, 0.08f, -4.0f);
+    float hillYaw = -90.0f, hillScale = 2.5f;
+    if (const Scene::Entity* e = scene->FindEntity("hill")) {
+        hillPosition = e->position;
+        hillYaw = e->yaw;
+        hillScale = e->scale;
+    }
+    glm::mat4 hillModel = glm::translate(glm::mat4(hillScale), hillPosition);
+    hillModel = glm::rotate(hillModel, glm::radians(hillYaw), glm::vec3(0, 1, 0));
+    terrainQuery = new TerrainQuery();
+    // a generated world covers the heightfield, so its ground is the flat bottom layer of blocks
+    if (world) terrainQuery->BuildFlat(glm::vec2(0.0f), groundY);
+    else terrainQuery->Build(glm::vec2(0.0f));
+    terrainQuery->AddHill(*hill, hillModel);
+    glm::mat4 pyramidModel(1.0f);
+    if (const Scene::Entity* e = scene->FindEntity("pyramid")) {
+        pyramid = new SmoothPyramid(1.0f, 0.5f, 32, 16);
+        pyramid->Init(tessellation);
+        pyramidModel = glm::translate(glm::mat4(1.0f), e->position);
+        pyramidModel = glm::rotate(pyramidModel, glm::radians(e->yaw), glm::vec3(0, 1, 0));
+        pyramidModel = glm::scale(pyramidModel, glm::vec3(e->scale));
+        terrainQuery->AddPyramid(*pyramid, pyramidModel);
+    }
+    terrainQuery->AddBox(glm::vec2(-planeOffset - blockSize), glm::vec2(planeOffset + blockSize), groundY);
+    // the standing block columns of the scene's prefabs raise the ground, so walls stop the robot
+    // (updateRobot only climbs a block at a time) and the floor inside the house is walked on
+    std::vector<std::vector<Scene::Column>> prefabColumns(scenePrefabs);
+    for (size_t p = 0; p < scenePrefabs; p++) prefabColumns[p] = scene->Columns((uint32_t)p, spacing);
+    for (size_t n = 0; n < scene->InstanceCount(); n++) {
+        const Scene::Instance& inst = scene->Instances()[n];
+        // the world's chunks are added column by column below
+        if (inst.prefab >= scenePrefabs) continue;
+        for (const Scene::Column& c : prefabColumns[inst.prefab]) {
+            glm::vec2 p = glm::vec2(inst.position.x + c.x, inst.position.z + c.z);
+            terrainQuery->AddBox(p - blockSize, p + blockSize, inst.position.y + c.top + blockSize);
+        }
+    }
+    if (blockStore) {
+        const glm::ivec3& lo = blockStore->Min();
+        const glm::ivec3& hi = blockStore->Max();
+        for (int z = lo.z; z < hi.z; z++)
+            for (int x = lo.x; x < hi.x; x++) {
+                int level = blockStore->Top(x, z);
+                if (level < 0) continue;
+                glm::vec2 center(x * spacing, z * spacing);
+                terrainQuery->AddBox(center - glm::vec2(blockSize), center + glm::vec2(blockSize), level * spacing + blockSize);
+            }
+    }
+    if (benchQuery) benchTerrainQuery();
+    shapes = new ShapeInstancer();
+    shapes->Init();
+    srand(7);
+    for (int i = 0; i < shapeCount; i++) {
+        float a = rand() / (float)RAND_MAX * 6.2831853f;
+        float r = 30.0f + rand() / (float)RAND_MAX * 70.0f;
+        float yaw = rand() / (float)RAND_MAX * 360.0f;
+        float size = 3.0f + rand() / (float)RAND_MAX * 7.0f;
+        glm::vec3 p(cosf(a) * r, 0.0f, sinf(a) * r);
+        p.y = Terrain::HeightAt(p.x, p.z) - 0.2f;
+        if (i % 2 == 0) shapes->AddHill(p, yaw, size, size * 0.3f, 2.0f + (i % 5) * 0.5f, size * 6.25f);
+        else shapes->AddPyramid(p, yaw, size * 0.4f, size * 0.6f);
+    }
 
-        processInput(win, dt);
-        updateRobot(dt, win);
-        glViewport(0, 0, SHW, SHH);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+    // the frame: shadow map (transient), then scene and robot into the window,
+    // or into a colour and depth texture pair when there is no window
+    RenderGraph* frameGraph = new RenderGraph();
+    RenderGraph::Resource shadowMap = frameGraph->CreateTexture("shadow map", { SHW, SHH, GL_DEPTH_COMPONENT, GL_LINEAR, GL_CLAMP_TO_BORDER });
+    RenderGraph::Resource target, targetDepth = -1;
+    if (headless) {
+        target = frameGraph->CreateTexture("frame", { screenWidth, screenHeight, GL_RGBA8 });
+        targetDepth = frameGraph->CreateTexture("frame depth", { screenWidth, screenHeight, GL_DEPTH_COMPONENT24 });
+        frameGraph->MarkOutput(target);
+    }
+    else target = frameGraph->Backbuffer(screenWidth, screenHeight);
+    auto writeTarget = [&](RenderGraph::Builder& b) {
+        b.Write(target);
+        if (targetDepth >= 0) b.Write(targetDepth);
+    };
+    frameGraph->AddPass("shadow", [&](RenderGraph::Builder& b) { b.Write(shadowMap); }, [&](const RenderGraph& g) {
+        PROFILE_SCOPE("shadow pass");
+        GpuZone zone("shadow");
+        GLuint depthMap = g.Texture(shadowMap);
         glClear(GL_DEPTH_BUFFER_BIT);
-        glUseProgram(depthShader);
+        impostorsEnabled = false;
+        GLState::UseProgram(depthShader);
         glUniformMatrix4fv(
             glGetUniformLocation(depthShader, "lightSpaceMatrix"),
             1, GL_FALSE, glm::value_ptr(lightSpace)
@@ -425,10 +1179,13 @@ int main() {
             lightSpace, lightDir, dirLightColor,
             camera.Position, depthMap
         );
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, 800, 600);
+        impostorsEnabled = true;
+        });
+    frameGraph->AddPass("scene", [&](RenderGraph::Builder& b) { b.Read(shadowMap); writeTarget(b); }, [&](const RenderGraph& g) {
+        PROFILE_SCOPE("scene pass");
+        GLuint depthMap = g.Texture(shadowMap);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(sceneShader);
+        GLState::UseProgram(sceneShader);
         glUniformMatrix4fv(
             glGetUniformLocation(sceneShader, "view"),
             1, GL_FALSE, glm::value_ptr(camera.GetViewMatrix())
@@ -451,7 +1208,7 @@ int main() {
         );
         glUniform3fv(
             glGetUniformLocation(sceneShader, "cornerLightPos"),
-            1, glm::value_ptr(glm::vec3(0, 5, 0))
+            1, glm::value_ptr(cornerLightPos)
         );
         glUniform3fv(
             glGetUniformLocation(sceneShader, "cornerLightColor"),
@@ -461,35 +1218,291 @@ int main() {
             glGetUniformLocation(sceneShader, "viewPos"),
             1, glm::value_ptr(camera.Position)
         );
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
+        GLState::ActiveTexture(GL_TEXTURE0);
+        GLState::BindTexture(GL_TEXTURE_2D, depthMap);
         glUniform1i(
             glGetUniformLocation(sceneShader, "shadowMap"),
             0
         );
-        glm::mat4 hillModel = glm::translate(glm::mat4(2.5f), hillPosition);
-        hillModel = glm::rotate(hillModel, glm::radians(hillRotation.x), glm::vec3(1, 0, 0));
-        hillModel = glm::rotate(hillModel, glm::radians(hillRotation.y), glm::vec3(0, 1, 0));
-        hillModel = glm::rotate(hillModel, glm::radians(hillRotation.z), glm::vec3(0, 0, 1));
-        hill->Draw(camera.GetViewMatrix(), projection, hillModel, lightSpace, lightDir, dirLightColor, camera.Position, depthMap);
+        // a generated world covers the heightfield
+        if (!world) {
+            GpuZone zone("terrain");
+            terrain->Draw(camera.GetViewMatrix(), projection, lightSpace, lightDir, dirLightColor, camera.Position, depthMap);
+        }
+        {
+            GpuZone zone("shapes");
+            shapes->Draw(camera.GetViewMatrix(), projection, lightSpace, lightDir, dirLightColor, camera.Position, depthMap);
+        }
+        {
+            GpuZone zone("hill");
+            hill->Draw(camera.GetViewMatrix(), projection, hillModel, lightSpace, lightDir, dirLightColor, camera.Position, depthMap);
+        }
+        if (pyramid) {
+            GpuZone zone("pyramid");
+            pyramid->Draw(camera.GetViewMatrix(), projection, pyramidModel, lightDir, dirLightColor, camera.Position);
+        }
+        GpuZone zone("blocks");
         renderScene(
             camera.GetViewMatrix(), projection,
             lightSpace, lightDir, dirLightColor,
-            camera.Position, depthMap
+            camera.Position, depthMap, true
         );
+        });
+    frameGraph->AddPass("robot", writeTarget, [&](const RenderGraph&) {
+        PROFILE_SCOPE("robot pass");
+        GpuZone zone("robot");
+        robot->Draw(camera.GetViewMatrix(), projection);
+        });
+    // the performance overlay, F1 in the window
+    PerfHud* hud = new PerfHud();
+    hud->Init();
+    hud->SetVisible(showHud);
+    frameGraph->AddPass("hud", writeTarget, [&](const RenderGraph&) {
+        if (!hud->Visible()) return;
+        PROFILE_SCOPE("hud pass");
+        GpuZone zone("hud");
+        hud->Draw(screenWidth, screenHeight);
+        });
+    if (!frameGraph->Compile()) return -1;
+    if (graphStats) printGraphStats("frame graph", *frameGraph);
 
+    // per-pass GPU times, read back a few frames late; the overlay starts one when it is first shown
+    GpuProfiler* profiler = nullptr;
+    auto startProfiler = [&]() {
+        profiler = new GpuProfiler();
+        profiler->Init();
+        if (!profiler->PipelineStatistics()) std::cout << "no pipeline statistics queries, timing passes only" << std::endl;
+    };
+    if (gpuStats || benchmark || showHud) startProfiler();
+    Benchmark* bench = nullptr;
+    if (benchmark) {
+        bench = new Benchmark();
+        bench->SetInfo("path", benchPathFile ? benchPathFile : "orbit");
+        bench->SetInfo("resolution", std::to_string(screenWidth) + "x" + std::to_string(screenHeight));
+        bench->SetInfo("context", headless ? "headless" : "window");
+        bench->SetInfo("renderer", (const char*)glGetString(GL_RENDERER));
+    }
+    int frame = 0;
+    int lastFrame = benchmark ? benchWarmup + (int)ceilf(benchPath.Duration() * 60.0f) + 1 : headless ? headlessFrames : 0;
+    bool cacheCleared = false;
+    float statsTime = (float)elapsedSeconds();
+    double loopStart = elapsedSeconds();
+    float recordStart = statsTime, nextRecordKey = 0.0f;
+    while (lastFrame ? frame < lastFrame && !(win && glfwWindowShouldClose(win)) : !glfwWindowShouldClose(win)) {
+        PROFILE_SCOPE("frame");
+        float now = (float)elapsedSeconds();
+        static float last = now;
+        float frameSeconds = now - last;
+        // headless and benchmark runs step a fixed 60 Hz so the same arguments give the same frames
+        float dt = headless || benchmark ? 1.0f / 60.0f : frameSeconds;
+        last = now;
+        PerfHud::Counters hudCounters = { culledObjects };
+        if (blockBatch && blockBatch->Culling()) {
+            BlockBatch::CullStats cs = blockBatch->GetCullStats();
+            hudCounters.culled += cs.instances - cs.visible;
+        }
+        hud->AddFrame(frameSeconds * 1000.0f, hudCounters, *frameGraph);
+        // benchmarks hold the path's first key through the warm-up frames, then measure every frame
+        float pathTime = std::max(frame - benchWarmup, 0) / 60.0f;
+        bool measuring = bench && frame >= benchWarmup;
+        if (profiler) profiler->BeginFrame();
+        if (measuring) bench->BeginFrame();
+        if (assets) assets->Pump(2.0);
+        // once every block texture is resident the decoded copies can go
+        if (++frame > 1 && !cacheCleared && (!assets || assets->Pending() == 0)) {
+            ImageCache::Clear();
+            cacheCleared = true;
+            if (assets) std::cout << "assets: " << assets->Loaded() << " textures resident after " << (int)(now * 1000.0f) << " ms" << std::endl;
+        }
+        if ((jobStats || textureStats || (ringStats && ring) || (cullStats && blockBatch) || glStats || gpuStats || (streamStats && streamer)) && now - statsTime > 5.0f) {
+            if (jobStats) {
+                uint64_t jobCount = 0, steals = 0;
+                for (auto& w : jobs->Stats()) { jobCount += w.jobs; steals += w.steals; }
+                std::cout << "jobs: " << jobs->ThreadCount() << " threads, " << (int)(jobs->Utilisation() * 100.0) << "% busy, "
+                    << jobCount << " jobs, " << steals << " steals" << std::endl;
+                jobs->ResetStats();
+            }
+            if (textureStats) {
+                TextureResidency::Stats ts = residency->GetStats();
+                std::cout << "textures: " << ts.residentBytes / 1024 << "/" << ts.budgetBytes / 1024 << " KB resident, "
+                    << ts.textures << " tracked, " << ts.reduced << " reduced, " << ts.evicted << " evicted; "
+                    << ts.evictions << " evictions, " << ts.mipDrops << " mip drops, " << ts.streamIns << " stream-ins (avg "
+                    << ts.avgStreamInMs << " ms, max " << ts.maxStreamInMs << " ms)" << std::endl;
+            }
+            if (ringStats && ring) {
+                FrameRingBuffer::Stats rs = ring->GetStats();
+                std::cout << "ring: peak " << rs.peakBytes / 1024 << "/" << rs.regionBytes / 1024 << " KB per frame, "
+                    << rs.fenceWaits << " fence waits (" << rs.fenceWaitMs << " ms), " << rs.overflows << " overflows" << std::endl;
+                ring->ResetStats();
+            }
+            if (cullStats && blockBatch && blockBatch->Culling()) {
+                BlockBatch::CullStats cs = blockBatch->GetCullStats();
+                std::cout << "gpu cull: " << cs.visible << "/" << cs.instances << " blocks drawn, "
+                    << cs.instances - cs.visible << " culled, " << cs.draws << " draws" << std::endl;
+            }
+            if (glStats) {
+                GLState::Stats gs = GLState::FrameStats();
+                std::cout << "gl state: " << gs.issued << " calls issued, " << gs.elided << " elided, " << gs.draws << " draws last frame" << std::endl;
+            }
+            if (gpuStats) {
+                const GpuProfiler::FrameResult& gr = profiler->Latest();
+                std::cout << "gpu frame " << gr.frame << ":";
+                for (const GpuProfiler::ZoneResult& z : gr.zones) {
+                    std::cout << " " << z.name << " " << z.gpuMs << " ms";
+                    if (profiler->PipelineStatistics())
+                        std::cout << " (" << z.vertices << " verts, " << z.primitives << " prims, " << z.fragments << " frags)";
+                    std::cout << ";";
+                }
+                std::cout << " " << profiler->DroppedFrames() << " frames dropped" << std::endl;
+            }
+            if (streamStats && streamer) {
+                ChunkStreamer::Stats ss = streamer->GetStats();
+                std::cout << "stream: " << ss.resident << " resident, " << ss.wanted << " wanted, " << ss.inFlight << " in flight, "
+                          << ss.meshed << " meshed, " << ss.pooled << " pooled; " << ss.uploaded << " uploads (" << ss.uploadedBytes / 1024 << " KB), "
+                          << ss.unloaded << " unloaded, " << ss.wasted << " wasted; latency mean " << ss.meanLatencyMs << " ms, p95 "
+                          << ss.p95LatencyMs << " ms, max " << ss.maxLatencyMs << " ms; blocks " << ss.voxelBytes / 1024 << " KB, "
+                          << ss.listBytes / 1024 << " KB as block lists" << std::endl;
+                streamer->ResetStats();
+            }
+            statsTime = now;
+        }
+
+        unsigned keys = 0;
+        if (benchmark) {
+            glm::vec3 pos;
+            float yaw, pitch;
+            benchPath.Sample(pathTime, pos, yaw, pitch);
+            camera.Position = pos;
+            camera.SetOrientation(yaw, pitch);
+            if (frame > benchWarmup) keys = benchPath.KeysAt(pathTime);
+        }
+        else if (win) {
+            processInput(win, dt);
+            keys = robotKeys(win);
+            // F2 starts a CPU trace; pressed again it saves the last seconds of it
+            static bool traceKeyDown = false;
+            bool traceKey = glfwGetKey(win, GLFW_KEY_F2) == GLFW_PRESS;
+            if (traceKey && !traceKeyDown) {
+                if (CpuProfiler::Enabled()) saveTrace();
+                else {
+                    CpuProfiler::Start();
+                    std::cout << "CPU trace started, F2 again writes " << tracePath << std::endl;
+                }
+            }
+            traceKeyDown = traceKey;
+            static bool hudKeyDown = false;
+            bool hudKey = glfwGetKey(win, GLFW_KEY_F1) == GLFW_PRESS;
+            if (hudKey && !hudKeyDown) {
+                hud->Toggle();
+                if (hud->Visible() && !profiler) startProfiler();
+            }
+            hudKeyDown = hudKey;
+            // F5 saves the streamed world; the save runs on its own thread
+            static bool saveKeyDown = false;
+            bool saveKey = glfwGetKey(win, GLFW_KEY_F5) == GLFW_PRESS;
+            if (saveKey && !saveKeyDown && regionStore && streamer) {
+                if (regionStore->SaveAsync(streamer->Snapshot())) std::cout << "saving the world to " << worldDir << std::endl;
+                else std::cout << "the last save is still running" << std::endl;
+            }
+            saveKeyDown = saveKey;
+            // F6 names the world block in the middle of the screen
+            static bool pickKeyDown = false;
+            bool pickKey = glfwGetKey(win, GLFW_KEY_F6) == GLFW_PRESS;
+            if (pickKey && !pickKeyDown && streamer) std::cout << "pick: needs a generated world, streamed chunks have no block store" << std::endl;
+            if (pickKey && !pickKeyDown && blockStore) {
+                // blocks are centred on whole multiples of the spacing
+                float s = world->Spacing();
+                BlockStore::Hit hit;
+                if (blockStore->Raycast(camera.Position / s + 0.5f, camera.Front, 64.0f / s, hit))
+                    std::cout << "pick: " << Scene::BlockTypeName(PaletteChunk::TypeOf(hit.value)) << " at " << hit.block.x << " " << hit.block.y << " "
+                              << hit.block.z << ", " << hit.distance * s << " away" << std::endl;
+                else std::cout << "pick: nothing" << std::endl;
+            }
+            pickKeyDown = pickKey;
+        }
+        if (recordPath && !benchmark) {
+            float t = now - recordStart;
+            if (t >= nextRecordKey) {
+                recordedPath.AddKey(t, camera.Position, camera.Yaw, camera.Pitch);
+                nextRecordKey += 0.25f;
+            }
+            recordedPath.AddInput(t, keys);
+        }
+        updateRobot(dt, keys);
+        if (!world) terrain->Update(camera.Position);
+        if (streamer) streamer->Update(camera.Position, camera.Front);
         robot->Position = robotPos;
         robot->Yaw = glm::radians(robotYaw);
-            robot->Update(dt, win);
-        robot->Draw(camera.GetViewMatrix(), projection);
+        robot->Update(dt, keys);
+        frameGraph->Execute();
+        if (profiler) profiler->EndFrame();
+        if (ring) ring->EndFrame();
+        if (measuring) bench->EndFrame(camera.Position);
 
-        glfwSwapBuffers(win);
-        glfwPollEvents();
+        if (win) {
+            PROFILE_SCOPE("swap");
+            glfwSwapBuffers(win);
+        }
+        GLState::EndFrame();
+        residency->EndFrame();
+        if (frame == 1) std::cout << "first frame after " << (int)(elapsedSeconds() * 1000.0) << " ms" << std::endl;
+        if (win) glfwPollEvents();
+    }
+    if (bench) {
+        bench->Finish();
+        bench->Print();
+        if (bench->WriteJson(benchOut + ".json") && bench->WriteCsv(benchOut + ".csv"))
+            std::cout << "benchmark: wrote " << benchOut << ".json and " << benchOut << ".csv" << std::endl;
+        else
+            std::cout << "benchmark: could not write " << benchOut << ".json/.csv" << std::endl;
+        delete bench;
+    }
+    delete profiler;
+    if (traceAtStart) saveTrace();
+    if (recordPath && !benchmark) {
+        if (recordedPath.Save(recordPath)) std::cout << "recorded camera path to " << recordPath << std::endl;
+        else std::cout << "could not write " << recordPath << std::endl;
+    }
+    if (headless) {
+        glFinish();
+        double ms = (elapsedSeconds() - loopStart) * 1000.0;
+        std::cout << "headless: " << frame << " frames at " << screenWidth << "x" << screenHeight << ", "
+            << ms / frame << " ms per frame" << std::endl;
+        if (outputPath) {
+            if (saveFramePPM(outputPath, frameGraph->Texture(target), screenWidth, screenHeight))
+                std::cout << "headless: wrote " << outputPath << std::endl;
+            else
+                std::cout << "headless: could not write " << outputPath << std::endl;
+        }
     }
 
-    delete oakLogCube; delete grassBlock; delete stairs; delete leaves; delete glassPanel; delete door;
+    delete hud;
+    delete frameGraph;
+    delete blockBatch;
+    delete oakLogCube; delete grassBlock; delete stairs; delete leaves; delete glassPanel; delete dirtBlock; delete door;
     for (auto& f : flowers) delete f;
-    delete robot; delete hill;
-    glfwTerminate();
+    for (Impostor* imp : prefabImpostors) delete imp;
+    if (regionStore && streamer) {
+        regionStore->Wait();
+        RegionStore::Snapshot snapshot = streamer->Snapshot();
+        if (regionStore->Save(snapshot)) {
+            RegionStore::Stats s = regionStore->GetStats();
+            std::cout << "regions: saved " << s.chunksSaved << " chunks (" << s.savedPackedBytes / 1024 << " KB) to " << worldDir
+                      << ", loaded " << s.chunksLoaded << std::endl;
+        }
+    }
+    delete streamer;
+    delete regionStore;
+    delete blockStore;
+    delete world;
+    delete scene;
+    delete robot; delete hill; delete pyramid; delete terrain; delete terrainQuery; delete shapes;
+    delete assets;
+    delete residency;
+    delete ring;
+    delete assetPack;
+    delete jobs;
+    if (headless) delete headlessContext;
+    else glfwTerminate();
     return 0;
 }